@@ -12,6 +12,8 @@ struct Expression : Node {
 
 struct IdentifierExpr : Expression {
     std::string name;
+    // Set by the borrow checker when this use moves an owned value out
+    bool moved = false;
     IdentifierExpr(std::string t_name) : name(t_name) {}
 };
 
@@ -21,14 +23,25 @@ struct AssignExpr : Expression {
     AssignExpr(std::string t_name, Expression* t_value) : name(t_name), value(t_value) {}
 };
 
+// &name or &mut name, only valid as a call argument
+struct BorrowExpr : Expression {
+    std::string name;
+    bool isMutable;
+    BorrowExpr(std::string t_name, bool t_isMutable) : name(t_name), isMutable(t_isMutable) {}
+};
+
+// Literals are int or float unless the semantic analyzer gives them the
+// type of the other operand, variable or parameter they are used with
 struct IntExpr : Expression {
-    int value;
-    IntExpr(int t_value) : value(t_value) {}
+    int64_t value;
+    TypeKind type = TypeKind::INT;
+    IntExpr(int64_t t_value) : value(t_value) {}
 };
 
 struct FloatExpr : Expression {
-    float value;
-    FloatExpr(float t_value) : value(t_value) {}
+    double value;
+    TypeKind type = TypeKind::FLOAT;
+    FloatExpr(double t_value) : value(t_value) {}
 };
 
 struct BoolExpr : Expression {
@@ -49,6 +62,8 @@ struct StringExpr : Expression {
 struct UnaryExpr : Expression {
     Operator op;
     Expression* operand;
+    // Proven by RangeAnalyzer
+    bool noSignedWrap = false;
 
     UnaryExpr(Operator t_op, Expression* t_operand) : op(t_op), operand(t_operand) {}
 };
@@ -58,6 +73,24 @@ struct BinaryExpr : Expression {
     Expression* left;
     Expression* right;
 
+    // Facts proven by RangeAnalyzer
+    bool noSignedWrap = false;
+    bool noUnsignedWrap = false;
+    // Divisor is never zero (nor -1 with a INT_MIN dividend), or the
+    // division is on floats
+    bool safeDivision = false;
+    // Both operands are >= 0, so signed and unsigned division agree
+    bool nonNegative = false;
+    // Set by the semantic analyzer for && and || on vectors of bool: both
+    // sides are evaluated and combined lane by lane
+    bool lanewise = false;
+    // Set by the semantic analyzer: the operands are unsigned integers, so
+    // division and comparisons are unsigned
+    bool isUnsigned = false;
+    // Set by the semantic analyzer: the operands are strings, so + concatenates
+    // and comparisons compare the contents
+    bool isString = false;
+
     BinaryExpr(Operator t_op, Expression* t_left, Expression* t_right) : op(t_op), left(t_left), right(t_right) {}
 };
 
@@ -67,3 +100,193 @@ struct CallExpr : Expression {
 
     CallExpr(std::string t_callee, std::vector<Expression*> t_arguments) : callee(t_callee), arguments(t_arguments) {}
 };
+
+// name[index], an array element or a lane of a vector
+struct IndexExpr : Expression {
+    std::string name;
+    Expression* index;
+    // Proven by RangeAnalyzer: 0 <= index < len(name), so no bounds check
+    bool inBounds = false;
+    // Set by the semantic analyzer when name is a vector
+    bool lane = false;
+
+    IndexExpr(std::string t_name, Expression* t_index) : name(t_name), index(t_index) {}
+};
+
+// name[index] = value
+struct IndexAssignExpr : Expression {
+    std::string name;
+    Expression* index;
+    Expression* value;
+    bool inBounds = false;
+    bool lane = false;
+
+    IndexAssignExpr(std::string t_name, Expression* t_index, Expression* t_value)
+        : name(t_name), index(t_index), value(t_value) {}
+};
+
+// T[n]: a new dynamic array of n zeroed elements
+struct ArrayAllocExpr : Expression {
+    Type element;
+    Expression* length;
+
+    ArrayAllocExpr(Type t_element, Expression* t_length) : element(t_element), length(t_length) {}
+};
+
+// Name(a, b, ...): a struct value with one argument per field, in
+// declaration order
+struct StructExpr : Expression {
+    std::string name;
+    std::vector<Expression*> arguments;
+
+    StructExpr(std::string t_name, std::vector<Expression*> t_arguments)
+        : name(t_name), arguments(t_arguments) {}
+};
+
+// name.field of a struct variable, or name[index].field of an array of
+// structs
+struct FieldExpr : Expression {
+    std::string name;
+    // Null for a struct variable
+    Expression* index;
+    std::string field;
+    // Set by the semantic analyzer
+    Type type;
+    // Proven by RangeAnalyzer: 0 <= index < len(name), so no bounds check
+    bool inBounds = false;
+
+    FieldExpr(std::string t_name, Expression* t_index, std::string t_field)
+        : name(t_name), index(t_index), field(t_field) {}
+};
+
+// name.field = value or name[index].field = value
+struct FieldAssignExpr : Expression {
+    std::string name;
+    Expression* index;
+    std::string field;
+    Expression* value;
+    Type type;
+    bool inBounds = false;
+
+    FieldAssignExpr(std::string t_name, Expression* t_index, std::string t_field, Expression* t_value)
+        : name(t_name), index(t_index), field(t_field), value(t_value) {}
+};
+
+// slice(name, start, end): bytes start to end - 1 of the string name. The
+// result points into the buffer of name; it is only copied when it is
+// stored somewhere that owns it.
+struct SliceExpr : Expression {
+    std::string name;
+    Expression* start;
+    Expression* end;
+
+    SliceExpr(std::string t_name, Expression* t_start, Expression* t_end)
+        : name(t_name), start(t_start), end(t_end) {}
+};
+
+// T(operand): converts a number, char or bool to the scalar type T
+struct CastExpr : Expression {
+    TypeKind target;
+    Expression* operand;
+    // Set by the semantic analyzer
+    TypeKind source = TypeKind::VOID;
+
+    CastExpr(TypeKind t_target, Expression* t_operand) : target(t_target), operand(t_operand) {}
+};
+
+// len(name), of an array or a string
+struct LengthExpr : Expression {
+    std::string name;
+    LengthExpr(std::string t_name) : name(t_name) {}
+};
+
+// vec<T, N>(a, b, ...) with one element per lane, or vec<T, N>(x) with x
+// in every lane. vec<T, N>(v) with v a vector of N lanes of another type
+// converts each lane.
+struct VectorExpr : Expression {
+    Type type;
+    // Set by the semantic analyzer for a conversion: the lane type of v
+    TypeKind source = TypeKind::VOID;
+    std::vector<Expression*> elements;
+
+    VectorExpr(Type t_type, std::vector<Expression*> t_elements) : type(t_type), elements(t_elements) {}
+};
+
+// shuffle(a, lanes...) or shuffle(a, b, lanes...): lane i of the result is
+// lane lanes[i] of a, or lane lanes[i] - N of b
+struct ShuffleExpr : Expression {
+    Expression* first;
+    Expression* second;
+    std::vector<int> lanes;
+
+    ShuffleExpr(Expression* t_first, Expression* t_second, std::vector<int> t_lanes)
+        : first(t_first), second(t_second), lanes(t_lanes) {}
+};
+
+enum class Builtin {
+    Select,     // select(mask, a, b): a where mask is set, b elsewhere
+    ReduceAdd,  // reduce_add(v) .. reduce_max(v): combines the lanes of v
+    ReduceMul,
+    ReduceMin,
+    ReduceMax,
+    Any,        // any(mask), all(mask)
+    All,
+    // Math and bit operations; each also works lanewise on vectors
+    Sqrt,       // sqrt(x), fma(a, b, c) = a * b + c rounded once: float
+    Fma,
+    Abs,        // abs(x): int or float
+    Min,        // min(a, b), max(a, b): int, float or char
+    Max,
+    Popcount,   // popcount(x) .. bswap(x): int
+    Ctz,
+    Clz,
+    Rotl,       // rotl(x, n): x rotated left by n bits
+    Bswap,
+    Find,       // find(s, needle): index of the first needle in string s, or -1
+    // Buffered standard input and output
+    Print,      // print(x), println(x), println(): a number, bool, char or string
+    Println,
+    ReadInt,    // read_int(): the next integer of the input, 0 at its end
+    ReadLine,   // read_line(): the next line, without its newline
+    Eof         // eof(): nothing is left to read
+};
+
+struct BuiltinExpr : Expression {
+    Builtin builtin;
+    std::vector<Expression*> arguments;
+    // Set by the semantic analyzer when min, max and the reductions work on
+    // unsigned integers
+    bool isUnsigned = false;
+    // Set by the semantic analyzer for print and println: the type printed
+    TypeKind printed = TypeKind::VOID;
+
+    BuiltinExpr(Builtin t_builtin, std::vector<Expression*> t_arguments)
+        : builtin(t_builtin), arguments(t_arguments) {}
+};
+
+// load(name, index, mask): the elements name[index], name[index + 1], ...
+// under the set lanes of mask, zero in the others. Only the selected
+// elements have to be in bounds.
+struct VectorLoadExpr : Expression {
+    std::string name;
+    Expression* index;
+    Expression* mask;
+    // Proven by RangeAnalyzer: every lane is in bounds
+    bool inBounds = false;
+
+    VectorLoadExpr(std::string t_name, Expression* t_index, Expression* t_mask)
+        : name(t_name), index(t_index), mask(t_mask) {}
+};
+
+// store(name, index, value) or store(name, index, value, mask)
+struct VectorStoreExpr : Expression {
+    std::string name;
+    Expression* index;
+    Expression* value;
+    // Null stores every lane
+    Expression* mask;
+    bool inBounds = false;
+
+    VectorStoreExpr(std::string t_name, Expression* t_index, Expression* t_value, Expression* t_mask)
+        : name(t_name), index(t_index), value(t_value), mask(t_mask) {}
+};
@@ -4,26 +4,48 @@
 #include "item.h"
 #include "statement.h"
 
+// Facts proven by EffectAnalyzer, lowered to LLVM function attributes
+struct FunctionEffects {
+    bool noMemory = false;
+    bool readOnly = false;
+    bool noUnwind = false;
+    bool willReturn = false;
+    bool noRecurse = false;
+    bool speculatable = false;
+};
+
 struct Param {
-    TypeKind type;
+    Type type;
     std::string name;
+    PassMode mode = PassMode::Value;
+    // Set by the borrow checker when no other pointer can reach the
+    // argument's storage during the call
+    bool noalias = false;
 };
 
 struct FunctionDef : Item {
     std::string name;
     std::vector<Param> params;
     BlockStmt* body;
-    TypeKind returnType;
+    Type returnType;
+    FunctionEffects effects;
+    // Set by the borrow checker when a return calls the function itself as
+    // a tail call (ReturnStmt::tailCall), which codegen turns into a loop
+    bool tailRecursive = false;
 
-    FunctionDef(std::string t_name, std::vector<Param> t_params, BlockStmt* t_body, TypeKind t_returnType)
+    FunctionDef(std::string t_name, std::vector<Param> t_params, BlockStmt* t_body, Type t_returnType)
         : name(t_name), params(t_params), body(t_body), returnType(t_returnType) {}
 };
 
 struct ExternDecl : Item {
     std::string name;
     std::vector<Param> params;
-    TypeKind returnType;
+    Type returnType;
+    // Declared `extern pure`: no side effects, no memory access, and returns
+    // for every argument (math routines such as sqrt)
+    bool isPure = false;
+    FunctionEffects effects;
     
-    ExternDecl(std::string t_name, std::vector<Param> t_params, TypeKind t_returnType)
+    ExternDecl(std::string t_name, std::vector<Param> t_params, Type t_returnType)
         : name(t_name), params(t_params), returnType(t_returnType) {}
 };
@@ -2,7 +2,10 @@
 
 #pragma once
 #include "node.h"
+#include <cstddef>
 
 struct Item : Node {
-    
+    // Hash of the item's tokens, set by the parser. Items with equal
+    // fingerprints parse to the same AST.
+    size_t fingerprint = 0;
 };
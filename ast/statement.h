@@ -3,7 +3,9 @@
 #include "expression.h"
 
 struct Statement : Item {
-    
+    // Owned locals whose last use is this statement; their storage can be
+    // released right after it (filled in by the borrow checker)
+    std::vector<std::string> dropsAfter;
 };
 
 struct ExprStmt : Statement {
@@ -13,11 +15,13 @@ struct ExprStmt : Statement {
 };
 
 struct VarDeclStmt : Statement {
-    TypeKind kind;
+    Type kind;
     std::string name;
     Expression* initializer;
+    // Has a drop point, so codegen brackets its storage with lifetime markers
+    bool hasDropPoint = false;
 
-    VarDeclStmt(TypeKind t_kind, std::string t_name, Expression* t_initializer)
+    VarDeclStmt(Type t_kind, std::string t_name, Expression* t_initializer)
         : kind(t_kind), name(t_name), initializer(t_initializer) {}
 };
 
@@ -27,6 +31,10 @@ struct BlockStmt : Statement {
 
 struct ReturnStmt : Statement {
     Expression* value;
+    // Set by the borrow checker when value is a call of a defined function
+    // that is given nothing living in this frame, so the frame can be
+    // released before the call
+    bool tailCall = false;
 
     ReturnStmt(Expression* t_value) : value(t_value) {}
 };
@@ -48,6 +56,32 @@ struct WhileStmt : Statement {
         : condition(t_condition), body(t_body) {}
 };
 
+// region { ... }: strings and dynamic arrays created in the body come from
+// an arena that is released as a whole when the body is left
+struct RegionStmt : Statement {
+    BlockStmt* body;
+
+    RegionStmt(BlockStmt* t_body) : body(t_body) {}
+};
+
+struct SwitchCase {
+    // Int or char literals, or negated int literals
+    std::vector<Expression*> labels;
+    BlockStmt* body;
+};
+
+// switch (value) { case 1, 2 { ... } default { ... } }: runs the body of the
+// case listing value, or the default one if there is any; there is no
+// fallthrough between cases
+struct SwitchStmt : Statement {
+    Expression* value;
+    std::vector<SwitchCase> cases;
+    BlockStmt* defaultBlock;
+
+    SwitchStmt(Expression* t_value, std::vector<SwitchCase> t_cases, BlockStmt* t_defaultBlock)
+        : value(t_value), cases(t_cases), defaultBlock(t_defaultBlock) {}
+};
+
 struct ForStmt : Statement {
     Statement* init;
     Expression* condition;
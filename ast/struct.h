@@ -0,0 +1,31 @@
+//Header file for struct declarations
+
+#pragma once
+#include "item.h"
+#include "../token/token.h"
+#include <string>
+#include <vector>
+
+struct Field {
+    Type type;
+    std::string name;
+};
+
+// struct Name [packed] [aligned(N)] [reorder] [soa] { T field; ... }
+struct StructDecl : Item {
+    std::string name;
+    std::vector<Field> fields;
+    // No padding between fields
+    bool packed = false;
+    // Arrays of the struct start on a multiple of this many bytes, and so
+    // does each element; 0 keeps the natural alignment
+    int64_t align = 0;
+    // Fields are laid out by decreasing alignment, which leaves the least
+    // padding, instead of in declaration order
+    bool reorder = false;
+    // Arrays of the struct keep each field in a contiguous array of its own
+    // (structure of arrays); single values are unaffected
+    bool soa = false;
+
+    StructDecl(std::string t_name, std::vector<Field> t_fields) : name(t_name), fields(t_fields) {}
+};
@@ -0,0 +1,37 @@
+/* The arrays benchmark written in C, see arrays.er */
+#include <stdlib.h>
+
+static float dot(const float* a, const float* b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void saxpy(float* restrict y, const float* restrict x, float k, int n) {
+    for (int i = 0; i < n; i++) {
+        y[i] += k * x[i];
+    }
+}
+
+int main(void) {
+    int n = 4096;
+    float* x = aligned_alloc(64, n * sizeof(float));
+    float* y = aligned_alloc(64, n * sizeof(float));
+    float v = 0.0f;
+    for (int i = 0; i < n; i++) {
+        x[i] = v;
+        y[i] = 1.0f - v;
+        v += 0.00025f;
+    }
+
+    float total = 0.0f;
+    for (int round = 0; round < 100000; round++) {
+        saxpy(y, x, 0.0001f, n);
+        total += dot(x, y, n);
+    }
+    free(x);
+    free(y);
+    return total > 0.0f ? 0 : 1;
+}
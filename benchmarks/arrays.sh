@@ -0,0 +1,17 @@
+#!/bin/bash
+# Times the dot product and saxpy kernels of arrays.er against the same
+# program in C, both at -O2 for the host CPU. Run from the repository root
+# after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+CC=${CC:-cc}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$ERODE benchmarks/arrays.er output --emit=exe -O2 -mcpu=native -o "$DIR/erode"
+$CC -O2 -march=native -o "$DIR/c" benchmarks/arrays.c
+
+for build in erode c; do
+    echo "$build:"
+    time "$DIR/$build" || true
+done
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Times a 50-opcode interpreter dispatching with a switch (dispatch.er) and
+# with an if per opcode (dispatch_if.er), both at -O2, and checks that the
+# results match. Run from the repository root after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$ERODE benchmarks/dispatch.er output --emit=exe -O2 -o "$DIR/switch"
+$ERODE benchmarks/dispatch_if.er output --emit=exe -O2 -o "$DIR/if"
+
+for build in switch if; do
+    echo "$build:"
+    time "$DIR/$build" > "$DIR/$build.out"
+done
+cmp "$DIR/switch.out" "$DIR/if.out" && echo "results match"
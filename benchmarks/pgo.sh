@@ -0,0 +1,19 @@
+#!/bin/bash
+# Times pgo_branches.er built at -O2 without and with a profile from an
+# instrumented run. Run from the repository root after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$ERODE benchmarks/pgo_branches.er output --emit=exe -O2 -o "$DIR/plain"
+$ERODE benchmarks/pgo_branches.er output --emit=exe -O2 --instrument="$DIR/branches.profile" \
+    -o "$DIR/instrumented"
+"$DIR/instrumented" || true
+$ERODE benchmarks/pgo_branches.er output --emit=exe -O2 --profile-use="$DIR/branches.profile" \
+    -o "$DIR/pgo"
+
+for build in plain pgo; do
+    echo "$build:"
+    time "$DIR/$build" || true
+done
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Times printing 10^7 integers with println (print.er) and with printf and
+# putchar (print_printf.er), both at -O2 and into a file, and checks that
+# the outputs match. Run from the repository root after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$ERODE benchmarks/print.er output --emit=exe -O2 -o "$DIR/println"
+$ERODE benchmarks/print_printf.er output --emit=exe -O2 -o "$DIR/printf"
+
+for build in println printf; do
+    echo "$build:"
+    time "$DIR/$build" > "$DIR/$build.out"
+done
+cmp "$DIR/println.out" "$DIR/printf.out" && echo "outputs match"
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Checks that the range analysis drops what a condition compared about a
+# variable once the condition assigns it (ranges.er): the add in f must
+# not be nsw, and the program must print the wrapped sum at -O2. Run from
+# the repository root after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+
+if $ERODE benchmarks/ranges.er codegen | sed -n '/^define i32 @f(/,/^}/p' | grep -q 'add nsw'; then
+    echo "f: add marked nsw"
+    exit 1
+fi
+result=$($ERODE benchmarks/ranges.er run -O2)
+if [ "$result" != "-649" ]; then
+    echo "expected -649, got $result"
+    exit 1
+fi
+echo "ranges ok"
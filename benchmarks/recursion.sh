@@ -0,0 +1,22 @@
+#!/bin/bash
+# Runs the tail-recursive computations of recursion.er and the loops of
+# recursion_loop.er, both at -O0 and -O2, with a 1 MiB stack, and checks
+# that the results match. Without tail calls recursion.er overflows the
+# stack. Run from the repository root after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+for level in O0 O2; do
+    $ERODE benchmarks/recursion.er output --emit=exe -$level -o "$DIR/recursion-$level"
+    $ERODE benchmarks/recursion_loop.er output --emit=exe -$level -o "$DIR/loop-$level"
+done
+
+ulimit -s 1024
+for build in recursion-O0 loop-O0 recursion-O2 loop-O2; do
+    echo "$build:"
+    time "$DIR/$build" > "$DIR/$build.out"
+done
+cmp "$DIR/recursion-O0.out" "$DIR/loop-O0.out"
+cmp "$DIR/recursion-O2.out" "$DIR/loop-O2.out" && echo "results match"
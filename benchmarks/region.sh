@@ -0,0 +1,18 @@
+#!/bin/bash
+# Times 10^6 requests that each build strings and a scratch array, in a
+# region (region.er) and on the heap (region_heap.er), both at -O2, and
+# checks that the results match. Run from the repository root after
+# building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$ERODE benchmarks/region.er output --emit=exe -O2 -o "$DIR/region"
+$ERODE benchmarks/region_heap.er output --emit=exe -O2 -o "$DIR/heap"
+
+for build in region heap; do
+    echo "$build:"
+    time "$DIR/$build" > "$DIR/$build.out"
+done
+cmp "$DIR/region.out" "$DIR/heap.out" && echo "results match"
@@ -0,0 +1,27 @@
+#!/bin/bash
+# Builds thinlto_main.er and thinlto_util.er at -O2 twice: as per-file
+# objects linked with cc, and as bitcode linked with ThinLTO, which can
+# inline the helpers across the files. Prints the link times, then times
+# both programs and checks that their output matches. Run from the
+# repository root after building erode.
+set -e
+ERODE=${ERODE:-build/erode}
+CC=${CC:-cc}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+for file in thinlto_main thinlto_util; do
+    $ERODE benchmarks/$file.er output -O2 -o "$DIR/$file.o"
+    $ERODE benchmarks/$file.er output --emit=bc -O2 -o "$DIR/$file.bc"
+done
+
+echo "per-file link:"
+time $CC "$DIR/thinlto_main.o" "$DIR/thinlto_util.o" -o "$DIR/perfile"
+echo "thinlto link:"
+time $ERODE "$DIR/thinlto_main.bc" link "$DIR/thinlto_util.bc" -O2 -o "$DIR/thinlto"
+
+for build in perfile thinlto; do
+    echo "$build:"
+    time "$DIR/$build" > "$DIR/$build.out"
+done
+cmp "$DIR/perfile.out" "$DIR/thinlto.out" && echo "results match"
@@ -1,10 +1,27 @@
 // codegen.cpp
 #include "codegen.h"
+#include "../parser/parser_helper.h"
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/MathExtras.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <iostream>
+#include <functional>
+#include <numeric>
 
-CodeGen::CodeGen() {
+// Heap arrays and stack arrays of at least this size start on a cache line,
+// so aligned vector loads of their elements never straddle two
+static const uint64_t kArrayAlignment = 64;
+
+// Strings up to this length are stored in place of the data pointer and
+// length, so building them needs no allocation; the rest of the 16 bytes
+// is zero, which keeps a NUL after them
+static const uint64_t kSmallString = 15;
+static const uint64_t kSmallFlag = uint64_t(1) << 63;
+
+CodeGen::CodeGen(bool directSSA) : directSSA(directSSA) {
     // Initialize LLVM components
     context = std::make_unique<llvm::LLVMContext>();
     module = std::make_unique<llvm::Module>("my_module", *context);
@@ -16,8 +33,22 @@ CodeGen::CodeGen() {
 }
 
 // Convert lexer provided typekind to LLVM types
-llvm::Type* CodeGen::getLLVMType(TypeKind kind) {
-    switch (kind) {
+llvm::Type* CodeGen::getLLVMType(const Type& type) {
+    if (type.isFixedArray()) {
+        // The variable holds the address of the elements
+        return llvm::PointerType::getUnqual(*context);
+    }
+    if (type.isDynamicArray()) {
+        return llvm::StructType::get(llvm::PointerType::getUnqual(*context),
+                                     llvm::Type::getInt64Ty(*context));
+    }
+    if (type.isVector()) {
+        return llvm::FixedVectorType::get(getLLVMType(type.element), type.length);
+    }
+    if (type.isStruct()) {
+        return getStructLayout(type.name).type;
+    }
+    switch (type.kind) {
         case TypeKind::INT:
             return llvm::Type::getInt32Ty(*context);
         case TypeKind::FLOAT:
@@ -25,7 +56,21 @@ llvm::Type* CodeGen::getLLVMType(TypeKind kind) {
         case TypeKind::BOOL:
             return llvm::Type::getInt1Ty(*context);
         case TypeKind::CHAR:
+        case TypeKind::I8:
+        case TypeKind::U8:
             return llvm::Type::getInt8Ty(*context);
+        case TypeKind::I16:
+        case TypeKind::U16:
+            return llvm::Type::getInt16Ty(*context);
+        case TypeKind::U32:
+            return llvm::Type::getInt32Ty(*context);
+        case TypeKind::I64:
+        case TypeKind::U64:
+            return llvm::Type::getInt64Ty(*context);
+        case TypeKind::F64:
+            return llvm::Type::getDoubleTy(*context);
+        case TypeKind::STRING:
+            return getStringType();
         case TypeKind::VOID:
             return llvm::Type::getVoidTy(*context);
         default:
@@ -34,6 +79,134 @@ llvm::Type* CodeGen::getLLVMType(TypeKind kind) {
     }
 }
 
+const CodeGen::StructLayout& CodeGen::getStructLayout(const std::string& name) {
+    StructLayout& layout = structs[name];
+    if (layout.type) {
+        return layout;
+    }
+    StructDecl* decl = layout.decl;
+    const llvm::DataLayout& dataLayout = module->getDataLayout();
+    std::vector<llvm::Type*> fieldTypes;
+    for (const Field& field : decl->fields) {
+        fieldTypes.push_back(getLLVMType(field.type));
+    }
+    std::vector<unsigned> order(decl->fields.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (decl->reorder) {
+        // Decreasing alignment never needs padding between fields
+        std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+            return dataLayout.getABITypeAlign(fieldTypes[a]) > dataLayout.getABITypeAlign(fieldTypes[b]);
+        });
+    }
+    std::vector<llvm::Type*> members;
+    layout.members.resize(decl->fields.size());
+    for (unsigned field : order) {
+        layout.members[field] = members.size();
+        members.push_back(fieldTypes[field]);
+    }
+    layout.type = llvm::StructType::create(*context, members, name, decl->packed);
+    if (decl->align) {
+        // Tail padding makes the size, and so the distance between array
+        // elements, a multiple of the alignment
+        uint64_t size = dataLayout.getTypeAllocSize(layout.type);
+        uint64_t padded = llvm::alignTo(size, decl->align);
+        if (padded != size) {
+            members.push_back(llvm::ArrayType::get(builder->getInt8Ty(), padded - size));
+            layout.type->setBody(members, decl->packed);
+        }
+    }
+    return layout;
+}
+
+unsigned CodeGen::fieldIndex(const std::string& name, const std::string& field) {
+    const std::vector<Field>& fields = getStructLayout(name).decl->fields;
+    for (unsigned i = 0; i < fields.size(); ++i) {
+        if (fields[i].name == field) {
+            return i;
+        }
+    }
+    std::cerr << "Unknown field: " << name << "." << field << std::endl;
+    return 0;
+}
+
+llvm::MDNode* CodeGen::getTBAATag(TypeKind element) {
+    auto found = tbaaTags.find(element);
+    if (found != tbaaTags.end()) {
+        return found->second;
+    }
+    llvm::MDBuilder mdBuilder(*context);
+    if (!tbaaRoot) {
+        tbaaRoot = mdBuilder.createTBAARoot("erode TBAA");
+    }
+    llvm::MDNode* scalar = mdBuilder.createTBAAScalarTypeNode(type_to_string(element), tbaaRoot);
+    llvm::MDNode* tag = mdBuilder.createTBAAStructTagNode(scalar, scalar, 0);
+    tbaaTags[element] = tag;
+    return tag;
+}
+
+std::vector<llvm::Type*> CodeGen::getParamTypes(const std::vector<Param>& params) {
+    std::vector<llvm::Type*> types;
+    for (const Param& param : params) {
+        if (param.type.isDynamicArray()) {
+            types.push_back(llvm::PointerType::getUnqual(*context));
+            types.push_back(builder->getInt64Ty());
+        } else {
+            types.push_back(getLLVMType(param.type));
+        }
+    }
+    return types;
+}
+
+void CodeGen::applyEffects(llvm::Function* func, const FunctionEffects& effects) {
+    if (effects.noMemory) {
+        func->setDoesNotAccessMemory();
+    } else if (effects.readOnly) {
+        func->setOnlyReadsMemory();
+    }
+    if (effects.noUnwind) {
+        func->setDoesNotThrow();
+    }
+    if (effects.willReturn) {
+        func->addFnAttr(llvm::Attribute::WillReturn);
+    }
+    if (effects.noRecurse) {
+        func->setDoesNotRecurse();
+    }
+    if (effects.speculatable) {
+        func->addFnAttr(llvm::Attribute::Speculatable);
+    }
+}
+
+void CodeGen::applyAttributes(llvm::Function* func, FunctionDef* funcDef) {
+    auto arg = func->arg_begin();
+    for (const Param& param : funcDef->params) {
+        // Strings are passed as values, not through a pointer
+        if (param.type == TypeKind::STRING) {
+            ++arg;
+            continue;
+        }
+        if (param.noalias) {
+            arg->addAttr(llvm::Attribute::NoAlias);
+        }
+        if (param.mode == PassMode::Borrow) {
+            arg->addAttr(llvm::Attribute::ReadOnly);
+        }
+        if (param.type.isArray() && param.mode != PassMode::Value) {
+            // Borrows end with the call
+            arg->addAttr(llvm::Attribute::NoCapture);
+        }
+        if (param.type.isFixedArray()) {
+            arg->addAttr(llvm::Attribute::getWithDereferenceableBytes(
+                *context, module->getDataLayout().getTypeAllocSize(getStorageType(param.type))));
+        }
+        if (param.type.isDynamicArray()) {
+            ++arg;
+        }
+        ++arg;
+    }
+    applyEffects(func, funcDef->effects);
+}
+
 // Create a stack allocation in the entry block of a function
 llvm::AllocaInst* CodeGen::createEntryBlockAlloca(llvm::Function* func,
                                                    const std::string& varName,
@@ -45,7 +218,7 @@ llvm::AllocaInst* CodeGen::createEntryBlockAlloca(llvm::Function* func,
 
 // Scope management
 void CodeGen::pushScope() {
-    namedValues.push_back(std::map<std::string, llvm::AllocaInst*>());
+    namedValues.push_back(std::map<std::string, Local*>());
 }
 
 void CodeGen::popScope() {
@@ -54,7 +227,7 @@ void CodeGen::popScope() {
     }
 }
 
-llvm::AllocaInst* CodeGen::findVariable(const std::string& name) {
+CodeGen::Local* CodeGen::findVariable(const std::string& name) {
     for (auto it = namedValues.rbegin(); it != namedValues.rend(); ++it) {
         auto found = it->find(name);
         if (found != it->end()) {
@@ -64,12 +237,230 @@ llvm::AllocaInst* CodeGen::findVariable(const std::string& name) {
     return nullptr;
 }
 
+CodeGen::Local* CodeGen::declareLocal(const std::string& name, const Type& type) {
+    auto local = std::make_unique<Local>();
+    local->name = name;
+    local->sourceType = type;
+    local->type = getLLVMType(type);
+    // Owned values keep their slot so their storage can be released with
+    // lifetime markers at the drop point. A fixed-size array's storage is
+    // separate, and its address never changes.
+    if (!directSSA || (isOwnedType(type) && !type.isFixedArray())) {
+        local->alloca = createEntryBlockAlloca(currentFunction, name, local->type);
+    }
+    
+    Local* result = local.get();
+    locals.push_back(std::move(local));
+    namedValues.back()[name] = result;
+    return result;
+}
+
+llvm::Value* CodeGen::readLocal(Local* local) {
+    if (local->alloca) {
+        return builder->CreateLoad(local->type, local->alloca, local->name);
+    }
+    return readVariable(local, builder->GetInsertBlock());
+}
+
+void CodeGen::writeLocal(Local* local, llvm::Value* value) {
+    if (local->alloca) {
+        builder->CreateStore(value, local->alloca);
+    } else {
+        local->defs[builder->GetInsertBlock()] = value;
+    }
+}
+
+llvm::Value* CodeGen::readVariable(Local* local, llvm::BasicBlock* block) {
+    auto found = local->defs.find(block);
+    if (found != local->defs.end() && found->second) {
+        return found->second;
+    }
+    return readVariableRecursive(local, block);
+}
+
+llvm::Value* CodeGen::readVariableRecursive(Local* local, llvm::BasicBlock* block) {
+    llvm::Value* value;
+    if (!sealedBlocks.count(block)) {
+        // More predecessors may still show up; fill the phi in when the
+        // block is sealed
+        llvm::IRBuilder<> phiBuilder(block, block->begin());
+        llvm::PHINode* phi = phiBuilder.CreatePHI(local->type, 0, local->name);
+        incompletePhis[block].push_back({local, phi});
+        value = phi;
+    } else if (llvm::BasicBlock* pred = block->getSinglePredecessor()) {
+        value = readVariable(local, pred);
+    } else {
+        // Record the phi before visiting the predecessors to break cycles
+        llvm::IRBuilder<> phiBuilder(block, block->begin());
+        llvm::PHINode* phi = phiBuilder.CreatePHI(local->type, 0, local->name);
+        local->defs[block] = phi;
+        value = addPhiOperands(local, phi);
+    }
+    local->defs[block] = value;
+    return value;
+}
+
+llvm::Value* CodeGen::addPhiOperands(Local* local, llvm::PHINode* phi) {
+    llvm::BasicBlock* block = phi->getParent();
+    for (llvm::BasicBlock* pred : llvm::predecessors(block)) {
+        phi->addIncoming(readVariable(local, pred), pred);
+    }
+    return tryRemoveTrivialPhi(phi);
+}
+
+llvm::Value* CodeGen::tryRemoveTrivialPhi(llvm::PHINode* phi) {
+    llvm::Value* same = nullptr;
+    for (llvm::Value* op : phi->incoming_values()) {
+        if (op == same || op == phi) {
+            continue;
+        }
+        if (same) {
+            return phi;
+        }
+        same = op;
+    }
+    if (!same) {
+        // Unreachable, or read before any assignment
+        same = llvm::PoisonValue::get(phi->getType());
+    }
+    
+    std::vector<llvm::WeakTrackingVH> phiUsers;
+    for (llvm::User* user : phi->users()) {
+        if (user != phi && llvm::isa<llvm::PHINode>(user)) {
+            phiUsers.push_back(user);
+        }
+    }
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+    
+    // Removing this phi may have made the phis using it trivial. Phis that
+    // are still collecting operands are checked once they are complete.
+    for (llvm::WeakTrackingVH& user : phiUsers) {
+        auto* userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user);
+        if (userPhi && userPhi->getNumIncomingValues() == llvm::pred_size(userPhi->getParent())) {
+            tryRemoveTrivialPhi(userPhi);
+        }
+    }
+    return same;
+}
+
+void CodeGen::sealBlock(llvm::BasicBlock* block) {
+    for (auto& [local, phi] : incompletePhis[block]) {
+        addPhiOperands(local, phi);
+    }
+    incompletePhis.erase(block);
+    sealedBlocks.insert(block);
+}
+
 void CodeGen::dump() {
     module->print(llvm::outs(), nullptr);
 }
 
 void CodeGen::generate(Program* program) {
     generateProgram(program);
+    finishProfiling(program);
+    
+    std::string errStr;
+    llvm::raw_string_ostream os(errStr);
+    if (llvm::verifyModule(*module, &os)) {
+        std::cerr << "Error: Module verification failed:\n" << os.str() << std::endl;
+    }
+}
+
+void CodeGen::generatePartition(Program* program, const std::set<std::string>& functions) {
+    generateProgram(program, &functions);
+    
+    std::string errStr;
+    llvm::raw_string_ostream os(errStr);
+    if (llvm::verifyModule(*module, &os)) {
+        std::cerr << "Error: Module verification failed:\n" << os.str() << std::endl;
+    }
+}
+
+void CodeGen::regenerate(Program* program, const std::set<std::string>& changed,
+                         const std::set<std::string>& redeclared) {
+    // Drop the stale bodies first; afterwards nothing refers to the
+    // functions that are about to be replaced
+    for (const std::string& name : changed) {
+        if (llvm::Function* func = module->getFunction(name)) {
+            func->deleteBody();
+        }
+    }
+    
+    // Struct declarations are unchanged, or the module would be rebuilt
+    std::map<std::string, Item*> items;
+    for (Item* item : program->items) {
+        if (auto* ext = dynamic_cast<ExternDecl*>(item)) {
+            items[ext->name] = ext;
+        } else if (auto* func = dynamic_cast<FunctionDef*>(item)) {
+            items[func->name] = func;
+        } else if (auto* decl = dynamic_cast<StructDecl*>(item)) {
+            structs[decl->name].decl = decl;
+        }
+    }
+    declarations = items;
+    
+    std::vector<llvm::Function*> stale;
+    for (llvm::Function& func : *module) {
+        std::string name = func.getName().str();
+        // C functions the runtime and the remaining bodies call are not
+        // items, but still in use
+        if (!func.isIntrinsic() && !isStringRuntime(name) && !isIoRuntime(name) &&
+            !isRegionRuntime(name) &&
+            ((!items.count(name) && func.use_empty()) || redeclared.count(name))) {
+            stale.push_back(&func);
+        }
+    }
+    // Stale functions may still call each other
+    for (llvm::Function* func : stale) {
+        func->dropAllReferences();
+    }
+    for (llvm::Function* func : stale) {
+        func->eraseFromParent();
+    }
+    
+    // String literals of the dropped bodies
+    std::vector<llvm::GlobalVariable*> unused;
+    for (llvm::GlobalVariable& global : module->globals()) {
+        if (global.hasPrivateLinkage() && global.use_empty()) {
+            unused.push_back(&global);
+        }
+    }
+    for (llvm::GlobalVariable* global : unused) {
+        for (auto it = stringLiterals.begin(); it != stringLiterals.end(); ++it) {
+            if (it->second == global) {
+                stringLiterals.erase(it);
+                break;
+            }
+        }
+        global->eraseFromParent();
+    }
+    
+    for (auto& [name, item] : items) {
+        llvm::Function* func = module->getFunction(name);
+        if (auto* ext = dynamic_cast<ExternDecl*>(item)) {
+            if (!func) {
+                generateExtern(ext);
+            } else {
+                func->setAttributes(llvm::AttributeList());
+                applyEffects(func, ext->effects);
+            }
+        } else if (auto* funcDef = dynamic_cast<FunctionDef*>(item)) {
+            if (!func) {
+                declareFunction(funcDef);
+            } else {
+                func->setAttributes(llvm::AttributeList());
+                applyAttributes(func, funcDef);
+            }
+        }
+    }
+    
+    for (Item* item : program->items) {
+        auto* func = dynamic_cast<FunctionDef*>(item);
+        if (func && changed.count(func->name)) {
+            generateFunction(func);
+        }
+    }
     
     std::string errStr;
     llvm::raw_string_ostream os(errStr);
@@ -78,31 +469,52 @@ void CodeGen::generate(Program* program) {
     }
 }
 
-void CodeGen::generateProgram(Program* program) {
-    // First pass: generate all extern declarations
+void CodeGen::generateProgram(Program* program, const std::set<std::string>* functions) {
+    // First pass: generate all extern declarations and function prototypes,
+    // so calls can refer to functions defined further down. A partition
+    // declares only what its bodies call, when they first call it.
     for (Item* item : program->items) {
         if (auto* ext = dynamic_cast<ExternDecl*>(item)) {
-            generateExtern(ext);
+            declarations[ext->name] = ext;
+            if (!functions) {
+                generateExtern(ext);
+            }
+        } else if (auto* func = dynamic_cast<FunctionDef*>(item)) {
+            declarations[func->name] = func;
+            if (!functions) {
+                declareFunction(func);
+            }
+        } else if (auto* decl = dynamic_cast<StructDecl*>(item)) {
+            structs[decl->name].decl = decl;
         }
     }
     
     // Second pass: generate all functions
     for (Item* item : program->items) {
         if (auto* func = dynamic_cast<FunctionDef*>(item)) {
-            generateFunction(func);
+            if (!functions || functions->count(func->name)) {
+                generateFunction(func);
+            }
         } else if (auto* stmt = dynamic_cast<Statement*>(item)) {
-            std::cerr << "Warning: Top-level statements not supported\n";
+            if (!functions) {
+                std::cerr << "Warning: Top-level statements not supported\n";
+            }
         }
     }
 }
 
 llvm::Function* CodeGen::generateExtern(ExternDecl* ext) {
+    // Strings cross over to C as NUL-terminated char pointers
+    auto cType = [&](const Type& type) {
+        return type == TypeKind::STRING ? llvm::PointerType::getUnqual(*context)
+                                        : getLLVMType(type);
+    };
     std::vector<llvm::Type*> paramTypes;
     for (const Param& param : ext->params) {
-        paramTypes.push_back(getLLVMType(param.type));
+        paramTypes.push_back(cType(param.type));
     }
     
-    llvm::Type* returnType = getLLVMType(ext->returnType);
+    llvm::Type* returnType = cType(ext->returnType);
     llvm::FunctionType* funcType = llvm::FunctionType::get(
         returnType,
         paramTypes,
@@ -121,6 +533,36 @@ llvm::Function* CodeGen::generateExtern(ExternDecl* ext) {
         arg.setName(ext->params[idx++].name);
     }
     
+    applyEffects(func, ext->effects);
+    return func;
+}
+
+llvm::Function* CodeGen::declareFunction(FunctionDef* funcDef) {
+    std::vector<llvm::Type*> paramTypes = getParamTypes(funcDef->params);
+    
+    llvm::Type* returnType = getLLVMType(funcDef->returnType);
+    llvm::FunctionType* funcType = llvm::FunctionType::get(
+        returnType,
+        paramTypes,
+        false
+    );
+    
+    llvm::Function* func = llvm::Function::Create(
+        funcType,
+        llvm::Function::ExternalLinkage,
+        funcDef->name,
+        module.get()
+    );
+    
+    auto arg = func->arg_begin();
+    for (const Param& param : funcDef->params) {
+        (arg++)->setName(param.name);
+        if (param.type.isDynamicArray()) {
+            (arg++)->setName(param.name + ".len");
+        }
+    }
+    
+    applyAttributes(func, funcDef);
     return func;
 }
 
@@ -128,29 +570,7 @@ llvm::Function* CodeGen::generateFunction(FunctionDef* funcDef) {
     llvm::Function* func = module->getFunction(funcDef->name);
     
     if (!func) {
-        std::vector<llvm::Type*> paramTypes;
-        for (const Param& param : funcDef->params) {
-            paramTypes.push_back(getLLVMType(param.type));
-        }
-        
-        llvm::Type* returnType = getLLVMType(funcDef->returnType);
-        llvm::FunctionType* funcType = llvm::FunctionType::get(
-            returnType,
-            paramTypes,
-            false
-        );
-        
-        func = llvm::Function::Create(
-            funcType,
-            llvm::Function::ExternalLinkage,
-            funcDef->name,
-            module.get()
-        );
-        
-        unsigned idx = 0;
-        for (auto& arg : func->args()) {
-            arg.setName(funcDef->params[idx++].name);
-        }
+        func = declareFunction(funcDef);
     }
     
     llvm::BasicBlock* entryBlock = llvm::BasicBlock::Create(
@@ -161,24 +581,52 @@ llvm::Function* CodeGen::generateFunction(FunctionDef* funcDef) {
     builder->SetInsertPoint(entryBlock);
     
     currentFunction = func;
+    locals.clear();
+    sealedBlocks.clear();
+    incompletePhis.clear();
+    sealBlock(entryBlock);
+
+    functionSites = 0;
+    siteCounts = nullptr;
+    if (profile) {
+        siteCounts = profile->find(funcDef->name, funcDef->fingerprint);
+        if (!siteCounts) {
+            std::cerr << "Warning: No current profile for " << funcDef->name << "\n";
+        }
+    }
     
     pushScope();
     
-    for (auto& arg : func->args()) {
-        llvm::AllocaInst* alloca = createEntryBlockAlloca(
-            func,
-            arg.getName().str(),
-            arg.getType()
-        );
-        
-        builder->CreateStore(&arg, alloca);
-        namedValues.back()[arg.getName().str()] = alloca;
+    parameters.clear();
+    auto arg = func->arg_begin();
+    for (const Param& param : funcDef->params) {
+        llvm::Value* value = &*arg++;
+        if (param.type.isDynamicArray()) {
+            llvm::Value* array = llvm::PoisonValue::get(getLLVMType(param.type));
+            array = builder->CreateInsertValue(array, value, 0);
+            value = builder->CreateInsertValue(array, &*arg++, 1, param.name);
+        }
+        Local* local = declareLocal(param.name, param.type);
+        local->owned = (param.type.isDynamicArray() || param.type == TypeKind::STRING) &&
+                       param.mode == PassMode::Value;
+        writeLocal(local, value);
+        parameters.push_back(local);
+    }
+
+    // Tail calls of the function itself store the new arguments in the
+    // parameters and jump here, so the recursion runs as a loop
+    tailRecurse = nullptr;
+    if (funcDef->tailRecursive) {
+        tailRecurse = llvm::BasicBlock::Create(*context, "tailrecurse", func);
+        builder->CreateBr(tailRecurse);
+        builder->SetInsertPoint(tailRecurse);
     }
     
     generateBlock(funcDef->body, false);
     
     llvm::BasicBlock* currentBlock = builder->GetInsertBlock();
     if (!currentBlock->getTerminator()) {
+        dropOwnedLocals();
         if (funcDef->returnType == TypeKind::VOID) {
             builder->CreateRetVoid();
         } else {
@@ -186,9 +634,20 @@ llvm::Function* CodeGen::generateFunction(FunctionDef* funcDef) {
             builder->CreateRet(llvm::Constant::getNullValue(retType));
         }
     }
+    if (tailRecurse) {
+        // Every back edge is in place now
+        sealBlock(tailRecurse);
+        tailRecurse = nullptr;
+    }
     
     popScope();
     currentFunction = nullptr;
+
+    if (!profileOutput.empty()) {
+        counterLayout += funcDef->name + " " + std::to_string(funcDef->fingerprint) + " " +
+                         std::to_string(functionSites) + "\n";
+        counterCount += functionSites;
+    }
     
     std::string errStr;
     llvm::raw_string_ostream os(errStr);
@@ -212,6 +671,7 @@ void CodeGen::generateBlock(BlockStmt* block, bool newScope) {
         if (builder->GetInsertBlock()->getTerminator()) {
             break;
         }
+        generateDrops(stmt);
     }
     
     if (newScope) {
@@ -219,12 +679,38 @@ void CodeGen::generateBlock(BlockStmt* block, bool newScope) {
     }
 }
 
+// Release the storage of owned locals whose last use was this statement
+void CodeGen::generateDrops(Statement* stmt) {
+    for (const std::string& name : stmt->dropsAfter) {
+        Local* local = findVariable(name);
+        if (!local) {
+            continue;
+        }
+        if (local->owned) {
+            dropOwned(local);
+        } else if (local->storage) {
+            builder->CreateLifetimeEnd(local->storage, getAllocaSize(local->storage));
+        } else if (local->alloca) {
+            builder->CreateLifetimeEnd(local->alloca, getAllocaSize(local->alloca));
+        }
+    }
+}
+
+llvm::ConstantInt* CodeGen::getAllocaSize(llvm::AllocaInst* alloca) {
+    return builder->getInt64(
+        module->getDataLayout().getTypeAllocSize(alloca->getAllocatedType())
+    );
+}
+
 void CodeGen::generateStatement(Statement* stmt) {
     if (auto* varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
         generateVarDecl(varDecl);
     }
     else if (auto* exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
-        generateExpression(exprStmt->expr);
+        llvm::Value* value = generateExpression(exprStmt->expr);
+        if (value && isTemporaryString(exprStmt->expr)) {
+            dropString(value);
+        }
     }
     else if (auto* retStmt = dynamic_cast<ReturnStmt*>(stmt)) {
         generateReturn(retStmt);
@@ -238,69 +724,157 @@ void CodeGen::generateStatement(Statement* stmt) {
     else if (auto* forStmt = dynamic_cast<ForStmt*>(stmt)) {
         generateFor(forStmt);
     }
+    else if (auto* regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        generateRegion(regionStmt);
+    }
+    else if (auto* switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        generateSwitch(switchStmt);
+    }
     else if (auto* blockStmt = dynamic_cast<BlockStmt*>(stmt)) {
         generateBlock(blockStmt, true);
     }
 }
 
 void CodeGen::generateVarDecl(VarDeclStmt* stmt) {
-    llvm::Type* type = getLLVMType(stmt->kind);
-    llvm::AllocaInst* alloca = createEntryBlockAlloca(
-        currentFunction,
-        stmt->name,
-        type
-    );
-    
+    // The initializer cannot see the new variable, only one it shadows
+    llvm::Value* initVal = nullptr;
     if (stmt->initializer) {
-        llvm::Value* initVal = generateExpression(stmt->initializer);
-        builder->CreateStore(initVal, alloca);
+        initVal = generateOwnedValue(stmt->initializer);
+    }
+    
+    Local* local = declareLocal(stmt->name, stmt->kind);
+    if (stmt->kind.isFixedArray()) {
+        llvm::Type* arrayType = getStorageType(stmt->kind);
+        local->storage = createEntryBlockAlloca(currentFunction, stmt->name, arrayType);
+        uint64_t size = module->getDataLayout().getTypeAllocSize(arrayType);
+        uint64_t alignment = std::max(size >= kArrayAlignment ? kArrayAlignment : 1,
+                                      structAlignment(stmt->kind));
+        if (alignment > local->storage->getAlign().value()) {
+            local->storage->setAlignment(llvm::Align(alignment));
+        }
+        if (stmt->hasDropPoint) {
+            builder->CreateLifetimeStart(local->storage, getAllocaSize(local->storage));
+        }
+        builder->CreateMemSet(local->storage, builder->getInt8(0), size,
+                              local->storage->getAlign());
+        writeLocal(local, local->storage);
+        return;
+    }
+    if (stmt->kind.isDynamicArray() || stmt->kind == TypeKind::STRING) {
+        // The slot stays valid until the function returns, which frees
+        // whatever it still holds. Strings built in a region are views of
+        // its arena, which dropping leaves alone; arrays aligned beyond a
+        // cache line stay on the heap.
+        local->region = arenas.size();
+        local->owned = !local->region || stmt->kind == TypeKind::STRING ||
+                       structAlignment(stmt->kind) > kArrayAlignment;
+        if (initVal && !local->owned) {
+            initVal = adoptArray(local, stmt->initializer, initVal);
+        }
+        writeLocal(local, initVal ? initVal : llvm::Constant::getNullValue(local->type));
+        return;
+    }
+
+    if (stmt->hasDropPoint && local->alloca) {
+        builder->CreateLifetimeStart(local->alloca, getAllocaSize(local->alloca));
     }
     
-    namedValues.back()[stmt->name] = alloca;
+    if (initVal) {
+        writeLocal(local, initVal);
+    } else if (stmt->kind.isVector() || stmt->kind.isStruct()) {
+        // Lanes and fields can be assigned one by one, so start from zero
+        // like arrays
+        writeLocal(local, llvm::Constant::getNullValue(local->type));
+    }
 }
 
 void CodeGen::generateReturn(ReturnStmt* stmt) {
-    if (stmt->value) {
-        llvm::Value* retVal = generateExpression(stmt->value);
+    if (stmt->tailCall) {
+        generateTailCall(static_cast<CallExpr*>(stmt->value));
+    } else if (stmt->value) {
+        llvm::Value* outer = arena;
+        arena = nullptr;
+        llvm::Value* retVal = generateOwnedValue(stmt->value);
+        arena = outer;
+        dropOwnedLocals();
+        releaseArenas();
         builder->CreateRet(retVal);
     } else {
+        dropOwnedLocals();
+        releaseArenas();
         builder->CreateRetVoid();
     }
 }
 
-void CodeGen::generateIf(IfStmt* stmt) {
-    llvm::Value* condValue = generateExpression(stmt->condition);
-    
-    // Convert to i1 if needed (comparison results are already i1)
-    if (condValue->getType()->isIntegerTy(32)) {
-        condValue = builder->CreateICmpNE(
-            condValue,
-            llvm::ConstantInt::get(*context, llvm::APInt(32, 0)),
-            "ifcond"
-        );
-    } else if (!condValue->getType()->isIntegerTy(1)) {
-        condValue = builder->CreateICmpNE(
-            condValue,
-            llvm::Constant::getNullValue(condValue->getType()),
-            "ifcond"
-        );
+// Nothing a tail call is given lives in this frame, so the owned locals
+// and the arenas are released before it and the call is directly followed
+// by the return. A call of the function itself becomes a jump back to the
+// start of its body; one of a function with the same prototype is made
+// musttail, which the backend has to turn into a jump even at -O0.
+void CodeGen::generateTailCall(CallExpr* call) {
+    llvm::Function* calleeFunc = lookupFunction(call->callee);
+    if (!calleeFunc) {
+        std::cerr << "Unknown function: " << call->callee << std::endl;
+        return;
     }
-    
-    // Create blocks - initially without parent function for else and merge
-    llvm::BasicBlock* thenBlock = llvm::BasicBlock::Create(
-        *context, "then", currentFunction
-    );
+    std::vector<llvm::Value*> args;
+    std::vector<llvm::Value*> temporaries;
+    std::vector<llvm::Value*> copies;
+    if (!generateArguments(call, args, temporaries, copies)) {
+        return;
+    }
+    countCall(call->callee);
+    dropOwnedLocals();
+    releaseArenas();
+
+    if (calleeFunc == currentFunction && tailRecurse) {
+        auto arg = args.begin();
+        for (Local* parameter : parameters) {
+            llvm::Value* value = *arg++;
+            if (parameter->sourceType.isDynamicArray()) {
+                llvm::Value* array = llvm::PoisonValue::get(parameter->type);
+                array = builder->CreateInsertValue(array, value, 0);
+                value = builder->CreateInsertValue(array, *arg++, 1, parameter->name);
+            }
+            writeLocal(parameter, value);
+        }
+        builder->CreateBr(tailRecurse);
+        return;
+    }
+
+    llvm::CallInst* result = calleeFunc->getReturnType()->isVoidTy()
+                                 ? builder->CreateCall(calleeFunc, args)
+                                 : builder->CreateCall(calleeFunc, args, "calltmp");
+    result->setTailCallKind(calleeFunc->getFunctionType() == currentFunction->getFunctionType()
+                                ? llvm::CallInst::TCK_MustTail
+                                : llvm::CallInst::TCK_Tail);
+    if (calleeFunc->getReturnType()->isVoidTy()) {
+        builder->CreateRetVoid();
+    } else {
+        builder->CreateRet(result);
+    }
+}
+
+void CodeGen::generateIf(IfStmt* stmt) {
+    // The blocks join the function after the condition's own blocks
+    llvm::BasicBlock* thenBlock = llvm::BasicBlock::Create(*context, "then");
     llvm::BasicBlock* elseBlock = nullptr;
     llvm::BasicBlock* mergeBlock = llvm::BasicBlock::Create(*context, "ifcont");
     
     if (stmt->elseBlock) {
         elseBlock = llvm::BasicBlock::Create(*context, "else");
-        builder->CreateCondBr(condValue, thenBlock, elseBlock);
-    } else {
-        builder->CreateCondBr(condValue, thenBlock, mergeBlock);
+    }
+    if (!generateCondition(stmt->condition, thenBlock, elseBlock ? elseBlock : mergeBlock)) {
+        return;
+    }
+    
+    sealBlock(thenBlock);
+    if (elseBlock) {
+        sealBlock(elseBlock);
     }
     
     // Generate then block
+    thenBlock->insertInto(currentFunction);
     builder->SetInsertPoint(thenBlock);
     generateBlock(stmt->thenBlock, true);
     if (!builder->GetInsertBlock()->getTerminator()) {
@@ -320,6 +894,7 @@ void CodeGen::generateIf(IfStmt* stmt) {
     
     // Insert merge block into function
     mergeBlock->insertInto(currentFunction);
+    sealBlock(mergeBlock);
     builder->SetInsertPoint(mergeBlock);
 }
 
@@ -334,23 +909,11 @@ void CodeGen::generateWhile(WhileStmt* stmt) {
     
     // Generate condition block
     builder->SetInsertPoint(condBlock);
-    llvm::Value* condValue = generateExpression(stmt->condition);
-    
-    // Convert to i1 if needed
-    if (condValue->getType()->isIntegerTy(32)) {
-        condValue = builder->CreateICmpNE(
-            condValue,
-            llvm::ConstantInt::get(*context, llvm::APInt(32, 0)),
-            "whilecond"
-        );
-    } else if (!condValue->getType()->isIntegerTy(1)) {
-        condValue = builder->CreateICmpNE(
-            condValue,
-            llvm::Constant::getNullValue(condValue->getType()),
-            "whilecond"
-        );
+    if (!generateCondition(stmt->condition, bodyBlock, afterBlock)) {
+        return;
     }
-    builder->CreateCondBr(condValue, bodyBlock, afterBlock);
+    sealBlock(bodyBlock);
+    sealBlock(afterBlock);
     
     // Generate body block
     bodyBlock->insertInto(currentFunction);
@@ -359,6 +922,8 @@ void CodeGen::generateWhile(WhileStmt* stmt) {
     if (!builder->GetInsertBlock()->getTerminator()) {
         builder->CreateBr(condBlock);
     }
+    // The back edge was the last predecessor of the condition
+    sealBlock(condBlock);
     
     // Continue with after block
     afterBlock->insertInto(currentFunction);
@@ -385,26 +950,15 @@ void CodeGen::generateFor(ForStmt* stmt) {
     // Generate condition block
     builder->SetInsertPoint(condBlock);
     if (stmt->condition) {
-        llvm::Value* condValue = generateExpression(stmt->condition);
-        
-        // Convert to i1 if needed
-        if (condValue->getType()->isIntegerTy(32)) {
-            condValue = builder->CreateICmpNE(
-                condValue,
-                llvm::ConstantInt::get(*context, llvm::APInt(32, 0)),
-                "forcond"
-            );
-        } else if (!condValue->getType()->isIntegerTy(1)) {
-            condValue = builder->CreateICmpNE(
-                condValue,
-                llvm::Constant::getNullValue(condValue->getType()),
-                "forcond"
-            );
-        }
-        builder->CreateCondBr(condValue, bodyBlock, afterBlock);
+        if (!generateCondition(stmt->condition, bodyBlock, afterBlock)) {
+            popScope();
+            return;
+        }
     } else {
         builder->CreateBr(bodyBlock);
     }
+    sealBlock(bodyBlock);
+    sealBlock(afterBlock);
     
     // Generate body block
     bodyBlock->insertInto(currentFunction);
@@ -413,6 +967,7 @@ void CodeGen::generateFor(ForStmt* stmt) {
     if (!builder->GetInsertBlock()->getTerminator()) {
         builder->CreateBr(incBlock);
     }
+    sealBlock(incBlock);
     
     // Generate increment block
     incBlock->insertInto(currentFunction);
@@ -421,6 +976,8 @@ void CodeGen::generateFor(ForStmt* stmt) {
         generateExpression(stmt->increment);
     }
     builder->CreateBr(condBlock);
+    // The back edge was the last predecessor of the condition
+    sealBlock(condBlock);
     
     // Continue with after block
     afterBlock->insertInto(currentFunction);
@@ -429,39 +986,197 @@ void CodeGen::generateFor(ForStmt* stmt) {
     popScope();
 }
 
-llvm::Value* CodeGen::generateExpression(Expression* expr) {
-    if (auto* intExpr = dynamic_cast<IntExpr*>(expr)) {
-        return llvm::ConstantInt::get(
-            *context,
-            llvm::APInt(32, intExpr->value, true)
-        );
-    }
-    else if (auto* floatExpr = dynamic_cast<FloatExpr*>(expr)) {
-        return llvm::ConstantFP::get(*context, llvm::APFloat(floatExpr->value));
-    }
-    else if (auto* boolExpr = dynamic_cast<BoolExpr*>(expr)) {
-        return llvm::ConstantInt::get(
-            *context,
-            llvm::APInt(1, boolExpr->value ? 1 : 0)
-        );
-    }
-    else if (auto* charExpr = dynamic_cast<CharExpr*>(expr)) {
-        return llvm::ConstantInt::get(
-            *context,
-            llvm::APInt(8, charExpr->value)
-        );
+void CodeGen::generateSwitch(SwitchStmt* stmt) {
+    llvm::Value* value = generateExpression(stmt->value);
+    if (!value) {
+        return;
     }
-    else if (auto* stringExpr = dynamic_cast<StringExpr*>(expr)) {
-        return builder->CreateGlobalStringPtr(stringExpr->value);
+    // Every destination gets a block of its own, even an empty default,
+    // so the profile can count how often each one is taken
+    std::vector<llvm::BasicBlock*> blocks;
+    std::vector<BlockStmt*> bodies;
+    for (SwitchCase& switchCase : stmt->cases) {
+        blocks.push_back(llvm::BasicBlock::Create(*context, "case"));
+        bodies.push_back(switchCase.body);
     }
-    else if (auto* identExpr = dynamic_cast<IdentifierExpr*>(expr)) {
-        return generateIdentifier(identExpr);
+    llvm::BasicBlock* defaultBlock = llvm::BasicBlock::Create(*context, "default");
+    llvm::BasicBlock* afterBlock = llvm::BasicBlock::Create(*context, "afterswitch");
+
+    llvm::SwitchInst* inst = builder->CreateSwitch(value, defaultBlock, stmt->cases.size());
+    for (size_t i = 0; i < stmt->cases.size(); ++i) {
+        for (Expression* label : stmt->cases[i].labels) {
+            inst->addCase(llvm::cast<llvm::ConstantInt>(generateExpression(label)), blocks[i]);
+        }
     }
-    else if (auto* binaryExpr = dynamic_cast<BinaryExpr*>(expr)) {
-        return generateBinaryExpr(binaryExpr);
+    blocks.push_back(defaultBlock);
+    bodies.push_back(stmt->defaultBlock);
+
+    size_t site = allocateSites(blocks.size());
+    if (siteCounts && site + blocks.size() <= siteCounts->size()) {
+        const uint64_t* counts = &(*siteCounts)[site];
+        uint64_t total = 0;
+        uint64_t most = 0;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            total += counts[i];
+            most = std::max(most, counts[i]);
+        }
+        profiledCounts.push_back(total);
+        // The default comes first, then every label; a case with several
+        // labels shares its count among them. Weights are 32 bits wide and
+        // only their ratio matters.
+        uint64_t scale = most / UINT32_MAX + 1;
+        std::vector<uint32_t> weights = {static_cast<uint32_t>(counts[blocks.size() - 1] / scale)};
+        for (size_t i = 0; i < stmt->cases.size(); ++i) {
+            size_t labels = stmt->cases[i].labels.size();
+            for (size_t j = 0; j < labels; ++j) {
+                weights.push_back(static_cast<uint32_t>(counts[i] / labels / scale));
+            }
+        }
+        inst->setMetadata(llvm::LLVMContext::MD_prof,
+                          llvm::MDBuilder(*context).createBranchWeights(weights));
     }
-    else if (auto* unaryExpr = dynamic_cast<UnaryExpr*>(expr)) {
-        return generateUnaryExpr(unaryExpr);
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        sealBlock(blocks[i]);
+        blocks[i]->insertInto(currentFunction);
+        builder->SetInsertPoint(blocks[i]);
+        countSite(site + i);
+        if (bodies[i]) {
+            generateBlock(bodies[i], true);
+        }
+        if (!builder->GetInsertBlock()->getTerminator()) {
+            builder->CreateBr(afterBlock);
+        }
+    }
+
+    afterBlock->insertInto(currentFunction);
+    sealBlock(afterBlock);
+    builder->SetInsertPoint(afterBlock);
+}
+
+// Strings and arrays made in the body are bumped out of an arena in this
+// frame and freed together on the way out; a return inside frees them in
+// generateReturn()
+void CodeGen::generateRegion(RegionStmt* stmt) {
+    llvm::AllocaInst* record = createEntryBlockAlloca(currentFunction, "arena",
+                                                      getArenaType(*context));
+    builder->CreateStore(llvm::Constant::getNullValue(record->getAllocatedType()), record);
+    arenas.push_back(record);
+    llvm::Value* outer = arena;
+    arena = record;
+    
+    generateBlock(stmt->body, true);
+    
+    arena = outer;
+    arenas.pop_back();
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        builder->CreateCall(getRegionRuntime(*module, RegionRuntime::Release), {record});
+    }
+}
+
+bool CodeGen::generateCondition(Expression* cond, llvm::BasicBlock* trueBlock,
+                                llvm::BasicBlock* falseBlock) {
+    if (auto* binary = dynamic_cast<BinaryExpr*>(cond)) {
+        if (binary->op == Operator::AndAnd || binary->op == Operator::OrOr) {
+            bool isAnd = binary->op == Operator::AndAnd;
+            llvm::BasicBlock* rhsBlock = llvm::BasicBlock::Create(
+                *context, isAnd ? "and.rhs" : "or.rhs", currentFunction);
+            bool generated = isAnd ? generateCondition(binary->left, rhsBlock, falseBlock)
+                                   : generateCondition(binary->left, trueBlock, rhsBlock);
+            if (!generated) {
+                return false;
+            }
+            sealBlock(rhsBlock);
+            builder->SetInsertPoint(rhsBlock);
+            return generateCondition(binary->right, trueBlock, falseBlock);
+        }
+    }
+    if (auto* unary = dynamic_cast<UnaryExpr*>(cond)) {
+        if (unary->op == Operator::Not) {
+            return generateCondition(unary->operand, falseBlock, trueBlock);
+        }
+    }
+
+    llvm::Value* condValue = generateExpression(cond);
+    if (!condValue) {
+        return false;
+    }
+    condValue = toCondition(condValue);
+    size_t site = allocateSites(2);
+    countBranch(site, condValue);
+    setBranchWeights(builder->CreateCondBr(condValue, trueBlock, falseBlock), site);
+    return true;
+}
+
+// Convert to i1 if needed (comparison results are already i1)
+llvm::Value* CodeGen::toCondition(llvm::Value* value) {
+    if (value->getType()->isIntegerTy(1)) {
+        return value;
+    }
+    return builder->CreateICmpNE(value, llvm::Constant::getNullValue(value->getType()), "cond");
+}
+
+llvm::Value* CodeGen::generateLogicalExpr(BinaryExpr* expr) {
+    llvm::BasicBlock* trueBlock = llvm::BasicBlock::Create(*context, "logic.true", currentFunction);
+    llvm::BasicBlock* falseBlock = llvm::BasicBlock::Create(*context, "logic.false");
+    llvm::BasicBlock* mergeBlock = llvm::BasicBlock::Create(*context, "logic.end");
+    if (!generateCondition(expr, trueBlock, falseBlock)) {
+        return nullptr;
+    }
+    sealBlock(trueBlock);
+    sealBlock(falseBlock);
+
+    builder->SetInsertPoint(trueBlock);
+    builder->CreateBr(mergeBlock);
+    falseBlock->insertInto(currentFunction);
+    builder->SetInsertPoint(falseBlock);
+    builder->CreateBr(mergeBlock);
+
+    mergeBlock->insertInto(currentFunction);
+    sealBlock(mergeBlock);
+    builder->SetInsertPoint(mergeBlock);
+    llvm::PHINode* phi = builder->CreatePHI(builder->getInt1Ty(), 2, "logictmp");
+    phi->addIncoming(builder->getTrue(), trueBlock);
+    phi->addIncoming(builder->getFalse(), falseBlock);
+    return phi;
+}
+
+llvm::Value* CodeGen::generateExpression(Expression* expr) {
+    if (auto* intExpr = dynamic_cast<IntExpr*>(expr)) {
+        return llvm::ConstantInt::get(getLLVMType(intExpr->type), intExpr->value, true);
+    }
+    else if (auto* floatExpr = dynamic_cast<FloatExpr*>(expr)) {
+        return llvm::ConstantFP::get(getLLVMType(floatExpr->type), floatExpr->value);
+    }
+    else if (auto* boolExpr = dynamic_cast<BoolExpr*>(expr)) {
+        return llvm::ConstantInt::get(
+            *context,
+            llvm::APInt(1, boolExpr->value ? 1 : 0)
+        );
+    }
+    else if (auto* charExpr = dynamic_cast<CharExpr*>(expr)) {
+        return llvm::ConstantInt::get(
+            *context,
+            llvm::APInt(8, charExpr->value)
+        );
+    }
+    else if (auto* stringExpr = dynamic_cast<StringExpr*>(expr)) {
+        return generateStringLiteral(stringExpr->value);
+    }
+    else if (auto* identExpr = dynamic_cast<IdentifierExpr*>(expr)) {
+        return generateIdentifier(identExpr);
+    }
+    else if (auto* borrowExpr = dynamic_cast<BorrowExpr*>(expr)) {
+        // A borrow passes the owner's value itself, which points at the
+        // elements or bytes; the checker guarantees nobody frees or writes
+        // them behind the borrower's back.
+        return loadVariable(borrowExpr->name);
+    }
+    else if (auto* binaryExpr = dynamic_cast<BinaryExpr*>(expr)) {
+        return generateBinaryExpr(binaryExpr);
+    }
+    else if (auto* unaryExpr = dynamic_cast<UnaryExpr*>(expr)) {
+        return generateUnaryExpr(unaryExpr);
     }
     else if (auto* callExpr = dynamic_cast<CallExpr*>(expr)) {
         return generateCallExpr(callExpr);
@@ -469,35 +1184,115 @@ llvm::Value* CodeGen::generateExpression(Expression* expr) {
     else if (auto* assignExpr = dynamic_cast<AssignExpr*>(expr)) {
         return generateAssignExpr(assignExpr);
     }
+    else if (auto* indexExpr = dynamic_cast<IndexExpr*>(expr)) {
+        return generateIndexExpr(indexExpr);
+    }
+    else if (auto* indexAssignExpr = dynamic_cast<IndexAssignExpr*>(expr)) {
+        return generateIndexAssignExpr(indexAssignExpr);
+    }
+    else if (auto* allocExpr = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        return generateArrayAlloc(allocExpr);
+    }
+    else if (auto* lengthExpr = dynamic_cast<LengthExpr*>(expr)) {
+        return generateLengthExpr(lengthExpr);
+    }
+    else if (auto* sliceExpr = dynamic_cast<SliceExpr*>(expr)) {
+        return generateSlice(sliceExpr);
+    }
+    else if (auto* structExpr = dynamic_cast<StructExpr*>(expr)) {
+        return generateStructExpr(structExpr);
+    }
+    else if (auto* fieldExpr = dynamic_cast<FieldExpr*>(expr)) {
+        return generateFieldExpr(fieldExpr);
+    }
+    else if (auto* fieldAssignExpr = dynamic_cast<FieldAssignExpr*>(expr)) {
+        return generateFieldAssignExpr(fieldAssignExpr);
+    }
+    else if (auto* castExpr = dynamic_cast<CastExpr*>(expr)) {
+        llvm::Value* operand = generateExpression(castExpr->operand);
+        if (!operand) {
+            return nullptr;
+        }
+        return generateConversion(operand, castExpr->source, castExpr->target,
+                                  getLLVMType(castExpr->target));
+    }
+    else if (auto* vectorExpr = dynamic_cast<VectorExpr*>(expr)) {
+        return generateVectorExpr(vectorExpr);
+    }
+    else if (auto* shuffleExpr = dynamic_cast<ShuffleExpr*>(expr)) {
+        return generateShuffleExpr(shuffleExpr);
+    }
+    else if (auto* builtinExpr = dynamic_cast<BuiltinExpr*>(expr)) {
+        return generateBuiltinExpr(builtinExpr);
+    }
+    else if (auto* loadExpr = dynamic_cast<VectorLoadExpr*>(expr)) {
+        return generateVectorLoad(loadExpr);
+    }
+    else if (auto* storeExpr = dynamic_cast<VectorStoreExpr*>(expr)) {
+        return generateVectorStore(storeExpr);
+    }
     
     std::cerr << "Unknown expression type\n";
     return nullptr;
 }
 
 llvm::Value* CodeGen::generateIdentifier(IdentifierExpr* expr) {
-    llvm::AllocaInst* alloca = findVariable(expr->name);
-    if (!alloca) {
-        std::cerr << "Unknown variable: " << expr->name << std::endl;
+    llvm::Value* value = loadVariable(expr->name);
+    Local* local = findVariable(expr->name);
+    if (value && expr->moved && local->owned) {
+        // The new owner frees it now
+        writeLocal(local, llvm::Constant::getNullValue(local->type));
+    }
+    return value;
+}
+
+llvm::Value* CodeGen::loadVariable(const std::string& name) {
+    Local* local = findVariable(name);
+    if (!local) {
+        std::cerr << "Unknown variable: " << name << std::endl;
         return nullptr;
     }
     
-    return builder->CreateLoad(alloca->getAllocatedType(), alloca, expr->name);
+    return readLocal(local);
 }
 
 llvm::Value* CodeGen::generateAssignExpr(AssignExpr* expr) {
-    llvm::Value* val = generateExpression(expr->value);
-    llvm::AllocaInst* alloca = findVariable(expr->name);
+    Local* local = findVariable(expr->name);
     
-    if (!alloca) {
+    if (!local) {
         std::cerr << "Unknown variable: " << expr->name << std::endl;
         return nullptr;
     }
     
-    builder->CreateStore(val, alloca);
+    // The value lives as long as the variable
+    llvm::Value* outer = arena;
+    if (isOwnedType(local->sourceType)) {
+        arena = local->region ? arenas[local->region - 1] : nullptr;
+    }
+    llvm::Value* val = generateOwnedValue(expr->value);
+    if (val && !local->owned && local->sourceType.isDynamicArray()) {
+        val = adoptArray(local, expr->value, val);
+    }
+    arena = outer;
+    if (!val) {
+        return nullptr;
+    }
+    
+    if (local->owned) {
+        dropOwned(local);
+    }
+    writeLocal(local, val);
     return val;
 }
 
 llvm::Value* CodeGen::generateBinaryExpr(BinaryExpr* expr) {
+    if (expr->isString) {
+        return expr->op == Operator::Plus ? generateConcat(expr) : generateStringCompare(expr);
+    }
+    if ((expr->op == Operator::AndAnd || expr->op == Operator::OrOr) && !expr->lanewise) {
+        return generateLogicalExpr(expr);
+    }
+
     llvm::Value* left = generateExpression(expr->left);
     llvm::Value* right = generateExpression(expr->right);
     
@@ -505,41 +1300,72 @@ llvm::Value* CodeGen::generateBinaryExpr(BinaryExpr* expr) {
         return nullptr;
     }
     
-    bool isFloat = left->getType()->isFloatingPointTy() || 
-                   right->getType()->isFloatingPointTy();
+    // A scalar next to a vector goes into every lane
+    if (auto* vectorType = llvm::dyn_cast<llvm::FixedVectorType>(left->getType())) {
+        if (!right->getType()->isVectorTy()) {
+            right = builder->CreateVectorSplat(vectorType->getNumElements(), right, "splat");
+        }
+    } else if (auto* vectorType = llvm::dyn_cast<llvm::FixedVectorType>(right->getType())) {
+        left = builder->CreateVectorSplat(vectorType->getNumElements(), left, "splat");
+    }
+    
+    bool isFloat = left->getType()->getScalarType()->isFloatingPointTy() || 
+                   right->getType()->getScalarType()->isFloatingPointTy();
     
     switch (expr->op) {
+        case Operator::AndAnd:
+            return builder->CreateAnd(left, right, "andtmp");
+        
+        case Operator::OrOr:
+            return builder->CreateOr(left, right, "ortmp");
+        
         case Operator::Plus:
             return isFloat ? builder->CreateFAdd(left, right, "addtmp")
-                          : builder->CreateAdd(left, right, "addtmp");
+                          : builder->CreateAdd(left, right, "addtmp",
+                                               expr->noUnsignedWrap, expr->noSignedWrap);
         
         case Operator::Minus:
             return isFloat ? builder->CreateFSub(left, right, "subtmp")
-                          : builder->CreateSub(left, right, "subtmp");
+                          : builder->CreateSub(left, right, "subtmp",
+                                               expr->noUnsignedWrap, expr->noSignedWrap);
         
         case Operator::Multiply:
             return isFloat ? builder->CreateFMul(left, right, "multmp")
-                          : builder->CreateMul(left, right, "multmp");
+                          : builder->CreateMul(left, right, "multmp",
+                                               expr->noUnsignedWrap, expr->noSignedWrap);
         
         case Operator::Divide:
-            return isFloat ? builder->CreateFDiv(left, right, "divtmp")
-                          : builder->CreateSDiv(left, right, "divtmp");
+            if (isFloat) {
+                return builder->CreateFDiv(left, right, "divtmp");
+            }
+            // Signed and unsigned division agree on non-negative operands,
+            // and udiv is cheaper to lower and easier for LLVM to reason about
+            return expr->isUnsigned || expr->nonNegative ? builder->CreateUDiv(left, right, "divtmp")
+                                                         : builder->CreateSDiv(left, right, "divtmp");
         
         case Operator::Less:
             return isFloat ? builder->CreateFCmpULT(left, right, "cmptmp")
-                          : builder->CreateICmpSLT(left, right, "cmptmp");
+                           : builder->CreateICmp(expr->isUnsigned ? llvm::CmpInst::ICMP_ULT
+                                                                  : llvm::CmpInst::ICMP_SLT,
+                                                 left, right, "cmptmp");
         
         case Operator::Greater:
             return isFloat ? builder->CreateFCmpUGT(left, right, "cmptmp")
-                          : builder->CreateICmpSGT(left, right, "cmptmp");
+                           : builder->CreateICmp(expr->isUnsigned ? llvm::CmpInst::ICMP_UGT
+                                                                  : llvm::CmpInst::ICMP_SGT,
+                                                 left, right, "cmptmp");
         
         case Operator::LessEqual:
             return isFloat ? builder->CreateFCmpULE(left, right, "cmptmp")
-                          : builder->CreateICmpSLE(left, right, "cmptmp");
+                           : builder->CreateICmp(expr->isUnsigned ? llvm::CmpInst::ICMP_ULE
+                                                                  : llvm::CmpInst::ICMP_SLE,
+                                                 left, right, "cmptmp");
         
         case Operator::GreaterEqual:
             return isFloat ? builder->CreateFCmpUGE(left, right, "cmptmp")
-                          : builder->CreateICmpSGE(left, right, "cmptmp");
+                           : builder->CreateICmp(expr->isUnsigned ? llvm::CmpInst::ICMP_UGE
+                                                                  : llvm::CmpInst::ICMP_SGE,
+                                                 left, right, "cmptmp");
         
         case Operator::EqualEqual:
             return isFloat ? builder->CreateFCmpUEQ(left, right, "cmptmp")
@@ -549,12 +1375,6 @@ llvm::Value* CodeGen::generateBinaryExpr(BinaryExpr* expr) {
             return isFloat ? builder->CreateFCmpUNE(left, right, "cmptmp")
                           : builder->CreateICmpNE(left, right, "cmptmp");
         
-        case Operator::AndAnd:
-            return builder->CreateAnd(left, right, "andtmp");
-        
-        case Operator::OrOr:
-            return builder->CreateOr(left, right, "ortmp");
-        
         default:
             std::cerr << "Unknown binary operator\n";
             return nullptr;
@@ -570,8 +1390,10 @@ llvm::Value* CodeGen::generateUnaryExpr(UnaryExpr* expr) {
     
     switch (expr->op) {
         case Operator::Minus:
-            if (operand->getType()->isFloatingPointTy()) {
+            if (operand->getType()->getScalarType()->isFloatingPointTy()) {
                 return builder->CreateFNeg(operand, "negtmp");
+            } else if (expr->noSignedWrap) {
+                return builder->CreateNSWNeg(operand, "negtmp");
             } else {
                 return builder->CreateNeg(operand, "negtmp");
             }
@@ -585,30 +1407,1239 @@ llvm::Value* CodeGen::generateUnaryExpr(UnaryExpr* expr) {
     }
 }
 
+llvm::Function* CodeGen::lookupFunction(const std::string& name) {
+    if (llvm::Function* func = module->getFunction(name)) {
+        return func;
+    }
+    Item* decl = findDeclaration(name);
+    if (!decl) {
+        return nullptr;
+    }
+    if (auto* ext = dynamic_cast<ExternDecl*>(decl)) {
+        return generateExtern(ext);
+    }
+    return declareFunction(static_cast<FunctionDef*>(decl));
+}
+
+Item* CodeGen::findDeclaration(const std::string& name) {
+    auto it = declarations.find(name);
+    return it == declarations.end() ? nullptr : it->second;
+}
+
 llvm::Value* CodeGen::generateCallExpr(CallExpr* expr) {
-    llvm::Function* calleeFunc = module->getFunction(expr->callee);
+    llvm::Function* calleeFunc = lookupFunction(expr->callee);
     
     if (!calleeFunc) {
         std::cerr << "Unknown function: " << expr->callee << std::endl;
         return nullptr;
     }
     
-    if (calleeFunc->arg_size() != expr->arguments.size()) {
+    std::vector<llvm::Value*> args;
+    // Strings only an extern reads, and the C copies made of them
+    std::vector<llvm::Value*> temporaries;
+    std::vector<llvm::Value*> copies;
+    if (!generateArguments(expr, args, temporaries, copies)) {
+        return nullptr;
+    }
+    countCall(expr->callee);
+    
+    llvm::Value* result = calleeFunc->getReturnType()->isVoidTy()
+                              ? builder->CreateCall(calleeFunc, args)
+                              : builder->CreateCall(calleeFunc, args, "calltmp");
+    auto* ext = dynamic_cast<ExternDecl*>(findDeclaration(expr->callee));
+    if (!ext) {
+        return result;
+    }
+    llvm::FunctionCallee freeFunc = module->getOrInsertFunction(
+        "free", builder->getVoidTy(), llvm::PointerType::getUnqual(*context));
+    for (llvm::Value* copy : copies) {
+        builder->CreateCall(freeFunc, {copy});
+    }
+    for (llvm::Value* temporary : temporaries) {
+        dropString(temporary);
+    }
+    return ext->returnType == TypeKind::STRING ? stringFromCString(result) : result;
+}
+
+bool CodeGen::generateArguments(CallExpr* expr, std::vector<llvm::Value*>& args,
+                                std::vector<llvm::Value*>& temporaries,
+                                std::vector<llvm::Value*>& copies) {
+    const std::vector<Param>* params = nullptr;
+    Item* decl = findDeclaration(expr->callee);
+    ExternDecl* ext = dynamic_cast<ExternDecl*>(decl);
+    if (auto* funcDef = dynamic_cast<FunctionDef*>(decl)) {
+        params = &funcDef->params;
+    }
+    
+    for (size_t i = 0; i < expr->arguments.size(); ++i) {
+        Expression* arg = expr->arguments[i];
+        bool isString = ext && i < ext->params.size() && ext->params[i].type == TypeKind::STRING;
+        bool byValue = params && i < params->size() && (*params)[i].mode == PassMode::Value;
+        // The callee frees what it is given, so it comes from the heap
+        llvm::Value* outer = arena;
+        if (byValue) {
+            arena = nullptr;
+        }
+        llvm::Value* argVal = isString ? generateStringOperand(arg, temporaries)
+                              : byValue ? generateOwnedValue(arg)
+                                        : generateExpression(arg);
+        arena = outer;
+        if (!argVal) {
+            return false;
+        }
+        if (isString) {
+            args.push_back(cStringArgument(argVal, copies));
+        } else if (params && i < params->size() && (*params)[i].type.isDynamicArray()) {
+            // A borrowed fixed-size array passes its length as a constant
+            Local* array = nullptr;
+            if (auto* borrow = dynamic_cast<BorrowExpr*>(expr->arguments[i])) {
+                array = findVariable(borrow->name);
+            }
+            args.push_back(array ? arrayData(array, argVal) : builder->CreateExtractValue(argVal, 0));
+            args.push_back(array ? arrayLength(array, argVal) : builder->CreateExtractValue(argVal, 1));
+        } else {
+            args.push_back(argVal);
+        }
+    }
+    
+    if (lookupFunction(expr->callee)->arg_size() != args.size()) {
         std::cerr << "Incorrect number of arguments for " << expr->callee << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void CodeGen::countCall(const std::string& callee) {
+    size_t site = allocateSites(1);
+    countSite(site);
+    if (siteCounts && site < siteCounts->size()) {
+        entryCounts[callee] += (*siteCounts)[site];
+    }
+}
+
+llvm::Value* CodeGen::arrayData(Local* array, llvm::Value* value) {
+    if (array->sourceType.isFixedArray()) {
+        return value;
+    }
+    return builder->CreateExtractValue(value, 0, array->name + ".data");
+}
+
+llvm::Value* CodeGen::arrayLength(Local* array, llvm::Value* value) {
+    if (array->sourceType.isFixedArray()) {
+        return builder->getInt64(array->sourceType.length);
+    }
+    return builder->CreateExtractValue(value, 1, array->name + ".len");
+}
+
+void CodeGen::generateCheck(llvm::Value* ok) {
+    llvm::Function* func = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock* okBlock = llvm::BasicBlock::Create(*context, "check.ok", func);
+    llvm::BasicBlock* failBlock = llvm::BasicBlock::Create(*context, "check.fail", func);
+    
+    builder->CreateCondBr(ok, okBlock, failBlock,
+                          llvm::MDBuilder(*context).createBranchWeights(2000, 1));
+    sealBlock(okBlock);
+    sealBlock(failBlock);
+    
+    builder->SetInsertPoint(failBlock);
+    builder->CreateCall(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::trap));
+    builder->CreateUnreachable();
+    
+    builder->SetInsertPoint(okBlock);
+}
+
+llvm::Value* CodeGen::generateArrayIndex(Local* array, Expression* index, bool inBounds) {
+    llvm::Value* indexVal = generateExpression(index);
+    if (!indexVal) {
+        return nullptr;
+    }
+    indexVal = builder->CreateSExt(indexVal, builder->getInt64Ty(), "idx");
+    
+    if (!inBounds) {
+        // Unsigned, so negative indices fail too
+        llvm::Value* length = arrayLength(array, readLocal(array));
+        generateCheck(builder->CreateICmpULT(indexVal, length, "inbounds"));
+    }
+    return indexVal;
+}
+
+llvm::Value* CodeGen::generateElementPointer(Local* array, Expression* index, bool inBounds) {
+    llvm::Value* indexVal = generateArrayIndex(array, index, inBounds);
+    if (!indexVal) {
+        return nullptr;
+    }
+    llvm::Type* elementType = getLLVMType(array->sourceType.elementType());
+    return builder->CreateInBoundsGEP(elementType, arrayData(array, readLocal(array)), indexVal, "elem");
+}
+
+llvm::Value* CodeGen::soaOffset(const StructLayout& layout, size_t field, llvm::Value* length) {
+    const llvm::DataLayout& dataLayout = module->getDataLayout();
+    llvm::Value* offset = builder->getInt64(0);
+    for (size_t i = 0; i < field; ++i) {
+        uint64_t fieldSize = dataLayout.getTypeAllocSize(getLLVMType(layout.decl->fields[i].type));
+        llvm::Value* size = builder->CreateNUWMul(length, builder->getInt64(fieldSize));
+        size = builder->CreateAnd(builder->CreateNUWAdd(size, builder->getInt64(kArrayAlignment - 1)),
+                                  builder->getInt64(~(kArrayAlignment - 1)));
+        offset = builder->CreateNUWAdd(offset, size);
+    }
+    return offset;
+}
+
+llvm::Type* CodeGen::getStorageType(const Type& array) {
+    if (array.element == TypeKind::STRUCT) {
+        const StructLayout& layout = getStructLayout(array.name);
+        if (layout.decl->soa) {
+            // Constant folded, since the length is
+            llvm::Value* size = soaOffset(layout, layout.decl->fields.size(),
+                                          builder->getInt64(array.length));
+            return llvm::ArrayType::get(builder->getInt8Ty(),
+                                        llvm::cast<llvm::ConstantInt>(size)->getZExtValue());
+        }
+    }
+    return llvm::ArrayType::get(getLLVMType(array.elementType()), array.length);
+}
+
+uint64_t CodeGen::structAlignment(const Type& array) {
+    if (array.element != TypeKind::STRUCT) {
+        return 1;
+    }
+    return std::max<uint64_t>(getStructLayout(array.name).decl->align, 1);
+}
+
+llvm::Value* CodeGen::fieldPointer(Local* array, llvm::Value* index, unsigned field) {
+    const StructLayout& layout = getStructLayout(array->sourceType.name);
+    const Field& decl = layout.decl->fields[field];
+    llvm::Value* value = readLocal(array);
+    if (layout.decl->soa) {
+        llvm::Value* offset = soaOffset(layout, field, arrayLength(array, value));
+        llvm::Value* column = builder->CreateInBoundsGEP(builder->getInt8Ty(), arrayData(array, value),
+                                                         offset, array->name + "." + decl.name);
+        return builder->CreateInBoundsGEP(getLLVMType(decl.type), column, index, "field");
+    }
+    llvm::Value* element = builder->CreateInBoundsGEP(layout.type, arrayData(array, value), index, "elem");
+    return builder->CreateStructGEP(layout.type, element, layout.members[field], "field");
+}
+
+llvm::Align CodeGen::fieldAlignment(const StructLayout& layout, unsigned field) {
+    const llvm::DataLayout& dataLayout = module->getDataLayout();
+    if (layout.decl->soa) {
+        // Each column is a plain array of the field's type
+        return dataLayout.getABITypeAlign(getLLVMType(layout.decl->fields[field].type));
+    }
+    if (layout.decl->packed) {
+        return llvm::Align(1);
+    }
+    llvm::Align elementAlign = std::max(dataLayout.getABITypeAlign(layout.type),
+                                        llvm::Align(std::max<uint64_t>(layout.decl->align, 1)));
+    uint64_t offset = dataLayout.getStructLayout(layout.type)->getElementOffset(layout.members[field]);
+    return llvm::commonAlignment(elementAlign, offset);
+}
+
+llvm::Value* CodeGen::loadStructElement(Local* array, llvm::Value* index) {
+    const StructLayout& layout = getStructLayout(array->sourceType.name);
+    llvm::Value* result = llvm::Constant::getNullValue(layout.type);
+    for (unsigned i = 0; i < layout.decl->fields.size(); ++i) {
+        TypeKind kind = layout.decl->fields[i].type.kind;
+        llvm::LoadInst* load = builder->CreateAlignedLoad(getLLVMType(kind), fieldPointer(array, index, i),
+                                                          fieldAlignment(layout, i));
+        load->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(kind));
+        result = builder->CreateInsertValue(result, load, layout.members[i]);
+    }
+    return result;
+}
+
+void CodeGen::storeStructElement(Local* array, llvm::Value* index, llvm::Value* value) {
+    const StructLayout& layout = getStructLayout(array->sourceType.name);
+    for (unsigned i = 0; i < layout.decl->fields.size(); ++i) {
+        llvm::Value* field = builder->CreateExtractValue(value, layout.members[i]);
+        llvm::StoreInst* store = builder->CreateAlignedStore(field, fieldPointer(array, index, i),
+                                                             fieldAlignment(layout, i));
+        store->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(layout.decl->fields[i].type.kind));
+    }
+}
+
+llvm::Value* CodeGen::generateIndexExpr(IndexExpr* expr) {
+    Local* array = findVariable(expr->name);
+    if (!array) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    if (array->sourceType.isVector()) {
+        llvm::Value* lane = generateLaneIndex(array, expr->index, expr->inBounds);
+        if (!lane) {
+            return nullptr;
+        }
+        return builder->CreateExtractElement(readLocal(array), lane, expr->name + ".lane");
+    }
+    if (array->sourceType.element == TypeKind::STRUCT) {
+        llvm::Value* index = generateArrayIndex(array, expr->index, expr->inBounds);
+        return index ? loadStructElement(array, index) : nullptr;
+    }
+    llvm::Value* ptr = generateElementPointer(array, expr->index, expr->inBounds);
+    if (!ptr) {
         return nullptr;
     }
+    TypeKind element = array->sourceType.element;
+    llvm::LoadInst* load = builder->CreateLoad(getLLVMType(element), ptr, expr->name + ".elem");
+    load->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(element));
+    return load;
+}
+
+llvm::Value* CodeGen::generateIndexAssignExpr(IndexAssignExpr* expr) {
+    Local* array = findVariable(expr->name);
+    if (!array) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    llvm::Value* val = generateExpression(expr->value);
+    if (!val) {
+        return nullptr;
+    }
+    if (array->sourceType.isVector()) {
+        llvm::Value* lane = generateLaneIndex(array, expr->index, expr->inBounds);
+        if (!lane) {
+            return nullptr;
+        }
+        writeLocal(array, builder->CreateInsertElement(readLocal(array), val, lane));
+        return val;
+    }
+    if (array->sourceType.element == TypeKind::STRUCT) {
+        llvm::Value* index = generateArrayIndex(array, expr->index, expr->inBounds);
+        if (!index) {
+            return nullptr;
+        }
+        storeStructElement(array, index, val);
+        return val;
+    }
+    llvm::Value* ptr = generateElementPointer(array, expr->index, expr->inBounds);
+    if (!ptr) {
+        return nullptr;
+    }
+    llvm::StoreInst* store = builder->CreateStore(val, ptr);
+    store->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(array->sourceType.element));
+    return val;
+}
+
+llvm::Value* CodeGen::generateArrayAlloc(ArrayAllocExpr* expr) {
+    llvm::Value* length = generateExpression(expr->length);
+    if (!length) {
+        return nullptr;
+    }
+    length = builder->CreateSExt(length, builder->getInt64Ty(), "len");
+    generateCheck(builder->CreateICmpSGE(length, builder->getInt64(0), "len.valid"));
+    
+    // aligned_alloc wants a multiple of the alignment
+    Type arrayType = Type::arrayOf(expr->element, 0);
+    uint64_t alignment = std::max(kArrayAlignment, structAlignment(arrayType));
+    llvm::Value* size = arrayAllocationSize(expr->element, length, alignment);
     
+    llvm::Value* data;
+    if (arena && alignment <= kArrayAlignment) {
+        // Arena memory is aligned to a cache line already
+        data = builder->CreateCall(getRegionRuntime(*module, RegionRuntime::Alloc), {arena, size},
+                                   "data");
+    } else {
+        llvm::Type* ptrTy = llvm::PointerType::getUnqual(*context);
+        llvm::FunctionCallee alignedAlloc = module->getOrInsertFunction(
+            "aligned_alloc", ptrTy, builder->getInt64Ty(), builder->getInt64Ty());
+        llvm::CallInst* call = builder->CreateCall(alignedAlloc,
+                                                   {builder->getInt64(alignment), size}, "data");
+        call->addRetAttr(llvm::Attribute::NoAlias);
+        call->addRetAttr(llvm::Attribute::getWithAlignment(*context, llvm::Align(alignment)));
+        generateCheck(builder->CreateOr(builder->CreateIsNotNull(call),
+                                        builder->CreateICmpEQ(size, builder->getInt64(0)),
+                                        "alloc.ok"));
+        data = call;
+    }
+    builder->CreateMemSet(data, builder->getInt8(0), size, llvm::Align(alignment));
+    
+    llvm::Value* array = llvm::PoisonValue::get(getLLVMType(arrayType));
+    array = builder->CreateInsertValue(array, data, 0);
+    return builder->CreateInsertValue(array, length, 1, "array");
+}
+
+llvm::Value* CodeGen::arrayAllocationSize(const Type& element, llvm::Value* length,
+                                           uint64_t alignment) {
+    llvm::Value* size;
+    if (element.isStruct() && getStructLayout(element.name).decl->soa) {
+        const StructLayout& layout = getStructLayout(element.name);
+        size = soaOffset(layout, layout.decl->fields.size(), length);
+    } else {
+        uint64_t elementSize = module->getDataLayout().getTypeAllocSize(getLLVMType(element));
+        size = builder->CreateNUWMul(length, builder->getInt64(elementSize), "size");
+    }
+    return builder->CreateAnd(builder->CreateNUWAdd(size, builder->getInt64(alignment - 1)),
+                              builder->getInt64(~(alignment - 1)), "size.aligned");
+}
+
+llvm::Value* CodeGen::adoptArray(Local* array, Expression* source, llvm::Value* value) {
+    if (dynamic_cast<ArrayAllocExpr*>(source)) {
+        return value;
+    }
+    if (auto* ident = dynamic_cast<IdentifierExpr*>(source)) {
+        Local* local = findVariable(ident->name);
+        if (local && local->region) {
+            return value;
+        }
+    }
+    llvm::Value* data = builder->CreateExtractValue(value, 0);
+    llvm::Value* length = builder->CreateExtractValue(value, 1);
+    llvm::Value* size = arrayAllocationSize(array->sourceType.elementType(), length,
+                                            kArrayAlignment);
+    llvm::Value* copy = builder->CreateCall(getRegionRuntime(*module, RegionRuntime::Alloc),
+                                            {arena, size}, "adopted");
+    builder->CreateMemCpy(copy, llvm::Align(kArrayAlignment), data, llvm::Align(kArrayAlignment),
+                          size);
+    llvm::FunctionCallee freeFunc = module->getOrInsertFunction(
+        "free", builder->getVoidTy(), llvm::PointerType::getUnqual(*context));
+    builder->CreateCall(freeFunc, {data});
+    return builder->CreateInsertValue(value, copy, 0, "array");
+}
+
+llvm::Value* CodeGen::generateLengthExpr(LengthExpr* expr) {
+    Local* array = findVariable(expr->name);
+    if (!array) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    if (array->sourceType == TypeKind::STRING) {
+        return builder->CreateTrunc(stringLength(readLocal(array)), builder->getInt32Ty(), "len");
+    }
+    if (array->sourceType.isFixedArray()) {
+        return builder->getInt32(array->sourceType.length);
+    }
+    llvm::Value* length = arrayLength(array, readLocal(array));
+    return builder->CreateTrunc(length, builder->getInt32Ty(), "len");
+}
+
+llvm::Value* CodeGen::generateStructExpr(StructExpr* expr) {
+    const StructLayout& layout = getStructLayout(expr->name);
+    // Zero, so the padding of aligned structs is defined
+    llvm::Value* result = llvm::Constant::getNullValue(layout.type);
+    for (size_t i = 0; i < expr->arguments.size(); ++i) {
+        llvm::Value* field = generateExpression(expr->arguments[i]);
+        if (!field) {
+            return nullptr;
+        }
+        result = builder->CreateInsertValue(result, field, layout.members[i]);
+    }
+    return result;
+}
+
+llvm::Value* CodeGen::generateFieldExpr(FieldExpr* expr) {
+    Local* local = findVariable(expr->name);
+    if (!local) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    unsigned field = fieldIndex(local->sourceType.name, expr->field);
+    if (!expr->index) {
+        // Struct variables are SSA values like vectors
+        const StructLayout& layout = getStructLayout(local->sourceType.name);
+        return builder->CreateExtractValue(readLocal(local), layout.members[field],
+                                           expr->name + "." + expr->field);
+    }
+    llvm::Value* index = generateArrayIndex(local, expr->index, expr->inBounds);
+    if (!index) {
+        return nullptr;
+    }
+    const StructLayout& layout = getStructLayout(local->sourceType.name);
+    llvm::LoadInst* load = builder->CreateAlignedLoad(getLLVMType(expr->type),
+                                                      fieldPointer(local, index, field),
+                                                      fieldAlignment(layout, field),
+                                                      expr->name + "." + expr->field);
+    load->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(expr->type.kind));
+    return load;
+}
+
+llvm::Value* CodeGen::generateFieldAssignExpr(FieldAssignExpr* expr) {
+    Local* local = findVariable(expr->name);
+    if (!local) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    llvm::Value* val = generateExpression(expr->value);
+    if (!val) {
+        return nullptr;
+    }
+    unsigned field = fieldIndex(local->sourceType.name, expr->field);
+    if (!expr->index) {
+        const StructLayout& layout = getStructLayout(local->sourceType.name);
+        writeLocal(local, builder->CreateInsertValue(readLocal(local), val, layout.members[field]));
+        return val;
+    }
+    llvm::Value* index = generateArrayIndex(local, expr->index, expr->inBounds);
+    if (!index) {
+        return nullptr;
+    }
+    const StructLayout& layout = getStructLayout(local->sourceType.name);
+    llvm::StoreInst* store = builder->CreateAlignedStore(val, fieldPointer(local, index, field),
+                                                         fieldAlignment(layout, field));
+    store->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(expr->type.kind));
+    return val;
+}
+
+void CodeGen::dropOwned(Local* local) {
+    if (local->sourceType == TypeKind::STRING) {
+        dropString(readLocal(local));
+    } else {
+        llvm::FunctionCallee freeFunc = module->getOrInsertFunction(
+            "free", builder->getVoidTy(), llvm::PointerType::getUnqual(*context));
+        builder->CreateCall(freeFunc, {arrayData(local, readLocal(local))});
+    }
+    writeLocal(local, llvm::Constant::getNullValue(local->type));
+}
+
+void CodeGen::dropOwnedLocals() {
+    for (auto& scope : namedValues) {
+        for (auto& [name, local] : scope) {
+            if (local->owned) {
+                dropOwned(local);
+            }
+        }
+    }
+}
+
+void CodeGen::releaseArenas() {
+    for (auto it = arenas.rbegin(); it != arenas.rend(); ++it) {
+        builder->CreateCall(getRegionRuntime(*module, RegionRuntime::Release), {*it});
+    }
+}
+
+llvm::StructType* CodeGen::getStringType() {
+    if (!stringType) {
+        stringType = llvm::StructType::create(
+            *context, {llvm::PointerType::getUnqual(*context), builder->getInt64Ty(),
+                       builder->getInt64Ty()},
+            "erode.string");
+    }
+    return stringType;
+}
+
+llvm::Value* CodeGen::generateStringLiteral(const std::string& value) {
+    // Private, unnamed_addr and NUL-terminated, so the linker also merges
+    // equal literals of different objects
+    llvm::GlobalVariable*& global = stringLiterals[value];
+    if (!global) {
+        llvm::Constant* bytes = llvm::ConstantDataArray::getString(*context, value);
+        global = new llvm::GlobalVariable(*module, bytes->getType(), true,
+                                          llvm::GlobalValue::PrivateLinkage, bytes, ".str");
+        global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        global->setAlignment(llvm::Align(1));
+    }
+    return llvm::ConstantStruct::get(getStringType(), {global, builder->getInt64(value.size()),
+                                                       builder->getInt64(0)});
+}
+
+llvm::Value* CodeGen::stringLength(llvm::Value* str) {
+    llvm::Value* capacity = builder->CreateExtractValue(str, 2, "str.cap");
+    llvm::Value* isSmall = builder->CreateICmpSLT(capacity, builder->getInt64(0), "str.small");
+    return builder->CreateSelect(isSmall, builder->CreateAnd(capacity, kSmallFlag - 1),
+                                 builder->CreateExtractValue(str, 1), "str.len");
+}
+
+llvm::Value* CodeGen::stringData(llvm::Value* str) {
+    llvm::AllocaInst* slot = createEntryBlockAlloca(currentFunction, "str.bytes", getStringType());
+    builder->CreateStore(str, slot);
+    llvm::Value* capacity = builder->CreateExtractValue(str, 2, "str.cap");
+    llvm::Value* isSmall = builder->CreateICmpSLT(capacity, builder->getInt64(0), "str.small");
+    return builder->CreateSelect(isSmall, slot, builder->CreateExtractValue(str, 0), "str.data");
+}
+
+llvm::Value* CodeGen::allocateBuffer(llvm::Value* size) {
+    llvm::FunctionCallee mallocFunc = module->getOrInsertFunction(
+        "malloc", llvm::PointerType::getUnqual(*context), builder->getInt64Ty());
+    llvm::Value* buffer = builder->CreateCall(mallocFunc, {size}, "buffer");
+    generateCheck(builder->CreateIsNotNull(buffer, "allocated"));
+    return buffer;
+}
+
+llvm::Value* CodeGen::buildString(const std::vector<std::pair<llvm::Value*, llvm::Value*>>& parts) {
+    llvm::Value* total = builder->getInt64(0);
+    for (auto& [data, length] : parts) {
+        total = builder->CreateNUWAdd(total, length, "str.total");
+    }
+    llvm::BasicBlock* smallBlock = llvm::BasicBlock::Create(*context, "str.small", currentFunction);
+    llvm::BasicBlock* heapBlock = llvm::BasicBlock::Create(*context, "str.heap", currentFunction);
+    llvm::BasicBlock* mergeBlock = llvm::BasicBlock::Create(*context, "str.built", currentFunction);
+    builder->CreateCondBr(builder->CreateICmpULE(total, builder->getInt64(kSmallString)),
+                          smallBlock, heapBlock);
+    sealBlock(smallBlock);
+    sealBlock(heapBlock);
+
+    auto copyParts = [&](llvm::Value* buffer, llvm::MaybeAlign alignment) {
+        llvm::Value* offset = builder->getInt64(0);
+        for (auto& [data, length] : parts) {
+            llvm::Value* target = builder->CreateInBoundsGEP(builder->getInt8Ty(), buffer, offset);
+            builder->CreateMemCpy(target, alignment, data, llvm::MaybeAlign(1), length);
+            offset = builder->CreateNUWAdd(offset, length);
+            alignment = llvm::MaybeAlign(1);
+        }
+    };
+
+    builder->SetInsertPoint(smallBlock);
+    llvm::AllocaInst* slot = createEntryBlockAlloca(currentFunction, "str.small", getStringType());
+    builder->CreateMemSet(slot, builder->getInt8(0),
+                          module->getDataLayout().getTypeAllocSize(getStringType()), slot->getAlign());
+    copyParts(slot, slot->getAlign());
+    llvm::Value* small = builder->CreateLoad(getStringType(), slot);
+    small = builder->CreateInsertValue(small, builder->CreateOr(total, kSmallFlag), 2);
+    builder->CreateBr(mergeBlock);
+    llvm::BasicBlock* smallEnd = builder->GetInsertBlock();
+
+    // In a region the buffer belongs to the arena, so the string is a view
+    // of it
+    builder->SetInsertPoint(heapBlock);
+    llvm::Value* bufferSize = builder->CreateNUWAdd(total, builder->getInt64(1));
+    llvm::Value* buffer = arena ? builder->CreateCall(getRegionRuntime(*module, RegionRuntime::Alloc),
+                                                      {arena, bufferSize}, "buffer")
+                                : allocateBuffer(bufferSize);
+    copyParts(buffer, llvm::MaybeAlign(1));
+    builder->CreateStore(builder->getInt8(0),
+                         builder->CreateInBoundsGEP(builder->getInt8Ty(), buffer, total));
+    llvm::Value* heap = llvm::PoisonValue::get(getStringType());
+    heap = builder->CreateInsertValue(heap, buffer, 0);
+    heap = builder->CreateInsertValue(heap, total, 1);
+    heap = builder->CreateInsertValue(heap, arena ? builder->getInt64(0) : total, 2);
+    builder->CreateBr(mergeBlock);
+    llvm::BasicBlock* heapEnd = builder->GetInsertBlock();
+
+    sealBlock(mergeBlock);
+    builder->SetInsertPoint(mergeBlock);
+    llvm::PHINode* result = builder->CreatePHI(getStringType(), 2, "str");
+    result->addIncoming(small, smallEnd);
+    result->addIncoming(heap, heapEnd);
+    return result;
+}
+
+bool CodeGen::isTemporaryString(Expression* expr) {
+    if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
+        return binary->isString && binary->op == Operator::Plus;
+    }
+    if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        auto* funcDef = dynamic_cast<FunctionDef*>(findDeclaration(call->callee));
+        return funcDef && funcDef->returnType == TypeKind::STRING;
+    }
+    if (auto* builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        return builtin->builtin == Builtin::ReadLine;
+    }
+    return false;
+}
+
+llvm::Value* CodeGen::generateStringOperand(Expression* expr,
+                                            std::vector<llvm::Value*>& temporaries) {
+    llvm::Value* value = generateExpression(expr);
+    if (value && isTemporaryString(expr)) {
+        temporaries.push_back(value);
+    }
+    return value;
+}
+
+llvm::Value* CodeGen::generateOwnedValue(Expression* expr) {
+    llvm::Value* value = generateExpression(expr);
+    if (value && dynamic_cast<SliceExpr*>(expr)) {
+        return buildString({{stringData(value), stringLength(value)}});
+    }
+    return value;
+}
+
+void CodeGen::dropString(llvm::Value* str) {
+    // Views and small strings own no buffer, and free(NULL) does nothing
+    llvm::Value* capacity = builder->CreateExtractValue(str, 2, "str.cap");
+    llvm::Value* buffer = builder->CreateSelect(
+        builder->CreateICmpSGT(capacity, builder->getInt64(0)),
+        builder->CreateExtractValue(str, 0),
+        llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(*context)), "str.buffer");
+    llvm::FunctionCallee freeFunc = module->getOrInsertFunction(
+        "free", builder->getVoidTy(), llvm::PointerType::getUnqual(*context));
+    builder->CreateCall(freeFunc, {buffer});
+}
+
+// a + b + c builds the result in one go: the lengths are added up first and
+// every operand is copied once
+llvm::Value* CodeGen::generateConcat(BinaryExpr* expr) {
+    std::vector<Expression*> operands;
+    std::function<void(Expression*)> flatten = [&](Expression* operand) {
+        auto* binary = dynamic_cast<BinaryExpr*>(operand);
+        if (binary && binary->isString && binary->op == Operator::Plus) {
+            flatten(binary->left);
+            flatten(binary->right);
+        } else {
+            operands.push_back(operand);
+        }
+    };
+    flatten(expr);
+
+    std::vector<llvm::Value*> temporaries;
+    std::vector<std::pair<llvm::Value*, llvm::Value*>> parts;
+    for (Expression* operand : operands) {
+        llvm::Value* value = generateStringOperand(operand, temporaries);
+        if (!value) {
+            return nullptr;
+        }
+        parts.push_back({stringData(value), stringLength(value)});
+    }
+    llvm::Value* result = buildString(parts);
+    for (llvm::Value* temporary : temporaries) {
+        dropString(temporary);
+    }
+    return result;
+}
+
+llvm::Value* CodeGen::generateStringCompare(BinaryExpr* expr) {
+    std::vector<llvm::Value*> temporaries;
+    llvm::Value* left = generateStringOperand(expr->left, temporaries);
+    llvm::Value* right = generateStringOperand(expr->right, temporaries);
+    if (!left || !right) {
+        return nullptr;
+    }
+    std::vector<llvm::Value*> args = {stringData(left), stringLength(left), stringData(right),
+                                      stringLength(right)};
+    llvm::Value* result;
+    if (expr->op == Operator::EqualEqual || expr->op == Operator::NotEqual) {
+        result = builder->CreateCall(getStringRuntime(*module, StringRuntime::Equal), args, "streq");
+        if (expr->op == Operator::NotEqual) {
+            result = builder->CreateNot(result, "strne");
+        }
+    } else {
+        llvm::Value* order =
+            builder->CreateCall(getStringRuntime(*module, StringRuntime::Compare), args, "strcmp");
+        llvm::CmpInst::Predicate predicate = expr->op == Operator::Less      ? llvm::CmpInst::ICMP_SLT
+                                             : expr->op == Operator::Greater ? llvm::CmpInst::ICMP_SGT
+                                             : expr->op == Operator::LessEqual ? llvm::CmpInst::ICMP_SLE
+                                                                               : llvm::CmpInst::ICMP_SGE;
+        result = builder->CreateICmp(predicate, order, builder->getInt32(0), "cmptmp");
+    }
+    for (llvm::Value* temporary : temporaries) {
+        dropString(temporary);
+    }
+    return result;
+}
+
+llvm::Value* CodeGen::generateSlice(SliceExpr* expr) {
+    Local* local = findVariable(expr->name);
+    if (!local) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    llvm::Value* start = generateExpression(expr->start);
+    llvm::Value* end = generateExpression(expr->end);
+    if (!start || !end) {
+        return nullptr;
+    }
+    start = builder->CreateSExt(start, builder->getInt64Ty(), "start");
+    end = builder->CreateSExt(end, builder->getInt64Ty(), "end");
+    llvm::Value* str = readLocal(local);
+    // Unsigned, so negative bounds fail too
+    generateCheck(builder->CreateAnd(builder->CreateICmpULE(start, end),
+                                     builder->CreateICmpULE(end, stringLength(str)), "inbounds"));
+    llvm::Value* data = builder->CreateInBoundsGEP(builder->getInt8Ty(), stringData(str), start);
+    llvm::Value* view = llvm::PoisonValue::get(getStringType());
+    view = builder->CreateInsertValue(view, data, 0);
+    view = builder->CreateInsertValue(view, builder->CreateNUWSub(end, start), 1);
+    return builder->CreateInsertValue(view, builder->getInt64(0), 2, "slice");
+}
+
+llvm::Value* CodeGen::generateFind(BuiltinExpr* expr) {
+    std::vector<llvm::Value*> temporaries;
+    llvm::Value* haystack = generateStringOperand(expr->arguments[0], temporaries);
+    llvm::Value* needle = generateStringOperand(expr->arguments[1], temporaries);
+    if (!haystack || !needle) {
+        return nullptr;
+    }
+    llvm::Value* index = builder->CreateCall(
+        getStringRuntime(*module, StringRuntime::Find),
+        {stringData(haystack), stringLength(haystack), stringData(needle), stringLength(needle)},
+        "find");
+    for (llvm::Value* temporary : temporaries) {
+        dropString(temporary);
+    }
+    return builder->CreateTrunc(index, builder->getInt32Ty(), "find");
+}
+
+llvm::Value* CodeGen::generateIoBuiltin(BuiltinExpr* expr) {
+    if (expr->builtin == Builtin::ReadInt) {
+        llvm::Value* value =
+            builder->CreateCall(getIoRuntime(*module, IoRuntime::ReadInt), {}, "read");
+        return builder->CreateTrunc(value, builder->getInt32Ty(), "read");
+    }
+    if (expr->builtin == Builtin::Eof) {
+        return builder->CreateCall(getIoRuntime(*module, IoRuntime::AtEnd), {}, "eof");
+    }
+    if (expr->builtin == Builtin::ReadLine) {
+        // The buffer is the string's own; an empty line has none, which
+        // makes it the empty view
+        llvm::Value* line =
+            builder->CreateCall(getIoRuntime(*module, IoRuntime::ReadLine), {}, "line");
+        llvm::Value* length = builder->CreateExtractValue(line, 1);
+        llvm::Value* str = llvm::PoisonValue::get(getStringType());
+        str = builder->CreateInsertValue(str, builder->CreateExtractValue(line, 0), 0);
+        str = builder->CreateInsertValue(str, length, 1);
+        return builder->CreateInsertValue(str, length, 2, "line");
+    }
+
+    llvm::Value* result = nullptr;
+    if (!expr->arguments.empty()) {
+        std::vector<llvm::Value*> temporaries;
+        llvm::Value* value = generateStringOperand(expr->arguments[0], temporaries);
+        if (!value) {
+            return nullptr;
+        }
+        TypeKind type = expr->printed;
+        if (type == TypeKind::STRING) {
+            result = builder->CreateCall(getIoRuntime(*module, IoRuntime::Write),
+                                         {stringData(value), stringLength(value)});
+        } else if (type == TypeKind::BOOL) {
+            llvm::Value* yes = builder->CreateExtractValue(generateStringLiteral("true"), 0);
+            llvm::Value* no = builder->CreateExtractValue(generateStringLiteral("false"), 0);
+            result = builder->CreateCall(
+                getIoRuntime(*module, IoRuntime::Write),
+                {builder->CreateSelect(value, yes, no),
+                 builder->CreateSelect(value, builder->getInt64(4), builder->getInt64(5))});
+        } else if (type == TypeKind::CHAR) {
+            result = builder->CreateCall(getIoRuntime(*module, IoRuntime::Byte), {value});
+        } else if (isFloat(type)) {
+            result = builder->CreateCall(
+                getIoRuntime(*module, IoRuntime::Float),
+                {builder->CreateFPExt(value, builder->getDoubleTy())});
+        } else if (isUnsigned(type)) {
+            result = builder->CreateCall(
+                getIoRuntime(*module, IoRuntime::Uint),
+                {builder->CreateZExt(value, builder->getInt64Ty())});
+        } else {
+            result = builder->CreateCall(
+                getIoRuntime(*module, IoRuntime::Int),
+                {builder->CreateSExt(value, builder->getInt64Ty())});
+        }
+        for (llvm::Value* temporary : temporaries) {
+            dropString(temporary);
+        }
+    }
+    if (expr->builtin == Builtin::Println) {
+        result = builder->CreateCall(getIoRuntime(*module, IoRuntime::Byte),
+                                     {builder->getInt8('\n')});
+    }
+    return result;
+}
+
+llvm::Value* CodeGen::cStringArgument(llvm::Value* str, std::vector<llvm::Value*>& copies) {
+    llvm::Value* data = stringData(str);
+    llvm::Value* length = stringLength(str);
+    // An empty string may have no buffer at all
+    llvm::Value* empty = builder->CreateExtractValue(generateStringLiteral(""), 0);
+    data = builder->CreateSelect(builder->CreateIsNull(data), empty, data);
+    llvm::Value* terminator = builder->CreateLoad(
+        builder->getInt8Ty(), builder->CreateInBoundsGEP(builder->getInt8Ty(), data, length));
+
+    llvm::BasicBlock* before = builder->GetInsertBlock();
+    llvm::BasicBlock* copyBlock = llvm::BasicBlock::Create(*context, "cstr.copy", currentFunction);
+    llvm::BasicBlock* doneBlock = llvm::BasicBlock::Create(*context, "cstr", currentFunction);
+    builder->CreateCondBr(builder->CreateIsNull(terminator), doneBlock, copyBlock);
+    sealBlock(copyBlock);
+
+    builder->SetInsertPoint(copyBlock);
+    llvm::Value* buffer = allocateBuffer(builder->CreateNUWAdd(length, builder->getInt64(1)));
+    builder->CreateMemCpy(buffer, llvm::MaybeAlign(1), data, llvm::MaybeAlign(1), length);
+    builder->CreateStore(builder->getInt8(0),
+                         builder->CreateInBoundsGEP(builder->getInt8Ty(), buffer, length));
+    builder->CreateBr(doneBlock);
+    llvm::BasicBlock* copyEnd = builder->GetInsertBlock();
+
+    sealBlock(doneBlock);
+    builder->SetInsertPoint(doneBlock);
+    llvm::PHINode* result = builder->CreatePHI(data->getType(), 2, "cstr");
+    result->addIncoming(data, before);
+    result->addIncoming(buffer, copyEnd);
+    llvm::PHINode* copy = builder->CreatePHI(data->getType(), 2, "cstr.copy");
+    copy->addIncoming(llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(*context)), before);
+    copy->addIncoming(buffer, copyEnd);
+    copies.push_back(copy);
+    return result;
+}
+
+llvm::Value* CodeGen::stringFromCString(llvm::Value* ptr) {
+    llvm::Value* empty = builder->CreateExtractValue(generateStringLiteral(""), 0);
+    ptr = builder->CreateSelect(builder->CreateIsNull(ptr), empty, ptr);
+    llvm::FunctionCallee strlenFunc = module->getOrInsertFunction(
+        "strlen", builder->getInt64Ty(), llvm::PointerType::getUnqual(*context));
+    llvm::Value* view = llvm::PoisonValue::get(getStringType());
+    view = builder->CreateInsertValue(view, ptr, 0);
+    view = builder->CreateInsertValue(view, builder->CreateCall(strlenFunc, {ptr}, "strlen"), 1);
+    return builder->CreateInsertValue(view, builder->getInt64(0), 2, "cstr.view");
+}
+
+llvm::Value* CodeGen::generateConversion(llvm::Value* value, TypeKind from, TypeKind to,
+                                         llvm::Type* type) {
+    // char is signed, like in comparisons; bool converts to 0 or 1
+    bool fromSigned = !isUnsigned(from) && from != TypeKind::BOOL;
+    if (isFloat(from)) {
+        if (isFloat(to)) {
+            return builder->CreateFPCast(value, type, "conv");
+        }
+        // Saturating: out of range values clamp and NaN becomes 0, where
+        // fptosi/fptoui would give poison
+        llvm::Intrinsic::ID convert = isUnsigned(to) ? llvm::Intrinsic::fptoui_sat
+                                                     : llvm::Intrinsic::fptosi_sat;
+        return builder->CreateIntrinsic(convert, {type, value->getType()}, {value}, nullptr, "conv");
+    }
+    if (isFloat(to)) {
+        return fromSigned ? builder->CreateSIToFP(value, type, "conv")
+                          : builder->CreateUIToFP(value, type, "conv");
+    }
+    return builder->CreateIntCast(value, type, fromSigned, "conv");
+}
+
+llvm::Value* CodeGen::generateLaneIndex(Local* vector, Expression* index, bool inBounds) {
+    llvm::Value* lane = generateExpression(index);
+    if (lane && !inBounds) {
+        generateCheck(builder->CreateICmpULT(lane, builder->getInt32(vector->sourceType.length),
+                                             "inbounds"));
+    }
+    return lane;
+}
+
+llvm::Value* CodeGen::generateVectorExpr(VectorExpr* expr) {
+    std::vector<llvm::Value*> elements;
+    for (Expression* element : expr->elements) {
+        llvm::Value* value = generateExpression(element);
+        if (!value) {
+            return nullptr;
+        }
+        elements.push_back(value);
+    }
+    if (expr->source != TypeKind::VOID) {
+        return generateConversion(elements[0], expr->source, expr->type.element,
+                                  getLLVMType(expr->type));
+    }
+    if (elements.size() == 1) {
+        return builder->CreateVectorSplat(expr->type.length, elements[0], "splat");
+    }
+    llvm::Value* vector = llvm::PoisonValue::get(getLLVMType(expr->type));
+    for (size_t i = 0; i < elements.size(); ++i) {
+        vector = builder->CreateInsertElement(vector, elements[i], i);
+    }
+    return vector;
+}
+
+llvm::Value* CodeGen::generateShuffleExpr(ShuffleExpr* expr) {
+    llvm::Value* first = generateExpression(expr->first);
+    if (!first) {
+        return nullptr;
+    }
+    llvm::Value* second = expr->second ? generateExpression(expr->second)
+                                       : llvm::PoisonValue::get(first->getType());
+    if (!second) {
+        return nullptr;
+    }
+    return builder->CreateShuffleVector(first, second, expr->lanes, "shuffle");
+}
+
+llvm::Value* CodeGen::generateBuiltinExpr(BuiltinExpr* expr) {
+    if (expr->builtin == Builtin::Find) {
+        return generateFind(expr);
+    }
+    if (expr->builtin == Builtin::Print || expr->builtin == Builtin::Println ||
+        expr->builtin == Builtin::ReadInt || expr->builtin == Builtin::ReadLine ||
+        expr->builtin == Builtin::Eof) {
+        return generateIoBuiltin(expr);
+    }
     std::vector<llvm::Value*> args;
-    for (Expression* argExpr : expr->arguments) {
-        llvm::Value* argVal = generateExpression(argExpr);
-        if (!argVal) {
+    for (Expression* arg : expr->arguments) {
+        llvm::Value* value = generateExpression(arg);
+        if (!value) {
             return nullptr;
         }
-        args.push_back(argVal);
+        args.push_back(value);
     }
     
-    if (calleeFunc->getReturnType()->isVoidTy()) {
-        return builder->CreateCall(calleeFunc, args);
+    llvm::Type* laneType = args[0]->getType()->getScalarType();
+    bool isFloat = laneType->isFloatingPointTy();
+    llvm::Value* result = nullptr;
+    switch (expr->builtin) {
+        case Builtin::Select:
+            return builder->CreateSelect(args[0], args[1], args[2], "select");
+        case Builtin::ReduceAdd:
+            // The lanes may be added in any order, which lets the backend
+            // use a tree of shuffles instead of a serial chain
+            result = isFloat ? builder->CreateFAddReduce(llvm::ConstantFP::getNegativeZero(laneType), args[0])
+                             : builder->CreateAddReduce(args[0]);
+            break;
+        case Builtin::ReduceMul:
+            result = isFloat ? builder->CreateFMulReduce(llvm::ConstantFP::get(laneType, 1.0), args[0])
+                             : builder->CreateMulReduce(args[0]);
+            break;
+        case Builtin::ReduceMin:
+            result = isFloat ? builder->CreateFPMinReduce(args[0])
+                             : builder->CreateIntMinReduce(args[0], !expr->isUnsigned);
+            break;
+        case Builtin::ReduceMax:
+            result = isFloat ? builder->CreateFPMaxReduce(args[0])
+                             : builder->CreateIntMaxReduce(args[0], !expr->isUnsigned);
+            break;
+        case Builtin::Any:
+            return builder->CreateOrReduce(args[0]);
+        case Builtin::All:
+            return builder->CreateAndReduce(args[0]);
+        case Builtin::Sqrt:
+            return builder->CreateUnaryIntrinsic(llvm::Intrinsic::sqrt, args[0], nullptr, "sqrt");
+        case Builtin::Fma:
+            return builder->CreateIntrinsic(llvm::Intrinsic::fma, {args[0]->getType()}, args,
+                                            nullptr, "fma");
+        case Builtin::Abs:
+            // abs of the smallest int wraps around to itself
+            return isFloat ? builder->CreateUnaryIntrinsic(llvm::Intrinsic::fabs, args[0], nullptr, "abs")
+                           : builder->CreateBinaryIntrinsic(llvm::Intrinsic::abs, args[0],
+                                                            builder->getFalse(), nullptr, "abs");
+        case Builtin::Min:
+            return builder->CreateBinaryIntrinsic(isFloat ? llvm::Intrinsic::minnum
+                                                  : expr->isUnsigned ? llvm::Intrinsic::umin
+                                                                     : llvm::Intrinsic::smin,
+                                                  args[0], args[1], nullptr, "min");
+        case Builtin::Max:
+            return builder->CreateBinaryIntrinsic(isFloat ? llvm::Intrinsic::maxnum
+                                                  : expr->isUnsigned ? llvm::Intrinsic::umax
+                                                                     : llvm::Intrinsic::smax,
+                                                  args[0], args[1], nullptr, "max");
+        case Builtin::Popcount:
+            return builder->CreateUnaryIntrinsic(llvm::Intrinsic::ctpop, args[0], nullptr, "popcount");
+        // Defined for zero, which gives the bit width
+        case Builtin::Ctz:
+            return builder->CreateBinaryIntrinsic(llvm::Intrinsic::cttz, args[0], builder->getFalse(),
+                                                  nullptr, "ctz");
+        case Builtin::Clz:
+            return builder->CreateBinaryIntrinsic(llvm::Intrinsic::ctlz, args[0], builder->getFalse(),
+                                                  nullptr, "clz");
+        case Builtin::Rotl: {
+            llvm::Value* bits = args[1];
+            if (auto* vectorType = llvm::dyn_cast<llvm::FixedVectorType>(args[0]->getType());
+                vectorType && !bits->getType()->isVectorTy()) {
+                bits = builder->CreateVectorSplat(vectorType->getNumElements(), bits, "splat");
+            }
+            // A funnel shift of a value with itself is a rotate, and takes
+            // the amount modulo the bit width
+            return builder->CreateIntrinsic(llvm::Intrinsic::fshl, {args[0]->getType()},
+                                            {args[0], args[0], bits}, nullptr, "rotl");
+        }
+        case Builtin::Bswap:
+            return builder->CreateUnaryIntrinsic(llvm::Intrinsic::bswap, args[0], nullptr, "bswap");
+        case Builtin::Find:
+        case Builtin::Print:
+        case Builtin::Println:
+        case Builtin::ReadInt:
+        case Builtin::ReadLine:
+        case Builtin::Eof:
+            break;
+    }
+    if (isFloat) {
+        llvm::cast<llvm::Instruction>(result)->setHasAllowReassoc(true);
+    }
+    return result;
+}
+
+void CodeGen::generateLaneCheck(Local* array, llvm::Value* value, llvm::Value* index,
+                                llvm::Value* mask) {
+    auto* maskType = llvm::cast<llvm::FixedVectorType>(mask->getType());
+    unsigned lanes = maskType->getNumElements();
+    std::vector<llvm::Constant*> offsets;
+    for (unsigned i = 0; i < lanes; ++i) {
+        offsets.push_back(builder->getInt64(i));
+    }
+    llvm::Value* indices = builder->CreateAdd(builder->CreateVectorSplat(lanes, index),
+                                              llvm::ConstantVector::get(offsets), "lanes");
+    llvm::Value* length = builder->CreateVectorSplat(lanes, arrayLength(array, value));
+    // Unsigned, so negative indices fail too
+    llvm::Value* outside = builder->CreateAnd(mask, builder->CreateICmpUGE(indices, length));
+    generateCheck(builder->CreateNot(builder->CreateOrReduce(outside), "inbounds"));
+}
+
+llvm::Value* CodeGen::generateVectorLoad(VectorLoadExpr* expr) {
+    Local* array = findVariable(expr->name);
+    if (!array) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    llvm::Value* index = generateExpression(expr->index);
+    llvm::Value* mask = generateExpression(expr->mask);
+    if (!index || !mask) {
+        return nullptr;
+    }
+    index = builder->CreateSExt(index, builder->getInt64Ty(), "idx");
+    
+    llvm::Value* value = readLocal(array);
+    if (!expr->inBounds) {
+        generateLaneCheck(array, value, index, mask);
+    }
+    TypeKind element = array->sourceType.element;
+    llvm::Type* elementType = getLLVMType(element);
+    auto* vectorType = llvm::FixedVectorType::get(
+        elementType, llvm::cast<llvm::FixedVectorType>(mask->getType())->getNumElements());
+    // Not inbounds: with the trailing lanes masked off, index may be past
+    // the end
+    llvm::Value* ptr = builder->CreateGEP(elementType, arrayData(array, value), index, "elem");
+    llvm::CallInst* load = builder->CreateMaskedLoad(
+        vectorType, ptr, module->getDataLayout().getABITypeAlign(elementType), mask,
+        llvm::Constant::getNullValue(vectorType), expr->name + ".lanes");
+    load->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(element));
+    return load;
+}
+
+llvm::Value* CodeGen::generateVectorStore(VectorStoreExpr* expr) {
+    Local* array = findVariable(expr->name);
+    if (!array) {
+        std::cerr << "Unknown variable: " << expr->name << std::endl;
+        return nullptr;
+    }
+    llvm::Value* index = generateExpression(expr->index);
+    llvm::Value* val = generateExpression(expr->value);
+    if (!index || !val) {
+        return nullptr;
+    }
+    auto* vectorType = llvm::cast<llvm::FixedVectorType>(val->getType());
+    llvm::Value* mask = expr->mask ? generateExpression(expr->mask)
+                                   : llvm::Constant::getAllOnesValue(llvm::FixedVectorType::get(
+                                         builder->getInt1Ty(), vectorType->getNumElements()));
+    if (!mask) {
+        return nullptr;
+    }
+    index = builder->CreateSExt(index, builder->getInt64Ty(), "idx");
+    
+    llvm::Value* value = readLocal(array);
+    if (!expr->inBounds) {
+        generateLaneCheck(array, value, index, mask);
     }
-    return builder->CreateCall(calleeFunc, args, "calltmp");
-}
\ No newline at end of file
+    TypeKind element = array->sourceType.element;
+    llvm::Type* elementType = getLLVMType(element);
+    llvm::Value* ptr = builder->CreateGEP(elementType, arrayData(array, value), index, "elem");
+    llvm::CallInst* store = builder->CreateMaskedStore(
+        val, ptr, module->getDataLayout().getABITypeAlign(elementType), mask);
+    store->setMetadata(llvm::LLVMContext::MD_tbaa, getTBAATag(element));
+    return store;
+}
+
+size_t CodeGen::allocateSites(size_t count) {
+    size_t first = functionSites;
+    functionSites += count;
+    return first;
+}
+
+void CodeGen::countSite(size_t site) {
+    if (profileOutput.empty()) {
+        return;
+    }
+    if (!counters) {
+        counters = llvm::cast<llvm::GlobalVariable>(
+            module->getOrInsertGlobal("__erode_counters", builder->getInt64Ty()));
+    }
+    // Plain load and store; a lost update under threads only makes the
+    // profile a little less exact
+    llvm::Value* counter = builder->CreateConstInBoundsGEP1_64(
+        builder->getInt64Ty(), counters, counterCount + site);
+    llvm::Value* count = builder->CreateLoad(builder->getInt64Ty(), counter);
+    builder->CreateStore(builder->CreateAdd(count, builder->getInt64(1)), counter);
+}
+
+void CodeGen::countBranch(size_t site, llvm::Value* cond) {
+    if (profileOutput.empty()) {
+        return;
+    }
+    countSite(site);
+    // Taken is counted here rather than in the target block, which other
+    // branches of a short-circuit condition may share
+    llvm::Value* counter = builder->CreateConstInBoundsGEP1_64(
+        builder->getInt64Ty(), counters, counterCount + site + 1);
+    llvm::Value* count = builder->CreateLoad(builder->getInt64Ty(), counter);
+    builder->CreateStore(builder->CreateAdd(count, builder->CreateZExt(cond, builder->getInt64Ty())),
+                         counter);
+}
+
+void CodeGen::setBranchWeights(llvm::BranchInst* branch, size_t site) {
+    if (!siteCounts || site + 1 >= siteCounts->size()) {
+        return;
+    }
+    uint64_t evaluated = (*siteCounts)[site];
+    uint64_t taken = std::min((*siteCounts)[site + 1], evaluated);
+    uint64_t notTaken = evaluated - taken;
+    profiledCounts.push_back(evaluated);
+
+    // Weights are 32 bits wide; only their ratio matters
+    uint64_t scale = std::max(taken, notTaken) / UINT32_MAX + 1;
+    branch->setMetadata(llvm::LLVMContext::MD_prof,
+                        llvm::MDBuilder(*context).createBranchWeights(
+                            static_cast<uint32_t>(taken / scale),
+                            static_cast<uint32_t>(notTaken / scale)));
+}
+
+// Instrumenting: sizes the counter array and registers the profile writer
+// to run at exit. With a profile: sets the entry counts and the summary.
+void CodeGen::finishProfiling(Program* program) {
+    if (!profileOutput.empty()) {
+        llvm::Type* int64Ty = builder->getInt64Ty();
+        auto* arrayTy = llvm::ArrayType::get(int64Ty, counterCount);
+        auto* array = llvm::cast<llvm::GlobalVariable>(
+            module->getOrInsertGlobal("__erode_counters.array", arrayTy));
+        array->setInitializer(llvm::ConstantAggregateZero::get(arrayTy));
+        array->setLinkage(llvm::GlobalValue::InternalLinkage);
+        if (counters) {
+            counters->replaceAllUsesWith(array);
+            counters->eraseFromParent();
+        }
+        array->setName("__erode_counters");
+        counters = array;
+
+        llvm::Type* ptrTy = llvm::PointerType::getUnqual(*context);
+        llvm::FunctionCallee fopenFunc =
+            module->getOrInsertFunction("fopen", ptrTy, ptrTy, ptrTy);
+        llvm::FunctionCallee fwriteFunc =
+            module->getOrInsertFunction("fwrite", int64Ty, ptrTy, int64Ty, int64Ty, ptrTy);
+        llvm::FunctionCallee fcloseFunc =
+            module->getOrInsertFunction("fclose", builder->getInt32Ty(), ptrTy);
+
+        auto* writer = llvm::Function::Create(
+            llvm::FunctionType::get(builder->getVoidTy(), false),
+            llvm::Function::ExternalLinkage, kWriteProfile, module.get());
+        llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", writer);
+        llvm::BasicBlock* write = llvm::BasicBlock::Create(*context, "write", writer);
+        llvm::BasicBlock* done = llvm::BasicBlock::Create(*context, "done", writer);
+
+        std::string header = "erode-profile 1 " + std::to_string(counterCount) + "\n" +
+                             counterLayout + "\n";
+        builder->SetInsertPoint(entry);
+        llvm::Value* file = builder->CreateCall(
+            fopenFunc, {builder->CreateGlobalStringPtr(profileOutput),
+                        builder->CreateGlobalStringPtr("wb")});
+        builder->CreateCondBr(builder->CreateIsNotNull(file), write, done);
+        builder->SetInsertPoint(write);
+        builder->CreateCall(fwriteFunc, {builder->CreateGlobalStringPtr(header),
+                                         builder->getInt64(1), builder->getInt64(header.size()),
+                                         file});
+        builder->CreateCall(fwriteFunc, {counters, builder->getInt64(sizeof(uint64_t)),
+                                         builder->getInt64(counterCount), file});
+        builder->CreateCall(fcloseFunc, {file});
+        builder->CreateBr(done);
+        builder->SetInsertPoint(done);
+        builder->CreateRetVoid();
+
+        // Like the output flush, so that a program leaving through exit()
+        // keeps its counts; hosts that call main themselves call it after
+        llvm::appendToGlobalDtors(*module, writer, 65535);
+    }
+
+    if (profile) {
+        uint64_t maxEntryCount = 0;
+        size_t functionCount = 0;
+        for (Item* item : program->items) {
+            auto* funcDef = dynamic_cast<FunctionDef*>(item);
+            llvm::Function* func = funcDef ? module->getFunction(funcDef->name) : nullptr;
+            if (!func || func->isDeclaration()) {
+                continue;
+            }
+            // main is entered once per run, from outside the program
+            uint64_t count = entryCounts[funcDef->name] + (funcDef->name == "main");
+            func->setEntryCount(count);
+            profiledCounts.push_back(count);
+            maxEntryCount = std::max(maxEntryCount, count);
+            ++functionCount;
+        }
+        setProfileSummary(*module, profiledCounts, maxEntryCount, functionCount);
+    }
+}
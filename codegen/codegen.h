@@ -3,6 +3,11 @@
 #include "../ast/function.h"
 #include "../ast/statement.h"
 #include "../ast/expression.h"
+#include "../ast/struct.h"
+#include "profile.h"
+#include "io_runtime.h"
+#include "region_runtime.h"
+#include "string_runtime.h"
 #include <algorithm>
 #include <llvm-18/llvm/IR/Instructions.h>
 #include <llvm/IR/IRBuilder.h>
@@ -12,7 +17,9 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/IR/ValueHandle.h>
 #include <map>
+#include <set>
 #include <string>
 #include <memory>
 
@@ -21,46 +28,324 @@ class CodeGen {
     std::unique_ptr<llvm::IRBuilder<>> builder;
     std::unique_ptr<llvm::Module> module;
 
-    std::vector<std::map<std::string, llvm::AllocaInst*>> namedValues;
+    // A local variable or parameter. Owned values, and every local when
+    // direct SSA construction is off, live in an entry-block alloca. The
+    // rest are SSA values tracked per block (Braun et al., "Simple and
+    // Efficient Construction of Static Single Assignment Form").
+    struct Local {
+        std::string name;
+        Type sourceType;
+        llvm::Type* type;
+        llvm::AllocaInst* alloca = nullptr;
+        // Stack storage of a fixed-size array; the variable holds its address
+        llvm::AllocaInst* storage = nullptr;
+        // Frees its dynamic array or string buffer when dropped, reassigned
+        // or returning
+        bool owned = false;
+        // Number of region blocks around the declaration. Arrays it does not
+        // own live in the arena of the innermost one.
+        size_t region = 0;
+        // Value of the variable at the end of each block that assigns it;
+        // follows phis that are replaced after the fact
+        std::map<llvm::BasicBlock*, llvm::WeakTrackingVH> defs;
+    };
+
+    std::vector<std::map<std::string, Local*>> namedValues;
+    std::vector<std::unique_ptr<Local>> locals;
+
+    // Blocks whose predecessors are all known, and the phis placed in the
+    // other blocks that still wait for operands
+    std::set<llvm::BasicBlock*> sealedBlocks;
+    std::map<llvm::BasicBlock*, std::vector<std::pair<Local*, llvm::PHINode*>>> incompletePhis;
+
+    bool directSSA;
+
+    // Functions and externs of the program by name. generatePartition()
+    // only declares them once a body calls them.
+    std::map<std::string, Item*> declarations;
+
+    // Structs of the program by name. Their LLVM type is built when first
+    // used, with the fields in layout order.
+    struct StructLayout {
+        StructDecl* decl = nullptr;
+        llvm::StructType* type = nullptr;
+        // Member of type holding each field, in declaration order
+        std::vector<unsigned> members;
+    };
+    std::map<std::string, StructLayout> structs;
+
+    // {data, length, capacity}. Capacity 0 marks a view of bytes owned by
+    // something else: a literal, or the string a slice was taken from.
+    // Small strings have the top bit of capacity set, the length in its
+    // low bits and up to kSmallString bytes in place of data and length.
+    // Otherwise data is a heap buffer of capacity + 1 bytes. Every buffer
+    // has a NUL after the last byte.
+    llvm::StructType* stringType = nullptr;
+    // Literals by contents, so equal literals share one constant
+    std::map<std::string, llvm::GlobalVariable*> stringLiterals;
 
     llvm::Function* currentFunction; 
+    // Locals of the current function's parameters, in order
+    std::vector<Local*> parameters;
+    // Start of the current function's body, after the parameters are
+    // stored, when it calls itself as a tail call
+    llvm::BasicBlock* tailRecurse = nullptr;
+
+    // Arena records of the region blocks being generated, innermost last
+    std::vector<llvm::AllocaInst*> arenas;
+    // Where strings and dynamic arrays being created go: one of arenas, or
+    // null for the heap. Values headed out of the regions (returned, moved
+    // into a parameter or into a variable declared further out) use the
+    // heap or the arena of their destination.
+    llvm::Value* arena = nullptr;
+
+    // Profile-guided optimization. Every conditional branch has two
+    // counters (evaluated, taken) and every call one.
+    // Instrumenting writes them to profileOutput at exit; with a
+    // profile, they become branch weights and function entry counts.
+    std::string profileOutput;
+    const Profile* profile = nullptr;
+    // Stands in for the counter array until its size is known
+    llvm::GlobalVariable* counters = nullptr;
+    // Header lines of the profile file, one per instrumented function
+    std::string counterLayout;
+    size_t counterCount = 0;
+    // Sites of the current function so far, and its recorded counts
+    size_t functionSites = 0;
+    const std::vector<uint64_t>* siteCounts = nullptr;
+    // Calls to each function, summed over the profiled call sites
+    std::map<std::string, uint64_t> entryCounts;
+    // Counts behind the branch weights, for the profile summary
+    std::vector<uint64_t> profiledCounts;
+
+    // Array element accesses are tagged by element type; nothing else in a
+    // program can point at them
+    llvm::MDNode* tbaaRoot = nullptr;
+    std::map<TypeKind, llvm::MDNode*> tbaaTags;
 
-    llvm::Type* getLLVMType(TypeKind type);
+    llvm::Type* getLLVMType(const Type& type);
+    const StructLayout& getStructLayout(const std::string& name);
+    // Position of field in the declaration of struct name
+    unsigned fieldIndex(const std::string& name, const std::string& field);
+    llvm::MDNode* getTBAATag(TypeKind element);
+
+    // Lower inferred effects to function attributes
+    void applyEffects(llvm::Function* func, const FunctionEffects& effects);
+    // Parameter attributes plus effects; every fact the analyses proved about
+    // a definition that shows up in its declaration
+    void applyAttributes(llvm::Function* func, FunctionDef* funcDef);
+    // Dynamic arrays are passed as a data pointer and a length
+    std::vector<llvm::Type*> getParamTypes(const std::vector<Param>& params);
 
     llvm::AllocaInst* createEntryBlockAlloca(llvm::Function* func, 
                                              const std::string& varName, 
                                              llvm::Type* type);
 
     // Code generation methods for each AST node type
-    void generateProgram(Program* program);
+    // Declares everything, but only emits the bodies in functions when
+    // given
+    void generateProgram(Program* program, const std::set<std::string>* functions = nullptr);
+    llvm::Function* declareFunction(FunctionDef* func);
     llvm::Function* generateFunction(FunctionDef* func);
     llvm::Function* generateExtern(ExternDecl* ext);
+    // The module's function called name, declaring it first if it is
+    // deferred
+    llvm::Function* lookupFunction(const std::string& name);
+    // The function or extern declared as name, or null for builtins and
+    // unknown names
+    Item* findDeclaration(const std::string& name);
     void generateStatement(Statement* stmt);
     void generateBlock(BlockStmt* block, bool newScope = true);
+    void generateDrops(Statement* stmt);
+    llvm::ConstantInt* getAllocaSize(llvm::AllocaInst* alloca);
     llvm::Value* generateExpression(Expression* expr);
     
     // Specific statement generators
     void generateVarDecl(VarDeclStmt* stmt);
     void generateReturn(ReturnStmt* stmt);
+    // return call, for a ReturnStmt::tailCall
+    void generateTailCall(CallExpr* call);
     void generateIf(IfStmt* stmt);
+    // Branches to trueBlock or falseBlock on cond, lowering && and || to
+    // branches of their own so the right operand only runs when it decides
+    // the outcome. The caller seals both targets. Returns false, without
+    // terminating the current block, if cond could not be generated.
+    bool generateCondition(Expression* cond, llvm::BasicBlock* trueBlock,
+                           llvm::BasicBlock* falseBlock);
+    llvm::Value* toCondition(llvm::Value* value);
     void generateWhile(WhileStmt* stmt);
     void generateFor(ForStmt* stmt);
+    void generateRegion(RegionStmt* stmt);
+    // An LLVM switch, which the backend lowers to a jump table, a binary
+    // search or compares as the labels suggest
+    void generateSwitch(SwitchStmt* stmt);
     
     // Specific expression generators
     llvm::Value* generateBinaryExpr(BinaryExpr* expr);
+    // && and || used as values: a phi over the short-circuit branches
+    llvm::Value* generateLogicalExpr(BinaryExpr* expr);
     llvm::Value* generateUnaryExpr(UnaryExpr* expr);
     llvm::Value* generateCallExpr(CallExpr* expr);
+    // The LLVM arguments of a call, dynamic arrays as data and length.
+    // Strings passed to an extern are converted to C strings; the copies
+    // made and the temporaries read are left for the caller to free.
+    bool generateArguments(CallExpr* expr, std::vector<llvm::Value*>& args,
+                           std::vector<llvm::Value*>& temporaries,
+                           std::vector<llvm::Value*>& copies);
+    // Counts a call of callee for the profile
+    void countCall(const std::string& callee);
     llvm::Value* generateAssignExpr(AssignExpr* expr);
     llvm::Value* generateIdentifier(IdentifierExpr* expr);
+    llvm::Value* loadVariable(const std::string& name);
+
+    // Arrays
+    llvm::Value* generateIndexExpr(IndexExpr* expr);
+    llvm::Value* generateIndexAssignExpr(IndexAssignExpr* expr);
+    llvm::Value* generateArrayAlloc(ArrayAllocExpr* expr);
+    llvm::Value* generateLengthExpr(LengthExpr* expr);
+
+    // Structs
+    llvm::Value* generateStructExpr(StructExpr* expr);
+    llvm::Value* generateFieldExpr(FieldExpr* expr);
+    llvm::Value* generateFieldAssignExpr(FieldAssignExpr* expr);
+    // Address of name[index], checking the bounds unless inBounds
+    llvm::Value* generateElementPointer(Local* array, Expression* index, bool inBounds);
+    // Evaluates index as an i64 and checks it against the length of array
+    // unless inBounds
+    llvm::Value* generateArrayIndex(Local* array, Expression* index, bool inBounds);
+    // Address of field of element index of an array of structs. A soa
+    // struct keeps each field in an array of its own.
+    llvm::Value* fieldPointer(Local* array, llvm::Value* index, unsigned field);
+    // Alignment of the address fieldPointer() returns. A field of a packed
+    // struct may sit at any byte offset, so loads and stores must not
+    // claim the natural alignment of its type.
+    llvm::Align fieldAlignment(const StructLayout& layout, unsigned field);
+    // Whole elements of an array of structs, one field at a time
+    llvm::Value* loadStructElement(Local* array, llvm::Value* index);
+    void storeStructElement(Local* array, llvm::Value* index, llvm::Value* value);
+    // Byte offset of the array of field in a soa array of length elements;
+    // every field array starts on a cache line. The offset past the last
+    // field is the size of the whole allocation.
+    llvm::Value* soaOffset(const StructLayout& layout, size_t field, llvm::Value* length);
+    // Bytes allocated for a dynamic array of length elements, rounded up
+    // to alignment
+    llvm::Value* arrayAllocationSize(const Type& element, llvm::Value* length,
+                                     uint64_t alignment);
+    // value of source, stored into array, a variable declared in a region:
+    // arrays from the heap (call results, variables declared outside any
+    // region) are copied into arena and freed
+    llvm::Value* adoptArray(Local* array, Expression* source, llvm::Value* value);
+    // Stack storage of a fixed-size array
+    llvm::Type* getStorageType(const Type& array);
+    // Alignment the elements of array need beyond their natural one
+    uint64_t structAlignment(const Type& array);
+    llvm::Value* arrayData(Local* array, llvm::Value* value);
+    llvm::Value* arrayLength(Local* array, llvm::Value* value);
+    // Stops the program unless ok holds
+    void generateCheck(llvm::Value* ok);
+    // Frees what an owning local holds and leaves it empty
+    void dropOwned(Local* local);
+    // Drops every owning local in scope, before a return
+    void dropOwnedLocals();
+    // Frees the arenas of every region being left by a return
+    void releaseArenas();
+
+    // Strings
+    llvm::StructType* getStringType();
+    llvm::Value* generateStringLiteral(const std::string& value);
+    llvm::Value* stringLength(llvm::Value* str);
+    // Address of the bytes of str. A small string is spilled to a slot of
+    // its own, which stays valid until the same code runs again.
+    llvm::Value* stringData(llvm::Value* str);
+    // An owned string made of the (data, length) parts, allocated once
+    llvm::Value* buildString(const std::vector<std::pair<llvm::Value*, llvm::Value*>>& parts);
+    llvm::Value* generateConcat(BinaryExpr* expr);
+    llvm::Value* generateStringCompare(BinaryExpr* expr);
+    llvm::Value* generateSlice(SliceExpr* expr);
+    llvm::Value* generateFind(BuiltinExpr* expr);
+    // A string that only lives until its one use consumes it: the result
+    // of a concatenation or a call
+    bool isTemporaryString(Expression* expr);
+    // Evaluates a string that is only read; temporaries are added to
+    // temporaries, for dropString() once they have been read
+    llvm::Value* generateStringOperand(Expression* expr, std::vector<llvm::Value*>& temporaries);
+    // Evaluates expr for a new owner, copying a slice out of its source
+    llvm::Value* generateOwnedValue(Expression* expr);
+    // Frees the buffer of str if it owns one
+    void dropString(llvm::Value* str);
+    // str as a C string for an extern. Strings that are not followed by a
+    // NUL (slices) are copied; the copy, or null, is added to copies for
+    // freeing after the call.
+    llvm::Value* cStringArgument(llvm::Value* str, std::vector<llvm::Value*>& copies);
+    // A view of a C string returned by an extern
+    llvm::Value* stringFromCString(llvm::Value* ptr);
+    // malloc(size), stopping the program when it fails
+    llvm::Value* allocateBuffer(llvm::Value* size);
+
+    // print, println and the input builtins, through the IoRuntime
+    // functions
+    llvm::Value* generateIoBuiltin(BuiltinExpr* expr);
+
+    // Vectors
+    llvm::Value* generateVectorExpr(VectorExpr* expr);
+    llvm::Value* generateShuffleExpr(ShuffleExpr* expr);
+    llvm::Value* generateBuiltinExpr(BuiltinExpr* expr);
+    llvm::Value* generateVectorLoad(VectorLoadExpr* expr);
+    llvm::Value* generateVectorStore(VectorStoreExpr* expr);
+    // Converts a scalar or the lanes of a vector; type is the result type
+    llvm::Value* generateConversion(llvm::Value* value, TypeKind from, TypeKind to, llvm::Type* type);
+    // Lane number for vector[index], checked unless inBounds
+    llvm::Value* generateLaneIndex(Local* vector, Expression* index, bool inBounds);
+    // Stops the program unless every lane of mask that is set selects an
+    // element of the array
+    void generateLaneCheck(Local* array, llvm::Value* value, llvm::Value* index, llvm::Value* mask);
 
     // Scope management
     void pushScope();
     void popScope();
-    llvm::AllocaInst* findVariable(const std::string& name);
+    Local* findVariable(const std::string& name);
+
+    // Locals
+    Local* declareLocal(const std::string& name, const Type& type);
+    llvm::Value* readLocal(Local* local);
+    void writeLocal(Local* local, llvm::Value* value);
+
+    // On-the-fly SSA construction
+    llvm::Value* readVariable(Local* local, llvm::BasicBlock* block);
+    llvm::Value* readVariableRecursive(Local* local, llvm::BasicBlock* block);
+    llvm::Value* addPhiOperands(Local* local, llvm::PHINode* phi);
+    llvm::Value* tryRemoveTrivialPhi(llvm::PHINode* phi);
+    void sealBlock(llvm::BasicBlock* block);
+
+    // Profiling sites
+    size_t allocateSites(size_t count);
+    void countSite(size_t site);
+    void countBranch(size_t site, llvm::Value* cond);
+    void setBranchWeights(llvm::BranchInst* branch, size_t site);
+    void finishProfiling(Program* program);
 
 public:
-    CodeGen();
+    // With directSSA off every local gets a stack slot and is left for
+    // mem2reg to promote
+    CodeGen(bool directSSA = true);
+    // Both apply to generate() only
+    void setInstrumentation(const std::string& path) { profileOutput = path; }
+    void setProfile(const Profile* profile) { this->profile = profile; }
     void generate(Program* program);
+    // Emits only the bodies of functions; everything else in program is
+    // declared, so calls into other partitions link up later
+    void generatePartition(Program* program, const std::set<std::string>& functions);
+    // Incremental counterpart of generate() for a module that was generated
+    // from an earlier version of program. Only the bodies in changed are
+    // re-emitted; functions in redeclared (changed signature) or no longer in
+    // program are replaced, and every caller of those must be in changed.
+    // Attributes are refreshed on all functions.
+    void regenerate(Program* program, const std::set<std::string>& changed,
+                    const std::set<std::string>& redeclared);
     void dump();  // Print the generated IR
     llvm::Module* getModule() { return module.get(); }
+    // Hand the module and its context over, e.g. to the JIT. Nothing can
+    // be generated afterwards.
+    std::unique_ptr<llvm::Module> takeModule() { return std::move(module); }
+    std::unique_ptr<llvm::LLVMContext> takeContext() { return std::move(context); }
 };
\ No newline at end of file
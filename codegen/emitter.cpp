@@ -0,0 +1,161 @@
+// emitter.cpp
+#include "emitter.h"
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Host.h>
+#include <stdexcept>
+
+llvm::CodeGenOptLevel toCodeGenLevel(OptLevel level) {
+    switch (level) {
+        case OptLevel::O0:
+            return llvm::CodeGenOptLevel::None;
+        case OptLevel::O1:
+            return llvm::CodeGenOptLevel::Less;
+        case OptLevel::O3:
+            return llvm::CodeGenOptLevel::Aggressive;
+        default:
+            return llvm::CodeGenOptLevel::Default;
+    }
+}
+
+static const llvm::Target* lookupTarget(const std::string& triple) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    std::string error;
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        throw std::runtime_error(error);
+    }
+    return target;
+}
+
+void resolveCPU(const TargetConfig& config, const std::string& triple,
+                std::string& cpu, std::vector<std::string>& features) {
+    cpu = config.cpu.empty() ? "generic" : config.cpu;
+    if (cpu == "native") {
+        cpu = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+            for (auto& feature : hostFeatures) {
+                features.push_back((feature.second ? "+" : "-") + feature.first().str());
+            }
+        }
+        return;
+    }
+
+    std::unique_ptr<llvm::MCSubtargetInfo> subtarget(
+        lookupTarget(triple)->createMCSubtargetInfo(triple, "", ""));
+    if (!subtarget->isCPUStringValid(cpu)) {
+        throw std::runtime_error("Unknown CPU: " + cpu);
+    }
+}
+
+ResolvedTarget resolveTarget(const TargetConfig& config) {
+    ResolvedTarget resolved;
+    resolved.triple = llvm::sys::getDefaultTargetTriple();
+    resolved.target = lookupTarget(resolved.triple);
+
+    std::vector<std::string> featureList;
+    resolveCPU(config, resolved.triple, resolved.cpu, featureList);
+    for (auto& feature : featureList) {
+        resolved.features += feature + ",";
+    }
+
+    resolved.relocModel =
+        config.relocModel == RelocModel::PIC ? llvm::Reloc::PIC_ : llvm::Reloc::Static;
+    return resolved;
+}
+
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const ResolvedTarget& resolved,
+                                                         OptLevel level) {
+    llvm::TargetMachine* targetMachine = resolved.target->createTargetMachine(
+        resolved.triple, resolved.cpu, resolved.features, llvm::TargetOptions(),
+        resolved.relocModel, std::nullopt, toCodeGenLevel(level));
+    if (!targetMachine) {
+        throw std::runtime_error("Unable to create a target machine for " + resolved.triple);
+    }
+    return std::unique_ptr<llvm::TargetMachine>(targetMachine);
+}
+
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const TargetConfig& config,
+                                                         OptLevel level) {
+    return createTargetMachine(resolveTarget(config), level);
+}
+
+void emitObjectFile(llvm::Module& module, llvm::TargetMachine& targetMachine,
+                    const std::string& path) {
+    std::error_code EC;
+    llvm::raw_fd_ostream dest(path, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+        throw std::runtime_error("Could not open " + path + ": " + EC.message());
+    }
+
+    llvm::legacy::PassManager pass;
+    if (targetMachine.addPassesToEmitFile(pass, dest, nullptr,
+                                          llvm::CodeGenFileType::ObjectFile)) {
+        throw std::runtime_error("The target cannot emit object files");
+    }
+    pass.run(module);
+    dest.flush();
+}
+
+void emitBitcodeFile(llvm::Module& module, const std::string& path) {
+    std::error_code EC;
+    llvm::raw_fd_ostream dest(path, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+        throw std::runtime_error("Could not open " + path + ": " + EC.message());
+    }
+
+    llvm::ProfileSummaryInfo profileSummary(module);
+    llvm::ModuleSummaryIndex index =
+        llvm::buildModuleSummaryIndex(module, nullptr, &profileSummary);
+    llvm::WriteBitcodeToFile(module, dest, false, &index, true);
+}
+
+// Runs cc on objectPaths with extraArgs, writing outputPath
+static void runLinker(const std::vector<std::string>& objectPaths, const std::string& outputPath,
+                      const std::vector<llvm::StringRef>& extraArgs) {
+    auto linker = llvm::sys::findProgramByName("cc");
+    if (!linker) {
+        throw std::runtime_error("No system linker found (cc is not on PATH)");
+    }
+
+    std::vector<llvm::StringRef> args = {*linker};
+    args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+    for (const std::string& objectPath : objectPaths) {
+        args.push_back(objectPath);
+    }
+    args.push_back("-o");
+    args.push_back(outputPath);
+
+    std::string error;
+    int status = llvm::sys::ExecuteAndWait(*linker, args, std::nullopt, {}, 0, 0, &error);
+    if (status != 0) {
+        throw std::runtime_error("Linking " + outputPath + " failed" +
+                                 (error.empty() ? "" : ": " + error));
+    }
+}
+
+void linkExecutable(const std::vector<std::string>& objectPaths, const std::string& outputPath,
+                    RelocModel relocModel) {
+    // Position-dependent code cannot go into the default PIE
+    if (relocModel == RelocModel::Static) {
+        runLinker(objectPaths, outputPath, {"-no-pie"});
+    } else {
+        runLinker(objectPaths, outputPath, {});
+    }
+}
+
+void combineObjects(const std::vector<std::string>& objectPaths, const std::string& outputPath) {
+    runLinker(objectPaths, outputPath, {"-r"});
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "optimizer.h"
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class RelocModel {
+    Static,
+    PIC,
+};
+
+struct TargetConfig {
+    // CPU to generate code for; empty for a generic CPU of the host
+    // architecture, "native" for the host CPU with all of its features
+    std::string cpu;
+    RelocModel relocModel = RelocModel::PIC;
+};
+
+// Backend optimization level that goes with level
+llvm::CodeGenOptLevel toCodeGenLevel(OptLevel level);
+
+// Resolves config.cpu for triple; "native" becomes the host CPU and its
+// feature list. Throws std::runtime_error for an unknown CPU.
+void resolveCPU(const TargetConfig& config, const std::string& triple,
+                std::string& cpu, std::vector<std::string>& features);
+
+// Target, CPU and feature string for the host triple. Resolving them
+// initializes and queries LLVM's global target registry, so it belongs on
+// one thread; the result is read-only and can be shared by workers.
+struct ResolvedTarget {
+    const llvm::Target* target = nullptr;
+    std::string triple;
+    std::string cpu;
+    std::string features;
+    llvm::Reloc::Model relocModel = llvm::Reloc::PIC_;
+};
+
+// Resolves config for the host triple. Throws std::runtime_error.
+ResolvedTarget resolveTarget(const TargetConfig& config);
+
+// TargetMachine for an already resolved target. Does not touch the target
+// registry, so worker threads may call it concurrently.
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const ResolvedTarget& resolved,
+                                                         OptLevel level);
+
+// TargetMachine for the host triple. Modules should take its data layout
+// and triple before they are optimized. Throws std::runtime_error.
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(const TargetConfig& config,
+                                                         OptLevel level);
+
+// Writes module as a native object file straight from memory
+void emitObjectFile(llvm::Module& module, llvm::TargetMachine& targetMachine,
+                    const std::string& path);
+
+// Writes module as bitcode together with its ThinLTO summary, the input
+// linkThinLTO() expects
+void emitBitcodeFile(llvm::Module& module, const std::string& path);
+
+// Links object files into an executable with the system C compiler
+// driver, which knows where libc and the startup files live
+void linkExecutable(const std::vector<std::string>& objectPaths, const std::string& outputPath,
+                    RelocModel relocModel);
+
+// Merges object files into a single relocatable object (cc -r)
+void combineObjects(const std::vector<std::string>& objectPaths, const std::string& outputPath);
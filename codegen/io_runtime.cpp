@@ -0,0 +1,743 @@
+// io_runtime.cpp
+#include "io_runtime.h"
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+const char* const kFlushOutput = "erode.io.flush";
+
+static const uint64_t kOutputSize = 1 << 16;
+static const uint64_t kInputSize = 1 << 16;
+// Room Float needs in the buffer; the longest %g of a double is 13 bytes
+static const uint64_t kFloatWidth = 32;
+
+// Values of the input reader's state
+enum InputState : uint8_t { kNotStarted, kReading, kMapped };
+
+bool isIoRuntime(llvm::StringRef name) {
+    return name.starts_with("erode.io.");
+}
+
+static const char* runtimeName(IoRuntime function) {
+    switch (function) {
+        case IoRuntime::Write:
+            return "erode.io.write";
+        case IoRuntime::Byte:
+            return "erode.io.byte";
+        case IoRuntime::Int:
+            return "erode.io.int";
+        case IoRuntime::Uint:
+            return "erode.io.uint";
+        case IoRuntime::Float:
+            return "erode.io.float";
+        case IoRuntime::Flush:
+            return kFlushOutput;
+        case IoRuntime::ReadInt:
+            return "erode.io.read_int";
+        case IoRuntime::ReadLine:
+            return "erode.io.read_line";
+        case IoRuntime::AtEnd:
+            return "erode.io.at_end";
+    }
+    return "";
+}
+
+// One variable of the runtime's state, zero at startup
+static llvm::GlobalVariable* state(llvm::Module& module, const char* name, llvm::Type* type) {
+    if (llvm::GlobalVariable* global = module.getNamedGlobal(name)) {
+        return global;
+    }
+    auto* global = new llvm::GlobalVariable(module, type, false,
+                                            llvm::GlobalValue::LinkOnceODRLinkage,
+                                            llvm::Constant::getNullValue(type), name);
+    global->setAlignment(llvm::Align(16));
+    return global;
+}
+
+static llvm::GlobalVariable* outputBuffer(llvm::Module& module) {
+    return state(module, "erode.io.out",
+                 llvm::ArrayType::get(llvm::Type::getInt8Ty(module.getContext()), kOutputSize));
+}
+
+static llvm::GlobalVariable* outputUsed(llvm::Module& module) {
+    return state(module, "erode.io.out.used", llvm::Type::getInt64Ty(module.getContext()));
+}
+
+static llvm::GlobalVariable* inputBuffer(llvm::Module& module) {
+    return state(module, "erode.io.in",
+                 llvm::ArrayType::get(llvm::Type::getInt8Ty(module.getContext()), kInputSize));
+}
+
+// The bytes not yet consumed are data[pos..end), a block of the input
+// buffer or the whole mapped file
+static llvm::GlobalVariable* inputData(llvm::Module& module) {
+    return state(module, "erode.io.in.data", llvm::PointerType::getUnqual(module.getContext()));
+}
+
+static llvm::GlobalVariable* inputPos(llvm::Module& module) {
+    return state(module, "erode.io.in.pos", llvm::Type::getInt64Ty(module.getContext()));
+}
+
+static llvm::GlobalVariable* inputEnd(llvm::Module& module) {
+    return state(module, "erode.io.in.end", llvm::Type::getInt64Ty(module.getContext()));
+}
+
+static llvm::GlobalVariable* inputState(llvm::Module& module) {
+    return state(module, "erode.io.in.state", llvm::Type::getInt8Ty(module.getContext()));
+}
+
+static llvm::FunctionCallee libc(llvm::Module& module, const char* name, llvm::Type* result,
+                                 llvm::ArrayRef<llvm::Type*> params, bool varArgs = false) {
+    return module.getOrInsertFunction(name, llvm::FunctionType::get(result, params, varArgs));
+}
+
+// A runtime function, or a helper of one; nullptr when it is already
+// defined
+static llvm::Function* define(llvm::Module& module, const char* name, llvm::Type* result,
+                              llvm::ArrayRef<llvm::Type*> params) {
+    if (module.getFunction(name)) {
+        return nullptr;
+    }
+    auto* type = llvm::FunctionType::get(result, params, false);
+    llvm::Function* func =
+        llvm::Function::Create(type, llvm::GlobalValue::LinkOnceODRLinkage, name, module);
+    func->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    func->setDoesNotThrow();
+    return func;
+}
+
+// drain(data, length): hands the bytes to write(2) until it takes them all
+// or fails
+static llvm::Function* getDrain(llvm::Module& module) {
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(module.getContext());
+    llvm::Type* i64 = builder.getInt64Ty();
+    llvm::Function* func = define(module, "erode.io.drain", builder.getVoidTy(), {ptrType, i64});
+    if (!func) {
+        return module.getFunction("erode.io.drain");
+    }
+    llvm::FunctionCallee writeFunc =
+        libc(module, "write", i64, {builder.getInt32Ty(), ptrType, i64});
+    auto args = func->arg_begin();
+    llvm::Value* data = &*args++;
+    llvm::Value* length = &*args++;
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* head = llvm::BasicBlock::Create(context, "loop", func);
+    auto* body = llvm::BasicBlock::Create(context, "body", func);
+    auto* advance = llvm::BasicBlock::Create(context, "advance", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(head);
+    llvm::PHINode* at = builder.CreatePHI(ptrType, 2, "at");
+    llvm::PHINode* left = builder.CreatePHI(i64, 2, "left");
+    at->addIncoming(data, entry);
+    left->addIncoming(length, entry);
+    builder.CreateCondBr(builder.CreateICmpSGT(left, builder.getInt64(0)), body, done);
+
+    builder.SetInsertPoint(body);
+    llvm::Value* written = builder.CreateCall(writeFunc, {builder.getInt32(1), at, left}, "written");
+    builder.CreateCondBr(builder.CreateICmpSGT(written, builder.getInt64(0)), advance, done);
+
+    builder.SetInsertPoint(advance);
+    at->addIncoming(builder.CreateInBoundsGEP(builder.getInt8Ty(), at, written), advance);
+    left->addIncoming(builder.CreateSub(left, written), advance);
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(done);
+    builder.CreateRetVoid();
+    return func;
+}
+
+static void buildFlush(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* drain = llvm::BasicBlock::Create(context, "drain", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* used = builder.CreateLoad(builder.getInt64Ty(), outputUsed(module), "used");
+    builder.CreateCondBr(builder.CreateIsNull(used), done, drain);
+
+    builder.SetInsertPoint(drain);
+    builder.CreateCall(getDrain(module), {outputBuffer(module), used});
+    builder.CreateStore(builder.getInt64(0), outputUsed(module));
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    builder.CreateRetVoid();
+
+    // Runs at exit in a linked program; a second module's copy finds the
+    // buffer empty
+    llvm::appendToGlobalDtors(module, func, 65535);
+}
+
+static void buildWrite(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    auto args = func->arg_begin();
+    llvm::Value* data = &*args++;
+    llvm::Value* length = &*args++;
+    llvm::Value* buffer = outputBuffer(module);
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* append = llvm::BasicBlock::Create(context, "append", func);
+    auto* full = llvm::BasicBlock::Create(context, "full", func);
+    auto* refill = llvm::BasicBlock::Create(context, "refill", func);
+    auto* direct = llvm::BasicBlock::Create(context, "direct", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* used = builder.CreateLoad(builder.getInt64Ty(), outputUsed(module), "used");
+    llvm::Value* room = builder.CreateSub(builder.getInt64(kOutputSize), used, "room");
+    builder.CreateCondBr(builder.CreateICmpULE(length, room), append, full);
+
+    builder.SetInsertPoint(append);
+    builder.CreateMemCpy(builder.CreateInBoundsGEP(builder.getInt8Ty(), buffer, used),
+                         llvm::MaybeAlign(1), data, llvm::MaybeAlign(1), length);
+    builder.CreateStore(builder.CreateNUWAdd(used, length), outputUsed(module));
+    builder.CreateRetVoid();
+
+    // What does not fit in an empty buffer is written straight away
+    builder.SetInsertPoint(full);
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Flush));
+    builder.CreateCondBr(builder.CreateICmpULT(length, builder.getInt64(kOutputSize)), refill,
+                         direct);
+
+    builder.SetInsertPoint(refill);
+    builder.CreateMemCpy(buffer, llvm::MaybeAlign(16), data, llvm::MaybeAlign(1), length);
+    builder.CreateStore(length, outputUsed(module));
+    builder.CreateRetVoid();
+
+    builder.SetInsertPoint(direct);
+    builder.CreateCall(getDrain(module), {data, length});
+    builder.CreateRetVoid();
+}
+
+// Loads the buffer position to append room bytes at, flushing first if
+// they do not fit
+static llvm::Value* reserve(llvm::IRBuilder<>& builder, llvm::Function* func, uint64_t room) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    auto* flush = llvm::BasicBlock::Create(context, "flush", func);
+    auto* ready = llvm::BasicBlock::Create(context, "ready", func);
+
+    llvm::BasicBlock* before = builder.GetInsertBlock();
+    llvm::Value* used = builder.CreateLoad(builder.getInt64Ty(), outputUsed(module), "used");
+    builder.CreateCondBr(builder.CreateICmpUGT(used, builder.getInt64(kOutputSize - room)), flush,
+                         ready);
+
+    builder.SetInsertPoint(flush);
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Flush));
+    builder.CreateBr(ready);
+
+    builder.SetInsertPoint(ready);
+    llvm::PHINode* at = builder.CreatePHI(builder.getInt64Ty(), 2, "at");
+    at->addIncoming(used, before);
+    at->addIncoming(builder.getInt64(0), flush);
+    return at;
+}
+
+static void buildByte(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::IRBuilder<> builder(module.getContext());
+    builder.SetInsertPoint(llvm::BasicBlock::Create(module.getContext(), "entry", func));
+    llvm::Value* at = reserve(builder, func, 1);
+    builder.CreateStore(&*func->arg_begin(),
+                        builder.CreateInBoundsGEP(builder.getInt8Ty(), outputBuffer(module), at));
+    builder.CreateStore(builder.CreateNUWAdd(at, builder.getInt64(1)), outputUsed(module));
+    builder.CreateRetVoid();
+}
+
+// "00" "01" ... "99": two digits per division by 100
+static llvm::GlobalVariable* digitPairs(llvm::Module& module) {
+    if (llvm::GlobalVariable* global = module.getNamedGlobal("erode.io.digits")) {
+        return global;
+    }
+    std::string pairs;
+    for (int i = 0; i < 100; ++i) {
+        pairs += static_cast<char>('0' + i / 10);
+        pairs += static_cast<char>('0' + i % 10);
+    }
+    llvm::Constant* bytes = llvm::ConstantDataArray::getString(module.getContext(), pairs, false);
+    auto* global = new llvm::GlobalVariable(module, bytes->getType(), true,
+                                            llvm::GlobalValue::PrivateLinkage, bytes,
+                                            "erode.io.digits");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return global;
+}
+
+// Digits are produced from the right into a 20-byte scratch buffer, the
+// length of the largest u64, and appended with one Write
+static void buildUint(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Value* value = &*func->arg_begin();
+    llvm::Type* i8 = builder.getInt8Ty();
+    llvm::Type* i16 = builder.getInt16Ty();
+    llvm::Type* i64 = builder.getInt64Ty();
+    llvm::Value* pairs = digitPairs(module);
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* head = llvm::BasicBlock::Create(context, "pairs", func);
+    auto* body = llvm::BasicBlock::Create(context, "pairs.body", func);
+    auto* last = llvm::BasicBlock::Create(context, "last", func);
+    auto* lastPair = llvm::BasicBlock::Create(context, "last.pair", func);
+    auto* lastDigit = llvm::BasicBlock::Create(context, "last.digit", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* scratch = builder.CreateAlloca(llvm::ArrayType::get(i8, 20), nullptr, "digits");
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(head);
+    llvm::PHINode* rest = builder.CreatePHI(i64, 2, "rest");
+    llvm::PHINode* start = builder.CreatePHI(i64, 2, "start");
+    rest->addIncoming(value, entry);
+    start->addIncoming(builder.getInt64(20), entry);
+    builder.CreateCondBr(builder.CreateICmpUGE(rest, builder.getInt64(100)), body, last);
+
+    auto storePair = [&](llvm::Value* pair, llvm::Value* at) {
+        llvm::Value* digits = builder.CreateAlignedLoad(
+            i16, builder.CreateInBoundsGEP(i8, pairs, builder.CreateShl(pair, 1)), llvm::Align(1));
+        builder.CreateAlignedStore(digits, builder.CreateInBoundsGEP(i8, scratch, at),
+                                   llvm::Align(1));
+    };
+
+    builder.SetInsertPoint(body);
+    llvm::Value* quotient = builder.CreateUDiv(rest, builder.getInt64(100));
+    llvm::Value* pair = builder.CreateSub(rest, builder.CreateMul(quotient, builder.getInt64(100)));
+    llvm::Value* pairStart = builder.CreateSub(start, builder.getInt64(2));
+    storePair(pair, pairStart);
+    rest->addIncoming(quotient, body);
+    start->addIncoming(pairStart, body);
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(last);
+    builder.CreateCondBr(builder.CreateICmpUGE(rest, builder.getInt64(10)), lastPair, lastDigit);
+
+    builder.SetInsertPoint(lastPair);
+    llvm::Value* twoStart = builder.CreateSub(start, builder.getInt64(2));
+    storePair(rest, twoStart);
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(lastDigit);
+    llvm::Value* oneStart = builder.CreateSub(start, builder.getInt64(1));
+    builder.CreateStore(builder.CreateAdd(builder.CreateTrunc(rest, i8), builder.getInt8('0')),
+                        builder.CreateInBoundsGEP(i8, scratch, oneStart));
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    llvm::PHINode* first = builder.CreatePHI(i64, 2, "first");
+    first->addIncoming(twoStart, lastPair);
+    first->addIncoming(oneStart, lastDigit);
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Write),
+                       {builder.CreateInBoundsGEP(i8, scratch, first),
+                        builder.CreateSub(builder.getInt64(20), first)});
+    builder.CreateRetVoid();
+}
+
+static void buildInt(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Value* value = &*func->arg_begin();
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* negative = llvm::BasicBlock::Create(context, "negative", func);
+    auto* positive = llvm::BasicBlock::Create(context, "positive", func);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateCondBr(builder.CreateICmpSLT(value, builder.getInt64(0)), negative, positive);
+
+    // 0 - value as unsigned, which is also right for the smallest i64
+    builder.SetInsertPoint(negative);
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Byte), {builder.getInt8('-')});
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Uint), {builder.CreateNeg(value)});
+    builder.CreateRetVoid();
+
+    builder.SetInsertPoint(positive);
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Uint), {value});
+    builder.CreateRetVoid();
+}
+
+static void buildFloat(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::IRBuilder<> builder(module.getContext());
+    builder.SetInsertPoint(llvm::BasicBlock::Create(module.getContext(), "entry", func));
+    llvm::FunctionCallee snprintfFunc =
+        libc(module, "snprintf", builder.getInt32Ty(),
+             {llvm::PointerType::getUnqual(module.getContext()), builder.getInt64Ty(), llvm::PointerType::getUnqual(module.getContext())}, true);
+    llvm::Value* at = reserve(builder, func, kFloatWidth);
+    llvm::Value* written = builder.CreateCall(
+        snprintfFunc,
+        {builder.CreateInBoundsGEP(builder.getInt8Ty(), outputBuffer(module), at),
+         builder.getInt64(kFloatWidth), builder.CreateGlobalStringPtr("%g", "erode.io.float.format"),
+         &*func->arg_begin()},
+        "written");
+    written = builder.CreateSelect(builder.CreateICmpSLT(written, builder.getInt32(0)),
+                                   builder.getInt32(0), written);
+    builder.CreateStore(builder.CreateNUWAdd(at, builder.CreateZExt(written, builder.getInt64Ty())),
+                        outputUsed(module));
+    builder.CreateRetVoid();
+}
+
+// fill() -> i1: makes data[pos..end) non-empty, false at the end of the
+// input. The first call maps standard input if it is a regular file that
+// lseek can measure; otherwise, and if mmap fails, every call reads the
+// next block, after flushing the output so that prompts appear first.
+static llvm::Function* getFill(llvm::Module& module) {
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(module.getContext());
+    llvm::Type* i32 = builder.getInt32Ty();
+    llvm::Type* i64 = builder.getInt64Ty();
+    llvm::Function* func = define(module, "erode.io.fill", builder.getInt1Ty(), {});
+    if (!func) {
+        return module.getFunction("erode.io.fill");
+    }
+    llvm::FunctionCallee lseekFunc = libc(module, "lseek", i64, {i32, i64, i32});
+    llvm::FunctionCallee mmapFunc =
+        libc(module, "mmap", ptrType, {ptrType, i64, i32, i32, i32, i64});
+    llvm::FunctionCallee readFunc = libc(module, "read", i64, {i32, ptrType, i64});
+    // Equal on Linux and the BSDs
+    const int kSeekSet = 0, kSeekCur = 1, kSeekEnd = 2, kProtRead = 1, kMapPrivate = 2;
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* start = llvm::BasicBlock::Create(context, "start", func);
+    auto* map = llvm::BasicBlock::Create(context, "map", func);
+    auto* mapped = llvm::BasicBlock::Create(context, "mapped", func);
+    auto* rewind = llvm::BasicBlock::Create(context, "rewind", func);
+    auto* next = llvm::BasicBlock::Create(context, "next", func);
+    auto* read = llvm::BasicBlock::Create(context, "read", func);
+    auto* block = llvm::BasicBlock::Create(context, "block", func);
+    auto* end = llvm::BasicBlock::Create(context, "end", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* state = builder.CreateLoad(builder.getInt8Ty(), inputState(module), "state");
+    builder.CreateCondBr(builder.CreateICmpEQ(state, builder.getInt8(kNotStarted)), start, next);
+
+    builder.SetInsertPoint(start);
+    builder.CreateStore(builder.getInt8(kReading), inputState(module));
+    llvm::Value* offset = builder.CreateCall(
+        lseekFunc, {builder.getInt32(0), builder.getInt64(0), builder.getInt32(kSeekCur)}, "offset");
+    llvm::Value* size = builder.CreateCall(
+        lseekFunc, {builder.getInt32(0), builder.getInt64(0), builder.getInt32(kSeekEnd)}, "size");
+    builder.CreateCondBr(builder.CreateAnd(builder.CreateICmpSGE(offset, builder.getInt64(0)),
+                                           builder.CreateICmpSGT(size, offset)),
+                         map, read);
+
+    builder.SetInsertPoint(map);
+    llvm::Value* file = builder.CreateCall(
+        mmapFunc,
+        {llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(module.getContext())), size, builder.getInt32(kProtRead),
+         builder.getInt32(kMapPrivate), builder.getInt32(0), builder.getInt64(0)},
+        "file");
+    llvm::Value* failed = builder.CreateICmpEQ(builder.CreatePtrToInt(file, i64),
+                                               builder.getInt64(-1));
+    builder.CreateCondBr(failed, rewind, mapped);
+
+    builder.SetInsertPoint(mapped);
+    builder.CreateStore(builder.getInt8(kMapped), inputState(module));
+    builder.CreateStore(file, inputData(module));
+    builder.CreateStore(offset, inputPos(module));
+    builder.CreateStore(size, inputEnd(module));
+    builder.CreateRet(builder.getTrue());
+
+    builder.SetInsertPoint(rewind);
+    builder.CreateCall(lseekFunc, {builder.getInt32(0), offset, builder.getInt32(kSeekSet)});
+    builder.CreateBr(read);
+
+    // A mapped file has nothing after its end
+    builder.SetInsertPoint(next);
+    builder.CreateCondBr(builder.CreateICmpEQ(state, builder.getInt8(kMapped)), end, read);
+
+    builder.SetInsertPoint(read);
+    builder.CreateCall(getIoRuntime(module, IoRuntime::Flush));
+    llvm::Value* count = builder.CreateCall(
+        readFunc, {builder.getInt32(0), inputBuffer(module), builder.getInt64(kInputSize)}, "count");
+    builder.CreateCondBr(builder.CreateICmpSGT(count, builder.getInt64(0)), block, end);
+
+    builder.SetInsertPoint(block);
+    builder.CreateStore(inputBuffer(module), inputData(module));
+    builder.CreateStore(builder.getInt64(0), inputPos(module));
+    builder.CreateStore(count, inputEnd(module));
+    builder.CreateRet(builder.getTrue());
+
+    builder.SetInsertPoint(end);
+    builder.CreateRet(builder.getFalse());
+    return func;
+}
+
+// peek() -> i32: the next byte, not consumed, or -1 at the end of the input
+static llvm::Function* getPeek(llvm::Module& module) {
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Function* func = define(module, "erode.io.peek", builder.getInt32Ty(), {});
+    if (!func) {
+        return module.getFunction("erode.io.peek");
+    }
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* refill = llvm::BasicBlock::Create(context, "refill", func);
+    auto* load = llvm::BasicBlock::Create(context, "load", func);
+    auto* end = llvm::BasicBlock::Create(context, "end", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* pos = builder.CreateLoad(builder.getInt64Ty(), inputPos(module), "pos");
+    llvm::Value* limit = builder.CreateLoad(builder.getInt64Ty(), inputEnd(module), "end");
+    builder.CreateCondBr(builder.CreateICmpULT(pos, limit), load, refill);
+
+    builder.SetInsertPoint(refill);
+    builder.CreateCondBr(builder.CreateCall(getFill(module)), load, end);
+
+    builder.SetInsertPoint(load);
+    llvm::Value* data = builder.CreateLoad(llvm::PointerType::getUnqual(module.getContext()), inputData(module), "data");
+    pos = builder.CreateLoad(builder.getInt64Ty(), inputPos(module), "pos");
+    llvm::Value* byte = builder.CreateLoad(
+        builder.getInt8Ty(), builder.CreateInBoundsGEP(builder.getInt8Ty(), data, pos), "byte");
+    builder.CreateRet(builder.CreateZExt(byte, builder.getInt32Ty()));
+
+    builder.SetInsertPoint(end);
+    builder.CreateRet(builder.getInt32(-1));
+    return func;
+}
+
+// Consumes the byte peek() returned
+static void advance(llvm::IRBuilder<>& builder, llvm::Module& module) {
+    llvm::Value* pos = builder.CreateLoad(builder.getInt64Ty(), inputPos(module), "pos");
+    builder.CreateStore(builder.CreateNUWAdd(pos, builder.getInt64(1)), inputPos(module));
+}
+
+static void buildReadInt(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Function* peek = getPeek(module);
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* skip = llvm::BasicBlock::Create(context, "skip", func);
+    auto* space = llvm::BasicBlock::Create(context, "space", func);
+    auto* sign = llvm::BasicBlock::Create(context, "sign", func);
+    auto* minus = llvm::BasicBlock::Create(context, "minus", func);
+    auto* digits = llvm::BasicBlock::Create(context, "digits", func);
+    auto* digit = llvm::BasicBlock::Create(context, "digit", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+    auto* empty = llvm::BasicBlock::Create(context, "empty", func);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateBr(skip);
+
+    builder.SetInsertPoint(skip);
+    llvm::Value* c = builder.CreateCall(peek, {}, "c");
+    llvm::Value* isEnd = builder.CreateICmpSLT(c, builder.getInt32(0));
+    llvm::Value* isSpace = builder.CreateICmpSLE(c, builder.getInt32(' '));
+    auto* notEnd = llvm::BasicBlock::Create(context, "skip.byte", func, space);
+    builder.CreateCondBr(isEnd, empty, notEnd);
+    builder.SetInsertPoint(notEnd);
+    builder.CreateCondBr(isSpace, space, sign);
+
+    builder.SetInsertPoint(space);
+    advance(builder, module);
+    builder.CreateBr(skip);
+
+    builder.SetInsertPoint(sign);
+    llvm::Value* negative = builder.CreateICmpEQ(c, builder.getInt32('-'), "negative");
+    builder.CreateCondBr(negative, minus, digits);
+
+    builder.SetInsertPoint(minus);
+    advance(builder, module);
+    builder.CreateBr(digits);
+
+    builder.SetInsertPoint(digits);
+    llvm::PHINode* value = builder.CreatePHI(builder.getInt64Ty(), 3, "value");
+    value->addIncoming(builder.getInt64(0), sign);
+    value->addIncoming(builder.getInt64(0), minus);
+    llvm::Value* d = builder.CreateSub(builder.CreateCall(peek, {}), builder.getInt32('0'), "d");
+    builder.CreateCondBr(builder.CreateICmpULT(d, builder.getInt32(10)), digit, done);
+
+    builder.SetInsertPoint(digit);
+    advance(builder, module);
+    value->addIncoming(builder.CreateAdd(builder.CreateMul(value, builder.getInt64(10)),
+                                         builder.CreateZExt(d, builder.getInt64Ty())),
+                       digit);
+    builder.CreateBr(digits);
+
+    builder.SetInsertPoint(done);
+    builder.CreateRet(builder.CreateSelect(negative, builder.CreateNeg(value), value));
+
+    builder.SetInsertPoint(empty);
+    builder.CreateRet(builder.getInt64(0));
+}
+
+static void buildAtEnd(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::IRBuilder<> builder(module.getContext());
+    builder.SetInsertPoint(llvm::BasicBlock::Create(module.getContext(), "entry", func));
+    llvm::Value* c = builder.CreateCall(getPeek(module), {}, "c");
+    builder.CreateRet(builder.CreateICmpSLT(c, builder.getInt32(0)));
+}
+
+// Copies what is left of each block up to the newline, found with memchr,
+// into a buffer that doubles as needed
+static void buildReadLine(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(module.getContext());
+    llvm::Type* i8 = builder.getInt8Ty();
+    llvm::Type* i64 = builder.getInt64Ty();
+    llvm::FunctionCallee memchrFunc =
+        libc(module, "memchr", ptrType, {ptrType, builder.getInt32Ty(), i64});
+    llvm::FunctionCallee reallocFunc = libc(module, "realloc", ptrType, {ptrType, i64});
+    llvm::Value* null = llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(module.getContext()));
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* head = llvm::BasicBlock::Create(context, "loop", func);
+    auto* refill = llvm::BasicBlock::Create(context, "refill", func);
+    auto* chunk = llvm::BasicBlock::Create(context, "chunk", func);
+    auto* grow = llvm::BasicBlock::Create(context, "grow", func);
+    auto* outOfMemory = llvm::BasicBlock::Create(context, "oom", func);
+    auto* copy = llvm::BasicBlock::Create(context, "copy", func);
+    auto* finish = llvm::BasicBlock::Create(context, "finish", func);
+    auto* terminate = llvm::BasicBlock::Create(context, "terminate", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(head);
+    llvm::PHINode* buffer = builder.CreatePHI(ptrType, 2, "buffer");
+    llvm::PHINode* length = builder.CreatePHI(i64, 2, "length");
+    llvm::PHINode* capacity = builder.CreatePHI(i64, 2, "capacity");
+    buffer->addIncoming(null, entry);
+    length->addIncoming(builder.getInt64(0), entry);
+    capacity->addIncoming(builder.getInt64(0), entry);
+    llvm::Value* pos = builder.CreateLoad(i64, inputPos(module), "pos");
+    llvm::Value* limit = builder.CreateLoad(i64, inputEnd(module), "end");
+    builder.CreateCondBr(builder.CreateICmpULT(pos, limit), chunk, refill);
+
+    builder.SetInsertPoint(refill);
+    builder.CreateCondBr(builder.CreateCall(getFill(module)), chunk, finish);
+
+    builder.SetInsertPoint(chunk);
+    llvm::Value* data = builder.CreateLoad(ptrType, inputData(module), "data");
+    pos = builder.CreateLoad(i64, inputPos(module), "pos");
+    limit = builder.CreateLoad(i64, inputEnd(module), "end");
+    llvm::Value* start = builder.CreateInBoundsGEP(i8, data, pos, "start");
+    llvm::Value* available = builder.CreateSub(limit, pos, "available");
+    llvm::Value* newline =
+        builder.CreateCall(memchrFunc, {start, builder.getInt32('\n'), available}, "newline");
+    llvm::Value* found = builder.CreateIsNotNull(newline, "found");
+    llvm::Value* take = builder.CreateSelect(
+        found, builder.CreateSub(builder.CreatePtrToInt(newline, i64),
+                                 builder.CreatePtrToInt(start, i64)),
+        available, "take");
+    llvm::Value* needed = builder.CreateNUWAdd(length, take, "needed");
+    builder.CreateCondBr(builder.CreateICmpUGT(needed, capacity), grow, copy);
+
+    builder.SetInsertPoint(grow);
+    llvm::Value* doubled = builder.CreateShl(capacity, 1);
+    llvm::Value* grown = builder.CreateSelect(builder.CreateICmpUGT(needed, doubled), needed,
+                                              doubled, "grown");
+    llvm::Value* moved = builder.CreateCall(
+        reallocFunc, {buffer, builder.CreateNUWAdd(grown, builder.getInt64(1))}, "moved");
+    builder.CreateCondBr(builder.CreateIsNull(moved), outOfMemory, copy);
+
+    builder.SetInsertPoint(outOfMemory);
+    builder.CreateCall(llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::trap));
+    builder.CreateUnreachable();
+
+    builder.SetInsertPoint(copy);
+    llvm::PHINode* target = builder.CreatePHI(ptrType, 2, "target");
+    llvm::PHINode* room = builder.CreatePHI(i64, 2, "room");
+    target->addIncoming(buffer, chunk);
+    target->addIncoming(moved, grow);
+    room->addIncoming(capacity, chunk);
+    room->addIncoming(grown, grow);
+    builder.CreateMemCpy(builder.CreateInBoundsGEP(i8, target, length), llvm::MaybeAlign(1),
+                         start, llvm::MaybeAlign(1), take);
+    llvm::Value* consumed = builder.CreateNUWAdd(take, builder.CreateZExt(found, i64));
+    builder.CreateStore(builder.CreateNUWAdd(pos, consumed), inputPos(module));
+    buffer->addIncoming(target, copy);
+    length->addIncoming(needed, copy);
+    capacity->addIncoming(room, copy);
+    builder.CreateCondBr(found, finish, head);
+
+    builder.SetInsertPoint(finish);
+    llvm::PHINode* line = builder.CreatePHI(ptrType, 2, "line");
+    llvm::PHINode* lineLength = builder.CreatePHI(i64, 2, "line.length");
+    line->addIncoming(buffer, refill);
+    line->addIncoming(target, copy);
+    lineLength->addIncoming(length, refill);
+    lineLength->addIncoming(needed, copy);
+    builder.CreateCondBr(builder.CreateIsNull(line), done, terminate);
+
+    builder.SetInsertPoint(terminate);
+    builder.CreateStore(builder.getInt8(0), builder.CreateInBoundsGEP(i8, line, lineLength));
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    llvm::Value* result = llvm::PoisonValue::get(func->getReturnType());
+    result = builder.CreateInsertValue(result, line, 0);
+    builder.CreateRet(builder.CreateInsertValue(result, lineLength, 1));
+}
+
+llvm::Function* getIoRuntime(llvm::Module& module, IoRuntime function) {
+    if (llvm::Function* func = module.getFunction(runtimeName(function))) {
+        return func;
+    }
+    llvm::LLVMContext& context = module.getContext();
+    llvm::Type* voidType = llvm::Type::getVoidTy(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    llvm::Type* i64 = llvm::Type::getInt64Ty(context);
+    const char* name = runtimeName(function);
+    llvm::Function* func = nullptr;
+    switch (function) {
+        case IoRuntime::Write:
+            func = define(module, name, voidType, {ptrType, i64});
+            func->addParamAttr(0, llvm::Attribute::NoCapture);
+            func->addParamAttr(0, llvm::Attribute::ReadOnly);
+            buildWrite(func);
+            break;
+        case IoRuntime::Byte:
+            func = define(module, name, voidType, {llvm::Type::getInt8Ty(context)});
+            buildByte(func);
+            break;
+        case IoRuntime::Int:
+            func = define(module, name, voidType, {i64});
+            buildInt(func);
+            break;
+        case IoRuntime::Uint:
+            func = define(module, name, voidType, {i64});
+            buildUint(func);
+            break;
+        case IoRuntime::Float:
+            func = define(module, name, voidType, {llvm::Type::getDoubleTy(context)});
+            buildFloat(func);
+            break;
+        case IoRuntime::Flush:
+            func = define(module, name, voidType, {});
+            buildFlush(func);
+            break;
+        case IoRuntime::ReadInt:
+            func = define(module, name, i64, {});
+            buildReadInt(func);
+            break;
+        case IoRuntime::ReadLine:
+            func = define(module, name, llvm::StructType::get(context, {ptrType, i64}), {});
+            buildReadLine(func);
+            break;
+        case IoRuntime::AtEnd:
+            func = define(module, name, llvm::Type::getInt1Ty(context), {});
+            buildAtEnd(func);
+            break;
+    }
+    return func;
+}
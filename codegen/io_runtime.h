@@ -0,0 +1,45 @@
+#pragma once
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+// The functions behind print, println and the input builtins. Like the
+// string runtime they are built in IR into every module that uses them,
+// linkonce_odr, and so is their state: every object of a program shares
+// one 64 KiB output buffer and one input reader.
+//
+// Output goes to file descriptor 1 through write(2) once the buffer is
+// full, when input is read and at exit: modules that print register
+// Flush as a destructor, and the JIT calls it after main returns. Input
+// is mapped with mmap when standard input is a regular file, and read in
+// 64 KiB blocks otherwise.
+enum class IoRuntime {
+    // (data, length): appends bytes
+    Write,
+    // (i8): appends one byte
+    Byte,
+    // (i64): appends a signed or an unsigned integer in decimal, two
+    // digits per step
+    Int,
+    Uint,
+    // (double): appends printf's %g of the value
+    Float,
+    // Writes out the buffer
+    Flush,
+    // () -> i64: skips whitespace and reads an optionally negative
+    // decimal integer; 0 at the end of the input
+    ReadInt,
+    // () -> {ptr, i64}: the bytes up to the next newline, which is
+    // consumed, in a malloc'd buffer followed by a NUL; null when empty
+    ReadLine,
+    // () -> i1: no input left
+    AtEnd,
+};
+
+// Symbol of IoRuntime::Flush, for hosts that run main themselves
+extern const char* const kFlushOutput;
+
+llvm::Function* getIoRuntime(llvm::Module& module, IoRuntime function);
+// A function or global getIoRuntime() defines, rather than one of the
+// program's
+bool isIoRuntime(llvm::StringRef name);
@@ -0,0 +1,125 @@
+// jit.cpp
+#include "jit.h"
+#include "emitter.h"
+#include "io_runtime.h"
+#include "profile.h"
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/TargetSelect.h>
+#include <stdexcept>
+
+template <typename T>
+static T unwrap(llvm::Expected<T> value) {
+    if (!value) {
+        throw std::runtime_error(llvm::toString(value.takeError()));
+    }
+    return std::move(*value);
+}
+
+static void check(llvm::Error error) {
+    if (error) {
+        throw std::runtime_error(llvm::toString(std::move(error)));
+    }
+}
+
+// Module flag addModule() leaves for BackendCompiler
+static const char* kBackendLevelFlag = "erode.backend-level";
+
+// Like ORC's ConcurrentIRCompiler, but a module may ask for its own
+// backend optimization level, so that tiers can share one JIT
+class BackendCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+    llvm::orc::JITTargetMachineBuilder builder;
+
+public:
+    BackendCompiler(llvm::orc::JITTargetMachineBuilder t_builder)
+        : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(t_builder.getOptions())),
+          builder(std::move(t_builder)) {}
+
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module& module) override {
+        llvm::orc::JITTargetMachineBuilder moduleBuilder = builder;
+        if (auto* level = llvm::mdconst::extract_or_null<llvm::ConstantInt>(
+                module.getModuleFlag(kBackendLevelFlag))) {
+            moduleBuilder.setCodeGenOptLevel(
+                toCodeGenLevel(static_cast<OptLevel>(level->getZExtValue())));
+        }
+        auto targetMachine = moduleBuilder.createTargetMachine();
+        if (!targetMachine) {
+            return targetMachine.takeError();
+        }
+        return llvm::orc::SimpleCompiler(**targetMachine)(module);
+    }
+};
+
+JIT::JIT() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    jit = unwrap(llvm::orc::LLJITBuilder()
+                     .setCompileFunctionCreator(
+                         [](llvm::orc::JITTargetMachineBuilder builder)
+                             -> llvm::Expected<
+                                 std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+                             return std::make_unique<BackendCompiler>(std::move(builder));
+                         })
+                     .create());
+    jit->getMainJITDylib().addGenerator(unwrap(
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            getDataLayout().getGlobalPrefix())));
+}
+
+int JIT::runMain(std::unique_ptr<llvm::Module> module,
+                 std::unique_ptr<llvm::LLVMContext> context) {
+    llvm::Function* mainFunc = module->getFunction("main");
+    if (!mainFunc || mainFunc->isDeclaration()) {
+        throw std::runtime_error("No main function to run");
+    }
+    bool returnsInt = mainFunc->getReturnType()->isIntegerTy();
+
+    check(jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context))));
+    auto address = unwrap(jit->lookup("main"));
+
+    int result = 0;
+    if (returnsInt) {
+        result = address.toPtr<int (*)()>()();
+    } else {
+        address.toPtr<void (*)()>()();
+    }
+    flushOutput();
+    callIfDefined(kWriteProfile);
+    return result;
+}
+
+void JIT::flushOutput() {
+    // Not defined when nothing was printed
+    callIfDefined(kFlushOutput);
+}
+
+void JIT::callIfDefined(const char* name) {
+    auto address = jit->lookup(name);
+    if (!address) {
+        llvm::consumeError(address.takeError());
+        return;
+    }
+    address->toPtr<void (*)()>()();
+}
+
+void JIT::addModule(std::unique_ptr<llvm::Module> module,
+                    std::unique_ptr<llvm::LLVMContext> context, OptLevel level) {
+    module->addModuleFlag(llvm::Module::Override, kBackendLevelFlag,
+                          static_cast<uint32_t>(level));
+    check(jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context))));
+}
+
+void* JIT::lookup(const std::string& name) {
+    return unwrap(jit->lookup(name)).toPtr<void*>();
+}
+
+void JIT::defineHostFunction(const std::string& name, void* address) {
+    llvm::orc::SymbolMap symbols;
+    symbols[jit->mangleAndIntern(name)] = llvm::orc::ExecutorSymbolDef(
+        llvm::orc::ExecutorAddr::fromPtr(address),
+        llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+    check(jit->getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols))));
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "optimizer.h"
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <memory>
+#include <string>
+
+// In-process execution through ORC's LLJIT. extern declarations resolve
+// against the symbols of the host process, so libc functions such as
+// putchar work without linking anything.
+class JIT {
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+
+    // Calls the void function name, if some module defines it
+    void callIfDefined(const char* name);
+
+public:
+    // Targets the host; throws std::runtime_error if that is not possible
+    JIT();
+
+    // Modules should be given these before they are optimized
+    const llvm::DataLayout& getDataLayout() const { return jit->getDataLayout(); }
+    const llvm::Triple& getTargetTriple() const { return jit->getTargetTriple(); }
+
+    // Compiles module and calls its main(), then what a linked program
+    // runs at exit (output flush, profile writer); returns main's result,
+    // or 0 for a void main
+    int runMain(std::unique_ptr<llvm::Module> module,
+                std::unique_ptr<llvm::LLVMContext> context);
+    // Writes out what print and println buffered, as a linked program
+    // does at exit; for hosts that call main themselves
+    void flushOutput();
+
+    // Lower-level access for tiered execution. Modules are compiled when
+    // one of their symbols is first looked up, with the backend settings
+    // of level; both calls are safe from any thread.
+    void addModule(std::unique_ptr<llvm::Module> module,
+                   std::unique_ptr<llvm::LLVMContext> context, OptLevel level);
+    // Address of a compiled symbol; throws std::runtime_error if undefined
+    void* lookup(const std::string& name);
+    // Makes a function of the host process callable from JITed code as name
+    void defineHostFunction(const std::string& name, void* address);
+};
@@ -0,0 +1,110 @@
+// lto.cpp
+#include "lto.h"
+#include <llvm/LTO/LTO.h>
+#include <llvm/Support/Caching.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Host.h>
+#include <set>
+#include <stdexcept>
+
+static unsigned toLTOLevel(OptLevel level) {
+    switch (level) {
+        case OptLevel::O0:
+            return 0;
+        case OptLevel::O1:
+        case OptLevel::Quick:
+            return 1;
+        case OptLevel::O3:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+std::vector<std::string> linkThinLTO(const std::vector<std::string>& bitcodePaths,
+                                     const TargetConfig& target, OptLevel level) {
+    llvm::lto::Config config;
+    resolveCPU(target, llvm::sys::getDefaultTargetTriple(), config.CPU, config.MAttrs);
+    config.RelocModel =
+        target.relocModel == RelocModel::PIC ? llvm::Reloc::PIC_ : llvm::Reloc::Static;
+    config.OptLevel = toLTOLevel(level);
+
+    llvm::lto::LTO lto(std::move(config),
+                       llvm::lto::createInProcessThinBackend(
+                           llvm::heavyweight_hardware_concurrency()));
+
+    // The inputs refer into these buffers until the link is done
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+    std::set<std::string> defined;
+    for (const std::string& path : bitcodePaths) {
+        auto buffer = llvm::MemoryBuffer::getFile(path);
+        if (!buffer) {
+            throw std::runtime_error("Could not read " + path + ": " +
+                                     buffer.getError().message());
+        }
+        auto input = llvm::lto::InputFile::create((*buffer)->getMemBufferRef());
+        if (!input) {
+            throw std::runtime_error(path + ": " + llvm::toString(input.takeError()));
+        }
+        buffers.push_back(std::move(*buffer));
+
+        // Every definition prevails, except for the copies of the string
+        // runtime each module carries (the only weak symbols), where the
+        // first one does. Only main is referenced from outside the LTO
+        // unit, so everything else can be internalized once imports are
+        // resolved.
+        std::vector<llvm::lto::SymbolResolution> resolutions;
+        for (const llvm::lto::InputFile::Symbol& symbol : (*input)->symbols()) {
+            llvm::lto::SymbolResolution resolution;
+            if (!symbol.isUndefined()) {
+                bool first = defined.insert(symbol.getName().str()).second;
+                if (!first && !symbol.isWeak()) {
+                    throw std::runtime_error("Duplicate definition of " +
+                                             symbol.getName().str() + " in " + path);
+                }
+                resolution.Prevailing = first;
+                resolution.FinalDefinitionInLinkageUnit = true;
+                resolution.VisibleToRegularObj = symbol.getName() == "main";
+            }
+            resolutions.push_back(resolution);
+        }
+
+        if (llvm::Error error = lto.add(std::move(*input), resolutions)) {
+            throw std::runtime_error(path + ": " + llvm::toString(std::move(error)));
+        }
+    }
+
+    std::vector<std::string> objectPaths(lto.getMaxTasks());
+    auto addStream = [&](unsigned task, const llvm::Twine&)
+        -> llvm::Expected<std::unique_ptr<llvm::CachedFileStream>> {
+        int fd;
+        llvm::SmallString<128> objectPath;
+        if (std::error_code EC =
+                llvm::sys::fs::createTemporaryFile("erode-lto", "o", fd, objectPath)) {
+            return llvm::errorCodeToError(EC);
+        }
+        objectPaths[task] = objectPath.str().str();
+        return std::make_unique<llvm::CachedFileStream>(
+            std::make_unique<llvm::raw_fd_ostream>(fd, true));
+    };
+
+    if (llvm::Error error = lto.run(addStream)) {
+        for (const std::string& objectPath : objectPaths) {
+            if (!objectPath.empty()) {
+                llvm::sys::fs::remove(objectPath);
+            }
+        }
+        throw std::runtime_error(llvm::toString(std::move(error)));
+    }
+
+    std::vector<std::string> objects;
+    for (const std::string& objectPath : objectPaths) {
+        if (!objectPath.empty()) {
+            objects.push_back(objectPath);
+        }
+    }
+    return objects;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "emitter.h"
+#include <string>
+#include <vector>
+
+// Runs ThinLTO over bitcode files written by emitBitcodeFile(). The
+// combined summary index decides which functions each module imports from
+// the others (so small helpers can be inlined across files), then every
+// module is optimized and compiled to an object file on its own thread.
+// Returns the paths of the temporary object files, which the caller links
+// and removes. Throws std::runtime_error.
+std::vector<std::string> linkThinLTO(const std::vector<std::string>& bitcodePaths,
+                                     const TargetConfig& target, OptLevel level);
@@ -0,0 +1,355 @@
+// object_cache.cpp
+#include "object_cache.h"
+#include "../ast/function.h"
+#include "../ast/struct.h"
+#include "../parser/parser_helper.h"
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Host.h>
+#include <array>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+// Bump when codegen changes in a way that alters the objects of an
+// unchanged function
+static const char* kCacheFormat = "erode-object-cache-10";
+
+// The serializers below write every field codegen reads, in an
+// unambiguous form; the key is the hash of the result.
+
+static void writeString(llvm::raw_ostream& os, const std::string& value) {
+    os << value.size() << ':' << value;
+}
+
+static void writeExpression(llvm::raw_ostream& os, Expression* expr,
+                            std::set<std::string>& callees) {
+    if (!expr) {
+        os << '-';
+    } else if (auto* ident = dynamic_cast<IdentifierExpr*>(expr)) {
+        os << "id" << ident->moved;
+        writeString(os, ident->name);
+    } else if (auto* assign = dynamic_cast<AssignExpr*>(expr)) {
+        os << "assign";
+        writeString(os, assign->name);
+        writeExpression(os, assign->value, callees);
+    } else if (auto* borrow = dynamic_cast<BorrowExpr*>(expr)) {
+        os << (borrow->isMutable ? "borrowmut" : "borrow");
+        writeString(os, borrow->name);
+    } else if (auto* intExpr = dynamic_cast<IntExpr*>(expr)) {
+        os << "int" << static_cast<int>(intExpr->type) << ';' << intExpr->value << ';';
+    } else if (auto* floatExpr = dynamic_cast<FloatExpr*>(expr)) {
+        uint64_t bits;
+        std::memcpy(&bits, &floatExpr->value, sizeof(bits));
+        os << "float" << static_cast<int>(floatExpr->type) << ';' << bits << ';';
+    } else if (auto* boolExpr = dynamic_cast<BoolExpr*>(expr)) {
+        os << "bool" << boolExpr->value;
+    } else if (auto* charExpr = dynamic_cast<CharExpr*>(expr)) {
+        os << "char" << static_cast<int>(charExpr->value) << ';';
+    } else if (auto* stringExpr = dynamic_cast<StringExpr*>(expr)) {
+        os << "str";
+        writeString(os, stringExpr->value);
+    } else if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        os << "unary" << static_cast<int>(unary->op) << unary->noSignedWrap;
+        writeExpression(os, unary->operand, callees);
+    } else if (auto* cast = dynamic_cast<CastExpr*>(expr)) {
+        os << "cast" << static_cast<int>(cast->source) << ';' << static_cast<int>(cast->target) << ';';
+        writeExpression(os, cast->operand, callees);
+    } else if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
+        os << "binary" << static_cast<int>(binary->op) << binary->noSignedWrap
+           << binary->noUnsignedWrap << binary->safeDivision << binary->nonNegative
+           << binary->lanewise << binary->isUnsigned << binary->isString;
+        writeExpression(os, binary->left, callees);
+        writeExpression(os, binary->right, callees);
+    } else if (auto* index = dynamic_cast<IndexExpr*>(expr)) {
+        os << "index" << index->inBounds;
+        writeString(os, index->name);
+        writeExpression(os, index->index, callees);
+    } else if (auto* indexAssign = dynamic_cast<IndexAssignExpr*>(expr)) {
+        os << "indexassign" << indexAssign->inBounds;
+        writeString(os, indexAssign->name);
+        writeExpression(os, indexAssign->index, callees);
+        writeExpression(os, indexAssign->value, callees);
+    } else if (auto* alloc = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        os << "alloc";
+        writeString(os, type_to_string(alloc->element));
+        writeExpression(os, alloc->length, callees);
+    } else if (auto* structExpr = dynamic_cast<StructExpr*>(expr)) {
+        os << "struct";
+        writeString(os, structExpr->name);
+        os << structExpr->arguments.size() << ';';
+        for (Expression* arg : structExpr->arguments) {
+            writeExpression(os, arg, callees);
+        }
+    } else if (auto* field = dynamic_cast<FieldExpr*>(expr)) {
+        os << "field" << field->inBounds;
+        writeString(os, field->name);
+        writeString(os, field->field);
+        writeString(os, type_to_string(field->type));
+        writeExpression(os, field->index, callees);
+    } else if (auto* fieldAssign = dynamic_cast<FieldAssignExpr*>(expr)) {
+        os << "fieldassign" << fieldAssign->inBounds;
+        writeString(os, fieldAssign->name);
+        writeString(os, fieldAssign->field);
+        writeString(os, type_to_string(fieldAssign->type));
+        writeExpression(os, fieldAssign->index, callees);
+        writeExpression(os, fieldAssign->value, callees);
+    } else if (auto* slice = dynamic_cast<SliceExpr*>(expr)) {
+        os << "slice";
+        writeString(os, slice->name);
+        writeExpression(os, slice->start, callees);
+        writeExpression(os, slice->end, callees);
+    } else if (auto* length = dynamic_cast<LengthExpr*>(expr)) {
+        os << "len";
+        writeString(os, length->name);
+    } else if (auto* vector = dynamic_cast<VectorExpr*>(expr)) {
+        os << "vec" << static_cast<int>(vector->source) << ';';
+        writeString(os, type_to_string(vector->type));
+        os << vector->elements.size() << ';';
+        for (Expression* element : vector->elements) {
+            writeExpression(os, element, callees);
+        }
+    } else if (auto* shuffle = dynamic_cast<ShuffleExpr*>(expr)) {
+        os << "shuffle" << shuffle->lanes.size() << ';';
+        for (int lane : shuffle->lanes) {
+            os << lane << ',';
+        }
+        writeExpression(os, shuffle->first, callees);
+        writeExpression(os, shuffle->second, callees);
+    } else if (auto* builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        os << "builtin" << static_cast<int>(builtin->builtin) << ';' << builtin->isUnsigned
+           << static_cast<int>(builtin->printed) << ';' << builtin->arguments.size() << ';';
+        for (Expression* arg : builtin->arguments) {
+            writeExpression(os, arg, callees);
+        }
+    } else if (auto* load = dynamic_cast<VectorLoadExpr*>(expr)) {
+        os << "vload" << load->inBounds;
+        writeString(os, load->name);
+        writeExpression(os, load->index, callees);
+        writeExpression(os, load->mask, callees);
+    } else if (auto* store = dynamic_cast<VectorStoreExpr*>(expr)) {
+        os << "vstore" << store->inBounds;
+        writeString(os, store->name);
+        writeExpression(os, store->index, callees);
+        writeExpression(os, store->value, callees);
+        writeExpression(os, store->mask, callees);
+    } else if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        callees.insert(call->callee);
+        os << "call";
+        writeString(os, call->callee);
+        os << call->arguments.size() << ';';
+        for (Expression* arg : call->arguments) {
+            writeExpression(os, arg, callees);
+        }
+    } else {
+        throw std::runtime_error("Object cache: unknown expression");
+    }
+}
+
+static void writeStatement(llvm::raw_ostream& os, Statement* stmt,
+                           std::set<std::string>& callees) {
+    if (!stmt) {
+        os << '-';
+        return;
+    }
+    os << stmt->dropsAfter.size() << ';';
+    for (const std::string& name : stmt->dropsAfter) {
+        writeString(os, name);
+    }
+
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        os << "block" << block->statements.size() << ';';
+        for (Statement* s : block->statements) {
+            writeStatement(os, s, callees);
+        }
+    } else if (auto* exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        os << "expr";
+        writeExpression(os, exprStmt->expr, callees);
+    } else if (auto* varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
+        os << "var";
+        writeString(os, type_to_string(varDecl->kind));
+        os << varDecl->hasDropPoint;
+        writeString(os, varDecl->name);
+        writeExpression(os, varDecl->initializer, callees);
+    } else if (auto* returnStmt = dynamic_cast<ReturnStmt*>(stmt)) {
+        os << "return" << returnStmt->tailCall;
+        writeExpression(os, returnStmt->value, callees);
+    } else if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        os << "if";
+        writeExpression(os, ifStmt->condition, callees);
+        writeStatement(os, ifStmt->thenBlock, callees);
+        writeStatement(os, ifStmt->elseBlock, callees);
+    } else if (auto* whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        os << "while";
+        writeExpression(os, whileStmt->condition, callees);
+        writeStatement(os, whileStmt->body, callees);
+    } else if (auto* forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        os << "for";
+        writeStatement(os, forStmt->init, callees);
+        writeExpression(os, forStmt->condition, callees);
+        writeExpression(os, forStmt->increment, callees);
+        writeStatement(os, forStmt->body, callees);
+    } else if (auto* regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        os << "region";
+        writeStatement(os, regionStmt->body, callees);
+    } else if (auto* switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        os << "switch";
+        writeExpression(os, switchStmt->value, callees);
+        os << switchStmt->cases.size() << ';';
+        for (const SwitchCase& switchCase : switchStmt->cases) {
+            os << switchCase.labels.size() << ';';
+            for (Expression* label : switchCase.labels) {
+                writeExpression(os, label, callees);
+            }
+            writeStatement(os, switchCase.body, callees);
+        }
+        writeStatement(os, switchStmt->defaultBlock, callees);
+    } else {
+        throw std::runtime_error("Object cache: unknown statement");
+    }
+}
+
+// Everything a declaration of name contributes to a caller's code: the
+// prototype and the attributes derived from it
+static void writeSignature(llvm::raw_ostream& os, const std::vector<Param>& params,
+                           const Type& returnType, const FunctionEffects& effects) {
+    os << params.size() << ';';
+    for (const Param& param : params) {
+        writeString(os, type_to_string(param.type));
+        os << ',' << static_cast<int>(param.mode) << ',' << param.noalias << ';';
+    }
+    writeString(os, type_to_string(returnType));
+    os << ';' << effects.noMemory << effects.readOnly
+       << effects.noUnwind << effects.willReturn << effects.noRecurse << effects.speculatable;
+}
+
+static void writeDeclaration(llvm::raw_ostream& os, Item* item) {
+    if (auto* func = dynamic_cast<FunctionDef*>(item)) {
+        os << "def";
+        writeString(os, func->name);
+        writeSignature(os, func->params, func->returnType, func->effects);
+    } else if (auto* ext = dynamic_cast<ExternDecl*>(item)) {
+        os << "extern";
+        writeString(os, ext->name);
+        writeSignature(os, ext->params, ext->returnType, ext->effects);
+    } else {
+        os << "undeclared";
+    }
+}
+
+ObjectCache::ObjectCache(const std::string& t_directory, const TargetConfig& t_target,
+                         OptLevel t_level, bool t_directSSA)
+    : m_directory(t_directory) {
+    if (std::error_code EC = llvm::sys::fs::create_directories(m_directory)) {
+        throw std::runtime_error("Could not create cache directory " + m_directory + ": " +
+                                 EC.message());
+    }
+
+    // Resolve the CPU, so that "native" keys the features of this host
+    std::string triple = llvm::sys::getDefaultTargetTriple();
+    std::string cpu;
+    std::vector<std::string> features;
+    resolveCPU(t_target, triple, cpu, features);
+
+    llvm::raw_string_ostream os(m_configKey);
+    os << kCacheFormat << ';' << LLVM_VERSION_STRING << ';' << triple << ';' << cpu << ';';
+    for (const std::string& feature : features) {
+        os << feature << ',';
+    }
+    os << ';' << static_cast<int>(t_target.relocModel) << ';' << static_cast<int>(t_level)
+       << ';' << t_directSSA << ';';
+}
+
+std::vector<std::string> ObjectCache::keys(Program* t_program) const {
+    // Every function is keyed with the layout of every struct, which is
+    // simpler than tracking the ones it uses and rarely costs a reuse
+    std::map<std::string, Item*> declarations;
+    std::string structs;
+    llvm::raw_string_ostream structOs(structs);
+    for (Item* item : t_program->items) {
+        if (auto* func = dynamic_cast<FunctionDef*>(item)) {
+            declarations[func->name] = func;
+        } else if (auto* ext = dynamic_cast<ExternDecl*>(item)) {
+            declarations[ext->name] = ext;
+        } else if (auto* decl = dynamic_cast<StructDecl*>(item)) {
+            structOs << "struct";
+            writeString(structOs, decl->name);
+            structOs << decl->packed << decl->reorder << decl->soa << decl->align << ';'
+                     << decl->fields.size() << ';';
+            for (const Field& field : decl->fields) {
+                writeString(structOs, type_to_string(field.type));
+                writeString(structOs, field.name);
+            }
+        }
+    }
+    structOs.flush();
+
+    std::vector<std::string> result;
+    for (Item* item : t_program->items) {
+        auto* func = dynamic_cast<FunctionDef*>(item);
+        if (!func) {
+            continue;
+        }
+
+        std::string text = m_configKey + structs;
+        llvm::raw_string_ostream os(text);
+        std::set<std::string> callees;
+        writeDeclaration(os, func);
+        for (const Param& param : func->params) {
+            writeString(os, param.name);
+        }
+        writeStatement(os, func->body, callees);
+        for (const std::string& callee : callees) {
+            auto it = declarations.find(callee);
+            writeDeclaration(os, it == declarations.end() ? nullptr : it->second);
+        }
+        os.flush();
+
+        std::array<uint8_t, 32> digest = llvm::SHA256::hash(
+            llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size()));
+        result.push_back(llvm::toHex(digest, true));
+    }
+    return result;
+}
+
+std::string ObjectCache::lookup(const std::string& t_key) {
+    llvm::SmallString<128> path(m_directory);
+    llvm::sys::path::append(path, t_key + ".o");
+    if (llvm::sys::fs::exists(path)) {
+        ++m_hits;
+        return path.str().str();
+    }
+    ++m_misses;
+    return "";
+}
+
+std::string ObjectCache::temporaryPath(const std::string& t_key) const {
+    llvm::SmallString<128> model(m_directory);
+    llvm::sys::path::append(model, t_key + "-%%%%%%.tmp");
+    int fd;
+    llvm::SmallString<128> path;
+    if (std::error_code EC = llvm::sys::fs::createUniqueFile(model, fd, path)) {
+        throw std::runtime_error("Could not create a file in " + m_directory + ": " +
+                                 EC.message());
+    }
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    return path.str().str();
+}
+
+std::string ObjectCache::store(const std::string& t_key, const std::string& t_objectPath) {
+    llvm::SmallString<128> path(m_directory);
+    llvm::sys::path::append(path, t_key + ".o");
+    // rename() replaces atomically, so concurrent builds sharing the
+    // directory never see a half-written entry
+    if (std::error_code EC = llvm::sys::fs::rename(t_objectPath, path)) {
+        llvm::sys::fs::remove(t_objectPath);
+        throw std::runtime_error("Could not store " + path.str().str() + ": " + EC.message());
+    }
+    return path.str().str();
+}
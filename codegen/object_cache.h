@@ -0,0 +1,39 @@
+#pragma once
+#include "emitter.h"
+#include "../ast/program.h"
+#include <string>
+#include <vector>
+
+// Directory of optimized object files, one per function, named after a
+// hash of everything that decides the function's machine code: its
+// analyzed AST (including the facts the analyzers attached to it), the
+// signatures and effects of its callees, the optimization level and the
+// target. An entry never has to be invalidated; an edit that matters
+// changes the key instead.
+class ObjectCache {
+public:
+    // Creates directory if it does not exist. Throws std::runtime_error.
+    ObjectCache(const std::string& t_directory, const TargetConfig& t_target, OptLevel t_level,
+                bool t_directSSA);
+
+    // Key of every function in program, in source order
+    std::vector<std::string> keys(Program* t_program) const;
+
+    // Path of the cached object for key, or empty if there is none
+    std::string lookup(const std::string& t_key);
+    // Fresh file in the cache directory to emit key's object into
+    std::string temporaryPath(const std::string& t_key) const;
+    // Moves an object written to temporaryPath() into place and returns
+    // its final path
+    std::string store(const std::string& t_key, const std::string& t_objectPath);
+
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+
+private:
+    std::string m_directory;
+    // Compiler version, target and options, shared by every key
+    std::string m_configKey;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+};
@@ -0,0 +1,75 @@
+// optimizer.cpp
+#include "optimizer.h"
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Pass.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
+
+static llvm::OptimizationLevel toLLVM(OptLevel level) {
+    switch (level) {
+        case OptLevel::O1:
+            return llvm::OptimizationLevel::O1;
+        case OptLevel::O2:
+            return llvm::OptimizationLevel::O2;
+        case OptLevel::O3:
+            return llvm::OptimizationLevel::O3;
+        case OptLevel::Os:
+            return llvm::OptimizationLevel::Os;
+        default:
+            return llvm::OptimizationLevel::O0;
+    }
+}
+
+void optimizeModule(llvm::Module& module, OptLevel level, bool timePasses,
+                    llvm::TargetMachine* targetMachine, bool thinLTOPreLink) {
+    if (level == OptLevel::O0) {
+        return;
+    }
+
+    // A process-wide flag; only the caller that asked for timings sets it,
+    // so optimizations running on worker threads never write it
+    if (timePasses) {
+        llvm::TimePassesIsEnabled = true;
+    }
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassInstrumentationCallbacks PIC;
+    llvm::StandardInstrumentations SI(module.getContext(), false);
+    SI.registerCallbacks(PIC, &MAM);
+
+    llvm::PassBuilder PB(targetMachine, llvm::PipelineTuningOptions(), std::nullopt, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM;
+    if (level == OptLevel::Quick) {
+        llvm::FunctionPassManager FPM;
+        FPM.addPass(llvm::PromotePass());
+        FPM.addPass(llvm::InstCombinePass());
+        FPM.addPass(llvm::SimplifyCFGPass());
+        FPM.addPass(llvm::GVNPass());
+        MPM.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(FPM)));
+    } else if (thinLTOPreLink) {
+        MPM = PB.buildThinLTOPreLinkDefaultPipeline(toLLVM(level));
+    } else {
+        MPM = PB.buildPerModuleDefaultPipeline(toLLVM(level));
+    }
+    MPM.run(module, MAM);
+
+    if (timePasses) {
+        SI.getTimePasses().print();
+        llvm::TimePassesIsEnabled = false;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+enum class OptLevel {
+    O0,
+    O1,
+    O2,
+    O3,
+    Os,
+    // mem2reg, instcombine, simplifycfg and GVN on each function; for
+    // builds where compile time matters more than the last bit of speed
+    Quick,
+};
+
+// Runs the optimization pipeline for level over module. O1-O3 and Os are
+// the new pass manager's default pipelines; O0 runs nothing. With
+// timePasses set, the time spent in each pass is reported on stderr; that
+// toggles a process-wide LLVM flag, so only the main thread may set it. A
+// targetMachine lets the passes use the target's cost model. With
+// thinLTOPreLink set, the default pipelines stop short of the work ThinLTO
+// redoes after importing across modules.
+void optimizeModule(llvm::Module& module, OptLevel level, bool timePasses,
+                    llvm::TargetMachine* targetMachine = nullptr,
+                    bool thinLTOPreLink = false);
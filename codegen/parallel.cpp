@@ -0,0 +1,177 @@
+// parallel.cpp
+#include "parallel.h"
+#include "codegen.h"
+#include <llvm/Support/FileSystem.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+// Rough size of a function body, in statements, used to balance partitions
+static size_t statementCount(Statement* stmt) {
+    if (!stmt) {
+        return 0;
+    }
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        size_t count = 0;
+        for (Statement* s : block->statements) {
+            count += statementCount(s);
+        }
+        return count;
+    }
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        return 1 + statementCount(ifStmt->thenBlock) + statementCount(ifStmt->elseBlock);
+    }
+    if (auto* whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        return 1 + statementCount(whileStmt->body);
+    }
+    if (auto* forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        return 1 + statementCount(forStmt->init) + statementCount(forStmt->body);
+    }
+    if (auto* regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        return 1 + statementCount(regionStmt->body);
+    }
+    if (auto* switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        size_t count = 1 + statementCount(switchStmt->defaultBlock);
+        for (const SwitchCase& switchCase : switchStmt->cases) {
+            count += statementCount(switchCase.body);
+        }
+        return count;
+    }
+    return 1;
+}
+
+// Statements per partition. Small enough that a few thousand lines keep
+// every core busy, large enough that the per-module overhead (context,
+// TargetMachine, pass pipeline) stays negligible.
+static const size_t kPartitionBudget = 512;
+
+static std::vector<std::set<std::string>> partitionFunctions(Program* program) {
+    std::vector<std::set<std::string>> partitions;
+    size_t size = kPartitionBudget;
+    for (Item* item : program->items) {
+        auto* func = dynamic_cast<FunctionDef*>(item);
+        if (!func) {
+            continue;
+        }
+        if (size >= kPartitionBudget) {
+            partitions.emplace_back();
+            size = 0;
+        }
+        partitions.back().insert(func->name);
+        size += 1 + statementCount(func->body);
+    }
+    return partitions;
+}
+
+std::vector<std::string> compileParallel(Program* program, const TargetConfig& target,
+                                         OptLevel level, bool directSSA, unsigned jobs,
+                                         ObjectCache* cache) {
+    for (Item* item : program->items) {
+        if (dynamic_cast<Statement*>(item)) {
+            std::cerr << "Warning: Top-level statements not supported\n";
+        }
+    }
+
+    // A cached object has to stand for exactly one function, or editing
+    // any function would invalidate its neighbours as well
+    std::vector<std::set<std::string>> partitions;
+    std::vector<std::string> keys;
+    if (cache) {
+        for (Item* item : program->items) {
+            if (auto* func = dynamic_cast<FunctionDef*>(item)) {
+                partitions.push_back({func->name});
+            }
+        }
+        keys = cache->keys(program);
+    } else {
+        partitions = partitionFunctions(program);
+    }
+
+    std::vector<std::string> objectPaths(partitions.size());
+    std::vector<size_t> pending;
+    for (size_t index = 0; index < partitions.size(); ++index) {
+        if (cache) {
+            objectPaths[index] = cache->lookup(keys[index]);
+        }
+        if (objectPaths[index].empty()) {
+            pending.push_back(index);
+        }
+    }
+    std::vector<std::exception_ptr> errors(partitions.size());
+
+    // Target registration and CPU lookup go through LLVM globals, so they
+    // happen here, once; the workers only build TargetMachines from the result
+    ResolvedTarget resolved;
+    if (!pending.empty()) {
+        resolved = resolveTarget(target);
+    }
+
+    // The AST is only read from here on, so the workers share it. Each
+    // pulls the next partition until none are left.
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        std::unique_ptr<llvm::TargetMachine> targetMachine;
+        for (size_t i = next++; i < pending.size(); i = next++) {
+            size_t index = pending[i];
+            std::string objectPath;
+            try {
+                if (!targetMachine) {
+                    targetMachine = createTargetMachine(resolved, level);
+                }
+                CodeGen codegen(directSSA);
+                codegen.generatePartition(program, partitions[index]);
+                llvm::Module& module = *codegen.getModule();
+                module.setDataLayout(targetMachine->createDataLayout());
+                module.setTargetTriple(targetMachine->getTargetTriple().str());
+                optimizeModule(module, level, false, targetMachine.get());
+
+                if (cache) {
+                    objectPath = cache->temporaryPath(keys[index]);
+                } else {
+                    llvm::SmallString<128> path;
+                    if (llvm::sys::fs::createTemporaryFile("erode-part", "o", path)) {
+                        throw std::runtime_error("Could not create a temporary object file");
+                    }
+                    objectPath = path.str().str();
+                }
+                emitObjectFile(module, *targetMachine, objectPath);
+                objectPaths[index] = cache ? cache->store(keys[index], objectPath) : objectPath;
+            } catch (...) {
+                if (!objectPath.empty()) {
+                    llvm::sys::fs::remove(objectPath);
+                }
+                errors[index] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    unsigned count = std::max(1u, std::min<unsigned>(jobs, pending.size()));
+    for (unsigned i = 1; i < count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // Report the first failure in partition order, so the message does not
+    // depend on scheduling either
+    for (size_t index = 0; index < partitions.size(); ++index) {
+        if (errors[index]) {
+            if (!cache) {
+                for (const std::string& objectPath : objectPaths) {
+                    if (!objectPath.empty()) {
+                        llvm::sys::fs::remove(objectPath);
+                    }
+                }
+            }
+            std::rethrow_exception(errors[index]);
+        }
+    }
+    return objectPaths;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "emitter.h"
+#include "object_cache.h"
+#include "../ast/program.h"
+#include <string>
+#include <vector>
+
+// Compiles program into object files on up to jobs threads. Functions are
+// split in source order into partitions of roughly equal size; each
+// partition gets its own context and module, with declarations for the
+// functions it calls in other partitions, and is generated, optimized and
+// emitted independently. The partitions depend only on program, never on
+// jobs, so the objects are the same for every thread count. Returns the
+// paths of the temporary object files in partition order, which the caller
+// links and removes. Throws std::runtime_error.
+//
+// With a cache, every function is a partition of its own, functions whose
+// key is in the cache are not compiled at all, and the returned paths are
+// the cache entries, which the caller must not remove.
+std::vector<std::string> compileParallel(Program* program, const TargetConfig& target,
+                                         OptLevel level, bool directSSA, unsigned jobs,
+                                         ObjectCache* cache = nullptr);
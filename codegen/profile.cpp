@@ -0,0 +1,113 @@
+// profile.cpp
+#include "profile.h"
+#include <llvm/IR/ProfileSummary.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+const char* const kWriteProfile = "erode.profile.write";
+
+static const char* kProfileMagic = "erode-profile";
+static const int kProfileVersion = 1;
+
+Profile Profile::load(const std::string& t_path) {
+    std::ifstream file(t_path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not read profile " + t_path);
+    }
+    auto malformed = [&]() { return std::runtime_error("Malformed profile " + t_path); };
+
+    std::string line;
+    std::string magic;
+    int version = 0;
+    size_t total = 0;
+    if (!std::getline(file, line) || !(std::istringstream(line) >> magic >> version >> total) ||
+        magic != kProfileMagic) {
+        throw malformed();
+    }
+    if (version != kProfileVersion) {
+        throw std::runtime_error("Profile " + t_path + " has unsupported version " +
+                                 std::to_string(version));
+    }
+
+    struct Entry {
+        std::string name;
+        size_t fingerprint;
+        size_t count;
+    };
+    std::vector<Entry> entries;
+    size_t sum = 0;
+    while (std::getline(file, line) && !line.empty()) {
+        Entry entry;
+        if (!(std::istringstream(line) >> entry.name >> entry.fingerprint >> entry.count)) {
+            throw malformed();
+        }
+        sum += entry.count;
+        entries.push_back(entry);
+    }
+    if (sum != total) {
+        throw malformed();
+    }
+
+    std::vector<uint64_t> counters(total);
+    file.read(reinterpret_cast<char*>(counters.data()), total * sizeof(uint64_t));
+    if (static_cast<size_t>(file.gcount()) != total * sizeof(uint64_t)) {
+        throw malformed();
+    }
+
+    Profile profile;
+    size_t next = 0;
+    for (Entry& entry : entries) {
+        FunctionCounts& counts = profile.m_functions[entry.name];
+        counts.fingerprint = entry.fingerprint;
+        counts.counts.assign(counters.begin() + next, counters.begin() + next + entry.count);
+        next += entry.count;
+    }
+    return profile;
+}
+
+const std::vector<uint64_t>* Profile::find(const std::string& t_name,
+                                           size_t t_fingerprint) const {
+    auto it = m_functions.find(t_name);
+    if (it == m_functions.end() || it->second.fingerprint != t_fingerprint) {
+        return nullptr;
+    }
+    return &it->second.counts;
+}
+
+// The percentiles (per million) LLVM's own profile readers summarize; the
+// hot and cold thresholds are looked up among them
+static const uint32_t kCutoffs[] = {10000,  100000, 200000, 300000, 400000, 500000,
+                                    600000, 700000, 800000, 900000, 950000, 990000,
+                                    999000, 999900, 999990, 999999};
+
+void setProfileSummary(llvm::Module& module, std::vector<uint64_t> counts,
+                       uint64_t maxFunctionCount, size_t numFunctions) {
+    std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+
+    // For each cutoff, the smallest count among the hottest counters that
+    // together make up that share of the total
+    llvm::SummaryEntryVector detailed;
+    size_t index = 0;
+    uint64_t accumulated = 0;
+    for (uint32_t cutoff : kCutoffs) {
+        uint64_t target = total / 1000000 * cutoff + total % 1000000 * cutoff / 1000000;
+        while (index < counts.size() && accumulated < target) {
+            accumulated += counts[index++];
+        }
+        uint64_t minCount = index ? counts[index - 1] : (counts.empty() ? 0 : counts[0]);
+        detailed.push_back({cutoff, minCount, index});
+    }
+
+    uint64_t maxCount = counts.empty() ? 0 : counts.front();
+    llvm::ProfileSummary summary(llvm::ProfileSummary::PSK_Instr, detailed, total, maxCount,
+                                 maxCount, maxFunctionCount, counts.size(), numFunctions);
+    module.setProfileSummary(summary.getMD(module.getContext()), llvm::ProfileSummary::PSK_Instr);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <llvm/IR/Module.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Execution counts written by an --instrument build. The file starts with
+// a text header, one line per function with its name, fingerprint and
+// number of counters, followed by all counters as raw 64-bit integers:
+//
+//   erode-profile 1 <total counters>
+//   <name> <fingerprint> <counters>
+//   ...
+//   <blank line>
+//   <counters>
+//
+// A function's counters follow the order in which codegen reaches its
+// branch and call sites, so they only apply to the same source (the
+// fingerprint tells).
+// Function of an instrumented module that writes its counters out. It
+// runs from llvm.global_dtors in a linked program; a host that calls main
+// itself calls it afterwards.
+extern const char* const kWriteProfile;
+
+class Profile {
+public:
+    // Throws std::runtime_error if path cannot be read or is malformed
+    static Profile load(const std::string& t_path);
+
+    // Counters of function name, or null if the profile has none or they
+    // were recorded for a different version of it
+    const std::vector<uint64_t>* find(const std::string& t_name, size_t t_fingerprint) const;
+
+private:
+    struct FunctionCounts {
+        size_t fingerprint;
+        std::vector<uint64_t> counts;
+    };
+    std::map<std::string, FunctionCounts> m_functions;
+};
+
+// Gives module an instrumentation profile summary built from counts (every
+// block and entry count) so that the optimizer's hot/cold decisions use
+// the profile
+void setProfileSummary(llvm::Module& module, std::vector<uint64_t> counts,
+                       uint64_t maxFunctionCount, size_t numFunctions);
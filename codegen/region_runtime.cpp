@@ -0,0 +1,266 @@
+// region_runtime.cpp
+#include "region_runtime.h"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+
+// Allocations and chunks are aligned to a cache line
+static const uint64_t kAlignment = 64;
+// The header holds the previous chunk and the chunk's size, padded so that
+// the memory after it is aligned too
+static const uint64_t kHeader = kAlignment;
+static const uint64_t kMinChunk = 1 << 16;
+// Chunks stop doubling here; larger allocations get a chunk of their size
+static const uint64_t kMaxChunk = 1 << 26;
+
+// Fields of an arena record
+enum ArenaField : unsigned { kChunks, kCur, kEnd };
+
+static const char* runtimeName(RegionRuntime function) {
+    switch (function) {
+        case RegionRuntime::Alloc:
+            return "erode.region.alloc";
+        case RegionRuntime::Release:
+            return "erode.region.release";
+    }
+    return "";
+}
+
+bool isRegionRuntime(llvm::StringRef name) {
+    return name.starts_with("erode.region.");
+}
+
+llvm::StructType* getArenaType(llvm::LLVMContext& context) {
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    return llvm::StructType::get(context, {ptrType, ptrType, ptrType});
+}
+
+// A runtime function, or a helper of one; nullptr when it is already
+// defined
+static llvm::Function* define(llvm::Module& module, const char* name, llvm::Type* result,
+                              llvm::ArrayRef<llvm::Type*> params) {
+    if (module.getFunction(name)) {
+        return nullptr;
+    }
+    auto* type = llvm::FunctionType::get(result, params, false);
+    llvm::Function* func =
+        llvm::Function::Create(type, llvm::GlobalValue::LinkOnceODRLinkage, name, module);
+    func->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    func->setDoesNotThrow();
+    func->addParamAttr(0, llvm::Attribute::NoCapture);
+    return func;
+}
+
+static llvm::Value* field(llvm::IRBuilder<>& builder, llvm::Value* arena, ArenaField index) {
+    return builder.CreateStructGEP(getArenaType(builder.getContext()), arena, index);
+}
+
+// A chunk a released arena kept for the next one, so that a region entered
+// once per request or loop iteration stops calling malloc; null if none
+static llvm::GlobalVariable* spareChunk(llvm::Module& module) {
+    const char* name = "erode.region.spare";
+    if (llvm::GlobalVariable* global = module.getNamedGlobal(name)) {
+        return global;
+    }
+    auto* ptrType = llvm::PointerType::getUnqual(module.getContext());
+    return new llvm::GlobalVariable(module, ptrType, false, llvm::GlobalValue::LinkOnceODRLinkage,
+                                    llvm::ConstantPointerNull::get(ptrType), name);
+}
+
+static llvm::Value* chunkSizeOf(llvm::IRBuilder<>& builder, llvm::Value* chunk) {
+    return builder.CreateLoad(
+        builder.getInt64Ty(),
+        builder.CreateInBoundsGEP(builder.getInt8Ty(), chunk, builder.getInt64(8)), "chunk.size");
+}
+
+// grow(arena, size) -> ptr: starts a new chunk with room for size bytes,
+// the spare one if it fits, and takes them from it. Kept out of line so
+// that Alloc stays a bump.
+static llvm::Function* getGrow(llvm::Module& module) {
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    llvm::Type* i64 = builder.getInt64Ty();
+    llvm::Function* func = define(module, "erode.region.grow", ptrType, {ptrType, i64});
+    if (!func) {
+        return module.getFunction("erode.region.grow");
+    }
+    func->addFnAttr(llvm::Attribute::NoInline);
+    func->addFnAttr(llvm::Attribute::Cold);
+    llvm::FunctionCallee alignedAlloc =
+        module.getOrInsertFunction("aligned_alloc", ptrType, i64, i64);
+    auto args = func->arg_begin();
+    llvm::Value* arena = &*args++;
+    llvm::Value* size = &*args++;
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* spare = llvm::BasicBlock::Create(context, "spare", func);
+    auto* reuse = llvm::BasicBlock::Create(context, "reuse", func);
+    auto* sizing = llvm::BasicBlock::Create(context, "sizing", func);
+    auto* last = llvm::BasicBlock::Create(context, "last", func);
+    auto* allocate = llvm::BasicBlock::Create(context, "allocate", func);
+    auto* outOfMemory = llvm::BasicBlock::Create(context, "oom", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* chunks = builder.CreateLoad(ptrType, field(builder, arena, kChunks), "chunks");
+    llvm::Value* needed = builder.CreateNUWAdd(size, builder.getInt64(kHeader), "needed");
+    llvm::Value* kept = builder.CreateLoad(ptrType, spareChunk(module), "kept");
+    builder.CreateCondBr(builder.CreateIsNull(kept), sizing, spare);
+
+    builder.SetInsertPoint(spare);
+    llvm::Value* keptSize = chunkSizeOf(builder, kept);
+    builder.CreateCondBr(builder.CreateICmpUGE(keptSize, needed), reuse, sizing);
+
+    builder.SetInsertPoint(reuse);
+    builder.CreateStore(llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(context)),
+                        spareChunk(module));
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(sizing);
+    builder.CreateCondBr(builder.CreateIsNull(chunks), allocate, last);
+
+    builder.SetInsertPoint(last);
+    llvm::Value* lastSize = chunkSizeOf(builder, chunks);
+    builder.CreateBr(allocate);
+
+    builder.SetInsertPoint(allocate);
+    llvm::PHINode* previous = builder.CreatePHI(i64, 2, "previous");
+    previous->addIncoming(builder.getInt64(0), sizing);
+    previous->addIncoming(lastSize, last);
+    llvm::Value* newSize = builder.CreateBinaryIntrinsic(
+        llvm::Intrinsic::umin, builder.CreateShl(previous, 1), builder.getInt64(kMaxChunk));
+    newSize = builder.CreateBinaryIntrinsic(llvm::Intrinsic::umax, newSize,
+                                            builder.getInt64(kMinChunk));
+    newSize = builder.CreateBinaryIntrinsic(llvm::Intrinsic::umax, newSize, needed);
+    llvm::Value* allocated =
+        builder.CreateCall(alignedAlloc, {builder.getInt64(kAlignment), newSize}, "allocated");
+    builder.CreateCondBr(builder.CreateIsNull(allocated), outOfMemory, done);
+
+    builder.SetInsertPoint(outOfMemory);
+    builder.CreateCall(llvm::Intrinsic::getDeclaration(&module, llvm::Intrinsic::trap));
+    builder.CreateUnreachable();
+
+    builder.SetInsertPoint(done);
+    llvm::PHINode* chunk = builder.CreatePHI(ptrType, 2, "chunk");
+    chunk->addIncoming(kept, reuse);
+    chunk->addIncoming(allocated, allocate);
+    llvm::PHINode* chunkSize = builder.CreatePHI(i64, 2, "chunk.size");
+    chunkSize->addIncoming(keptSize, reuse);
+    chunkSize->addIncoming(newSize, allocate);
+    builder.CreateStore(chunks, chunk);
+    builder.CreateStore(chunkSize,
+                        builder.CreateInBoundsGEP(builder.getInt8Ty(), chunk, builder.getInt64(8)));
+    builder.CreateStore(chunk, field(builder, arena, kChunks));
+    llvm::Value* data =
+        builder.CreateInBoundsGEP(builder.getInt8Ty(), chunk, builder.getInt64(kHeader), "data");
+    builder.CreateStore(builder.CreateInBoundsGEP(builder.getInt8Ty(), data, size),
+                        field(builder, arena, kCur));
+    builder.CreateStore(builder.CreateInBoundsGEP(builder.getInt8Ty(), chunk, chunkSize),
+                        field(builder, arena, kEnd));
+    builder.CreateRet(data);
+    return func;
+}
+
+static void buildAlloc(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    llvm::Type* i64 = builder.getInt64Ty();
+    auto args = func->arg_begin();
+    llvm::Value* arena = &*args++;
+    llvm::Value* size = &*args++;
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* bump = llvm::BasicBlock::Create(context, "bump", func);
+    auto* grow = llvm::BasicBlock::Create(context, "grow", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* rounded = builder.CreateAnd(
+        builder.CreateNUWAdd(size, builder.getInt64(kAlignment - 1)),
+        builder.getInt64(~(kAlignment - 1)), "rounded");
+    llvm::Value* cur = builder.CreateLoad(ptrType, field(builder, arena, kCur), "cur");
+    llvm::Value* end = builder.CreateLoad(ptrType, field(builder, arena, kEnd), "end");
+    llvm::Value* room = builder.CreateSub(builder.CreatePtrToInt(end, i64),
+                                          builder.CreatePtrToInt(cur, i64), "room");
+    builder.CreateCondBr(builder.CreateICmpULE(rounded, room), bump, grow,
+                         llvm::MDBuilder(context).createBranchWeights(2000, 1));
+
+    builder.SetInsertPoint(bump);
+    builder.CreateStore(builder.CreateInBoundsGEP(builder.getInt8Ty(), cur, rounded),
+                        field(builder, arena, kCur));
+    builder.CreateRet(cur);
+
+    builder.SetInsertPoint(grow);
+    builder.CreateRet(builder.CreateCall(getGrow(module), {arena, rounded}));
+}
+
+static void buildRelease(llvm::Function* func) {
+    llvm::Module& module = *func->getParent();
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    llvm::FunctionCallee freeFunc =
+        module.getOrInsertFunction("free", builder.getVoidTy(), ptrType);
+    llvm::Value* arena = &*func->arg_begin();
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* head = llvm::BasicBlock::Create(context, "loop", func);
+    auto* body = llvm::BasicBlock::Create(context, "body", func);
+    auto* keep = llvm::BasicBlock::Create(context, "keep", func);
+    auto* drop = llvm::BasicBlock::Create(context, "drop", func);
+    auto* done = llvm::BasicBlock::Create(context, "done", func);
+
+    // The newest chunk, the largest, becomes the spare one if there is none
+    builder.SetInsertPoint(entry);
+    llvm::Value* first = builder.CreateLoad(ptrType, field(builder, arena, kChunks), "chunks");
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(head);
+    llvm::PHINode* chunk = builder.CreatePHI(ptrType, 3, "chunk");
+    chunk->addIncoming(first, entry);
+    builder.CreateCondBr(builder.CreateIsNull(chunk), done, body);
+
+    builder.SetInsertPoint(body);
+    llvm::Value* next = builder.CreateLoad(ptrType, chunk, "next");
+    llvm::Value* kept = builder.CreateLoad(ptrType, spareChunk(module), "kept");
+    builder.CreateCondBr(builder.CreateIsNull(kept), keep, drop);
+
+    builder.SetInsertPoint(keep);
+    builder.CreateStore(chunk, spareChunk(module));
+    chunk->addIncoming(next, keep);
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(drop);
+    builder.CreateCall(freeFunc, {chunk});
+    chunk->addIncoming(next, drop);
+    builder.CreateBr(head);
+
+    builder.SetInsertPoint(done);
+    builder.CreateStore(llvm::Constant::getNullValue(getArenaType(context)), arena);
+    builder.CreateRetVoid();
+}
+
+llvm::Function* getRegionRuntime(llvm::Module& module, RegionRuntime function) {
+    if (llvm::Function* func = module.getFunction(runtimeName(function))) {
+        return func;
+    }
+    llvm::LLVMContext& context = module.getContext();
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    const char* name = runtimeName(function);
+    llvm::Function* func = nullptr;
+    switch (function) {
+        case RegionRuntime::Alloc:
+            func = define(module, name, ptrType, {ptrType, llvm::Type::getInt64Ty(context)});
+            func->addRetAttr(llvm::Attribute::NoAlias);
+            func->addRetAttr(llvm::Attribute::getWithAlignment(context, llvm::Align(kAlignment)));
+            buildAlloc(func);
+            break;
+        case RegionRuntime::Release:
+            func = define(module, name, llvm::Type::getVoidTy(context), {ptrType});
+            buildRelease(func);
+            break;
+    }
+    return func;
+}
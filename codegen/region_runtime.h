@@ -0,0 +1,29 @@
+#pragma once
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+// The arenas behind region blocks. Like the string runtime, the functions
+// are built in IR into every module that uses them, linkonce_odr.
+//
+// An arena is a record {chunks, cur, end} in the frame of the function
+// that runs the region, all null on entry. Memory is bumped out of the
+// newest chunk in multiples of 64 bytes, so every allocation starts on a
+// cache line. A chunk is a malloc'd block with its size and the previous
+// chunk in a 64-byte header; each new one is at least twice the size of
+// the last. Releasing keeps one chunk for the next arena to start from, so
+// a region entered over and over stops calling malloc at all.
+enum class RegionRuntime {
+    // (arena, size) -> ptr: size bytes, not zeroed. Stops the program when
+    // memory runs out.
+    Alloc,
+    // (arena): frees every chunk but the spare one and empties the arena
+    Release,
+};
+
+// The type of an arena record
+llvm::StructType* getArenaType(llvm::LLVMContext& context);
+llvm::Function* getRegionRuntime(llvm::Module& module, RegionRuntime function);
+// A function getRegionRuntime() defines, rather than one of the program's
+bool isRegionRuntime(llvm::StringRef name);
@@ -0,0 +1,319 @@
+// string_runtime.cpp
+#include "string_runtime.h"
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+
+// Bytes compared per vector step; one SSE2 or NEON register
+static const unsigned kChunk = 16;
+
+static const char* runtimeName(StringRuntime function) {
+    switch (function) {
+        case StringRuntime::Equal:
+            return "erode.str.equal";
+        case StringRuntime::Compare:
+            return "erode.str.compare";
+        case StringRuntime::Find:
+            return "erode.str.find";
+    }
+    return "";
+}
+
+bool isStringRuntime(llvm::StringRef name) {
+    return name.starts_with("erode.str.");
+}
+
+static llvm::Function* declareRuntime(llvm::Module& module, StringRuntime function) {
+    llvm::LLVMContext& context = module.getContext();
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    llvm::Type* i64 = llvm::Type::getInt64Ty(context);
+    llvm::Type* result = function == StringRuntime::Equal     ? llvm::Type::getInt1Ty(context)
+                         : function == StringRuntime::Compare ? llvm::Type::getInt32Ty(context)
+                                                              : i64;
+    auto* type = llvm::FunctionType::get(result, {ptrType, i64, ptrType, i64}, false);
+    llvm::Function* func = llvm::Function::Create(type, llvm::GlobalValue::LinkOnceODRLinkage,
+                                                  runtimeName(function), module);
+    func->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    func->setDoesNotThrow();
+    func->setOnlyReadsMemory();
+    func->setOnlyAccessesArgMemory();
+    func->setDoesNotFreeMemory();
+    func->addFnAttr(llvm::Attribute::WillReturn);
+    func->addFnAttr(llvm::Attribute::NoSync);
+    for (unsigned i : {0u, 2u}) {
+        func->addParamAttr(i, llvm::Attribute::NoCapture);
+        func->addParamAttr(i, llvm::Attribute::ReadOnly);
+    }
+    return func;
+}
+
+// The 16 bytes at address, unaligned
+static llvm::Value* loadChunk(llvm::IRBuilder<>& builder, llvm::Value* address) {
+    auto* chunkType = llvm::FixedVectorType::get(builder.getInt8Ty(), kChunk);
+    return builder.CreateAlignedLoad(chunkType, address, llvm::Align(1));
+}
+
+// One bit per lane of a <16 x i1>
+static llvm::Value* toMask(llvm::IRBuilder<>& builder, llvm::Value* lanes) {
+    return builder.CreateBitCast(lanes, builder.getInt16Ty());
+}
+
+static llvm::Value* lowestSetBit(llvm::IRBuilder<>& builder, llvm::Value* mask) {
+    llvm::Value* bit = builder.CreateBinaryIntrinsic(llvm::Intrinsic::cttz, mask,
+                                                     builder.getTrue());
+    return builder.CreateZExt(bit, builder.getInt64Ty());
+}
+
+static llvm::Value* byteAt(llvm::IRBuilder<>& builder, llvm::Value* base, llvm::Value* index) {
+    return builder.CreateLoad(builder.getInt8Ty(),
+                              builder.CreateInBoundsGEP(builder.getInt8Ty(), base, index));
+}
+
+static void buildEqual(llvm::Function* func) {
+    llvm::LLVMContext& context = func->getContext();
+    llvm::IRBuilder<> builder(context);
+    auto args = func->arg_begin();
+    llvm::Value* a = &*args++;
+    llvm::Value* lengthA = &*args++;
+    llvm::Value* b = &*args++;
+    llvm::Value* lengthB = &*args++;
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* chunkHead = llvm::BasicBlock::Create(context, "chunk", func);
+    auto* chunkBody = llvm::BasicBlock::Create(context, "chunk.body", func);
+    auto* tailHead = llvm::BasicBlock::Create(context, "tail", func);
+    auto* tailBody = llvm::BasicBlock::Create(context, "tail.body", func);
+    auto* same = llvm::BasicBlock::Create(context, "same", func);
+    auto* different = llvm::BasicBlock::Create(context, "different", func);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateCondBr(builder.CreateICmpEQ(lengthA, lengthB), chunkHead, different);
+
+    builder.SetInsertPoint(chunkHead);
+    llvm::PHINode* i = builder.CreatePHI(i64, 2, "i");
+    i->addIncoming(builder.getInt64(0), entry);
+    llvm::Value* next = builder.CreateNUWAdd(i, builder.getInt64(kChunk));
+    builder.CreateCondBr(builder.CreateICmpULE(next, lengthA), chunkBody, tailHead);
+
+    builder.SetInsertPoint(chunkBody);
+    llvm::Value* differs = builder.CreateICmpNE(
+        loadChunk(builder, builder.CreateInBoundsGEP(builder.getInt8Ty(), a, i)),
+        loadChunk(builder, builder.CreateInBoundsGEP(builder.getInt8Ty(), b, i)));
+    builder.CreateCondBr(builder.CreateIsNull(toMask(builder, differs)), chunkHead, different);
+    i->addIncoming(next, chunkBody);
+
+    builder.SetInsertPoint(tailHead);
+    llvm::PHINode* j = builder.CreatePHI(i64, 2, "j");
+    j->addIncoming(i, chunkHead);
+    builder.CreateCondBr(builder.CreateICmpULT(j, lengthA), tailBody, same);
+
+    builder.SetInsertPoint(tailBody);
+    llvm::Value* equal = builder.CreateICmpEQ(byteAt(builder, a, j), byteAt(builder, b, j));
+    j->addIncoming(builder.CreateNUWAdd(j, builder.getInt64(1)), tailBody);
+    builder.CreateCondBr(equal, tailHead, different);
+
+    builder.SetInsertPoint(same);
+    builder.CreateRet(builder.getTrue());
+    builder.SetInsertPoint(different);
+    builder.CreateRet(builder.getFalse());
+}
+
+static void buildCompare(llvm::Function* func) {
+    llvm::LLVMContext& context = func->getContext();
+    llvm::IRBuilder<> builder(context);
+    auto args = func->arg_begin();
+    llvm::Value* a = &*args++;
+    llvm::Value* lengthA = &*args++;
+    llvm::Value* b = &*args++;
+    llvm::Value* lengthB = &*args++;
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* chunkHead = llvm::BasicBlock::Create(context, "chunk", func);
+    auto* chunkBody = llvm::BasicBlock::Create(context, "chunk.body", func);
+    auto* chunkFound = llvm::BasicBlock::Create(context, "chunk.found", func);
+    auto* tailHead = llvm::BasicBlock::Create(context, "tail", func);
+    auto* tailBody = llvm::BasicBlock::Create(context, "tail.body", func);
+    auto* mismatch = llvm::BasicBlock::Create(context, "mismatch", func);
+    auto* lengths = llvm::BasicBlock::Create(context, "lengths", func);
+
+    builder.SetInsertPoint(entry);
+    llvm::Value* common = builder.CreateSelect(builder.CreateICmpULT(lengthA, lengthB), lengthA,
+                                               lengthB, "common");
+    builder.CreateBr(chunkHead);
+
+    builder.SetInsertPoint(chunkHead);
+    llvm::PHINode* i = builder.CreatePHI(i64, 2, "i");
+    i->addIncoming(builder.getInt64(0), entry);
+    llvm::Value* next = builder.CreateNUWAdd(i, builder.getInt64(kChunk));
+    builder.CreateCondBr(builder.CreateICmpULE(next, common), chunkBody, tailHead);
+
+    builder.SetInsertPoint(chunkBody);
+    llvm::Value* differs = toMask(builder, builder.CreateICmpNE(
+        loadChunk(builder, builder.CreateInBoundsGEP(builder.getInt8Ty(), a, i)),
+        loadChunk(builder, builder.CreateInBoundsGEP(builder.getInt8Ty(), b, i))));
+    builder.CreateCondBr(builder.CreateIsNull(differs), chunkHead, chunkFound);
+    i->addIncoming(next, chunkBody);
+
+    builder.SetInsertPoint(chunkFound);
+    llvm::Value* position = builder.CreateNUWAdd(i, lowestSetBit(builder, differs));
+    builder.CreateBr(mismatch);
+
+    builder.SetInsertPoint(tailHead);
+    llvm::PHINode* j = builder.CreatePHI(i64, 2, "j");
+    j->addIncoming(i, chunkHead);
+    builder.CreateCondBr(builder.CreateICmpULT(j, common), tailBody, lengths);
+
+    builder.SetInsertPoint(tailBody);
+    llvm::Value* equal = builder.CreateICmpEQ(byteAt(builder, a, j), byteAt(builder, b, j));
+    j->addIncoming(builder.CreateNUWAdd(j, builder.getInt64(1)), tailBody);
+    builder.CreateCondBr(equal, tailHead, mismatch);
+
+    builder.SetInsertPoint(mismatch);
+    llvm::PHINode* at = builder.CreatePHI(i64, 2, "at");
+    at->addIncoming(position, chunkFound);
+    at->addIncoming(j, tailBody);
+    llvm::Value* byteA = builder.CreateZExt(byteAt(builder, a, at), builder.getInt32Ty());
+    llvm::Value* byteB = builder.CreateZExt(byteAt(builder, b, at), builder.getInt32Ty());
+    builder.CreateRet(builder.CreateNSWSub(byteA, byteB));
+
+    builder.SetInsertPoint(lengths);
+    llvm::Value* order = builder.CreateSelect(builder.CreateICmpUGT(lengthA, lengthB),
+                                              builder.getInt32(1), builder.getInt32(0));
+    builder.CreateRet(builder.CreateSelect(builder.CreateICmpULT(lengthA, lengthB),
+                                           builder.getInt32(-1), order));
+}
+
+static void buildFind(llvm::Function* func, llvm::Function* equalFunc) {
+    llvm::LLVMContext& context = func->getContext();
+    llvm::IRBuilder<> builder(context);
+    auto args = func->arg_begin();
+    llvm::Value* haystack = &*args++;
+    llvm::Value* haystackLength = &*args++;
+    llvm::Value* needle = &*args++;
+    llvm::Value* needleLength = &*args++;
+    llvm::Type* i8 = builder.getInt8Ty();
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    auto* entry = llvm::BasicBlock::Create(context, "entry", func);
+    auto* fits = llvm::BasicBlock::Create(context, "fits", func);
+    auto* setup = llvm::BasicBlock::Create(context, "setup", func);
+    auto* chunkHead = llvm::BasicBlock::Create(context, "chunk", func);
+    auto* chunkBody = llvm::BasicBlock::Create(context, "chunk.body", func);
+    auto* candidates = llvm::BasicBlock::Create(context, "candidates", func);
+    auto* candidate = llvm::BasicBlock::Create(context, "candidate", func);
+    auto* nextCandidate = llvm::BasicBlock::Create(context, "candidate.next", func);
+    auto* nextChunk = llvm::BasicBlock::Create(context, "chunk.next", func);
+    auto* tailHead = llvm::BasicBlock::Create(context, "tail", func);
+    auto* tailBody = llvm::BasicBlock::Create(context, "tail.body", func);
+    auto* tailCandidate = llvm::BasicBlock::Create(context, "tail.candidate", func);
+    auto* tailNext = llvm::BasicBlock::Create(context, "tail.next", func);
+    auto* found = llvm::BasicBlock::Create(context, "found", func);
+    auto* atStart = llvm::BasicBlock::Create(context, "empty", func);
+    auto* missing = llvm::BasicBlock::Create(context, "missing", func);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateCondBr(builder.CreateIsNull(needleLength), atStart, fits);
+
+    builder.SetInsertPoint(fits);
+    builder.CreateCondBr(builder.CreateICmpUGT(needleLength, haystackLength), missing, setup);
+
+    // Every position up to last leaves room for the needle
+    builder.SetInsertPoint(setup);
+    llvm::Value* last = builder.CreateNUWSub(haystackLength, needleLength, "last");
+    llvm::Value* lastOffset = builder.CreateNUWSub(needleLength, builder.getInt64(1));
+    llvm::Value* firstByte = builder.CreateLoad(i8, needle, "first");
+    llvm::Value* lastByte = byteAt(builder, needle, lastOffset);
+    llvm::Value* firstSplat = builder.CreateVectorSplat(kChunk, firstByte);
+    llvm::Value* lastSplat = builder.CreateVectorSplat(kChunk, lastByte);
+    builder.CreateBr(chunkHead);
+
+    // 16 candidate positions at a time; the chunk of last bytes must end
+    // inside the haystack
+    builder.SetInsertPoint(chunkHead);
+    llvm::PHINode* i = builder.CreatePHI(i64, 2, "i");
+    i->addIncoming(builder.getInt64(0), setup);
+    llvm::Value* next = builder.CreateNUWAdd(i, builder.getInt64(kChunk));
+    llvm::Value* chunkEnd = builder.CreateNUWAdd(i, builder.getInt64(kChunk - 1));
+    builder.CreateCondBr(builder.CreateICmpULE(chunkEnd, last), chunkBody, tailHead);
+
+    builder.SetInsertPoint(chunkBody);
+    llvm::Value* starts = builder.CreateInBoundsGEP(i8, haystack, i);
+    llvm::Value* ends = builder.CreateInBoundsGEP(i8, starts, lastOffset);
+    llvm::Value* matches = builder.CreateAnd(
+        builder.CreateICmpEQ(loadChunk(builder, starts), firstSplat),
+        builder.CreateICmpEQ(loadChunk(builder, ends), lastSplat));
+    llvm::Value* initialMask = toMask(builder, matches);
+    builder.CreateBr(candidates);
+
+    builder.SetInsertPoint(candidates);
+    llvm::PHINode* mask = builder.CreatePHI(builder.getInt16Ty(), 2, "mask");
+    mask->addIncoming(initialMask, chunkBody);
+    builder.CreateCondBr(builder.CreateIsNull(mask), nextChunk, candidate);
+
+    builder.SetInsertPoint(candidate);
+    llvm::Value* position = builder.CreateNUWAdd(i, lowestSetBit(builder, mask));
+    llvm::Value* match = builder.CreateCall(
+        equalFunc, {builder.CreateInBoundsGEP(i8, haystack, position), needleLength, needle,
+                    needleLength});
+    builder.CreateCondBr(match, found, nextCandidate);
+
+    builder.SetInsertPoint(nextCandidate);
+    mask->addIncoming(builder.CreateAnd(mask, builder.CreateSub(mask, builder.getInt16(1))),
+                      nextCandidate);
+    builder.CreateBr(candidates);
+
+    builder.SetInsertPoint(nextChunk);
+    i->addIncoming(next, nextChunk);
+    builder.CreateBr(chunkHead);
+
+    builder.SetInsertPoint(tailHead);
+    llvm::PHINode* j = builder.CreatePHI(i64, 2, "j");
+    j->addIncoming(i, chunkHead);
+    builder.CreateCondBr(builder.CreateICmpULE(j, last), tailBody, missing);
+
+    builder.SetInsertPoint(tailBody);
+    builder.CreateCondBr(builder.CreateICmpEQ(byteAt(builder, haystack, j), firstByte),
+                         tailCandidate, tailNext);
+
+    builder.SetInsertPoint(tailCandidate);
+    llvm::Value* tailMatch = builder.CreateCall(
+        equalFunc, {builder.CreateInBoundsGEP(i8, haystack, j), needleLength, needle,
+                    needleLength});
+    builder.CreateCondBr(tailMatch, found, tailNext);
+
+    builder.SetInsertPoint(tailNext);
+    j->addIncoming(builder.CreateNUWAdd(j, builder.getInt64(1)), tailNext);
+    builder.CreateBr(tailHead);
+
+    builder.SetInsertPoint(found);
+    llvm::PHINode* result = builder.CreatePHI(i64, 2, "index");
+    result->addIncoming(position, candidate);
+    result->addIncoming(j, tailCandidate);
+    builder.CreateRet(result);
+
+    builder.SetInsertPoint(atStart);
+    builder.CreateRet(builder.getInt64(0));
+    builder.SetInsertPoint(missing);
+    builder.CreateRet(builder.getInt64(-1));
+}
+
+llvm::Function* getStringRuntime(llvm::Module& module, StringRuntime function) {
+    if (llvm::Function* func = module.getFunction(runtimeName(function))) {
+        return func;
+    }
+    llvm::Function* func = declareRuntime(module, function);
+    switch (function) {
+        case StringRuntime::Equal:
+            buildEqual(func);
+            break;
+        case StringRuntime::Compare:
+            buildCompare(func);
+            break;
+        case StringRuntime::Find:
+            buildFind(func, getStringRuntime(module, StringRuntime::Equal));
+            break;
+    }
+    return func;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+// The string functions generated code calls. They are built in IR into
+// every module that uses them, so run, output, the object cache and
+// ThinLTO need no separate library. Each is linkonce_odr: the copies in
+// different objects or partitions fold into one at link time.
+//
+// All take (data, length) pairs, compare bytes as unsigned and scan 16
+// bytes per step with vector compares, finishing the tail byte by byte.
+// Lengths are stored with the string, so no function needs to look for a
+// terminator.
+enum class StringRuntime {
+    // (a, la, b, lb) -> i1: same bytes
+    Equal,
+    // (a, la, b, lb) -> i32: negative, zero or positive like memcmp, a
+    // prefix ordering before the longer string
+    Compare,
+    // (haystack, lh, needle, ln) -> i64: index of the first occurrence, or
+    // -1. Candidates are positions whose first and last byte both match.
+    Find,
+};
+
+llvm::Function* getStringRuntime(llvm::Module& module, StringRuntime function);
+// A function getStringRuntime() defines, rather than one of the program's
+bool isStringRuntime(llvm::StringRef name);
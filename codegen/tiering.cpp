@@ -0,0 +1,258 @@
+// tiering.cpp
+#include "tiering.h"
+#include "optimizer.h"
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+// Names the baseline code refers to; none can clash with a function of
+// the program, since identifiers cannot start with two underscores
+static const char* kTableName = "__erode_tier_table";
+static const char* kCountersName = "__erode_tier_counters";
+static const char* kPromoteName = "__erode_tier_promote";
+
+TieredExecution::TieredExecution(JIT& t_jit, TierConfig t_config)
+    : m_jit(t_jit), m_config(t_config) {}
+
+TieredExecution::~TieredExecution() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_queue.clear();
+    }
+    m_wake.notify_one();
+    if (m_compiler.joinable()) {
+        m_compiler.join();
+    }
+
+    if (m_config.stats) {
+        std::cerr << "Promoted " << m_promotions.size() << " of " << m_functions.size()
+                  << " functions to -O3";
+        const char* separator = ": ";
+        for (const Promotion& promotion : m_promotions) {
+            std::cerr << separator << promotion.function << " (" << promotion.compileMs
+                      << " ms)";
+            separator = ", ";
+        }
+        std::cerr << "\n";
+    }
+}
+
+int TieredExecution::runMain(std::unique_ptr<llvm::Module> t_module,
+                             std::unique_ptr<llvm::LLVMContext> t_context) {
+    llvm::Function* mainFunc = t_module->getFunction("main");
+    if (!mainFunc || mainFunc->isDeclaration()) {
+        throw std::runtime_error("No main function to run");
+    }
+    bool returnsInt = mainFunc->getReturnType()->isIntegerTy();
+
+    {
+        llvm::raw_string_ostream out(m_bitcode);
+        llvm::WriteBitcodeToFile(*t_module, out);
+    }
+    instrument(*t_module);
+    // Cheap IR cleanup, and the backend's fast instruction selector
+    optimizeModule(*t_module, OptLevel::Quick, false);
+
+    m_jit.defineHostFunction(kPromoteName, reinterpret_cast<void*>(&requestPromotion));
+    m_jit.addModule(std::move(t_module), std::move(t_context), OptLevel::O0);
+    m_table = static_cast<std::atomic<void*>*>(m_jit.lookup(kTableName));
+    m_compiler = std::thread(&TieredExecution::compileLoop, this);
+
+    void* entry = m_jit.lookup("main");
+    int result = 0;
+    if (returnsInt) {
+        result = reinterpret_cast<int (*)()>(entry)();
+    } else {
+        reinterpret_cast<void (*)()>(entry)();
+    }
+    m_jit.flushOutput();
+    return result;
+}
+
+// Adds the counters, the promotion checks and the pointer table, and
+// sends every call between defined functions through the table
+void TieredExecution::instrument(llvm::Module& t_module) {
+    llvm::LLVMContext& context = t_module.getContext();
+    std::map<llvm::Function*, size_t> indices;
+    std::vector<llvm::Constant*> entries;
+    for (llvm::Function& func : t_module) {
+        // The string, I/O and region runtimes (linkonce_odr) are inlined
+        // into or compiled with each function that calls them
+        if (!func.isDeclaration() && !func.hasLinkOnceODRLinkage()) {
+            indices[&func] = m_functions.size();
+            m_functions.push_back(func.getName().str());
+            entries.push_back(&func);
+        }
+    }
+
+    llvm::Type* ptrType = llvm::PointerType::getUnqual(context);
+    llvm::Type* i64 = llvm::Type::getInt64Ty(context);
+    auto* tableType = llvm::ArrayType::get(ptrType, entries.size());
+    auto* table =
+        llvm::cast<llvm::GlobalVariable>(t_module.getOrInsertGlobal(kTableName, tableType));
+    table->setInitializer(llvm::ConstantArray::get(tableType, entries));
+    auto* countersType = llvm::ArrayType::get(i64, entries.size());
+    auto* counters =
+        llvm::cast<llvm::GlobalVariable>(t_module.getOrInsertGlobal(kCountersName, countersType));
+    counters->setInitializer(llvm::ConstantAggregateZero::get(countersType));
+    counters->setLinkage(llvm::GlobalValue::InternalLinkage);
+    llvm::FunctionCallee promoteFunc = t_module.getOrInsertFunction(
+        kPromoteName, llvm::Type::getVoidTy(context), ptrType, llvm::Type::getInt32Ty(context));
+    llvm::Constant* self = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(i64, reinterpret_cast<uintptr_t>(this)), ptrType);
+    llvm::MDNode* unlikely = llvm::MDBuilder(context).createBranchWeights(1, 1 << 20);
+
+    llvm::IRBuilder<> builder(context);
+    for (auto& [func, index] : indices) {
+        // Loop headers are the targets of back edges, i.e. of edges to a
+        // block that dominates the source
+        std::set<llvm::BasicBlock*> counted = {&func->getEntryBlock()};
+        llvm::DominatorTree dominators(*func);
+        for (llvm::BasicBlock& block : *func) {
+            for (llvm::BasicBlock* successor : llvm::successors(&block)) {
+                if (dominators.dominates(successor, &block)) {
+                    counted.insert(successor);
+                }
+            }
+        }
+
+        for (llvm::BasicBlock* block : counted) {
+            // Stay behind the entry block's allocas, which must not move
+            // out of it
+            llvm::BasicBlock::iterator position = block->getFirstInsertionPt();
+            while (llvm::isa<llvm::AllocaInst>(*position)) {
+                ++position;
+            }
+            builder.SetInsertPoint(block, position);
+            llvm::Value* slot = builder.CreateConstInBoundsGEP2_64(countersType, counters, 0,
+                                                                   index);
+            llvm::Value* count = builder.CreateAdd(builder.CreateLoad(i64, slot),
+                                                   llvm::ConstantInt::get(i64, 1));
+            builder.CreateStore(count, slot);
+            llvm::Value* hot =
+                builder.CreateICmpEQ(count, llvm::ConstantInt::get(i64, m_config.threshold));
+            llvm::Instruction* then =
+                llvm::SplitBlockAndInsertIfThen(hot, &*position, false, unlikely);
+            builder.SetInsertPoint(then);
+            builder.CreateCall(promoteFunc, {self, builder.getInt32(index)});
+        }
+
+        std::vector<llvm::CallInst*> calls;
+        for (llvm::BasicBlock& block : *func) {
+            for (llvm::Instruction& inst : block) {
+                if (auto* call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+                    auto* callee = call->getCalledFunction();
+                    if (callee && indices.count(callee)) {
+                        calls.push_back(call);
+                    }
+                }
+            }
+        }
+        for (llvm::CallInst* call : calls) {
+            builder.SetInsertPoint(call);
+            llvm::Value* slot = builder.CreateConstInBoundsGEP2_64(
+                tableType, table, 0, indices[call->getCalledFunction()]);
+            llvm::LoadInst* target = builder.CreateLoad(ptrType, slot);
+            target->setAtomic(llvm::AtomicOrdering::Monotonic);
+            target->setAlignment(llvm::Align(sizeof(void*)));
+            call->setCalledOperand(target);
+        }
+    }
+}
+
+void TieredExecution::requestPromotion(TieredExecution* t_self, int32_t t_index) {
+    {
+        std::lock_guard<std::mutex> lock(t_self->m_mutex);
+        t_self->m_queue.push_back(t_index);
+    }
+    t_self->m_wake.notify_one();
+}
+
+void TieredExecution::compileLoop() {
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stopping || !m_queue.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            index = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        try {
+            promote(index);
+        } catch (const std::exception& e) {
+            // The baseline code keeps running
+            std::cerr << "Error: Could not promote " << m_functions[index] << ": " << e.what()
+                      << "\n";
+        }
+    }
+}
+
+// Compiles the function at index at -O3 and installs it in the table.
+// Everything else in its copy of the module becomes internal: callees are
+// inlined or compiled alongside it, and the rest is dropped.
+void TieredExecution::promote(size_t t_index) {
+    auto start = std::chrono::steady_clock::now();
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(m_bitcode, "tier", false);
+    llvm::Expected<std::unique_ptr<llvm::Module>> parsed =
+        llvm::parseBitcodeFile(buffer->getMemBufferRef(), *context);
+    if (!parsed) {
+        throw std::runtime_error(llvm::toString(parsed.takeError()));
+    }
+    std::unique_ptr<llvm::Module> module = std::move(*parsed);
+
+    const std::string& name = m_functions[t_index];
+    for (llvm::Function& func : *module) {
+        if (!func.isDeclaration() && func.getName() != name) {
+            func.setLinkage(llvm::GlobalValue::InternalLinkage);
+        }
+    }
+    llvm::Function* hot = module->getFunction(name);
+    hot->setName(name + ".tier1");
+    // The baseline module already registered the constructors and
+    // destructors (the output flush)
+    for (const char* list : {"llvm.global_ctors", "llvm.global_dtors"}) {
+        if (llvm::GlobalVariable* global = module->getNamedGlobal(list)) {
+            global->eraseFromParent();
+        }
+    }
+
+    auto builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!builder) {
+        throw std::runtime_error(llvm::toString(builder.takeError()));
+    }
+    builder->setCodeGenOptLevel(llvm::CodeGenOptLevel::Aggressive);
+    auto targetMachine = builder->createTargetMachine();
+    if (!targetMachine) {
+        throw std::runtime_error(llvm::toString(targetMachine.takeError()));
+    }
+    module->setDataLayout(m_jit.getDataLayout());
+    module->setTargetTriple(m_jit.getTargetTriple().str());
+    optimizeModule(*module, OptLevel::O3, false, targetMachine->get());
+
+    m_jit.addModule(std::move(module), std::move(context), OptLevel::O3);
+    void* address = m_jit.lookup(name + ".tier1");
+    m_table[t_index].store(address, std::memory_order_release);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_promotions.push_back({name, elapsed.count() / 1000.0});
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "jit.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TierConfig {
+    // Function entries plus loop iterations before a function is
+    // recompiled at -O3
+    uint64_t threshold = 10000;
+    // Report every promotion on stderr when main returns
+    bool stats = false;
+};
+
+// Two-tier execution on top of the JIT. Every function first runs from a
+// baseline compile (the quick pipeline) that counts its entries and loop
+// back edges. A function whose count reaches the threshold is recompiled at
+// -O3 on a background thread, together with internal copies of everything
+// it calls so the inliner can work across them. Calls between baseline
+// functions go through a table of function pointers, and the promoted
+// version is installed by overwriting its slot; calls already running keep
+// executing the baseline code, since there is no on-stack replacement.
+class TieredExecution {
+public:
+    TieredExecution(JIT& t_jit, TierConfig t_config);
+    // Waits for a compile in progress; promotions still queued are dropped
+    ~TieredExecution();
+
+    // Compiles the unoptimized module at the baseline tier and calls its
+    // main(); returns main's result, or 0 for a void main
+    int runMain(std::unique_ptr<llvm::Module> t_module,
+                std::unique_ptr<llvm::LLVMContext> t_context);
+
+private:
+    // Called from the baseline code of the function at index when its
+    // count reaches the threshold
+    static void requestPromotion(TieredExecution* t_self, int32_t t_index);
+
+    void instrument(llvm::Module& t_module);
+    void compileLoop();
+    void promote(size_t t_index);
+
+    JIT& m_jit;
+    TierConfig m_config;
+    // The module before instrumentation; every promotion parses its own
+    // copy, in its own context, on the compile thread
+    std::string m_bitcode;
+    // Defined functions, indexed like the pointer table
+    std::vector<std::string> m_functions;
+    std::atomic<void*>* m_table = nullptr;
+
+    std::thread m_compiler;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<size_t> m_queue;
+    bool m_stopping = false;
+
+    struct Promotion {
+        std::string function;
+        double compileMs;
+    };
+    std::vector<Promotion> m_promotions;
+};
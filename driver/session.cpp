@@ -0,0 +1,137 @@
+#include "session.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../parser/parser_helper.h"
+#include "../semantics/semantic_analyzer.h"
+#include "../semantics/borrow_checker.h"
+#include "../semantics/call_graph.h"
+#include "../semantics/effect_analyzer.h"
+#include "../semantics/range_analyzer.h"
+#include <stdexcept>
+
+std::string CompilationSession::signatureOf(const std::vector<Param>& params, const Type& returnType,
+                                            bool isExtern)
+{
+    std::string signature = isExtern ? "extern(" : "def(";
+    for (auto& param : params) {
+        signature += std::to_string(static_cast<int>(param.mode)) + ":" +
+                     type_to_string(param.type) + ",";
+    }
+    return signature + ")" + type_to_string(returnType);
+}
+
+void CompilationSession::compile(const std::string& source)
+{
+    std::string content = source;
+    content.push_back('\0');
+
+    Lexer lexer(content.c_str(), content.c_str() + content.size());
+    Parser parser(lexer);
+    std::unique_ptr<Program> program = parser.parseProgram();
+
+    std::map<std::string, std::string> signatures;
+    std::set<std::string> functions;
+    std::set<std::string> changed;
+    size_t topLevel = 0;
+    for (auto& item : program->items) {
+        if (auto func = dynamic_cast<FunctionDef*>(item)) {
+            signatures[func->name] = signatureOf(func->params, func->returnType, false);
+            functions.insert(func->name);
+            auto old = m_functions.find(func->name);
+            if (old == m_functions.end() || old->second.def->fingerprint != func->fingerprint)
+                changed.insert(func->name);
+        } else if (auto ext = dynamic_cast<ExternDecl*>(item)) {
+            signatures[ext->name] = signatureOf(ext->params, ext->returnType, true);
+        } else {
+            topLevel ^= item->fingerprint + 0x9e3779b97f4a7c15ULL + (topLevel << 6) + (topLevel >> 2);
+        }
+    }
+
+    // Declarations that were added, removed or changed their signature
+    std::set<std::string> redeclared;
+    for (auto& [name, signature] : signatures) {
+        auto old = m_signatures.find(name);
+        if (old == m_signatures.end() || old->second != signature)
+            redeclared.insert(name);
+    }
+    for (auto& [name, signature] : m_signatures) {
+        if (!signatures.count(name))
+            redeclared.insert(name);
+    }
+
+    bool rebuild = !m_codegen || topLevel != m_topLevel;
+    std::set<std::string> dirty = rebuild ? functions : changed;
+    if (!rebuild) {
+        // Unchanged bodies call what they called before
+        for (auto& [name, record] : m_functions) {
+            if (!functions.count(name))
+                continue;
+            for (auto& callee : record.uses) {
+                if (redeclared.count(callee)) {
+                    dirty.insert(name);
+                    break;
+                }
+            }
+        }
+
+        // Clean functions keep their analyzed AST, so the whole-program
+        // analyses below see the same facts codegen used for their bodies
+        for (auto& item : program->items) {
+            auto func = dynamic_cast<FunctionDef*>(item);
+            if (func && !dirty.count(func->name))
+                item = m_functions[func->name].def;
+        }
+    }
+
+    SemanticAnalyzer analyzer;
+    analyzer.analyzeFunctions(program.get(), dirty);
+
+    BorrowChecker borrowChecker;
+    borrowChecker.checkFunctions(program.get(), dirty);
+
+    CallGraph callGraph;
+    callGraph.build(program.get());
+
+    // Dead functions leave the module as if they had been deleted from the
+    // source, and come back as new ones once something calls them again
+    if (!m_roots.empty()) {
+        for (auto& root : m_roots) {
+            if (!callGraph.node(root))
+                throw std::runtime_error("Unknown root function: " + root);
+        }
+        removeUnreachableFunctions(program.get(), callGraph, m_roots);
+        callGraph.build(program.get());
+        for (auto it = signatures.begin(); it != signatures.end();) {
+            if (callGraph.node(it->first)) {
+                ++it;
+                continue;
+            }
+            dirty.erase(it->first);
+            redeclared.insert(it->first);
+            it = signatures.erase(it);
+        }
+    }
+
+    RangeAnalyzer ranges;
+    ranges.analyzeFunctions(program.get(), dirty);
+
+    EffectAnalyzer effects;
+    effects.analyzeProgram(program.get(), callGraph);
+
+    if (rebuild) {
+        m_codegen = std::make_unique<CodeGen>(m_directSSA);
+        m_codegen->generate(program.get());
+    } else {
+        m_codegen->regenerate(program.get(), dirty, redeclared);
+    }
+
+    m_functions.clear();
+    for (auto& item : program->items) {
+        if (auto func = dynamic_cast<FunctionDef*>(item))
+            m_functions[func->name] = {func, callGraph.node(func->name)->callees};
+    }
+    m_signatures = signatures;
+    m_topLevel = topLevel;
+    m_recompiled = dirty;
+    m_program = std::move(program);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "../ast/program.h"
+#include "../ast/function.h"
+#include "../codegen/codegen.h"
+
+// A long-lived compilation of one source file for edit-compile loops. Every
+// compile() re-parses the source, but only the functions whose definition
+// changed, and the functions whose bodies call a declaration whose signature
+// changed, are re-checked and re-emitted. All other functions keep their
+// analyzed AST and their llvm::Function from the previous compile.
+//
+// Editing a top-level statement rebuilds everything.
+class CompilationSession {
+public:
+    // With roots, functions unreachable from them are checked but not
+    // emitted, like --dce outside of watch mode
+    explicit CompilationSession(bool t_directSSA = true, std::vector<std::string> t_roots = {})
+        : m_directSSA(t_directSSA), m_roots(std::move(t_roots)) {}
+
+    // Throws CompileError if the new source is invalid; the session then
+    // still holds the last good program and module.
+    void compile(const std::string& t_source);
+
+    llvm::Module* module() { return m_codegen ? m_codegen->getModule() : nullptr; }
+    size_t functionCount() const { return m_functions.size(); }
+    // Functions whose bodies the last compile() re-checked and re-emitted
+    const std::set<std::string>& recompiled() const { return m_recompiled; }
+
+private:
+    struct FunctionRecord {
+        FunctionDef* def;
+        // Declarations the body consults, i.e. its callees
+        std::vector<std::string> uses;
+    };
+
+    static std::string signatureOf(const std::vector<Param>& t_params, const Type& t_returnType,
+                                   bool t_isExtern);
+
+    bool m_directSSA;
+    std::vector<std::string> m_roots;
+    std::unique_ptr<Program> m_program;
+    std::unique_ptr<CodeGen> m_codegen;
+    std::map<std::string, FunctionRecord> m_functions;
+    // Signature of every function and extern declaration
+    std::map<std::string, std::string> m_signatures;
+    // Combined fingerprint of the top-level statements
+    size_t m_topLevel = 0;
+    std::set<std::string> m_recompiled;
+};
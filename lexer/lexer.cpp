@@ -1,13 +1,15 @@
 #include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include "../token/token.h"
+#include "../token/compile_error.h"
 #include "lexer.h"
 
 [[noreturn]] void Lexer::error(const std::string& msg) {
     std::cerr << "Lexer error: " << msg << std::endl;
-    std::exit(1);
+    throw CompileError(msg);
 }
 
 Lexer::Lexer(const char *cur, const char *end) : cur(cur), end(end) {
@@ -19,6 +21,16 @@ Lexer::Lexer(const char *cur, const char *end) : cur(cur), end(end) {
     }
 }
 
+size_t Lexer::fingerprint(size_t begin, size_t end) const {
+    size_t hash = 0;
+    for (size_t i = begin; i < end && i < tokens.size(); ++i) {
+        size_t h = std::hash<size_t>()(static_cast<size_t>(tokens[i].kind)) ^
+                   (std::hash<decltype(Token::value)>()(tokens[i].value) << 1);
+        hash ^= h + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
 const Token& Lexer::next() {
     if (current_token_index < tokens.size()) {
         return tokens[current_token_index++];
@@ -46,12 +58,48 @@ Token Lexer::lex_alpha() {
     if (name == "extern") {
         return Token{Kind::tok_extern, std::monostate{}};
     }
+    if (name == "pure") {
+        return Token{Kind::tok_pure, std::monostate{}};
+    }
+    if (name == "mut") {
+        return Token{Kind::tok_mut, std::monostate{}};
+    }
     if (name == "int") {
         return Token{Kind::tok_int, std::monostate{}};
     }
     if (name == "float") {
         return Token{Kind::tok_float, std::monostate{}};
     }
+    if (name == "i8") {
+        return Token{Kind::tok_i8, std::monostate{}};
+    }
+    if (name == "i16") {
+        return Token{Kind::tok_i16, std::monostate{}};
+    }
+    if (name == "i32") {
+        return Token{Kind::tok_i32, std::monostate{}};
+    }
+    if (name == "i64") {
+        return Token{Kind::tok_i64, std::monostate{}};
+    }
+    if (name == "u8") {
+        return Token{Kind::tok_u8, std::monostate{}};
+    }
+    if (name == "u16") {
+        return Token{Kind::tok_u16, std::monostate{}};
+    }
+    if (name == "u32") {
+        return Token{Kind::tok_u32, std::monostate{}};
+    }
+    if (name == "u64") {
+        return Token{Kind::tok_u64, std::monostate{}};
+    }
+    if (name == "f32") {
+        return Token{Kind::tok_f32, std::monostate{}};
+    }
+    if (name == "f64") {
+        return Token{Kind::tok_f64, std::monostate{}};
+    }
     if (name == "bool") {
         return Token{Kind::tok_bool, std::monostate{}};
     }
@@ -82,6 +130,24 @@ Token Lexer::lex_alpha() {
     if (name == "for") {
         return Token{Kind::tok_for, std::monostate{}};
     }
+    if (name == "region") {
+        return Token{Kind::tok_region, std::monostate{}};
+    }
+    if (name == "switch") {
+        return Token{Kind::tok_switch, std::monostate{}};
+    }
+    if (name == "case") {
+        return Token{Kind::tok_case, std::monostate{}};
+    }
+    if (name == "default") {
+        return Token{Kind::tok_default, std::monostate{}};
+    }
+    if (name == "vec") {
+        return Token{Kind::tok_vec, std::monostate{}};
+    }
+    if (name == "struct") {
+        return Token{Kind::tok_struct, std::monostate{}};
+    }
     return Token{Kind::tok_identifier, name};
 }
 
@@ -164,6 +230,7 @@ Token Lexer::lex_separator() {
         case '}' : return Token{Kind::tok_rbrace, std::monostate{}};
         case '[' : return Token{Kind::tok_lbracket, std::monostate{}};
         case ']' : return Token{Kind::tok_rbracket, std::monostate{}};
+        case '.' : return Token{Kind::tok_dot, std::monostate{}};
         default:
             return Token{Kind::tok_eof, std::monostate{}};
     }
@@ -216,7 +283,7 @@ Token Lexer::lex() {
     if (*cur == '\0') {
         return lex_eof();
     }
-    if (*cur == ',' || *cur == ';' || *cur == '(' || *cur == ')' || *cur == '{' || *cur == '}' || *cur == '[' || *cur == ']') {
+    if (*cur == ',' || *cur == ';' || *cur == '(' || *cur == ')' || *cur == '{' || *cur == '}' || *cur == '[' || *cur == ']' || *cur == '.') {
         return lex_separator();
     }
     if(*cur == '"') {
@@ -273,6 +340,14 @@ void Lexer::test_lexer() {
                 std::cout << "EXTERN\n";
                 break;
 
+            case Kind::tok_pure:
+                std::cout << "PURE\n";
+                break;
+
+            case Kind::tok_mut:
+                std::cout << "MUT\n";
+                break;
+
             case Kind::tok_int:
                 std::cout << "INT\n";
                 break;
@@ -281,6 +356,46 @@ void Lexer::test_lexer() {
                 std::cout << "FLOAT\n";
                 break;
 
+            case Kind::tok_i8:
+                std::cout << "I8\n";
+                break;
+
+            case Kind::tok_i16:
+                std::cout << "I16\n";
+                break;
+
+            case Kind::tok_i32:
+                std::cout << "I32\n";
+                break;
+
+            case Kind::tok_i64:
+                std::cout << "I64\n";
+                break;
+
+            case Kind::tok_u8:
+                std::cout << "U8\n";
+                break;
+
+            case Kind::tok_u16:
+                std::cout << "U16\n";
+                break;
+
+            case Kind::tok_u32:
+                std::cout << "U32\n";
+                break;
+
+            case Kind::tok_u64:
+                std::cout << "U64\n";
+                break;
+
+            case Kind::tok_f32:
+                std::cout << "F32\n";
+                break;
+
+            case Kind::tok_f64:
+                std::cout << "F64\n";
+                break;
+
             case Kind::tok_int_literal:
                 std::cout << "INT_LITERAL " << std::get<int64_t>(token.value) << "\n";
                 break;
@@ -377,6 +492,34 @@ void Lexer::test_lexer() {
                 std::cout << "FOR\n";
                 break;
 
+            case Kind::tok_region:
+                std::cout << "REGION\n";
+                break;
+
+            case Kind::tok_switch:
+                std::cout << "SWITCH\n";
+                break;
+
+            case Kind::tok_case:
+                std::cout << "CASE\n";
+                break;
+
+            case Kind::tok_default:
+                std::cout << "DEFAULT\n";
+                break;
+
+            case Kind::tok_vec:
+                std::cout << "VEC\n";
+                break;
+
+            case Kind::tok_struct:
+                std::cout << "STRUCT\n";
+                break;
+
+            case Kind::tok_dot:
+                std::cout << "DOT\n";
+                break;
+
             case Kind::tok_eof:
                 std::cout << "EOF\n";
                 break;
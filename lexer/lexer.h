@@ -9,6 +9,11 @@ public:
 
     const Token& current() const;
     const Token& next();
+    // Index of the current token, for fingerprint()
+    size_t position() const { return current_token_index; }
+    // Hash of the tokens in [t_begin, t_end); equal for sources that only
+    // differ in whitespace
+    size_t fingerprint(size_t t_begin, size_t t_end) const;
     void test_lexer();
 
 private:
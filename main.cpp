@@ -1,23 +1,390 @@
 #include "lexer/lexer.h"
 #include "parser/parser.h"
 #include "semantics/semantic_analyzer.h"
+#include "semantics/borrow_checker.h"
+#include "semantics/call_graph.h"
+#include "semantics/effect_analyzer.h"
+#include "semantics/range_analyzer.h"
 #include "codegen/codegen.h"
+#include "codegen/optimizer.h"
+#include "codegen/jit.h"
+#include "codegen/tiering.h"
+#include "codegen/emitter.h"
+#include "codegen/lto.h"
+#include "codegen/object_cache.h"
+#include "codegen/parallel.h"
+#include "driver/session.h"
+#include "token/compile_error.h"
 
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <string>
+#include <thread>
+#include <vector>
+
+enum class EmitKind {
+    IR,
+    Object,
+    Executable,
+    // Bitcode with a ThinLTO summary, for the link mode
+    Bitcode,
+};
+
+struct DriverOptions {
+    // Drop functions unreachable from the roots before codegen
+    bool dropDeadFunctions = false;
+    std::vector<std::string> roots;
+    OptLevel optLevel = OptLevel::O0;
+    // Report the time spent in each optimization pass
+    bool timePasses = false;
+    // Build SSA form while generating code instead of leaving it to mem2reg
+    bool directSSA = true;
+    EmitKind emit = EmitKind::Object;
+    // Derived from the input file name when empty
+    std::string outputPath;
+    TargetConfig target;
+    // Bitcode files given after the mode, for link
+    std::vector<std::string> inputs;
+    // Worker threads for output; 0 compiles the program as one module
+    unsigned jobs = 0;
+    // Per-function object cache for output, off when empty
+    std::string cacheDir;
+    bool cacheStats = false;
+    // run: start at a baseline tier and promote hot functions to -O3
+    bool tiered = false;
+    TierConfig tiers;
+    // Profile-guided optimization: count branches and calls, writing the
+    // counts to instrumentPath, or optimize with the counts in profilePath
+    bool instrument = false;
+    std::string instrumentPath;
+    std::string profilePath;
+};
 
 void printUsage(const char* prog) {
     std::cerr << "Usage:\n"
               << "  " << prog << " <input_file> test-lexer\n"
               << "  " << prog << " <input_file> test-parser\n"
               << "  " << prog << " <input_file> test-semantics\n"
-              << "  " << prog << " <input_file> codegen\n"
-              << "  " << prog << " <input_file> full\n";
+              << "  " << prog << " <input_file> callgraph\n"
+              << "  " << prog << " <input_file> codegen [options]\n"
+              << "  " << prog << " <input_file> output [options]\n"
+              << "  " << prog << " <input_file> run [options]\n"
+              << "  " << prog << " <input_file> full\n"
+              << "  " << prog << " <input_file> watch [options]\n"
+              << "  " << prog << " <file.bc> link [more.bc ...] [options]\n"
+              << "Options:\n"
+              << "  --dce            drop functions unreachable from the roots\n"
+              << "  --root=<name>    add a root for --dce (default: main)\n"
+              << "  -O0 .. -O3, -Os  optimization level (default: -O0)\n"
+              << "  --quick          fast per-function pipeline instead of a -O level\n"
+              << "  --time-passes    report the time spent in each pass\n"
+              << "  --no-ssa         keep every local in a stack slot, as mem2reg input\n"
+              << "  --emit=<kind>    output/watch: obj (default), exe, ll or bc\n"
+              << "  -o <file>        output file (default: input name + .o, none, .ll, .bc)\n"
+              << "  -mcpu=<cpu>      CPU to generate code for, or native\n"
+              << "  -march=<cpu>     same as -mcpu\n"
+              << "  --relocation-model=<pic|static>  (default: pic)\n"
+              << "  -j <n>, --jobs=<n>  output: compile partitions of the program on n\n"
+              << "                   threads (obj or exe only)\n"
+              << "  --cache=<dir>    output: reuse the objects of unchanged functions from dir\n"
+              << "  --cache-stats    report how many functions the cache supplied\n"
+              << "  --tiered         run: baseline compile first, hot functions at -O3 later\n"
+              << "  --tier-threshold=<n>  calls plus loop iterations before promotion\n"
+              << "                   (default: 10000)\n"
+              << "  --tier-stats     report the promoted functions\n"
+              << "  --instrument[=<file>]  count branches and calls; the program writes\n"
+              << "                   them to file (default: input name + .profile)\n"
+              << "  --profile-use=<file>  optimize with the counts of an instrumented run\n";
+}
+
+bool parseOptions(int argc, char* argv[], DriverOptions& options) {
+    for (int i = 3; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--dce") {
+            options.dropDeadFunctions = true;
+        } else if (arg.rfind("--root=", 0) == 0) {
+            options.roots.push_back(arg.substr(7));
+        } else if (arg == "-O0") {
+            options.optLevel = OptLevel::O0;
+        } else if (arg == "-O1") {
+            options.optLevel = OptLevel::O1;
+        } else if (arg == "-O2") {
+            options.optLevel = OptLevel::O2;
+        } else if (arg == "-O3") {
+            options.optLevel = OptLevel::O3;
+        } else if (arg == "-Os") {
+            options.optLevel = OptLevel::Os;
+        } else if (arg == "--quick") {
+            options.optLevel = OptLevel::Quick;
+        } else if (arg == "--time-passes") {
+            options.timePasses = true;
+        } else if (arg == "--no-ssa") {
+            options.directSSA = false;
+        } else if (arg == "--emit=ll") {
+            options.emit = EmitKind::IR;
+        } else if (arg == "--emit=obj") {
+            options.emit = EmitKind::Object;
+        } else if (arg == "--emit=exe") {
+            options.emit = EmitKind::Executable;
+        } else if (arg == "--emit=bc") {
+            options.emit = EmitKind::Bitcode;
+        } else if (arg == "-o" && i + 1 < argc) {
+            options.outputPath = argv[++i];
+        } else if (arg.rfind("-mcpu=", 0) == 0) {
+            options.target.cpu = arg.substr(6);
+        } else if (arg.rfind("-march=", 0) == 0) {
+            options.target.cpu = arg.substr(7);
+        } else if (arg == "--relocation-model=pic") {
+            options.target.relocModel = RelocModel::PIC;
+        } else if (arg == "--relocation-model=static") {
+            options.target.relocModel = RelocModel::Static;
+        } else if ((arg == "-j" && i + 1 < argc) || arg.rfind("--jobs=", 0) == 0) {
+            const std::string count = arg == "-j" ? argv[++i] : arg.substr(7);
+            if (count.empty() || count.find_first_not_of("0123456789") != std::string::npos ||
+                std::stoul(count) == 0) {
+                std::cerr << "Invalid job count: " << count << "\n";
+                return false;
+            }
+            options.jobs = std::stoul(count);
+        } else if (arg.rfind("--cache=", 0) == 0 && arg.size() > 8) {
+            options.cacheDir = arg.substr(8);
+        } else if (arg == "--cache-stats") {
+            options.cacheStats = true;
+        } else if (arg == "--tiered") {
+            options.tiered = true;
+        } else if (arg.rfind("--tier-threshold=", 0) == 0) {
+            const std::string count = arg.substr(17);
+            if (count.empty() || count.find_first_not_of("0123456789") != std::string::npos ||
+                std::stoull(count) == 0) {
+                std::cerr << "Invalid tier threshold: " << count << "\n";
+                return false;
+            }
+            options.tiers.threshold = std::stoull(count);
+        } else if (arg == "--tier-stats") {
+            options.tiers.stats = true;
+        } else if (arg == "--instrument") {
+            options.instrument = true;
+        } else if (arg.rfind("--instrument=", 0) == 0 && arg.size() > 13) {
+            options.instrument = true;
+            options.instrumentPath = arg.substr(13);
+        } else if (arg.rfind("--profile-use=", 0) == 0 && arg.size() > 14) {
+            options.profilePath = arg.substr(14);
+        } else if (!arg.empty() && arg[0] != '-') {
+            options.inputs.push_back(arg);
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    if (options.roots.empty()) {
+        options.roots.push_back("main");
+    }
+    return true;
+}
+
+// Where output for filename goes unless -o says otherwise
+std::string outputPathFor(const DriverOptions& options, const std::string& filename) {
+    std::string path = options.outputPath;
+    if (path.empty()) {
+        std::filesystem::path stem = std::filesystem::path(filename).stem();
+        switch (options.emit) {
+            case EmitKind::IR:
+                path = stem.string() + ".ll";
+                break;
+            case EmitKind::Object:
+                path = stem.string() + ".o";
+                break;
+            case EmitKind::Executable:
+                path = stem.string();
+                break;
+            case EmitKind::Bitcode:
+                path = stem.string() + ".bc";
+                break;
+        }
+    }
+    return path;
+}
+
+// Writes the optimized module as options.emit asks
+void writeOutput(llvm::Module& module, llvm::TargetMachine& targetMachine,
+                 const DriverOptions& options, const std::string& filename) {
+    std::string path = outputPathFor(options, filename);
+    switch (options.emit) {
+        case EmitKind::IR: {
+            std::error_code EC;
+            llvm::raw_fd_ostream out(path, EC);
+            if (EC) {
+                throw std::runtime_error("Could not open " + path + ": " + EC.message());
+            }
+            module.print(out, nullptr);
+            break;
+        }
+        case EmitKind::Object:
+            emitObjectFile(module, targetMachine, path);
+            break;
+        case EmitKind::Bitcode:
+            emitBitcodeFile(module, path);
+            break;
+        case EmitKind::Executable: {
+            llvm::SmallString<128> objectPath;
+            if (llvm::sys::fs::createTemporaryFile("erode", "o", objectPath)) {
+                throw std::runtime_error("Could not create a temporary object file");
+            }
+            emitObjectFile(module, targetMachine, objectPath.str().str());
+            try {
+                linkExecutable({objectPath.str().str()}, path, options.target.relocModel);
+            } catch (...) {
+                llvm::sys::fs::remove(objectPath);
+                throw;
+            }
+            llvm::sys::fs::remove(objectPath);
+            break;
+        }
+    }
+}
+
+// Compiles program on options.jobs threads, through the object cache if
+// one is set, and links or merges the partition objects into the
+// requested output
+int outputParallel(Program* program, const DriverOptions& options, const std::string& filename) {
+    std::string path = outputPathFor(options, filename);
+    std::unique_ptr<ObjectCache> cache;
+    if (!options.cacheDir.empty()) {
+        cache = std::make_unique<ObjectCache>(options.cacheDir, options.target,
+                                              options.optLevel, options.directSSA);
+    }
+    std::vector<std::string> objects =
+        compileParallel(program, options.target, options.optLevel, options.directSSA,
+                        std::max(options.jobs, 1u), cache.get());
+
+    // Cache entries stay where they are for the next build
+    auto removeObjects = [&]() {
+        if (!cache) {
+            for (auto& object : objects) {
+                llvm::sys::fs::remove(object);
+            }
+        }
+    };
+    try {
+        if (options.emit == EmitKind::Executable) {
+            linkExecutable(objects, path, options.target.relocModel);
+        } else {
+            combineObjects(objects, path);
+        }
+    } catch (...) {
+        removeObjects();
+        throw;
+    }
+    removeObjects();
+
+    if (cache && options.cacheStats) {
+        size_t total = cache->hits() + cache->misses();
+        std::cerr << "Cache: " << cache->hits() << " of " << total << " functions reused ("
+                  << std::fixed << std::setprecision(1)
+                  << (total ? 100.0 * cache->hits() / total : 0.0) << "%), "
+                  << cache->misses() << " compiled\n";
+    }
+    return 0;
+}
+
+// ThinLTO-links bitcode files into an executable
+int linkFiles(const std::vector<std::string>& bitcodePaths, const DriverOptions& options) {
+    std::string path = options.outputPath;
+    if (path.empty()) {
+        path = std::filesystem::path(bitcodePaths.front()).stem().string();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> objects =
+        linkThinLTO(bitcodePaths, options.target, options.optLevel);
+    try {
+        linkExecutable(objects, path, options.target.relocModel);
+    } catch (...) {
+        for (auto& object : objects) {
+            llvm::sys::fs::remove(object);
+        }
+        throw;
+    }
+    for (auto& object : objects) {
+        llvm::sys::fs::remove(object);
+    }
+
+    if (options.timePasses) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        std::cerr << "Linked " << bitcodePaths.size() << " modules in "
+                  << elapsed.count() / 1000.0 << " ms\n";
+    }
+    return 0;
+}
+
+// Recompiles the file whenever it changes, reusing the
+// previous compile for every function the edit cannot have affected
+int watchFile(const std::string& filename, const DriverOptions& options) {
+    std::unique_ptr<llvm::TargetMachine> targetMachine =
+        createTargetMachine(options.target, options.optLevel);
+    CompilationSession session(options.directSSA, options.dropDeadFunctions
+                                                      ? options.roots
+                                                      : std::vector<std::string>{});
+    std::filesystem::file_time_type lastWrite;
+    while (true) {
+        std::error_code EC;
+        auto writeTime = std::filesystem::last_write_time(filename, EC);
+        if (EC || writeTime == lastWrite) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        lastWrite = writeTime;
+
+        std::ifstream file(filename);
+        std::string content(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+
+        auto start = std::chrono::steady_clock::now();
+        try {
+            session.compile(content);
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start);
+
+            // The session's module is reused by the next compile, so only a
+            // copy of it is optimized
+            std::unique_ptr<llvm::Module> optimized = llvm::CloneModule(*session.module());
+            optimized->setDataLayout(targetMachine->createDataLayout());
+            optimized->setTargetTriple(targetMachine->getTargetTriple().str());
+            optimizeModule(*optimized, options.optLevel, options.timePasses, targetMachine.get(),
+                           options.emit == EmitKind::Bitcode);
+            writeOutput(*optimized, *targetMachine, options, filename);
+
+            std::cout << "Recompiled " << session.recompiled().size() << " of "
+                      << session.functionCount() << " functions in "
+                      << elapsed.count() / 1000.0 << " ms";
+            const char* separator = ": ";
+            for (auto& name : session.recompiled()) {
+                std::cout << separator << name;
+                separator = ", ";
+            }
+            std::cout << std::endl;
+        } catch (const CompileError&) {
+            continue;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            continue;
+        }
+    }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    DriverOptions options;
+    if (argc < 3 || !parseOptions(argc, argv, options)) {
         printUsage(argv[0]);
         return 1;
     }
@@ -25,6 +392,38 @@ int main(int argc, char* argv[]) {
     const std::string filename = argv[1];
     const std::string mode = argv[2];
 
+    if (mode == "link") {
+        options.inputs.insert(options.inputs.begin(), filename);
+    } else if (!options.inputs.empty()) {
+        std::cerr << "Only link takes more than one input file\n";
+        return 1;
+    }
+    if ((options.jobs > 0 || !options.cacheDir.empty()) &&
+        (mode != "output" || options.emit == EmitKind::IR || options.emit == EmitKind::Bitcode)) {
+        std::cerr << "-j and --cache only apply to output with --emit=obj or --emit=exe\n";
+        return 1;
+    }
+    if (options.tiered && mode != "run") {
+        std::cerr << "--tiered only applies to run\n";
+        return 1;
+    }
+    if (options.instrument || !options.profilePath.empty()) {
+        if (options.instrument && !options.profilePath.empty()) {
+            std::cerr << "--instrument and --profile-use exclude each other\n";
+            return 1;
+        }
+        if ((mode != "output" && mode != "run" && mode != "codegen") || options.tiered ||
+            options.jobs > 0 || !options.cacheDir.empty()) {
+            std::cerr << "--instrument and --profile-use apply to codegen, output and run, "
+                         "without -j, --cache or --tiered\n";
+            return 1;
+        }
+        if (options.instrument && options.instrumentPath.empty()) {
+            options.instrumentPath =
+                std::filesystem::path(filename).stem().string() + ".profile";
+        }
+    }
+
     std::ifstream file(filename);
     if (!file) {
         std::cerr << "Failed to open file: " << filename << "\n";
@@ -37,11 +436,14 @@ int main(int argc, char* argv[]) {
     );
     content.push_back('\0');
 
-    std::error_code EC;
-    llvm::raw_fd_ostream out("output.ll", EC);
-    
-
     try {
+        if (mode == "watch") {
+            return watchFile(filename, options);
+        }
+        if (mode == "link") {
+            return linkFiles(options.inputs, options);
+        }
+
         Lexer lexer(content.c_str(), content.c_str() + content.size());
 
         if (mode == "test-lexer") {
@@ -63,14 +465,78 @@ int main(int argc, char* argv[]) {
         SemanticAnalyzer analyzer;
         analyzer.analyzeProgram(program.get());
 
+        BorrowChecker borrowChecker;
+        borrowChecker.checkProgram(program.get());
+
         if (mode == "test-semantics") {
             std::cout << "Semantic analysis successful!\n";
             return 0;
         }
 
-        CodeGen* codegen = new CodeGen();
+        CallGraph callGraph;
+        callGraph.build(program.get());
+
+        if (mode == "callgraph") {
+            callGraph.print();
+            return 0;
+        }
+
+        if (options.dropDeadFunctions) {
+            for (auto& root : options.roots) {
+                if (!callGraph.node(root)) {
+                    std::cerr << "Unknown root function: " << root << "\n";
+                    return 1;
+                }
+            }
+            removeUnreachableFunctions(program.get(), callGraph, options.roots);
+            callGraph.build(program.get());
+        }
+
+        RangeAnalyzer ranges;
+        ranges.analyzeProgram(program.get());
+
+        EffectAnalyzer effects;
+        effects.analyzeProgram(program.get(), callGraph);
+
+        if (options.jobs > 0 || !options.cacheDir.empty()) {
+            return outputParallel(program.get(), options, filename);
+        }
+
+        CodeGen* codegen = new CodeGen(options.directSSA);
+        Profile profile;
+        if (options.instrument) {
+            codegen->setInstrumentation(options.instrumentPath);
+        } else if (!options.profilePath.empty()) {
+            profile = Profile::load(options.profilePath);
+            codegen->setProfile(&profile);
+        }
         codegen->generate(program.get());
 
+        std::unique_ptr<JIT> jit;
+        std::unique_ptr<llvm::TargetMachine> targetMachine;
+        if (mode == "run") {
+            jit = std::make_unique<JIT>();
+            codegen->getModule()->setDataLayout(jit->getDataLayout());
+            codegen->getModule()->setTargetTriple(jit->getTargetTriple().str());
+        } else if (mode == "output") {
+            targetMachine = createTargetMachine(options.target, options.optLevel);
+            codegen->getModule()->setDataLayout(targetMachine->createDataLayout());
+            codegen->getModule()->setTargetTriple(targetMachine->getTargetTriple().str());
+        }
+
+        if (mode == "run" && options.tiered) {
+            // The tiers pick their own pipelines
+            TieredExecution tiers(*jit, options.tiers);
+            return tiers.runMain(codegen->takeModule(), codegen->takeContext());
+        }
+
+        optimizeModule(*codegen->getModule(), options.optLevel, options.timePasses,
+                       targetMachine.get(), options.emit == EmitKind::Bitcode);
+
+        if (mode == "run") {
+            return jit->runMain(codegen->takeModule(), codegen->takeContext());
+        }
+
         if (mode == "codegen") {
             codegen->dump();
             return 0;
@@ -83,7 +549,7 @@ int main(int argc, char* argv[]) {
         }
 
         if(mode == "output") {
-            codegen->getModule()->print(out, nullptr);
+            writeOutput(*codegen->getModule(), *targetMachine, options, filename);
             return 0;
         }
 
@@ -91,6 +557,9 @@ int main(int argc, char* argv[]) {
         printUsage(argv[0]);
         return 1;
 
+    } catch (const CompileError&) {
+        // Already reported where it was raised
+        return 1;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
         return 1;
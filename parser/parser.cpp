@@ -5,6 +5,7 @@
 #include "../ast/expression.h"
 #include "../token/token.h"
 #include "../ast/function.h"
+#include "../token/compile_error.h"
 #include <cstdint>
 #include <string>
 #include <iostream>
@@ -15,7 +16,7 @@
 
 [[noreturn]] void Parser::error(const std::string& message) {
     std::cerr << "Parse error: " << message << std::endl;
-    exit(1);
+    throw CompileError(message);
 }
 
 Parser::Parser(Lexer& lexer) : lexer(lexer) {}
@@ -29,10 +30,113 @@ Token Parser::consume(Kind expected, const std::string& msg) {
     return tok;
 }
 
+static const std::pair<const char*, Builtin> kBuiltins[] = {
+    {"select", Builtin::Select},
+    {"reduce_add", Builtin::ReduceAdd},
+    {"reduce_mul", Builtin::ReduceMul},
+    {"reduce_min", Builtin::ReduceMin},
+    {"reduce_max", Builtin::ReduceMax},
+    {"any", Builtin::Any},
+    {"all", Builtin::All},
+    {"sqrt", Builtin::Sqrt},
+    {"fma", Builtin::Fma},
+    {"abs", Builtin::Abs},
+    {"min", Builtin::Min},
+    {"max", Builtin::Max},
+    {"popcount", Builtin::Popcount},
+    {"ctz", Builtin::Ctz},
+    {"clz", Builtin::Clz},
+    {"rotl", Builtin::Rotl},
+    {"bswap", Builtin::Bswap},
+    {"find", Builtin::Find},
+    {"print", Builtin::Print},
+    {"println", Builtin::Println},
+    {"read_int", Builtin::ReadInt},
+    {"read_line", Builtin::ReadLine},
+    {"eof", Builtin::Eof},
+};
+
+static const char* builtinName(Builtin builtin) {
+    for (auto& [name, value] : kBuiltins) {
+        if (value == builtin) {
+            return name;
+        }
+    }
+    return "unknown";
+}
+
+bool Parser::isTypeStart() {
+    if (lexer.current().kind == Kind::tok_identifier) {
+        return structNames.count(std::get<std::string>(lexer.current().value)) > 0;
+    }
+    return isType(lexer.current().kind);
+}
+
+// A type keyword or struct name, optionally followed by [] (dynamic array)
+// or [N] (fixed-size array), or vec<T, N>
+Type Parser::parseType() {
+    if (!isTypeStart()) {
+        error("Expected type");
+    }
+    if (lexer.current().kind == Kind::tok_vec) {
+        return parseVectorType();
+    }
+    Type kind = lexer.current().kind == Kind::tok_identifier
+                    ? Type::structNamed(std::get<std::string>(lexer.current().value))
+                    : Type(getTypeKind(lexer.current().kind));
+    lexer.next();
+    if (lexer.current().kind != Kind::tok_lbracket) {
+        return kind;
+    }
+    lexer.next();
+    if (kind == TypeKind::STRING) {
+        error("Array elements must be numbers, bool, char or structs");
+    }
+    int64_t length = 0;
+    if (lexer.current().kind == Kind::tok_int_literal) {
+        length = std::get<int64_t>(lexer.current().value);
+        if (length <= 0) {
+            error("Array length must be positive");
+        }
+        lexer.next();
+    }
+    consume(Kind::tok_rbracket, "Expected ']' after array length");
+    return Type::arrayOf(kind, length);
+}
+
+Type Parser::parseVectorType() {
+    consume(Kind::tok_vec, "Expected 'vec'");
+    if (lexer.current().kind != Kind::tok_operator ||
+        std::get<Operator>(lexer.current().value) != Operator::Less) {
+        error("Expected '<' after 'vec'");
+    }
+    lexer.next();
+    Kind elementKind = lexer.current().kind;
+    if (!isScalarType(elementKind) || elementKind == Kind::tok_string) {
+        error("Vector lanes must be numbers, bool or char");
+    }
+    lexer.next();
+    consume(Kind::tok_comma, "Expected ',' after vector lane type");
+    Token lanesTok = consume(Kind::tok_int_literal, "Expected lane count in vector type");
+    int64_t lanes = std::get<int64_t>(lanesTok.value);
+    if (lanes < 2 || lanes > 64 || (lanes & (lanes - 1)) != 0) {
+        error("Vector lane count must be a power of two from 2 to 64");
+    }
+    if (lexer.current().kind != Kind::tok_operator ||
+        std::get<Operator>(lexer.current().value) != Operator::Greater) {
+        error("Expected '>' after vector lane count");
+    }
+    lexer.next();
+    return Type::vectorOf(getTypeKind(elementKind), lanes);
+}
+
 std::unique_ptr<Program> Parser::parseProgram() {
     auto program = std::unique_ptr<Program>(new Program());
     while (lexer.current().kind != Kind::tok_eof) {
-        program->items.push_back(parseItem());
+        size_t begin = lexer.position();
+        Item* item = parseItem();
+        item->fingerprint = lexer.fingerprint(begin, lexer.position());
+        program->items.push_back(item);
     }
     return program;
 }
@@ -46,9 +150,54 @@ Item* Parser::parseItem() {
         consume(Kind::tok_extern, "Expected 'extern' keyword");
         return parseExtern();
     }
+    if (lexer.current().kind == Kind::tok_struct) {
+        consume(Kind::tok_struct, "Expected 'struct' keyword");
+        return parseStruct();
+    }
     return parseStatement();
 }
 
+// The attributes between the name and the fields are plain identifiers
+StructDecl* Parser::parseStruct() {
+    Token token = consume(Kind::tok_identifier, "Expected identifier after struct");
+    auto* decl = new StructDecl(std::get<std::string>(token.value), {});
+    while (lexer.current().kind == Kind::tok_identifier) {
+        std::string attribute = std::get<std::string>(lexer.current().value);
+        lexer.next();
+        if (attribute == "packed") {
+            decl->packed = true;
+        } else if (attribute == "reorder") {
+            decl->reorder = true;
+        } else if (attribute == "soa") {
+            decl->soa = true;
+        } else if (attribute == "aligned") {
+            consume(Kind::tok_lparen, "Expected '(' after 'aligned'");
+            Token alignTok = consume(Kind::tok_int_literal, "Expected alignment in bytes");
+            decl->align = std::get<int64_t>(alignTok.value);
+            if (decl->align <= 0 || decl->align > 4096 || (decl->align & (decl->align - 1)) != 0) {
+                error("Struct alignment must be a power of two up to 4096");
+            }
+            consume(Kind::tok_rparen, "Expected ')' after alignment");
+        } else {
+            error("Unknown struct attribute " + attribute);
+        }
+    }
+    consume(Kind::tok_lbrace, "Expected '{' after struct name");
+    while (lexer.current().kind != Kind::tok_rbrace) {
+        Kind fieldKind = lexer.current().kind;
+        if (!isScalarType(fieldKind) || fieldKind == Kind::tok_string) {
+            error("Struct fields must be numbers, bool or char");
+        }
+        lexer.next();
+        Token nameTok = consume(Kind::tok_identifier, "Expected field name");
+        consume(Kind::tok_semicolon, "Expected ';' after struct field");
+        decl->fields.push_back({getTypeKind(fieldKind), std::get<std::string>(nameTok.value)});
+    }
+    consume(Kind::tok_rbrace, "Expected '}' after struct fields");
+    structNames.insert(decl->name);
+    return decl;
+}
+
 FunctionDef* Parser::parseFunction() {
     Token token = consume(Kind::tok_identifier, "Expected identifier after def");
     std::string name = std::get<std::string>(token.value);
@@ -56,16 +205,25 @@ FunctionDef* Parser::parseFunction() {
     token = lexer.current();
     std::vector<Param> params;
     while (token.kind != Kind::tok_rparen) {
-        if (isType(token.kind)) {
-            TypeKind type = getTypeKind(token.kind);
+        PassMode mode = PassMode::Value;
+        if (token.kind == Kind::tok_operator && std::get<Operator>(token.value) == Operator::And) {
+            mode = PassMode::Borrow;
             lexer.next();
+            if (lexer.current().kind == Kind::tok_mut) {
+                mode = PassMode::MutBorrow;
+                lexer.next();
+            }
+            token = lexer.current();
+        }
+        if (isTypeStart()) {
+            Type type = parseType();
             token = lexer.current();
             
             if (token.kind != Kind::tok_identifier) {
                 error("Expected identifier after type in function parameter");
             }
             std::string paramName = std::get<std::string>(token.value);
-            params.push_back({type, paramName});
+            params.push_back({type, paramName, mode});
             
             lexer.next();
             token = lexer.current();
@@ -82,16 +240,15 @@ FunctionDef* Parser::parseFunction() {
     }
     consume(Kind::tok_rparen, "Expected ')' after function parameters");
 
-    TypeKind returnType = TypeKind::VOID;
+    Type returnType = TypeKind::VOID;
 
     if (lexer.current().kind == Kind::tok_arrow) {
         lexer.next();
         token = lexer.current();
-        if (!isType(token.kind)) {
+        if (!isTypeStart()) {
             error("Expected type after '->' in function return type");
         }
-        returnType = getTypeKind(token.kind);
-        lexer.next();
+        returnType = parseType();
         token = lexer.current();
     }
 
@@ -115,6 +272,11 @@ BlockStmt* Parser::parseBlock() {
 }
 
 ExternDecl* Parser::parseExtern() {
+    bool isPure = false;
+    if (lexer.current().kind == Kind::tok_pure) {
+        lexer.next();
+        isPure = true;
+    }
     TypeKind returnType = TypeKind::VOID;
     if (isType(lexer.current().kind)) {
         returnType = getTypeKind(lexer.current().kind);
@@ -157,6 +319,7 @@ ExternDecl* Parser::parseExtern() {
     consume(Kind::tok_semicolon, "Expected ';' after extern declaration");
             
     ExternDecl* externDecl = new ExternDecl(name, params, returnType);
+    externDecl->isPure = isPure;
     return externDecl;
 }
 
@@ -198,9 +361,8 @@ ForStmt* Parser::parseFor() {
     // Parse initializer
     Statement* init = nullptr;
     if (lexer.current().kind != Kind::tok_semicolon) {
-        if (isType(lexer.current().kind)) {
-            TypeKind type = getTypeKind(lexer.current().kind);
-            lexer.next();
+        if (isTypeStart()) {
+            Type type = parseType();
             Token nameTok = consume(Kind::tok_identifier, "Expected identifier in for init");
             Expression* initExpr = nullptr;
             if (lexer.current().kind == Kind::tok_operator &&
@@ -237,6 +399,52 @@ ForStmt* Parser::parseFor() {
     return new ForStmt(init, condition, increment, body);
 }
 
+RegionStmt* Parser::parseRegion() {
+    consume(Kind::tok_lbrace, "Expected '{' after 'region'");
+    BlockStmt* body = parseBlock();
+    consume(Kind::tok_rbrace, "Expected '}' after region body");
+
+    return new RegionStmt(body);
+}
+
+SwitchStmt* Parser::parseSwitch() {
+    consume(Kind::tok_lparen, "Expected '(' after 'switch'");
+    Expression* value = parseExpression();
+    consume(Kind::tok_rparen, "Expected ')' after switch value");
+    consume(Kind::tok_lbrace, "Expected '{' after switch value");
+
+    std::vector<SwitchCase> cases;
+    BlockStmt* defaultBlock = nullptr;
+    while (lexer.current().kind != Kind::tok_rbrace) {
+        if (lexer.current().kind == Kind::tok_default) {
+            if (defaultBlock) {
+                error("Switch has more than one default");
+            }
+            lexer.next();
+            consume(Kind::tok_lbrace, "Expected '{' after 'default'");
+            defaultBlock = parseBlock();
+            consume(Kind::tok_rbrace, "Expected '}' after default body");
+            continue;
+        }
+        consume(Kind::tok_case, "Expected 'case' or 'default' in switch");
+        SwitchCase switchCase;
+        while (true) {
+            switchCase.labels.push_back(parseUnary());
+            if (lexer.current().kind != Kind::tok_comma) {
+                break;
+            }
+            lexer.next();
+        }
+        consume(Kind::tok_lbrace, "Expected '{' after case labels");
+        switchCase.body = parseBlock();
+        consume(Kind::tok_rbrace, "Expected '}' after case body");
+        cases.push_back(switchCase);
+    }
+    consume(Kind::tok_rbrace, "Expected '}' after switch cases");
+
+    return new SwitchStmt(value, cases, defaultBlock);
+}
+
 Statement* Parser::parseStatement() {
     if (lexer.current().kind == Kind::tok_if) {
         consume(Kind::tok_if, "Expected 'if'");
@@ -253,6 +461,16 @@ Statement* Parser::parseStatement() {
         return parseFor();
     }
 
+    if (lexer.current().kind == Kind::tok_region) {
+        consume(Kind::tok_region, "Expected 'region'");
+        return parseRegion();
+    }
+
+    if (lexer.current().kind == Kind::tok_switch) {
+        consume(Kind::tok_switch, "Expected 'switch'");
+        return parseSwitch();
+    }
+
     if (lexer.current().kind == Kind::tok_return) {
         consume(Kind::tok_return, "Expected 'return'");
         Expression* value = nullptr;
@@ -263,9 +481,8 @@ Statement* Parser::parseStatement() {
         return new ReturnStmt(value);
     }
 
-    if (isType(lexer.current().kind)) {
-        TypeKind type = getTypeKind(lexer.current().kind);
-        lexer.next();
+    if (isTypeStart()) {
+        Type type = parseType();
         Token nameTok = consume(Kind::tok_identifier, "Expected identifier");
         Expression* init = nullptr;
         if (lexer.current().kind == Kind::tok_operator &&
@@ -298,8 +515,12 @@ Expression* Parser::parseAssignment() {
         
         if (auto* ident = dynamic_cast<IdentifierExpr*>(left)) {
             return new AssignExpr(ident->name, right);
+        } else if (auto* index = dynamic_cast<IndexExpr*>(left)) {
+            return new IndexAssignExpr(index->name, index->index, right);
+        } else if (auto* field = dynamic_cast<FieldExpr*>(left)) {
+            return new FieldAssignExpr(field->name, field->index, field->field, right);
         } else {
-            error("Left side of assignment must be a variable");
+            error("Left side of assignment must be a variable, an array element or a field");
         }
     }
     
@@ -389,13 +610,48 @@ Expression* Parser::parseUnary() {
             Expression* operand = parseUnary();
             return new UnaryExpr(op, operand);
         }
+        if (op == Operator::And) {
+            lexer.next();
+            bool isMutable = false;
+            if (lexer.current().kind == Kind::tok_mut) {
+                lexer.next();
+                isMutable = true;
+            }
+            Token nameTok = consume(Kind::tok_identifier, "Expected variable name after '&'");
+            return new BorrowExpr(std::get<std::string>(nameTok.value), isMutable);
+        }
     }
     return parsePostfix();
 }
 
 Expression* Parser::parsePostfix() {
     Expression* expr = parsePrimary();
-    while (lexer.current().kind == Kind::tok_lparen) {
+    while (lexer.current().kind == Kind::tok_lparen || lexer.current().kind == Kind::tok_lbracket ||
+           lexer.current().kind == Kind::tok_dot) {
+        if (lexer.current().kind == Kind::tok_dot) {
+            lexer.next();
+            Token fieldTok = consume(Kind::tok_identifier, "Expected field name after '.'");
+            std::string field = std::get<std::string>(fieldTok.value);
+            if (auto* ident = dynamic_cast<IdentifierExpr*>(expr)) {
+                expr = new FieldExpr(ident->name, nullptr, field);
+            } else if (auto* index = dynamic_cast<IndexExpr*>(expr)) {
+                expr = new FieldExpr(index->name, index->index, field);
+            } else {
+                error("Can only access fields of struct variables and array elements");
+            }
+            continue;
+        }
+        if (lexer.current().kind == Kind::tok_lbracket) {
+            lexer.next();
+            Expression* index = parseExpression();
+            consume(Kind::tok_rbracket, "Expected ']' after array index");
+            if (auto* ident = dynamic_cast<IdentifierExpr*>(expr)) {
+                expr = new IndexExpr(ident->name, index);
+            } else {
+                error("Can only index array variables");
+            }
+            continue;
+        }
         lexer.next();
         std::vector<Expression*> args;
         while (lexer.current().kind != Kind::tok_rparen) {
@@ -408,7 +664,8 @@ Expression* Parser::parsePostfix() {
         }
         consume(Kind::tok_rparen, "Expected ')' after function arguments");
         if (auto* ident = dynamic_cast<IdentifierExpr*>(expr)) {
-            expr = new CallExpr(ident->name, args);
+            expr = isBuiltinFunction(ident->name) ? parseBuiltin(ident->name, args)
+                                                  : new CallExpr(ident->name, args);
         } else {
             error("Can only call identifiers");
         }
@@ -416,19 +673,125 @@ Expression* Parser::parsePostfix() {
     return expr;
 }
 
+// The array of load() and store(), and the string of slice(), is named,
+// like in an index expression
+static std::string arrayArgument(Expression* arg) {
+    auto* ident = dynamic_cast<IdentifierExpr*>(arg);
+    return ident ? ident->name : std::string();
+}
+
+Expression* Parser::parseBuiltin(const std::string& name, const std::vector<Expression*>& args) {
+    if (name == "shuffle") {
+        if (args.size() < 2) {
+            error("shuffle takes one or two vectors followed by lane numbers");
+        }
+        Expression* second = dynamic_cast<IntExpr*>(args[1]) ? nullptr : args[1];
+        std::vector<int> lanes;
+        for (size_t i = second ? 2 : 1; i < args.size(); ++i) {
+            auto* lane = dynamic_cast<IntExpr*>(args[i]);
+            if (!lane) {
+                error("Shuffle lanes must be integer literals");
+            }
+            lanes.push_back(lane->value);
+        }
+        return new ShuffleExpr(args[0], second, lanes);
+    }
+    if (name == "load") {
+        if (args.size() != 3 || arrayArgument(args[0]).empty()) {
+            error("load takes an array variable, an index and a mask");
+        }
+        return new VectorLoadExpr(arrayArgument(args[0]), args[1], args[2]);
+    }
+    if (name == "slice") {
+        if (args.size() != 3 || arrayArgument(args[0]).empty()) {
+            error("slice takes a string variable, a start and an end");
+        }
+        return new SliceExpr(arrayArgument(args[0]), args[1], args[2]);
+    }
+    if (name == "store") {
+        if ((args.size() != 3 && args.size() != 4) || arrayArgument(args[0]).empty()) {
+            error("store takes an array variable, an index, a vector and optionally a mask");
+        }
+        return new VectorStoreExpr(arrayArgument(args[0]), args[1], args[2],
+                                   args.size() == 4 ? args[3] : nullptr);
+    }
+    for (auto& [builtinName, builtin] : kBuiltins) {
+        if (name == builtinName) {
+            return new BuiltinExpr(builtin, args);
+        }
+    }
+    error("Unknown builtin " + name);
+}
+
 Expression* Parser::parsePrimary() {
     if (lexer.current().kind == Kind::tok_identifier) {
         std::string name = std::get<std::string>(lexer.current().value);
         lexer.next();
+        if (name == "len" && lexer.current().kind == Kind::tok_lparen) {
+            lexer.next();
+            Token arrayTok = consume(Kind::tok_identifier, "Expected array variable in len()");
+            consume(Kind::tok_rparen, "Expected ')' after len argument");
+            return new LengthExpr(std::get<std::string>(arrayTok.value));
+        }
+        if (structNames.count(name) && lexer.current().kind == Kind::tok_lbracket) {
+            lexer.next();
+            Expression* length = parseExpression();
+            consume(Kind::tok_rbracket, "Expected ']' after array length");
+            return new ArrayAllocExpr(Type::structNamed(name), length);
+        }
+        if (structNames.count(name)) {
+            consume(Kind::tok_lparen, "Expected '(' or '[' after struct name in expression");
+            std::vector<Expression*> arguments;
+            while (lexer.current().kind != Kind::tok_rparen) {
+                arguments.push_back(parseExpression());
+                if (lexer.current().kind == Kind::tok_comma) {
+                    lexer.next();
+                } else if (lexer.current().kind != Kind::tok_rparen) {
+                    error("Expected ',' or ')' in struct fields");
+                }
+            }
+            consume(Kind::tok_rparen, "Expected ')' after struct fields");
+            return new StructExpr(name, arguments);
+        }
         return new IdentifierExpr(name);
+    } else if (lexer.current().kind == Kind::tok_vec) {
+        Type type = parseVectorType();
+        consume(Kind::tok_lparen, "Expected '(' after vector type");
+        std::vector<Expression*> elements;
+        while (lexer.current().kind != Kind::tok_rparen) {
+            elements.push_back(parseExpression());
+            if (lexer.current().kind == Kind::tok_comma) {
+                lexer.next();
+            } else if (lexer.current().kind != Kind::tok_rparen) {
+                error("Expected ',' or ')' in vector elements");
+            }
+        }
+        consume(Kind::tok_rparen, "Expected ')' after vector elements");
+        return new VectorExpr(type, elements);
+    } else if (isType(lexer.current().kind)) {
+        TypeKind element = getTypeKind(lexer.current().kind);
+        lexer.next();
+        if (lexer.current().kind == Kind::tok_lparen) {
+            lexer.next();
+            Expression* operand = parseExpression();
+            consume(Kind::tok_rparen, "Expected ')' after converted value");
+            return new CastExpr(element, operand);
+        }
+        consume(Kind::tok_lbracket, "Expected '[' or '(' after type in expression");
+        if (element == TypeKind::STRING) {
+            error("Array elements must be numbers, bool or char");
+        }
+        Expression* length = parseExpression();
+        consume(Kind::tok_rbracket, "Expected ']' after array length");
+        return new ArrayAllocExpr(element, length);
     } else if (lexer.current().kind == Kind::tok_int_literal) {
         int64_t value = std::get<int64_t>(lexer.current().value);
         lexer.next();
-        return new IntExpr(static_cast<int>(value));
+        return new IntExpr(value);
     } else if (lexer.current().kind == Kind::tok_float_literal) {
         double value = std::get<double>(lexer.current().value);
         lexer.next();
-        return new FloatExpr(static_cast<float>(value));
+        return new FloatExpr(value);
     } else if (lexer.current().kind == Kind::tok_bool_literal) {
         bool value = std::get<bool>(lexer.current().value);
         lexer.next();
@@ -478,11 +841,11 @@ void printExpr(Expression* expr, int depth) {
     }
     if (auto* e = dynamic_cast<IntExpr*>(expr)) {
         indent(depth);
-        std::cout << "IntLiteral " << e->value << "\n";
+        std::cout << "IntLiteral " << e->value << " " << type_to_string(e->type) << "\n";
     }
     else if (auto* e = dynamic_cast<FloatExpr*>(expr)) {
         indent(depth);
-        std::cout << "FloatLiteral " << e->value << "\n";
+        std::cout << "FloatLiteral " << e->value << " " << type_to_string(e->type) << "\n";
     }
     else if (auto* e = dynamic_cast<BoolExpr*>(expr)) {
         indent(depth);
@@ -518,6 +881,104 @@ void printExpr(Expression* expr, int depth) {
         std::cout << "AssignExpr " << e->name << "\n";
         printExpr(e->value, depth + 1);
     }
+    else if (auto* e = dynamic_cast<BorrowExpr*>(expr)) {
+        indent(depth);
+        std::cout << "BorrowExpr " << (e->isMutable ? "&mut " : "&") << e->name << "\n";
+    }
+    else if (auto* e = dynamic_cast<IndexExpr*>(expr)) {
+        indent(depth);
+        std::cout << "IndexExpr " << e->name << "\n";
+        printExpr(e->index, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<IndexAssignExpr*>(expr)) {
+        indent(depth);
+        std::cout << "IndexAssignExpr " << e->name << "\n";
+        printExpr(e->index, depth + 1);
+        printExpr(e->value, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        indent(depth);
+        std::cout << "ArrayAllocExpr " << type_to_string(e->element) << "\n";
+        printExpr(e->length, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<LengthExpr*>(expr)) {
+        indent(depth);
+        std::cout << "LengthExpr " << e->name << "\n";
+    }
+    else if (auto* e = dynamic_cast<SliceExpr*>(expr)) {
+        indent(depth);
+        std::cout << "SliceExpr " << e->name << "\n";
+        printExpr(e->start, depth + 1);
+        printExpr(e->end, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<StructExpr*>(expr)) {
+        indent(depth);
+        std::cout << "StructExpr " << e->name << "\n";
+        for (auto* arg : e->arguments) {
+            printExpr(arg, depth + 1);
+        }
+    }
+    else if (auto* e = dynamic_cast<FieldExpr*>(expr)) {
+        indent(depth);
+        std::cout << "FieldExpr " << e->name << "." << e->field << "\n";
+        if (e->index) {
+            printExpr(e->index, depth + 1);
+        }
+    }
+    else if (auto* e = dynamic_cast<FieldAssignExpr*>(expr)) {
+        indent(depth);
+        std::cout << "FieldAssignExpr " << e->name << "." << e->field << "\n";
+        if (e->index) {
+            printExpr(e->index, depth + 1);
+        }
+        printExpr(e->value, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<CastExpr*>(expr)) {
+        indent(depth);
+        std::cout << "CastExpr " << type_to_string(e->target) << "\n";
+        printExpr(e->operand, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<VectorExpr*>(expr)) {
+        indent(depth);
+        std::cout << "VectorExpr " << type_to_string(e->type) << "\n";
+        for (auto* element : e->elements) {
+            printExpr(element, depth + 1);
+        }
+    }
+    else if (auto* e = dynamic_cast<ShuffleExpr*>(expr)) {
+        indent(depth);
+        std::cout << "ShuffleExpr";
+        for (int lane : e->lanes) {
+            std::cout << " " << lane;
+        }
+        std::cout << "\n";
+        printExpr(e->first, depth + 1);
+        if (e->second) {
+            printExpr(e->second, depth + 1);
+        }
+    }
+    else if (auto* e = dynamic_cast<BuiltinExpr*>(expr)) {
+        indent(depth);
+        std::cout << "BuiltinExpr " << builtinName(e->builtin) << "\n";
+        for (auto* arg : e->arguments) {
+            printExpr(arg, depth + 1);
+        }
+    }
+    else if (auto* e = dynamic_cast<VectorLoadExpr*>(expr)) {
+        indent(depth);
+        std::cout << "VectorLoadExpr " << e->name << "\n";
+        printExpr(e->index, depth + 1);
+        printExpr(e->mask, depth + 1);
+    }
+    else if (auto* e = dynamic_cast<VectorStoreExpr*>(expr)) {
+        indent(depth);
+        std::cout << "VectorStoreExpr " << e->name << "\n";
+        printExpr(e->index, depth + 1);
+        printExpr(e->value, depth + 1);
+        if (e->mask) {
+            printExpr(e->mask, depth + 1);
+        }
+    }
     else {
         indent(depth);
         std::cout << "<unknown expr>\n";
@@ -611,6 +1072,31 @@ void printStmt(Statement* stmt, int depth) {
         std::cout << "Body\n";
         printBlock(s->body, depth + 2);
     }
+    else if (auto* s = dynamic_cast<RegionStmt*>(stmt)) {
+        indent(depth);
+        std::cout << "RegionStmt\n";
+        printBlock(s->body, depth + 1);
+    }
+    else if (auto* s = dynamic_cast<SwitchStmt*>(stmt)) {
+        indent(depth);
+        std::cout << "SwitchStmt\n";
+        indent(depth + 1);
+        std::cout << "Value\n";
+        printExpr(s->value, depth + 2);
+        for (auto& switchCase : s->cases) {
+            indent(depth + 1);
+            std::cout << "Case\n";
+            for (auto* label : switchCase.labels) {
+                printExpr(label, depth + 2);
+            }
+            printBlock(switchCase.body, depth + 2);
+        }
+        if (s->defaultBlock) {
+            indent(depth + 1);
+            std::cout << "Default\n";
+            printBlock(s->defaultBlock, depth + 2);
+        }
+    }
     else if (auto* s = dynamic_cast<BlockStmt*>(stmt)) {
         printBlock(s, depth);
     }
@@ -636,6 +1122,10 @@ void printItem(Item* item, int depth) {
         std::cout << "Params\n";
         for (auto& p : f->params) {
             indent(depth + 2);
+            if (p.mode == PassMode::Borrow)
+                std::cout << "&";
+            else if (p.mode == PassMode::MutBorrow)
+                std::cout << "&mut ";
             std::cout << type_to_string(p.type) << " " << p.name << "\n";
         }
 
@@ -645,12 +1135,25 @@ void printItem(Item* item, int depth) {
     }
     else if (auto* e = dynamic_cast<ExternDecl*>(item)) {
         indent(depth);
-        std::cout << "ExternDecl " << e->name << "\n";
+        std::cout << "ExternDecl " << e->name << (e->isPure ? " pure" : "") << "\n";
         for (auto& p : e->params) {
             indent(depth + 1);
             std::cout << type_to_string(p.type) << " " << p.name << "\n";
         }
     }
+    else if (auto* d = dynamic_cast<StructDecl*>(item)) {
+        indent(depth);
+        std::cout << "StructDecl " << d->name << (d->packed ? " packed" : "")
+                  << (d->reorder ? " reorder" : "") << (d->soa ? " soa" : "");
+        if (d->align) {
+            std::cout << " aligned(" << d->align << ")";
+        }
+        std::cout << "\n";
+        for (auto& f : d->fields) {
+            indent(depth + 1);
+            std::cout << type_to_string(f.type) << " " << f.name << "\n";
+        }
+    }
     else if (auto* s = dynamic_cast<Statement*>(item)) {
         printStmt(s, depth);
     }
@@ -7,7 +7,9 @@
 #include "../ast/expression.h"
 #include "../token/token.h"
 #include "../ast/function.h"
+#include "../ast/struct.h"
 #include <memory>
+#include <set>
 
 class Parser {
 public:
@@ -18,20 +20,30 @@ public:
 
 private:
     Lexer& lexer;
+    // Structs declared so far; a struct can only be used after its
+    // declaration
+    std::set<std::string> structNames;
 
     [[noreturn]] void error(const std::string& t_message);
 
     Token consume(Kind t_expected, const std::string& t_msg);
+    // A type keyword or the name of a struct
+    bool isTypeStart();
+    Type parseType();
+    Type parseVectorType();
 
     Item* parseItem();
     FunctionDef* parseFunction();
     ExternDecl* parseExtern();
+    StructDecl* parseStruct();
 
     Statement* parseStatement();
     BlockStmt* parseBlock();
     IfStmt* parseIf();
     WhileStmt* parseWhile();
     ForStmt* parseFor();
+    RegionStmt* parseRegion();
+    SwitchStmt* parseSwitch();
 
     Expression* parseExpression();
     Expression* parseLogicalOr();
@@ -43,5 +55,6 @@ private:
     Expression* parseUnary();
     Expression* parsePostfix();
     Expression* parsePrimary();
+    Expression* parseBuiltin(const std::string& t_name, const std::vector<Expression*>& t_args);
     Expression* parseAssignment();
 };
\ No newline at end of file
@@ -1,17 +1,32 @@
 #pragma once
 #include "../token/token.h"
+#include <string>
 
 inline bool isOperator(Operator t_op) {
     return t_op == Operator::Plus || t_op == Operator::Minus || t_op == Operator::Multiply || t_op == Operator::Divide;
 }
 
+// Keywords of the scalar types
+inline bool isScalarType(Kind t_kind) {
+    return t_kind == Kind::tok_int || t_kind == Kind::tok_float || t_kind == Kind::tok_bool || t_kind == Kind::tok_char || t_kind == Kind::tok_string ||
+           (t_kind >= Kind::tok_i8 && t_kind <= Kind::tok_f64);
+}
+
 inline bool isType(Kind t_kind) {
-    return t_kind == Kind::tok_int || t_kind == Kind::tok_float || t_kind == Kind::tok_bool || t_kind == Kind::tok_char || t_kind == Kind::tok_string;
+    return isScalarType(t_kind) || t_kind == Kind::tok_vec;
 }
 
 inline TypeKind getTypeKind(Kind t_kind) {
-    if (t_kind == Kind::tok_int) return TypeKind::INT;
-    if (t_kind == Kind::tok_float) return TypeKind::FLOAT;
+    if (t_kind == Kind::tok_int || t_kind == Kind::tok_i32) return TypeKind::INT;
+    if (t_kind == Kind::tok_float || t_kind == Kind::tok_f32) return TypeKind::FLOAT;
+    if (t_kind == Kind::tok_i8) return TypeKind::I8;
+    if (t_kind == Kind::tok_i16) return TypeKind::I16;
+    if (t_kind == Kind::tok_i64) return TypeKind::I64;
+    if (t_kind == Kind::tok_u8) return TypeKind::U8;
+    if (t_kind == Kind::tok_u16) return TypeKind::U16;
+    if (t_kind == Kind::tok_u32) return TypeKind::U32;
+    if (t_kind == Kind::tok_u64) return TypeKind::U64;
+    if (t_kind == Kind::tok_f64) return TypeKind::F64;
     if (t_kind == Kind::tok_bool) return TypeKind::BOOL;
     if (t_kind == Kind::tok_char) return TypeKind::CHAR;
     if (t_kind == Kind::tok_string) return TypeKind::STRING;
@@ -22,12 +37,42 @@ inline bool isLiteral(Kind t_kind) {
     return t_kind == Kind::tok_int_literal || t_kind == Kind::tok_float_literal || t_kind == Kind::tok_bool_literal || t_kind == Kind::tok_char_literal;
 }
 
-inline std::string type_to_string(TypeKind t_type) {
-    switch (t_type) {
+// Names the parser turns into builtin expressions instead of calls
+inline bool isBuiltinFunction(const std::string& t_name) {
+    return t_name == "len" || t_name == "shuffle" || t_name == "select" ||
+           t_name == "reduce_add" || t_name == "reduce_mul" || t_name == "reduce_min" ||
+           t_name == "reduce_max" || t_name == "any" || t_name == "all" ||
+           t_name == "load" || t_name == "store" || t_name == "sqrt" || t_name == "fma" ||
+           t_name == "abs" || t_name == "min" || t_name == "max" || t_name == "popcount" ||
+           t_name == "ctz" || t_name == "clz" || t_name == "rotl" || t_name == "bswap" ||
+           t_name == "find" || t_name == "slice" || t_name == "print" || t_name == "println" ||
+           t_name == "read_int" || t_name == "read_line" || t_name == "eof";
+}
+
+inline std::string type_to_string(const Type& t_type) {
+    if (t_type.isArray()) {
+        return type_to_string(t_type.elementType()) + "[" +
+               (t_type.length ? std::to_string(t_type.length) : "") + "]";
+    }
+    if (t_type.isVector()) {
+        return "vec<" + type_to_string(t_type.element) + ", " + std::to_string(t_type.length) + ">";
+    }
+    if (t_type.isStruct()) {
+        return t_type.name;
+    }
+    switch (t_type.kind) {
         case TypeKind::INT: return "int";
         case TypeKind::FLOAT: return "float";
         case TypeKind::BOOL: return "bool";
         case TypeKind::CHAR: return "char";
+        case TypeKind::I8: return "i8";
+        case TypeKind::I16: return "i16";
+        case TypeKind::I64: return "i64";
+        case TypeKind::U8: return "u8";
+        case TypeKind::U16: return "u16";
+        case TypeKind::U32: return "u32";
+        case TypeKind::U64: return "u64";
+        case TypeKind::F64: return "f64";
         case TypeKind::VOID: return "void";
         case TypeKind::STRING: return "string";
         default: return "unknown";
@@ -0,0 +1,620 @@
+#include "borrow_checker.h"
+#include "../token/compile_error.h"
+#include <iostream>
+#include <cstdlib>
+
+static bool mentions(Expression* expr, const std::string& name);
+
+static bool mentions(Statement* stmt, const std::string& name)
+{
+    if (!stmt)
+        return false;
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        for (auto& s : block->statements)
+            if (mentions(s, name))
+                return true;
+        return false;
+    }
+    if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt))
+        return mentions(exprStmt->expr, name);
+    if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt))
+        return mentions(varDecl->initializer, name);
+    if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt))
+        return mentions(returnStmt->value, name);
+    if (auto ifStmt = dynamic_cast<IfStmt*>(stmt))
+        return mentions(ifStmt->condition, name) || mentions(ifStmt->thenBlock, name) ||
+               mentions(ifStmt->elseBlock, name);
+    if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt))
+        return mentions(whileStmt->condition, name) || mentions(whileStmt->body, name);
+    if (auto forStmt = dynamic_cast<ForStmt*>(stmt))
+        return mentions(forStmt->init, name) || mentions(forStmt->condition, name) ||
+               mentions(forStmt->increment, name) || mentions(forStmt->body, name);
+    if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt))
+        return mentions(regionStmt->body, name);
+    if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        for (auto& switchCase : switchStmt->cases)
+            if (mentions(switchCase.body, name))
+                return true;
+        return mentions(switchStmt->value, name) || mentions(switchStmt->defaultBlock, name);
+    }
+    return false;
+}
+
+static bool mentions(Expression* expr, const std::string& name)
+{
+    if (!expr)
+        return false;
+    if (auto ident = dynamic_cast<IdentifierExpr*>(expr))
+        return ident->name == name;
+    if (auto borrow = dynamic_cast<BorrowExpr*>(expr))
+        return borrow->name == name;
+    if (auto assign = dynamic_cast<AssignExpr*>(expr))
+        return assign->name == name || mentions(assign->value, name);
+    if (auto binary = dynamic_cast<BinaryExpr*>(expr))
+        return mentions(binary->left, name) || mentions(binary->right, name);
+    if (auto unary = dynamic_cast<UnaryExpr*>(expr))
+        return mentions(unary->operand, name);
+    if (auto cast = dynamic_cast<CastExpr*>(expr))
+        return mentions(cast->operand, name);
+    if (auto index = dynamic_cast<IndexExpr*>(expr))
+        return index->name == name || mentions(index->index, name);
+    if (auto indexAssign = dynamic_cast<IndexAssignExpr*>(expr))
+        return indexAssign->name == name || mentions(indexAssign->index, name) ||
+               mentions(indexAssign->value, name);
+    if (auto length = dynamic_cast<LengthExpr*>(expr))
+        return length->name == name;
+    if (auto slice = dynamic_cast<SliceExpr*>(expr))
+        return slice->name == name || mentions(slice->start, name) || mentions(slice->end, name);
+    if (auto alloc = dynamic_cast<ArrayAllocExpr*>(expr))
+        return mentions(alloc->length, name);
+    if (auto structExpr = dynamic_cast<StructExpr*>(expr)) {
+        for (auto& arg : structExpr->arguments)
+            if (mentions(arg, name))
+                return true;
+    }
+    if (auto field = dynamic_cast<FieldExpr*>(expr))
+        return field->name == name || mentions(field->index, name);
+    if (auto fieldAssign = dynamic_cast<FieldAssignExpr*>(expr))
+        return fieldAssign->name == name || mentions(fieldAssign->index, name) ||
+               mentions(fieldAssign->value, name);
+    if (auto vector = dynamic_cast<VectorExpr*>(expr)) {
+        for (auto& element : vector->elements)
+            if (mentions(element, name))
+                return true;
+    }
+    if (auto shuffle = dynamic_cast<ShuffleExpr*>(expr))
+        return mentions(shuffle->first, name) || mentions(shuffle->second, name);
+    if (auto builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        for (auto& arg : builtin->arguments)
+            if (mentions(arg, name))
+                return true;
+    }
+    if (auto load = dynamic_cast<VectorLoadExpr*>(expr))
+        return load->name == name || mentions(load->index, name) || mentions(load->mask, name);
+    if (auto store = dynamic_cast<VectorStoreExpr*>(expr))
+        return store->name == name || mentions(store->index, name) ||
+               mentions(store->value, name) || mentions(store->mask, name);
+    if (auto call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->arguments)
+            if (mentions(arg, name))
+                return true;
+    }
+    return false;
+}
+
+void BorrowChecker::error(const std::string& message)
+{
+    std::cerr << "Borrow Error: " << message << " in " << m_currentFunction << std::endl;
+    throw CompileError(message);
+}
+
+void BorrowChecker::report(const std::string& message)
+{
+    if (m_reportErrors)
+        error(message);
+}
+
+void BorrowChecker::checkProgram(Program* program)
+{
+    std::set<std::string> functions;
+    for (auto& item : program->items)
+        if (auto func = dynamic_cast<FunctionDef*>(item))
+            functions.insert(func->name);
+    checkFunctions(program, functions);
+}
+
+void BorrowChecker::checkFunctions(Program* program, const std::set<std::string>& functions)
+{
+    for (auto& item : program->items) {
+        if (auto func = dynamic_cast<FunctionDef*>(item)) {
+            // Functions without parameters need an entry too, or calls of
+            // them are never seen as tail calls
+            std::vector<PassMode>& modes = m_functions[func->name];
+            for (auto& p : func->params)
+                modes.push_back(p.mode);
+        } else if (auto ext = dynamic_cast<ExternDecl*>(item)) {
+            m_externs.insert(ext->name);
+        }
+    }
+
+    for (auto& item : program->items) {
+        auto func = dynamic_cast<FunctionDef*>(item);
+        if (func && functions.count(func->name))
+            checkFunction(func);
+    }
+}
+
+void BorrowChecker::checkFunction(FunctionDef* func)
+{
+    m_currentFunction = func->name;
+    m_tailRecursive = false;
+    m_state.clear();
+    m_state.emplace_back();
+
+    std::vector<std::string> ownedParams;
+    for (auto& param : func->params) {
+        if (!isOwnedType(param.type))
+            continue;
+        m_state.back()[param.name] = Var{param.mode, VarState::Live};
+        if (param.mode == PassMode::Value)
+            ownedParams.push_back(param.name);
+    }
+
+    checkBlock(func->body, false);
+
+    // Owned values arrive uniquely owned, & borrows are immutable for the
+    // duration of the call and &mut borrows are exclusive: in every case no
+    // other live pointer writes the memory behind the parameter.
+    for (auto& param : func->params) {
+        if (isOwnedType(param.type))
+            param.noalias = true;
+    }
+
+    placeDrops(func->body, ownedParams);
+    func->tailRecursive = m_tailRecursive;
+    m_state.clear();
+}
+
+bool BorrowChecker::checkBlock(BlockStmt* block, bool newScope)
+{
+    if (newScope)
+        m_state.emplace_back();
+
+    bool diverges = false;
+    for (auto& stmt : block->statements) {
+        if (checkStatement(stmt)) {
+            diverges = true;
+            break;
+        }
+    }
+
+    if (newScope)
+        m_state.pop_back();
+    return diverges;
+}
+
+bool BorrowChecker::checkStatement(Statement* stmt)
+{
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        return checkBlock(block, true);
+    }
+    if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        checkExpression(exprStmt->expr, Access::Read);
+        return false;
+    }
+    if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
+        if (varDecl->initializer)
+            checkExpression(varDecl->initializer, Access::Move);
+        if (isOwnedType(varDecl->kind)) {
+            // Fixed-size arrays start out zeroed
+            VarState state = varDecl->initializer || varDecl->kind.isFixedArray()
+                                 ? VarState::Live : VarState::Uninit;
+            m_state.back()[varDecl->name] = Var{PassMode::Value, state, m_region};
+        } else {
+            // Shadows any owned variable of the same name
+            m_state.back().erase(varDecl->name);
+        }
+        return false;
+    }
+    if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt)) {
+        if (returnStmt->value) {
+            checkEscape(returnStmt->value, 0, "the return value");
+            checkExpression(returnStmt->value, Access::Move);
+            auto call = dynamic_cast<CallExpr*>(returnStmt->value);
+            returnStmt->tailCall = call && isTailCall(call);
+            if (returnStmt->tailCall && call->callee == m_currentFunction)
+                m_tailRecursive = true;
+        }
+        return true;
+    }
+    if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        checkExpression(ifStmt->condition, Access::Read);
+        State before = m_state;
+        bool thenDiverges = checkBlock(ifStmt->thenBlock, true);
+        State afterThen = m_state;
+        m_state = before;
+        bool elseDiverges = ifStmt->elseBlock ? checkBlock(ifStmt->elseBlock, true) : false;
+        if (elseDiverges && !thenDiverges)
+            m_state = afterThen;
+        else if (!thenDiverges)
+            m_state = merge(afterThen, m_state);
+        return thenDiverges && elseDiverges;
+    }
+    if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        checkLoop(whileStmt->condition, whileStmt->body, true, nullptr);
+        return false;
+    }
+    if (auto forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        m_state.emplace_back();
+        if (forStmt->init)
+            checkStatement(forStmt->init);
+        // The body shares the for scope, like in codegen
+        checkLoop(forStmt->condition, forStmt->body, false, forStmt->increment);
+        m_state.pop_back();
+        return false;
+    }
+    if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        ++m_region;
+        bool diverges = checkBlock(regionStmt->body, true);
+        --m_region;
+        return diverges;
+    }
+    if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        checkExpression(switchStmt->value, Access::Read);
+        // Like an if with one branch per case; without a default the value
+        // can also match no case at all
+        State before = m_state;
+        State after;
+        bool fallsThrough = false;
+        auto branch = [&](BlockStmt* body) {
+            m_state = before;
+            if (!checkBlock(body, true)) {
+                after = fallsThrough ? merge(after, m_state) : m_state;
+                fallsThrough = true;
+            }
+        };
+        for (auto& switchCase : switchStmt->cases)
+            branch(switchCase.body);
+        if (switchStmt->defaultBlock) {
+            branch(switchStmt->defaultBlock);
+        } else {
+            after = fallsThrough ? merge(after, before) : before;
+            fallsThrough = true;
+        }
+        m_state = fallsThrough ? after : before;
+        return !fallsThrough;
+    }
+    return false;
+}
+
+// Iterates the loop to a fixpoint with errors suppressed, so values moved
+// in one iteration are seen as moved at the top of the next, then checks
+// the body once more against that state and reports.
+void BorrowChecker::checkLoop(Expression* condition, BlockStmt* body, bool newScope,
+                              Expression* increment)
+{
+    auto runBody = [&](State& exit) {
+        if (condition)
+            checkExpression(condition, Access::Read);
+        exit = m_state;
+        bool diverges = checkBlock(body, newScope);
+        if (!diverges && increment)
+            checkExpression(increment, Access::Read);
+        return diverges;
+    };
+
+    State entry = m_state;
+    State head = entry;
+    State exit;
+    bool reportErrors = m_reportErrors;
+    m_reportErrors = false;
+    for (;;) {
+        m_state = head;
+        bool diverges = runBody(exit);
+        State next = diverges ? head : merge(entry, m_state);
+        if (next == head)
+            break;
+        head = next;
+    }
+    m_reportErrors = reportErrors;
+
+    m_state = head;
+    runBody(exit);
+    m_state = exit;
+}
+
+void BorrowChecker::checkExpression(Expression* expr, Access access)
+{
+    if (!expr)
+        return;
+
+    if (auto ident = dynamic_cast<IdentifierExpr*>(expr)) {
+        ident->moved = access == Access::Move && lookup(ident->name);
+        use(ident->name, access);
+    }
+    else if (auto borrow = dynamic_cast<BorrowExpr*>(expr)) {
+        report("Borrow of " + borrow->name + " can only be passed as a call argument");
+    }
+    else if (auto assign = dynamic_cast<AssignExpr*>(expr)) {
+        if (Var* var = lookup(assign->name))
+            checkEscape(assign->value, var->region, assign->name);
+        checkExpression(assign->value, Access::Move);
+        if (Var* var = lookup(assign->name)) {
+            if (var->mode != PassMode::Value)
+                report("Cannot assign to borrowed parameter " + assign->name);
+            var->state = VarState::Live;
+        }
+    }
+    else if (auto binary = dynamic_cast<BinaryExpr*>(expr)) {
+        checkExpression(binary->left, Access::Read);
+        checkExpression(binary->right, Access::Read);
+    }
+    else if (auto unary = dynamic_cast<UnaryExpr*>(expr)) {
+        checkExpression(unary->operand, Access::Read);
+    }
+    else if (auto cast = dynamic_cast<CastExpr*>(expr)) {
+        checkExpression(cast->operand, Access::Read);
+    }
+    else if (auto index = dynamic_cast<IndexExpr*>(expr)) {
+        checkExpression(index->index, Access::Read);
+        use(index->name, Access::Read);
+    }
+    else if (auto indexAssign = dynamic_cast<IndexAssignExpr*>(expr)) {
+        checkExpression(indexAssign->index, Access::Read);
+        checkExpression(indexAssign->value, Access::Read);
+        if (Var* var = lookup(indexAssign->name)) {
+            if (var->mode == PassMode::Borrow)
+                report("Cannot write to " + indexAssign->name + ", it is a shared borrow");
+        }
+        use(indexAssign->name, Access::Read);
+    }
+    else if (auto length = dynamic_cast<LengthExpr*>(expr)) {
+        use(length->name, Access::Read);
+    }
+    else if (auto slice = dynamic_cast<SliceExpr*>(expr)) {
+        checkExpression(slice->start, Access::Read);
+        checkExpression(slice->end, Access::Read);
+        use(slice->name, Access::Read);
+    }
+    else if (auto alloc = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        checkExpression(alloc->length, Access::Read);
+    }
+    else if (auto structExpr = dynamic_cast<StructExpr*>(expr)) {
+        for (auto& arg : structExpr->arguments)
+            checkExpression(arg, Access::Read);
+    }
+    else if (auto field = dynamic_cast<FieldExpr*>(expr)) {
+        checkExpression(field->index, Access::Read);
+        use(field->name, Access::Read);
+    }
+    else if (auto fieldAssign = dynamic_cast<FieldAssignExpr*>(expr)) {
+        checkExpression(fieldAssign->index, Access::Read);
+        checkExpression(fieldAssign->value, Access::Read);
+        if (Var* var = lookup(fieldAssign->name)) {
+            if (var->mode == PassMode::Borrow)
+                report("Cannot write to " + fieldAssign->name + ", it is a shared borrow");
+        }
+        use(fieldAssign->name, Access::Read);
+    }
+    else if (auto vector = dynamic_cast<VectorExpr*>(expr)) {
+        for (auto& element : vector->elements)
+            checkExpression(element, Access::Read);
+    }
+    else if (auto shuffle = dynamic_cast<ShuffleExpr*>(expr)) {
+        checkExpression(shuffle->first, Access::Read);
+        checkExpression(shuffle->second, Access::Read);
+    }
+    else if (auto builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        for (auto& arg : builtin->arguments)
+            checkExpression(arg, Access::Read);
+    }
+    else if (auto load = dynamic_cast<VectorLoadExpr*>(expr)) {
+        checkExpression(load->index, Access::Read);
+        checkExpression(load->mask, Access::Read);
+        use(load->name, Access::Read);
+    }
+    else if (auto store = dynamic_cast<VectorStoreExpr*>(expr)) {
+        checkExpression(store->index, Access::Read);
+        checkExpression(store->value, Access::Read);
+        checkExpression(store->mask, Access::Read);
+        if (Var* var = lookup(store->name)) {
+            if (var->mode == PassMode::Borrow)
+                report("Cannot write to " + store->name + ", it is a shared borrow");
+        }
+        use(store->name, Access::Read);
+    }
+    else if (auto call = dynamic_cast<CallExpr*>(expr)) {
+        checkCall(call);
+    }
+}
+
+void BorrowChecker::checkCall(CallExpr* call)
+{
+    bool isExtern = m_externs.count(call->callee) > 0;
+    const std::vector<PassMode>* modes = nullptr;
+    if (m_functions.count(call->callee))
+        modes = &m_functions[call->callee];
+
+    // Direct borrows and moves of each argument, for aliasing conflicts
+    std::vector<std::pair<std::string, Access>> direct(call->arguments.size());
+
+    for (size_t i = 0; i < call->arguments.size(); ++i) {
+        Expression* arg = call->arguments[i];
+        if (auto borrow = dynamic_cast<BorrowExpr*>(arg)) {
+            Access access = borrow->isMutable ? Access::Mutable : Access::Shared;
+            use(borrow->name, access);
+            direct[i] = {borrow->name, access};
+        } else if (auto ident = dynamic_cast<IdentifierExpr*>(arg); ident && lookup(ident->name)) {
+            // Externs never take ownership
+            Access access = isExtern ? Access::Shared : Access::Move;
+            if (modes && i < modes->size() && (*modes)[i] != PassMode::Value)
+                access = Access::Shared;
+            ident->moved = access == Access::Move;
+            if (ident->moved)
+                checkEscape(ident, 0, "a parameter of " + call->callee);
+            use(ident->name, access);
+            direct[i] = {ident->name, access};
+        } else {
+            checkExpression(arg, Access::Move);
+        }
+    }
+
+    for (size_t i = 0; i < direct.size(); ++i) {
+        const std::string& name = direct[i].first;
+        Access access = direct[i].second;
+        if (name.empty())
+            continue;
+        for (size_t j = 0; j < call->arguments.size(); ++j) {
+            if (j == i || !mentions(call->arguments[j], name))
+                continue;
+            if (access == Access::Mutable)
+                report("Mutable borrow of " + name + " conflicts with another use in the call to " + call->callee);
+            if (access == Access::Move && direct[j].first == name &&
+                (direct[j].second == Access::Shared || direct[j].second == Access::Mutable))
+                report("Cannot move " + name + " while it is borrowed in the call to " + call->callee);
+        }
+    }
+}
+
+// Values created in a region die with its arena, so they can only move into
+// variables of the same region or of one nested inside it
+void BorrowChecker::checkEscape(Expression* value, int region, const std::string& target)
+{
+    auto ident = dynamic_cast<IdentifierExpr*>(value);
+    Var* var = ident ? lookup(ident->name) : nullptr;
+    if (var && var->region > region)
+        report("Cannot move " + ident->name + " into " + target + ", it lives in a region");
+}
+
+// By-value arguments are moved or freshly built on the heap, so only a
+// borrow can point into the frame: of an owned local, or of an owned
+// parameter the caller frees on return. Borrowed parameters point into an
+// older frame and can be passed on.
+bool BorrowChecker::isTailCall(CallExpr* call)
+{
+    auto modes = m_functions.find(call->callee);
+    if (modes == m_functions.end())
+        return false;
+    for (size_t i = 0; i < call->arguments.size() && i < modes->second.size(); ++i) {
+        if (modes->second[i] == PassMode::Value)
+            continue;
+        std::string name;
+        if (auto borrow = dynamic_cast<BorrowExpr*>(call->arguments[i]))
+            name = borrow->name;
+        else if (auto ident = dynamic_cast<IdentifierExpr*>(call->arguments[i]))
+            name = ident->name;
+        else
+            return false;
+        Var* var = lookup(name);
+        if (var && var->mode == PassMode::Value)
+            return false;
+    }
+    return true;
+}
+
+BorrowChecker::Var* BorrowChecker::lookup(const std::string& name)
+{
+    for (auto it = m_state.rbegin(); it != m_state.rend(); ++it) {
+        auto found = it->find(name);
+        if (found != it->end())
+            return &found->second;
+    }
+    return nullptr;
+}
+
+void BorrowChecker::use(const std::string& name, Access access)
+{
+    Var* var = lookup(name);
+    if (!var)
+        return;
+
+    switch (var->state) {
+        case VarState::Moved:
+            report("Use of moved value " + name);
+            break;
+        case VarState::MaybeMoved:
+            report("Use of possibly moved value " + name);
+            break;
+        case VarState::Uninit:
+            report("Use of uninitialized value " + name);
+            break;
+        case VarState::Live:
+            break;
+    }
+
+    if (access == Access::Mutable && var->mode == PassMode::Borrow)
+        report("Cannot borrow " + name + " as mutable, it is a shared borrow");
+    if (access == Access::Move) {
+        if (var->mode != PassMode::Value)
+            report("Cannot move out of borrowed parameter " + name);
+        var->state = VarState::Moved;
+    }
+}
+
+BorrowChecker::State BorrowChecker::merge(const State& a, const State& b)
+{
+    State result = a;
+    for (size_t i = 0; i < result.size() && i < b.size(); ++i) {
+        for (auto& [name, var] : result[i]) {
+            auto other = b[i].find(name);
+            if (other != b[i].end() && other->second.state != var.state)
+                var.state = VarState::MaybeMoved;
+        }
+    }
+    return result;
+}
+
+// Drops each owned local after the last statement of its declaring block
+// that mentions it. Uses nested inside loops or branches pin the drop to the
+// enclosing statement, so a value is never released while still reachable.
+void BorrowChecker::placeDrops(BlockStmt* block, const std::vector<std::string>& params)
+{
+    auto& stmts = block->statements;
+
+    for (auto& name : params) {
+        for (size_t j = stmts.size(); j-- > 0;) {
+            if (mentions(stmts[j], name)) {
+                stmts[j]->dropsAfter.push_back(name);
+                break;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < stmts.size(); ++k) {
+        auto varDecl = dynamic_cast<VarDeclStmt*>(stmts[k]);
+        if (varDecl && isOwnedType(varDecl->kind)) {
+            size_t last = k;
+            for (size_t j = stmts.size(); j-- > k + 1;) {
+                if (mentions(stmts[j], varDecl->name)) {
+                    last = j;
+                    break;
+                }
+            }
+            stmts[last]->dropsAfter.push_back(varDecl->name);
+            varDecl->hasDropPoint = true;
+        }
+        placeDropsIn(stmts[k]);
+    }
+}
+
+void BorrowChecker::placeDropsIn(Statement* stmt)
+{
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        placeDrops(block, {});
+    } else if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        placeDrops(ifStmt->thenBlock, {});
+        if (ifStmt->elseBlock)
+            placeDrops(ifStmt->elseBlock, {});
+    } else if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        placeDrops(whileStmt->body, {});
+    } else if (auto forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        placeDrops(forStmt->body, {});
+    } else if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        placeDrops(regionStmt->body, {});
+    } else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        for (auto& switchCase : switchStmt->cases)
+            placeDrops(switchCase.body, {});
+        if (switchStmt->defaultBlock)
+            placeDrops(switchStmt->defaultBlock, {});
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../ast/program.h"
+#include "../ast/function.h"
+
+// Ownership and borrow checking for owned types (see isOwnedType). Runs
+// after SemanticAnalyzer, so types and pass modes are already consistent.
+//
+// Rules:
+//  - initializing, assigning, returning or passing an owned value to a
+//    by-value parameter moves it; the source is unusable until reassigned
+//  - extern functions only ever borrow their owned arguments
+//  - borrows (&x, &mut x) live for a single call; &mut x may not be combined
+//    with any other use of x in the same call, and x may not be moved while
+//    borrowed
+//  - borrowed parameters can be read and reborrowed, never moved or assigned;
+//    elements of a shared borrow can't be written either
+//  - owned locals declared in a region block can't be returned, moved into
+//    a variable declared outside it or passed to a by-value parameter; they
+//    can still be borrowed
+//
+// On success it records the facts codegen exploits: owned parameters are
+// marked noalias, each owned local gets a drop point after its last use,
+// uses that move a value out are flagged, and so are returns of calls that
+// only borrow the caller's own borrowed parameters (tail calls).
+class BorrowChecker {
+public:
+    void checkProgram(Program* t_program);
+    // Only checks (and annotates) the bodies of t_functions
+    void checkFunctions(Program* t_program, const std::set<std::string>& t_functions);
+
+private:
+    enum class VarState { Live, Moved, MaybeMoved, Uninit };
+
+    struct Var {
+        PassMode mode;
+        VarState state;
+        // Number of region blocks around the declaration
+        int region = 0;
+
+        bool operator==(const Var& t_other) const {
+            return mode == t_other.mode && state == t_other.state && region == t_other.region;
+        }
+    };
+
+    enum class Access { Read, Move, Shared, Mutable };
+
+    using State = std::vector<std::map<std::string, Var>>;
+
+    [[noreturn]] void error(const std::string& t_message);
+    void report(const std::string& t_message);
+
+    void checkFunction(FunctionDef* t_func);
+    bool checkBlock(BlockStmt* t_block, bool t_newScope);
+    bool checkStatement(Statement* t_stmt);
+    void checkLoop(Expression* t_condition, BlockStmt* t_body, bool t_newScope,
+                   Expression* t_increment);
+    void checkExpression(Expression* t_expr, Access t_access);
+    void checkCall(CallExpr* t_call);
+    // Reports moving the variable t_value names out of its region into
+    // t_target, which lives t_region regions deep
+    void checkEscape(Expression* t_value, int t_region, const std::string& t_target);
+    // Whether returning t_call can be a tail call: the callee is defined
+    // here and none of its borrows point into the caller's frame
+    bool isTailCall(CallExpr* t_call);
+
+    Var* lookup(const std::string& t_name);
+    void use(const std::string& t_name, Access t_access);
+    static State merge(const State& t_a, const State& t_b);
+
+    void placeDrops(BlockStmt* t_block, const std::vector<std::string>& t_params);
+    void placeDropsIn(Statement* t_stmt);
+
+    State m_state;
+    std::map<std::string, std::vector<PassMode>> m_functions;
+    std::set<std::string> m_externs;
+    std::string m_currentFunction;
+    int m_region = 0;
+    // A return of the current function calls it again as a tail call
+    bool m_tailRecursive = false;
+    // Cleared while iterating loops to a fixpoint
+    bool m_reportErrors = true;
+};
@@ -0,0 +1,279 @@
+#include "call_graph.h"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+void CallGraph::build(Program* program)
+{
+    m_nodes.clear();
+    m_order.clear();
+    m_sccs.clear();
+
+    for (auto& item : program->items) {
+        CallGraphNode node;
+        if (auto func = dynamic_cast<FunctionDef*>(item)) {
+            node.name = func->name;
+        } else if (auto ext = dynamic_cast<ExternDecl*>(item)) {
+            node.name = ext->name;
+            node.isExtern = true;
+        } else {
+            continue;
+        }
+        node.decl = item;
+        m_order.push_back(node.name);
+        m_nodes.emplace(node.name, node);
+    }
+
+    for (auto& item : program->items) {
+        if (auto func = dynamic_cast<FunctionDef*>(item)) {
+            collectCalls(m_nodes[func->name], func->body);
+        }
+    }
+
+    computeSCCs();
+}
+
+void CallGraph::collectCalls(CallGraphNode& node, Statement* stmt)
+{
+    if (!stmt)
+        return;
+
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        for (auto& s : block->statements)
+            collectCalls(node, s);
+    }
+    else if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        collectCalls(node, exprStmt->expr);
+    }
+    else if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
+        collectCalls(node, varDecl->initializer);
+    }
+    else if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt)) {
+        collectCalls(node, returnStmt->value);
+    }
+    else if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        collectCalls(node, ifStmt->condition);
+        collectCalls(node, ifStmt->thenBlock);
+        collectCalls(node, ifStmt->elseBlock);
+    }
+    else if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        collectCalls(node, whileStmt->condition);
+        collectCalls(node, whileStmt->body);
+    }
+    else if (auto forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        collectCalls(node, forStmt->init);
+        collectCalls(node, forStmt->condition);
+        collectCalls(node, forStmt->increment);
+        collectCalls(node, forStmt->body);
+    }
+    else if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        collectCalls(node, regionStmt->body);
+    }
+    else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        collectCalls(node, switchStmt->value);
+        for (auto& switchCase : switchStmt->cases)
+            collectCalls(node, switchCase.body);
+        collectCalls(node, switchStmt->defaultBlock);
+    }
+}
+
+void CallGraph::collectCalls(CallGraphNode& node, Expression* expr)
+{
+    if (!expr)
+        return;
+
+    if (auto call = dynamic_cast<CallExpr*>(expr)) {
+        node.callSites.push_back(call);
+        if (m_nodes.count(call->callee) &&
+            std::find(node.callees.begin(), node.callees.end(), call->callee) == node.callees.end()) {
+            node.callees.push_back(call->callee);
+        }
+        for (auto& arg : call->arguments)
+            collectCalls(node, arg);
+    }
+    else if (auto binary = dynamic_cast<BinaryExpr*>(expr)) {
+        collectCalls(node, binary->left);
+        collectCalls(node, binary->right);
+    }
+    else if (auto unary = dynamic_cast<UnaryExpr*>(expr)) {
+        collectCalls(node, unary->operand);
+    }
+    else if (auto cast = dynamic_cast<CastExpr*>(expr)) {
+        collectCalls(node, cast->operand);
+    }
+    else if (auto assign = dynamic_cast<AssignExpr*>(expr)) {
+        collectCalls(node, assign->value);
+    }
+    else if (auto index = dynamic_cast<IndexExpr*>(expr)) {
+        collectCalls(node, index->index);
+    }
+    else if (auto indexAssign = dynamic_cast<IndexAssignExpr*>(expr)) {
+        collectCalls(node, indexAssign->index);
+        collectCalls(node, indexAssign->value);
+    }
+    else if (auto alloc = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        collectCalls(node, alloc->length);
+    }
+    else if (auto slice = dynamic_cast<SliceExpr*>(expr)) {
+        collectCalls(node, slice->start);
+        collectCalls(node, slice->end);
+    }
+    else if (auto structExpr = dynamic_cast<StructExpr*>(expr)) {
+        for (auto& arg : structExpr->arguments)
+            collectCalls(node, arg);
+    }
+    else if (auto field = dynamic_cast<FieldExpr*>(expr)) {
+        collectCalls(node, field->index);
+    }
+    else if (auto fieldAssign = dynamic_cast<FieldAssignExpr*>(expr)) {
+        collectCalls(node, fieldAssign->index);
+        collectCalls(node, fieldAssign->value);
+    }
+    else if (auto vector = dynamic_cast<VectorExpr*>(expr)) {
+        for (auto& element : vector->elements)
+            collectCalls(node, element);
+    }
+    else if (auto shuffle = dynamic_cast<ShuffleExpr*>(expr)) {
+        collectCalls(node, shuffle->first);
+        collectCalls(node, shuffle->second);
+    }
+    else if (auto builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        for (auto& arg : builtin->arguments)
+            collectCalls(node, arg);
+    }
+    else if (auto load = dynamic_cast<VectorLoadExpr*>(expr)) {
+        collectCalls(node, load->index);
+        collectCalls(node, load->mask);
+    }
+    else if (auto store = dynamic_cast<VectorStoreExpr*>(expr)) {
+        collectCalls(node, store->index);
+        collectCalls(node, store->value);
+        collectCalls(node, store->mask);
+    }
+}
+
+// Tarjan's algorithm. Components are emitted as they are closed, which is
+// already callee-before-caller order.
+void CallGraph::computeSCCs()
+{
+    std::map<std::string, int> index;
+    std::map<std::string, int> lowlink;
+    std::set<std::string> onStack;
+    std::vector<std::string> stack;
+    int nextIndex = 0;
+
+    std::function<void(const std::string&)> visit = [&](const std::string& name) {
+        index[name] = lowlink[name] = nextIndex++;
+        stack.push_back(name);
+        onStack.insert(name);
+
+        for (auto& callee : m_nodes[name].callees) {
+            if (!index.count(callee)) {
+                visit(callee);
+                lowlink[name] = std::min(lowlink[name], lowlink[callee]);
+            } else if (onStack.count(callee)) {
+                lowlink[name] = std::min(lowlink[name], index[callee]);
+            }
+        }
+
+        if (lowlink[name] != index[name])
+            return;
+
+        std::vector<std::string> component;
+        std::string member;
+        do {
+            member = stack.back();
+            stack.pop_back();
+            onStack.erase(member);
+            m_nodes[member].scc = static_cast<int>(m_sccs.size());
+            component.push_back(member);
+        } while (member != name);
+
+        bool recursive = component.size() > 1;
+        if (!recursive) {
+            auto& callees = m_nodes[name].callees;
+            recursive = std::find(callees.begin(), callees.end(), name) != callees.end();
+        }
+        for (auto& m : component)
+            m_nodes[m].recursive = recursive;
+
+        m_sccs.push_back(component);
+    };
+
+    for (auto& name : m_order) {
+        if (!index.count(name))
+            visit(name);
+    }
+}
+
+const CallGraphNode* CallGraph::node(const std::string& name) const
+{
+    auto it = m_nodes.find(name);
+    return it == m_nodes.end() ? nullptr : &it->second;
+}
+
+bool CallGraph::isRecursive(const std::string& name) const
+{
+    auto n = node(name);
+    return n && n->recursive;
+}
+
+std::set<std::string> CallGraph::reachableFrom(const std::vector<std::string>& roots) const
+{
+    std::set<std::string> reached;
+    std::vector<std::string> worklist;
+    for (auto& root : roots) {
+        if (m_nodes.count(root) && reached.insert(root).second)
+            worklist.push_back(root);
+    }
+    while (!worklist.empty()) {
+        std::string name = worklist.back();
+        worklist.pop_back();
+        for (auto& callee : m_nodes.at(name).callees) {
+            if (reached.insert(callee).second)
+                worklist.push_back(callee);
+        }
+    }
+    return reached;
+}
+
+void CallGraph::print() const
+{
+    std::cout << "CallGraph\n";
+    for (auto& name : m_order) {
+        const CallGraphNode& n = m_nodes.at(name);
+        std::cout << "  " << (n.isExtern ? "extern " : "") << name;
+        if (n.recursive)
+            std::cout << " [recursive]";
+        std::cout << "\n";
+        for (auto& callee : n.callees)
+            std::cout << "    -> " << callee << "\n";
+    }
+    std::cout << "SCCs\n";
+    for (size_t i = 0; i < m_sccs.size(); ++i) {
+        std::cout << "  #" << i << ":";
+        for (auto& m : m_sccs[i])
+            std::cout << " " << m;
+        std::cout << "\n";
+    }
+}
+
+size_t removeUnreachableFunctions(Program* program, const CallGraph& graph,
+                                  const std::vector<std::string>& roots)
+{
+    std::set<std::string> live = graph.reachableFrom(roots);
+    size_t before = program->items.size();
+
+    auto dead = [&](Item* item) {
+        if (auto func = dynamic_cast<FunctionDef*>(item))
+            return !live.count(func->name);
+        if (auto ext = dynamic_cast<ExternDecl*>(item))
+            return !live.count(ext->name);
+        return false;
+    };
+    program->items.erase(
+        std::remove_if(program->items.begin(), program->items.end(), dead),
+        program->items.end());
+
+    return before - program->items.size();
+}
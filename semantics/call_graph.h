@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../ast/program.h"
+#include "../ast/function.h"
+
+struct CallGraphNode {
+    std::string name;
+    Item* decl = nullptr;
+    bool isExtern = false;
+
+    // Unique callee names in first-call order
+    std::vector<std::string> callees;
+    std::vector<CallExpr*> callSites;
+
+    // Index into CallGraph::sccs()
+    int scc = -1;
+    // Calls itself directly or through a cycle
+    bool recursive = false;
+};
+
+// Call graph over the top-level functions of a program, built from CallExpr
+// sites after semantic analysis.
+class CallGraph {
+public:
+    void build(Program* t_program);
+
+    const CallGraphNode* node(const std::string& t_name) const;
+    const std::vector<std::string>& functions() const { return m_order; }
+
+    // Strongly connected components in reverse topological order:
+    // every component comes after all the components it calls into.
+    const std::vector<std::vector<std::string>>& sccs() const { return m_sccs; }
+    bool isRecursive(const std::string& t_name) const;
+
+    std::set<std::string> reachableFrom(const std::vector<std::string>& t_roots) const;
+
+    void print() const;
+
+private:
+    void collectCalls(CallGraphNode& t_node, Statement* t_stmt);
+    void collectCalls(CallGraphNode& t_node, Expression* t_expr);
+    void computeSCCs();
+
+    std::map<std::string, CallGraphNode> m_nodes;
+    std::vector<std::string> m_order;
+    std::vector<std::vector<std::string>> m_sccs;
+};
+
+// Drops every function and extern declaration that cannot be reached from
+// t_roots. Returns the number of items removed.
+size_t removeUnreachableFunctions(Program* t_program, const CallGraph& t_graph,
+                                  const std::vector<std::string>& t_roots);
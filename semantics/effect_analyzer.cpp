@@ -0,0 +1,435 @@
+#include "effect_analyzer.h"
+
+static bool assignsTo(Expression* expr, const std::string& name);
+
+static bool assignsTo(Statement* stmt, const std::string& name)
+{
+    if (!stmt)
+        return false;
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        for (auto& s : block->statements)
+            if (assignsTo(s, name))
+                return true;
+        return false;
+    }
+    if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt))
+        return assignsTo(exprStmt->expr, name);
+    if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt))
+        // Shadowing the variable is treated like assigning it
+        return varDecl->name == name || assignsTo(varDecl->initializer, name);
+    if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt))
+        return assignsTo(returnStmt->value, name);
+    if (auto ifStmt = dynamic_cast<IfStmt*>(stmt))
+        return assignsTo(ifStmt->condition, name) || assignsTo(ifStmt->thenBlock, name) ||
+               assignsTo(ifStmt->elseBlock, name);
+    if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt))
+        return assignsTo(whileStmt->condition, name) || assignsTo(whileStmt->body, name);
+    if (auto forStmt = dynamic_cast<ForStmt*>(stmt))
+        return assignsTo(forStmt->init, name) || assignsTo(forStmt->condition, name) ||
+               assignsTo(forStmt->increment, name) || assignsTo(forStmt->body, name);
+    if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt))
+        return assignsTo(regionStmt->body, name);
+    if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        for (auto& switchCase : switchStmt->cases)
+            if (assignsTo(switchCase.body, name))
+                return true;
+        return assignsTo(switchStmt->value, name) || assignsTo(switchStmt->defaultBlock, name);
+    }
+    return false;
+}
+
+static bool assignsTo(Expression* expr, const std::string& name)
+{
+    if (!expr)
+        return false;
+    if (auto assign = dynamic_cast<AssignExpr*>(expr))
+        return assign->name == name || assignsTo(assign->value, name);
+    if (auto binary = dynamic_cast<BinaryExpr*>(expr))
+        return assignsTo(binary->left, name) || assignsTo(binary->right, name);
+    if (auto unary = dynamic_cast<UnaryExpr*>(expr))
+        return assignsTo(unary->operand, name);
+    if (auto cast = dynamic_cast<CastExpr*>(expr))
+        return assignsTo(cast->operand, name);
+    if (auto index = dynamic_cast<IndexExpr*>(expr))
+        return assignsTo(index->index, name);
+    if (auto indexAssign = dynamic_cast<IndexAssignExpr*>(expr))
+        return (indexAssign->lane && indexAssign->name == name) ||
+               assignsTo(indexAssign->index, name) || assignsTo(indexAssign->value, name);
+    if (auto alloc = dynamic_cast<ArrayAllocExpr*>(expr))
+        return assignsTo(alloc->length, name);
+    if (auto slice = dynamic_cast<SliceExpr*>(expr))
+        return assignsTo(slice->start, name) || assignsTo(slice->end, name);
+    if (auto structExpr = dynamic_cast<StructExpr*>(expr)) {
+        for (auto& arg : structExpr->arguments)
+            if (assignsTo(arg, name))
+                return true;
+    }
+    if (auto field = dynamic_cast<FieldExpr*>(expr))
+        return assignsTo(field->index, name);
+    if (auto fieldAssign = dynamic_cast<FieldAssignExpr*>(expr))
+        return (!fieldAssign->index && fieldAssign->name == name) ||
+               assignsTo(fieldAssign->index, name) || assignsTo(fieldAssign->value, name);
+    if (auto vector = dynamic_cast<VectorExpr*>(expr)) {
+        for (auto& element : vector->elements)
+            if (assignsTo(element, name))
+                return true;
+    }
+    if (auto shuffle = dynamic_cast<ShuffleExpr*>(expr))
+        return assignsTo(shuffle->first, name) || assignsTo(shuffle->second, name);
+    if (auto builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        for (auto& arg : builtin->arguments)
+            if (assignsTo(arg, name))
+                return true;
+    }
+    if (auto load = dynamic_cast<VectorLoadExpr*>(expr))
+        return assignsTo(load->index, name) || assignsTo(load->mask, name);
+    if (auto store = dynamic_cast<VectorStoreExpr*>(expr))
+        return assignsTo(store->index, name) || assignsTo(store->value, name) ||
+               assignsTo(store->mask, name);
+    if (auto call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->arguments)
+            if (assignsTo(arg, name))
+                return true;
+    }
+    return false;
+}
+
+void EffectAnalyzer::analyzeProgram(Program* program, const CallGraph& graph)
+{
+    m_effects.clear();
+    for (auto& item : program->items) {
+        if (auto func = dynamic_cast<FunctionDef*>(item)) {
+            func->effects = FunctionEffects();
+            m_effects[func->name] = &func->effects;
+        } else if (auto ext = dynamic_cast<ExternDecl*>(item)) {
+            FunctionEffects effects;
+            if (ext->isPure) {
+                effects.noMemory = true;
+                effects.readOnly = true;
+                effects.noUnwind = true;
+                effects.willReturn = true;
+                effects.noRecurse = true;
+                effects.speculatable = true;
+            }
+            ext->effects = effects;
+            m_effects[ext->name] = &ext->effects;
+        }
+    }
+
+    // Components come callee-first, so everything a component calls outside
+    // itself is already final. Members of one component reach each other, so
+    // they share a single summary.
+    for (auto& component : graph.sccs()) {
+        const CallGraphNode* first = graph.node(component.front());
+        if (first->isExtern)
+            continue;
+
+        LocalEffects local;
+        FunctionEffects summary;
+        summary.noMemory = true;
+        summary.readOnly = true;
+        summary.noUnwind = true;
+        summary.willReturn = !first->recursive;
+        summary.noRecurse = !first->recursive;
+        summary.speculatable = true;
+
+        for (auto& name : component) {
+            const CallGraphNode* node = graph.node(name);
+            auto func = static_cast<FunctionDef*>(node->decl);
+            // Owned dynamic arrays and strings are freed by the callee
+            m_scopes.assign(1, {});
+            for (auto& param : func->params) {
+                m_scopes.back()[param.name] = param.type;
+                if (param.mode == PassMode::Value &&
+                    (param.type.isDynamicArray() || param.type == TypeKind::STRING))
+                    local.writesMemory = true;
+            }
+            analyzeStatement(func->body, local);
+
+            for (auto& callee : node->callees) {
+                const CallGraphNode* calleeNode = graph.node(callee);
+                if (calleeNode->scc == node->scc)
+                    continue;
+                FunctionEffects* effects = effectsOf(calleeNode);
+                summary.noMemory &= effects->noMemory;
+                summary.readOnly &= effects->readOnly;
+                summary.noUnwind &= effects->noUnwind;
+                summary.willReturn &= effects->willReturn;
+                summary.noRecurse &= effects->noRecurse;
+                summary.speculatable &= effects->speculatable;
+            }
+        }
+
+        if (local.readsGlobals || local.readsMemory)
+            summary.noMemory = false;
+        if (local.writesMemory) {
+            summary.noMemory = false;
+            summary.readOnly = false;
+        }
+        if (local.mayLoopForever || local.mayAbort)
+            summary.willReturn = false;
+        summary.speculatable &= summary.noMemory && summary.willReturn &&
+                                summary.noUnwind && !local.mayTrap;
+
+        for (auto& name : component)
+            *m_effects[name] = summary;
+    }
+}
+
+FunctionEffects* EffectAnalyzer::effectsOf(const CallGraphNode* node)
+{
+    return m_effects[node->name];
+}
+
+void EffectAnalyzer::analyzeStatement(Statement* stmt, LocalEffects& local)
+{
+    if (!stmt)
+        return;
+
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        m_scopes.emplace_back();
+        for (auto& s : block->statements)
+            analyzeStatement(s, local);
+        m_scopes.pop_back();
+    }
+    else if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        analyzeExpression(exprStmt->expr, local);
+    }
+    else if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
+        m_scopes.back()[varDecl->name] = varDecl->kind;
+        // Dynamic arrays and strings are freed at their drop point
+        if (varDecl->kind.isDynamicArray() || varDecl->kind == TypeKind::STRING)
+            local.writesMemory = true;
+        analyzeExpression(varDecl->initializer, local);
+    }
+    else if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt)) {
+        analyzeExpression(returnStmt->value, local);
+    }
+    else if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        analyzeExpression(ifStmt->condition, local);
+        analyzeStatement(ifStmt->thenBlock, local);
+        analyzeStatement(ifStmt->elseBlock, local);
+    }
+    else if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        local.mayLoopForever = true;
+        analyzeExpression(whileStmt->condition, local);
+        analyzeStatement(whileStmt->body, local);
+    }
+    else if (auto forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        if (!isCountedLoop(forStmt))
+            local.mayLoopForever = true;
+        // The init declares into the scope of the loop
+        m_scopes.emplace_back();
+        analyzeStatement(forStmt->init, local);
+        analyzeExpression(forStmt->condition, local);
+        analyzeExpression(forStmt->increment, local);
+        analyzeStatement(forStmt->body, local);
+        m_scopes.pop_back();
+    }
+    else if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        // The arena is freed on the way out
+        local.writesMemory = true;
+        analyzeStatement(regionStmt->body, local);
+    }
+    else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        analyzeExpression(switchStmt->value, local);
+        for (auto& switchCase : switchStmt->cases)
+            analyzeStatement(switchCase.body, local);
+        analyzeStatement(switchStmt->defaultBlock, local);
+    }
+}
+
+void EffectAnalyzer::analyzeExpression(Expression* expr, LocalEffects& local)
+{
+    if (!expr)
+        return;
+
+    if (dynamic_cast<StringExpr*>(expr)) {
+        local.readsGlobals = true;
+    }
+    else if (auto binary = dynamic_cast<BinaryExpr*>(expr)) {
+        // Integer division traps on zero (and INT_MIN / -1) unless the
+        // range analysis ruled both out
+        if (binary->op == Operator::Divide && !binary->safeDivision) {
+            local.mayTrap = true;
+        }
+        // Strings are compared in memory; concatenating allocates, and
+        // stops the program when that fails
+        if (binary->isString) {
+            local.readsMemory = true;
+            if (binary->op == Operator::Plus) {
+                local.writesMemory = true;
+                local.mayAbort = true;
+            }
+        }
+        analyzeExpression(binary->left, local);
+        analyzeExpression(binary->right, local);
+    }
+    else if (auto unary = dynamic_cast<UnaryExpr*>(expr)) {
+        analyzeExpression(unary->operand, local);
+    }
+    else if (auto cast = dynamic_cast<CastExpr*>(expr)) {
+        analyzeExpression(cast->operand, local);
+    }
+    else if (auto call = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : call->arguments)
+            analyzeExpression(arg, local);
+    }
+    else if (auto assign = dynamic_cast<AssignExpr*>(expr)) {
+        analyzeExpression(assign->value, local);
+    }
+    else if (auto index = dynamic_cast<IndexExpr*>(expr)) {
+        // Lanes of a vector are in registers
+        if (!index->lane)
+            local.readsMemory = true;
+        if (!index->inBounds)
+            local.mayAbort = true;
+        analyzeExpression(index->index, local);
+    }
+    else if (auto indexAssign = dynamic_cast<IndexAssignExpr*>(expr)) {
+        if (!indexAssign->lane)
+            local.writesMemory = true;
+        if (!indexAssign->inBounds)
+            local.mayAbort = true;
+        analyzeExpression(indexAssign->index, local);
+        analyzeExpression(indexAssign->value, local);
+    }
+    else if (auto alloc = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        // Allocates, and stops the program on a negative length
+        local.writesMemory = true;
+        local.mayAbort = true;
+        analyzeExpression(alloc->length, local);
+    }
+    else if (auto slice = dynamic_cast<SliceExpr*>(expr)) {
+        // Stops the program on bounds outside the string
+        local.readsMemory = true;
+        local.mayAbort = true;
+        analyzeExpression(slice->start, local);
+        analyzeExpression(slice->end, local);
+    }
+    else if (auto structExpr = dynamic_cast<StructExpr*>(expr)) {
+        for (auto& arg : structExpr->arguments)
+            analyzeExpression(arg, local);
+    }
+    else if (auto field = dynamic_cast<FieldExpr*>(expr)) {
+        // Struct variables are in registers, like vectors
+        if (field->index) {
+            local.readsMemory = true;
+            if (!field->inBounds)
+                local.mayAbort = true;
+        }
+        analyzeExpression(field->index, local);
+    }
+    else if (auto fieldAssign = dynamic_cast<FieldAssignExpr*>(expr)) {
+        if (fieldAssign->index) {
+            local.writesMemory = true;
+            if (!fieldAssign->inBounds)
+                local.mayAbort = true;
+        }
+        analyzeExpression(fieldAssign->index, local);
+        analyzeExpression(fieldAssign->value, local);
+    }
+    else if (auto vector = dynamic_cast<VectorExpr*>(expr)) {
+        for (auto& element : vector->elements)
+            analyzeExpression(element, local);
+    }
+    else if (auto shuffle = dynamic_cast<ShuffleExpr*>(expr)) {
+        analyzeExpression(shuffle->first, local);
+        analyzeExpression(shuffle->second, local);
+    }
+    else if (auto builtin = dynamic_cast<BuiltinExpr*>(expr)) {
+        if (builtin->builtin == Builtin::Find)
+            local.readsMemory = true;
+        // Input and output go through the runtime's buffers; reading a
+        // line allocates, and stops the program when that fails
+        if (builtin->builtin == Builtin::Print || builtin->builtin == Builtin::Println ||
+            builtin->builtin == Builtin::ReadInt || builtin->builtin == Builtin::ReadLine ||
+            builtin->builtin == Builtin::Eof) {
+            local.readsGlobals = true;
+            local.writesMemory = true;
+        }
+        if (builtin->builtin == Builtin::ReadLine)
+            local.mayAbort = true;
+        for (auto& arg : builtin->arguments)
+            analyzeExpression(arg, local);
+    }
+    else if (auto load = dynamic_cast<VectorLoadExpr*>(expr)) {
+        local.readsMemory = true;
+        if (!load->inBounds)
+            local.mayAbort = true;
+        analyzeExpression(load->index, local);
+        analyzeExpression(load->mask, local);
+    }
+    else if (auto store = dynamic_cast<VectorStoreExpr*>(expr)) {
+        local.writesMemory = true;
+        if (!store->inBounds)
+            local.mayAbort = true;
+        analyzeExpression(store->index, local);
+        analyzeExpression(store->value, local);
+        analyzeExpression(store->mask, local);
+    }
+}
+
+// Recognizes `for (int i = a; i < n; i = i + 1)` (and the mirrored
+// `i > n; i = i - 1`), or the same with `i = a` for an int i declared
+// earlier, where the body assigns neither i nor n. The step of one
+// cannot overshoot the bound, so these loops always terminate.
+bool EffectAnalyzer::isCountedLoop(ForStmt* stmt)
+{
+    std::string var;
+    if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt->init)) {
+        if (varDecl->kind != TypeKind::INT || !varDecl->initializer)
+            return false;
+        var = varDecl->name;
+    } else if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt->init)) {
+        auto assign = dynamic_cast<AssignExpr*>(exprStmt->expr);
+        if (!assign)
+            return false;
+        const Type* type = lookupType(assign->name);
+        if (!type || *type != TypeKind::INT)
+            return false;
+        var = assign->name;
+    } else {
+        return false;
+    }
+
+    auto cond = dynamic_cast<BinaryExpr*>(stmt->condition);
+    if (!cond || (cond->op != Operator::Less && cond->op != Operator::Greater))
+        return false;
+    auto lhs = dynamic_cast<IdentifierExpr*>(cond->left);
+    if (!lhs || lhs->name != var)
+        return false;
+    if (auto bound = dynamic_cast<IdentifierExpr*>(cond->right)) {
+        if (bound->name == var || assignsTo(stmt->body, bound->name) ||
+            assignsTo(stmt->increment, bound->name))
+            return false;
+    } else if (!dynamic_cast<IntExpr*>(cond->right)) {
+        return false;
+    }
+
+    auto inc = dynamic_cast<AssignExpr*>(stmt->increment);
+    if (!inc || inc->name != var)
+        return false;
+    auto step = dynamic_cast<BinaryExpr*>(inc->value);
+    if (!step)
+        return false;
+    auto stepVar = dynamic_cast<IdentifierExpr*>(step->left);
+    auto stepVal = dynamic_cast<IntExpr*>(step->right);
+    if (!stepVar || stepVar->name != var || !stepVal || stepVal->value != 1)
+        return false;
+    Operator expected = cond->op == Operator::Less ? Operator::Plus : Operator::Minus;
+    if (step->op != expected)
+        return false;
+
+    return !assignsTo(stmt->body, var);
+}
+
+const Type* EffectAnalyzer::lookupType(const std::string& name) const
+{
+    for (auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope) {
+        auto found = scope->find(name);
+        if (found != scope->end())
+            return &found->second;
+    }
+    return nullptr;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "call_graph.h"
+
+// Interprocedural effect/purity inference. Walks the call graph bottom-up
+// and fills FunctionDef::effects / ExternDecl::effects with what can be
+// proven about each function. Runs after RangeAnalyzer, whose division
+// facts decide whether a function may trap.
+class EffectAnalyzer {
+public:
+    void analyzeProgram(Program* t_program, const CallGraph& t_graph);
+
+private:
+    // What a function body does on its own, ignoring its callees
+    struct LocalEffects {
+        bool readsGlobals = false;
+        bool readsMemory = false;
+        bool writesMemory = false;
+        bool mayLoopForever = false;
+        bool mayTrap = false;
+        // Runs a check that stops the program when it fails (array bounds)
+        bool mayAbort = false;
+    };
+
+    void analyzeStatement(Statement* t_stmt, LocalEffects& t_local);
+    void analyzeExpression(Expression* t_expr, LocalEffects& t_local);
+    bool isCountedLoop(ForStmt* t_stmt);
+    // Declared type of a variable in scope, or null
+    const Type* lookupType(const std::string& t_name) const;
+
+    FunctionEffects* effectsOf(const CallGraphNode* t_node);
+
+    std::map<std::string, FunctionEffects*> m_effects;
+    // Variables declared in each enclosing block of the function walked
+    std::vector<std::map<std::string, Type>> m_scopes;
+};
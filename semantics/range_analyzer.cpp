@@ -0,0 +1,740 @@
+#include "range_analyzer.h"
+#include <algorithm>
+
+// int lowers to i32
+static const int64_t INT_MIN_VALUE = INT32_MIN;
+static const int64_t INT_MAX_VALUE = INT32_MAX;
+static const int64_t UINT_MAX_VALUE = UINT32_MAX;
+
+RangeAnalyzer::Interval RangeAnalyzer::full()
+{
+    return Interval{INT_MIN_VALUE, INT_MAX_VALUE};
+}
+
+// Arrays and vectors have the range of their length
+static bool hasLength(const Type& type)
+{
+    return type.isArray() || type.isVector();
+}
+
+bool RangeAnalyzer::hasRange(const Value& value)
+{
+    return value.type == TypeKind::INT || hasLength(value.type);
+}
+
+void RangeAnalyzer::analyzeProgram(Program* program)
+{
+    std::set<std::string> functions;
+    for (auto& item : program->items)
+        if (auto func = dynamic_cast<FunctionDef*>(item))
+            functions.insert(func->name);
+    analyzeFunctions(program, functions);
+}
+
+void RangeAnalyzer::analyzeFunctions(Program* program, const std::set<std::string>& functions)
+{
+    m_proven.clear();
+    for (auto& item : program->items) {
+        if (auto func = dynamic_cast<FunctionDef*>(item))
+            m_returnTypes[func->name] = func->returnType;
+        else if (auto ext = dynamic_cast<ExternDecl*>(item))
+            m_returnTypes[ext->name] = ext->returnType;
+    }
+
+    for (auto& item : program->items) {
+        auto func = dynamic_cast<FunctionDef*>(item);
+        if (func && functions.count(func->name))
+            analyzeFunction(func);
+    }
+
+    for (auto& [flag, holds] : m_proven)
+        *flag = holds;
+}
+
+void RangeAnalyzer::prove(bool& flag, bool holds)
+{
+    auto it = m_proven.find(&flag);
+    if (it == m_proven.end())
+        m_proven[&flag] = holds;
+    else
+        it->second = it->second && holds;
+}
+
+void RangeAnalyzer::analyzeFunction(FunctionDef* func)
+{
+    m_env = Env();
+    m_env.scopes.emplace_back();
+    for (auto& param : func->params)
+        declare(param.name, param.type, Value{param.type, full()});
+    analyzeBlock(func->body, false);
+}
+
+RangeAnalyzer::Value* RangeAnalyzer::lookup(const std::string& name)
+{
+    for (auto it = m_env.scopes.rbegin(); it != m_env.scopes.rend(); ++it) {
+        auto found = it->find(name);
+        if (found != it->end())
+            return &found->second;
+    }
+    return nullptr;
+}
+
+void RangeAnalyzer::declare(const std::string& name, const Type& type, const Value& init)
+{
+    forget(name);
+    Value value{type, full()};
+    if (type.isFixedArray() || type.isVector())
+        value.range = Interval{type.length, type.length};
+    else if (type.isDynamicArray())
+        value.range = Interval{std::max<int64_t>(init.range.lo, 0), init.range.hi};
+    else if (type == TypeKind::INT)
+        value = init;
+    value.type = type;
+    m_env.scopes.back()[name] = value;
+}
+
+void RangeAnalyzer::assign(Value& var, const std::string& name, const Value& value)
+{
+    if (var.type.isArray()) {
+        forget(name);
+        var.range = Interval{std::max<int64_t>(value.range.lo, 0), value.range.hi};
+    } else if (var.type.isVector()) {
+        // Same lane count
+    } else if (var.type == TypeKind::INT) {
+        Type type = var.type;
+        var = value;
+        var.type = type;
+    } else {
+        var.range = full();
+    }
+}
+
+void RangeAnalyzer::forget(const std::string& name)
+{
+    for (auto& scope : m_env.scopes) {
+        for (auto& [varName, value] : scope) {
+            value.below.erase(name);
+            if (value.lengthOf == name)
+                value.lengthOf.clear();
+        }
+    }
+}
+
+// Facts about arrays declared in the scope would otherwise carry over to
+// arrays of the same name in outer scopes
+void RangeAnalyzer::popScope()
+{
+    std::map<std::string, Value> scope = std::move(m_env.scopes.back());
+    m_env.scopes.pop_back();
+    for (auto& [name, value] : scope)
+        if (hasLength(value.type))
+            forget(name);
+}
+
+bool RangeAnalyzer::inBounds(const Value& index, const std::string& array)
+{
+    Value* var = lookup(array);
+    if (!var || !hasLength(var->type) || index.range.lo < 0)
+        return false;
+    return index.range.hi < var->range.lo || index.below.count(array);
+}
+
+RangeAnalyzer::Env RangeAnalyzer::join(const Env& a, const Env& b)
+{
+    if (!a.reachable)
+        return b;
+    if (!b.reachable)
+        return a;
+    Env result = a;
+    for (size_t i = 0; i < result.scopes.size() && i < b.scopes.size(); ++i) {
+        for (auto& [name, value] : result.scopes[i]) {
+            auto other = b.scopes[i].find(name);
+            if (!hasRange(value) || other == b.scopes[i].end())
+                continue;
+            value.range.lo = std::min(value.range.lo, other->second.range.lo);
+            value.range.hi = std::max(value.range.hi, other->second.range.hi);
+            std::set<std::string> below;
+            for (auto& array : value.below)
+                if (other->second.below.count(array))
+                    below.insert(array);
+            value.below = below;
+            if (value.lengthOf != other->second.lengthOf)
+                value.lengthOf.clear();
+        }
+    }
+    return result;
+}
+
+// Bounds that are still moving jump straight to the type's limits
+RangeAnalyzer::Env RangeAnalyzer::widen(const Env& old, const Env& next)
+{
+    if (!old.reachable)
+        return next;
+    Env result = next;
+    for (size_t i = 0; i < result.scopes.size() && i < old.scopes.size(); ++i) {
+        for (auto& [name, value] : result.scopes[i]) {
+            auto before = old.scopes[i].find(name);
+            if (!hasRange(value) || before == old.scopes[i].end())
+                continue;
+            if (value.range.lo < before->second.range.lo)
+                value.range.lo = INT_MIN_VALUE;
+            if (value.range.hi > before->second.range.hi)
+                value.range.hi = INT_MAX_VALUE;
+        }
+    }
+    return result;
+}
+
+bool RangeAnalyzer::contains(const Env& outer, const Env& inner)
+{
+    if (!inner.reachable)
+        return true;
+    if (!outer.reachable)
+        return false;
+    for (size_t i = 0; i < inner.scopes.size() && i < outer.scopes.size(); ++i) {
+        for (auto& [name, value] : inner.scopes[i]) {
+            auto other = outer.scopes[i].find(name);
+            if (!hasRange(value) || other == outer.scopes[i].end())
+                continue;
+            if (value.range.lo < other->second.range.lo || value.range.hi > other->second.range.hi)
+                return false;
+            for (auto& array : other->second.below)
+                if (!value.below.count(array))
+                    return false;
+            if (!other->second.lengthOf.empty() && other->second.lengthOf != value.lengthOf)
+                return false;
+        }
+    }
+    return true;
+}
+
+void RangeAnalyzer::analyzeBlock(BlockStmt* block, bool newScope)
+{
+    if (newScope)
+        m_env.scopes.emplace_back();
+    for (auto& stmt : block->statements) {
+        if (!m_env.reachable)
+            break;
+        analyzeStatement(stmt);
+    }
+    if (newScope)
+        popScope();
+}
+
+void RangeAnalyzer::analyzeStatement(Statement* stmt)
+{
+    if (auto block = dynamic_cast<BlockStmt*>(stmt)) {
+        analyzeBlock(block, true);
+    }
+    else if (auto exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        analyzeExpression(exprStmt->expr);
+    }
+    else if (auto varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
+        Value init{varDecl->kind, full()};
+        if (varDecl->initializer)
+            init = analyzeExpression(varDecl->initializer);
+        declare(varDecl->name, varDecl->kind, init);
+    }
+    else if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt)) {
+        if (returnStmt->value)
+            analyzeExpression(returnStmt->value);
+        m_env.reachable = false;
+    }
+    else if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        Env before = m_env;
+        analyzeCondition(ifStmt->condition, true);
+        if (m_env.reachable)
+            analyzeBlock(ifStmt->thenBlock, true);
+        Env afterThen = m_env;
+        m_env = before;
+        analyzeCondition(ifStmt->condition, false);
+        if (ifStmt->elseBlock && m_env.reachable)
+            analyzeBlock(ifStmt->elseBlock, true);
+        m_env = join(afterThen, m_env);
+    }
+    else if (auto whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        analyzeLoop(whileStmt->condition, whileStmt->body, true, nullptr);
+    }
+    else if (auto forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        m_env.scopes.emplace_back();
+        if (forStmt->init)
+            analyzeStatement(forStmt->init);
+        analyzeLoop(forStmt->condition, forStmt->body, false, forStmt->increment);
+        popScope();
+    }
+    else if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        analyzeBlock(regionStmt->body, true);
+    }
+    else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        analyzeExpression(switchStmt->value);
+        Env before = m_env;
+        Env after = before;
+        after.reachable = false;
+        auto ident = dynamic_cast<IdentifierExpr*>(switchStmt->value);
+        for (auto& switchCase : switchStmt->cases) {
+            m_env = before;
+            // An int value lies between the smallest and the largest label
+            Value* var = ident ? lookup(ident->name) : nullptr;
+            if (var && var->type == TypeKind::INT) {
+                Interval labels{INT64_MAX, INT64_MIN};
+                for (auto label : switchCase.labels) {
+                    auto negated = dynamic_cast<UnaryExpr*>(label);
+                    auto literal = static_cast<IntExpr*>(negated ? negated->operand : label);
+                    int64_t value = negated ? -literal->value : literal->value;
+                    labels.lo = std::min(labels.lo, value);
+                    labels.hi = std::max(labels.hi, value);
+                }
+                var->range.lo = std::max(var->range.lo, labels.lo);
+                var->range.hi = std::min(var->range.hi, labels.hi);
+            }
+            if (m_env.reachable)
+                analyzeBlock(switchCase.body, true);
+            after = join(after, m_env);
+        }
+        m_env = before;
+        if (switchStmt->defaultBlock && m_env.reachable)
+            analyzeBlock(switchStmt->defaultBlock, true);
+        m_env = join(after, m_env);
+    }
+}
+
+void RangeAnalyzer::analyzeLoop(Expression* condition, BlockStmt* body, bool newScope,
+                                Expression* increment)
+{
+    Env entry = m_env;
+    Env head = entry;
+    for (int iteration = 0;; ++iteration) {
+        m_env = head;
+        if (condition)
+            analyzeCondition(condition, true);
+        if (m_env.reachable)
+            analyzeBlock(body, newScope);
+        if (m_env.reachable && increment)
+            analyzeExpression(increment);
+
+        Env next = join(entry, m_env);
+        if (contains(head, next))
+            break;
+        head = iteration == 0 ? join(head, next) : widen(head, join(head, next));
+    }
+
+    // The loop leaves through a false condition
+    m_env = head;
+    if (condition)
+        analyzeCondition(condition, false);
+}
+
+RangeAnalyzer::Value RangeAnalyzer::analyzeExpression(Expression* expr)
+{
+    if (auto e = dynamic_cast<IntExpr*>(expr))
+        return Value{e->type, e->type == TypeKind::INT ? Interval{e->value, e->value} : full()};
+    if (auto e = dynamic_cast<FloatExpr*>(expr))
+        return Value{e->type, full()};
+    if (dynamic_cast<BoolExpr*>(expr))
+        return Value{TypeKind::BOOL, full()};
+    if (dynamic_cast<CharExpr*>(expr))
+        return Value{TypeKind::CHAR, full()};
+    if (dynamic_cast<StringExpr*>(expr) || dynamic_cast<BorrowExpr*>(expr))
+        return Value{TypeKind::STRING, full()};
+
+    if (auto e = dynamic_cast<IdentifierExpr*>(expr)) {
+        if (Value* var = lookup(e->name))
+            return *var;
+        return Value{TypeKind::VOID, full()};
+    }
+
+    if (auto e = dynamic_cast<AssignExpr*>(expr)) {
+        Value value = analyzeExpression(e->value);
+        if (Value* var = lookup(e->name))
+            assign(*var, e->name, value);
+        return value;
+    }
+
+    if (auto e = dynamic_cast<IndexExpr*>(expr)) {
+        Value index = analyzeExpression(e->index);
+        prove(e->inBounds, inBounds(index, e->name));
+        Value* array = lookup(e->name);
+        return Value{array ? array->type.elementType() : Type(), full()};
+    }
+
+    if (auto e = dynamic_cast<IndexAssignExpr*>(expr)) {
+        Value index = analyzeExpression(e->index);
+        Value value = analyzeExpression(e->value);
+        prove(e->inBounds, inBounds(index, e->name));
+        return value;
+    }
+
+    if (auto e = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        Value length = analyzeExpression(e->length);
+        // A negative length stops the program
+        return Value{Type::arrayOf(e->element, 0),
+                     Interval{std::max<int64_t>(length.range.lo, 0), std::max<int64_t>(length.range.hi, 0)}};
+    }
+
+    if (auto e = dynamic_cast<FieldExpr*>(expr)) {
+        if (e->index) {
+            Value index = analyzeExpression(e->index);
+            prove(e->inBounds, inBounds(index, e->name));
+        }
+        return Value{e->type, full()};
+    }
+
+    if (auto e = dynamic_cast<FieldAssignExpr*>(expr)) {
+        Value index = e->index ? analyzeExpression(e->index) : Value{TypeKind::VOID, full()};
+        Value value = analyzeExpression(e->value);
+        if (e->index)
+            prove(e->inBounds, inBounds(index, e->name));
+        return value;
+    }
+
+    if (auto e = dynamic_cast<StructExpr*>(expr)) {
+        for (auto& arg : e->arguments)
+            analyzeExpression(arg);
+        return Value{Type::structNamed(e->name), full()};
+    }
+
+    if (auto e = dynamic_cast<SliceExpr*>(expr)) {
+        analyzeExpression(e->start);
+        analyzeExpression(e->end);
+        return Value{TypeKind::STRING, full()};
+    }
+
+    if (auto e = dynamic_cast<LengthExpr*>(expr)) {
+        Value length{TypeKind::INT, Interval{0, INT_MAX_VALUE}};
+        if (Value* array = lookup(e->name); array && array->type.isArray())
+            length.range = array->range;
+        length.lengthOf = e->name;
+        return length;
+    }
+
+    // Only conversions to int keep a range: the operand's, or the range of
+    // a narrower source type
+    if (auto e = dynamic_cast<CastExpr*>(expr)) {
+        Value operand = analyzeExpression(e->operand);
+        if (e->target != TypeKind::INT)
+            return Value{e->target, full()};
+        switch (e->source) {
+            case TypeKind::INT: return operand;
+            case TypeKind::BOOL: return Value{TypeKind::INT, Interval{0, 1}};
+            case TypeKind::I8:
+            case TypeKind::CHAR: return Value{TypeKind::INT, Interval{INT8_MIN, INT8_MAX}};
+            case TypeKind::U8: return Value{TypeKind::INT, Interval{0, UINT8_MAX}};
+            case TypeKind::I16: return Value{TypeKind::INT, Interval{INT16_MIN, INT16_MAX}};
+            case TypeKind::U16: return Value{TypeKind::INT, Interval{0, UINT16_MAX}};
+            default: return Value{TypeKind::INT, full()};
+        }
+    }
+
+    if (auto e = dynamic_cast<CallExpr*>(expr)) {
+        for (auto& arg : e->arguments)
+            analyzeExpression(arg);
+        return Value{m_returnTypes[e->callee], full()};
+    }
+
+    if (auto e = dynamic_cast<VectorExpr*>(expr)) {
+        for (auto& element : e->elements)
+            analyzeExpression(element);
+        return Value{e->type, Interval{e->type.length, e->type.length}};
+    }
+
+    if (auto e = dynamic_cast<ShuffleExpr*>(expr)) {
+        Value first = analyzeExpression(e->first);
+        if (e->second)
+            analyzeExpression(e->second);
+        int64_t lanes = e->lanes.size();
+        return Value{Type::vectorOf(first.type.element, lanes), Interval{lanes, lanes}};
+    }
+
+    if (auto e = dynamic_cast<BuiltinExpr*>(expr)) {
+        std::vector<Value> args;
+        for (auto& arg : e->arguments)
+            args.push_back(analyzeExpression(arg));
+        if (e->builtin == Builtin::Find)
+            return Value{TypeKind::INT, Interval{-1, INT_MAX_VALUE}};
+        if (e->builtin == Builtin::Print || e->builtin == Builtin::Println)
+            return Value{TypeKind::VOID, full()};
+        if (e->builtin == Builtin::ReadInt)
+            return Value{TypeKind::INT, full()};
+        if (e->builtin == Builtin::ReadLine)
+            return Value{TypeKind::STRING, full()};
+        if (e->builtin == Builtin::Select && args.size() == 3)
+            return args[1].type == TypeKind::INT ? Value{TypeKind::INT, full()} : args[1];
+        if (e->builtin == Builtin::Any || e->builtin == Builtin::All || args.empty())
+            return Value{TypeKind::BOOL, full()};
+        if (args[0].type.isVector()) {
+            bool reduces = e->builtin == Builtin::ReduceAdd || e->builtin == Builtin::ReduceMul ||
+                           e->builtin == Builtin::ReduceMin || e->builtin == Builtin::ReduceMax;
+            return reduces ? Value{args[0].type.element, full()} : args[0];
+        }
+        if (args[0].type != TypeKind::INT)
+            return Value{args[0].type, full()};
+        switch (e->builtin) {
+            // e.g. min(i + 4, n) stays below n
+            case Builtin::Min:
+                return Value{TypeKind::INT, Interval{std::min(args[0].range.lo, args[1].range.lo),
+                                                     std::min(args[0].range.hi, args[1].range.hi)}};
+            case Builtin::Max:
+                return Value{TypeKind::INT, Interval{std::max(args[0].range.lo, args[1].range.lo),
+                                                     std::max(args[0].range.hi, args[1].range.hi)}};
+            case Builtin::Popcount:
+            case Builtin::Ctz:
+            case Builtin::Clz:
+                return Value{TypeKind::INT, Interval{0, 32}};
+            default:
+                return Value{TypeKind::INT, full()};
+        }
+    }
+
+    // Only proven when every lane is, whatever the mask
+    if (auto e = dynamic_cast<VectorLoadExpr*>(expr)) {
+        Value index = analyzeExpression(e->index);
+        Value mask = analyzeExpression(e->mask);
+        int64_t lanes = mask.type.length;
+        Value* array = lookup(e->name);
+        prove(e->inBounds, array && index.range.lo >= 0 &&
+                           index.range.hi + lanes <= array->range.lo);
+        return Value{Type::vectorOf(array ? array->type.element : TypeKind::VOID, lanes),
+                     Interval{lanes, lanes}};
+    }
+
+    if (auto e = dynamic_cast<VectorStoreExpr*>(expr)) {
+        Value index = analyzeExpression(e->index);
+        Value value = analyzeExpression(e->value);
+        if (e->mask)
+            analyzeExpression(e->mask);
+        Value* array = lookup(e->name);
+        prove(e->inBounds, array && index.range.lo >= 0 &&
+                           index.range.hi + value.type.length <= array->range.lo);
+        return Value{TypeKind::VOID, full()};
+    }
+
+    if (auto e = dynamic_cast<UnaryExpr*>(expr)) {
+        Value operand = analyzeExpression(e->operand);
+        if (e->op == Operator::Minus && operand.type == TypeKind::INT) {
+            bool fits = operand.range.lo > INT_MIN_VALUE;
+            prove(e->noSignedWrap, fits);
+            if (fits)
+                return Value{TypeKind::INT, Interval{-operand.range.hi, -operand.range.lo}};
+            return Value{TypeKind::INT, full()};
+        }
+        return Value{e->op == Operator::Not ? TypeKind::BOOL : operand.type, full()};
+    }
+
+    if (auto e = dynamic_cast<BinaryExpr*>(expr))
+        return analyzeBinary(e);
+
+    return Value{TypeKind::VOID, full()};
+}
+
+RangeAnalyzer::Value RangeAnalyzer::analyzeBinary(BinaryExpr* expr)
+{
+    // The right operand of && and || only runs when the left one did not
+    // decide the result, i.e. under the left one being true (false for ||)
+    if ((expr->op == Operator::AndAnd || expr->op == Operator::OrOr) && !expr->lanewise) {
+        bool isAnd = expr->op == Operator::AndAnd;
+        Env entry = m_env;
+        analyzeCondition(expr->left, !isAnd);
+        Env decided = m_env;
+        m_env = entry;
+        analyzeCondition(expr->left, isAnd);
+        if (m_env.reachable)
+            analyzeExpression(expr->right);
+        m_env = join(decided, m_env);
+        return Value{TypeKind::BOOL, full()};
+    }
+
+    Value left = analyzeExpression(expr->left);
+    Value right = analyzeExpression(expr->right);
+
+    switch (expr->op) {
+        case Operator::Plus:
+        case Operator::Minus:
+        case Operator::Multiply:
+        case Operator::Divide:
+            break;
+        default:
+            return Value{TypeKind::BOOL, full()};
+    }
+
+    if (left.type != TypeKind::INT || right.type != TypeKind::INT) {
+        if (expr->op == Operator::Divide)
+            prove(expr->safeDivision, isFloat(left.type.lane()) || isFloat(right.type.lane()));
+        return Value{left.type.isVector() ? left.type : right.type, full()};
+    }
+
+    const Interval& l = left.range;
+    const Interval& r = right.range;
+    Interval result = full();
+    bool exact = true;
+
+    switch (expr->op) {
+        case Operator::Plus:
+            result = Interval{l.lo + r.lo, l.hi + r.hi};
+            prove(expr->noUnsignedWrap, l.lo >= 0 && r.lo >= 0);
+            break;
+        case Operator::Minus:
+            result = Interval{l.lo - r.hi, l.hi - r.lo};
+            prove(expr->noUnsignedWrap, r.lo >= 0 && l.lo >= r.hi);
+            break;
+        case Operator::Multiply: {
+            int64_t products[] = {l.lo * r.lo, l.lo * r.hi, l.hi * r.lo, l.hi * r.hi};
+            result = Interval{*std::min_element(products, products + 4),
+                              *std::max_element(products, products + 4)};
+            prove(expr->noUnsignedWrap, l.lo >= 0 && r.lo >= 0 && l.hi * r.hi <= UINT_MAX_VALUE);
+            break;
+        }
+        case Operator::Divide: {
+            bool divisorNonZero = r.lo > 0 || r.hi < 0;
+            bool overflows = l.lo == INT_MIN_VALUE && r.lo <= -1 && r.hi >= -1;
+            prove(expr->safeDivision, divisorNonZero && !overflows);
+            prove(expr->nonNegative, l.lo >= 0 && r.lo >= 0);
+            exact = false;
+            if (l.lo >= 0 && r.lo > 0)
+                result = Interval{l.lo / r.hi, l.hi / r.lo};
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (exact) {
+        bool fits = result.lo >= INT_MIN_VALUE && result.hi <= INT_MAX_VALUE;
+        prove(expr->noSignedWrap, fits);
+        if (!fits)
+            result = full();
+    }
+    return Value{TypeKind::INT, result};
+}
+
+// Analyzes t_condition and narrows the environment to the states where it
+// evaluates to t_truth. Each operand of && and || narrows the environment
+// before the next one is analyzed, so a variable assigned later in the
+// condition does not keep a fact about its earlier value.
+void RangeAnalyzer::analyzeCondition(Expression* condition, bool truth)
+{
+    if (auto unary = dynamic_cast<UnaryExpr*>(condition); unary && unary->op == Operator::Not) {
+        analyzeCondition(unary->operand, !truth);
+        return;
+    }
+    auto binary = dynamic_cast<BinaryExpr*>(condition);
+    if (binary && !binary->lanewise &&
+        (binary->op == Operator::AndAnd || binary->op == Operator::OrOr)) {
+        // The right operand runs when the left one is true for &&, false
+        // for ||; the other value of the left one decides on its own
+        bool isAnd = binary->op == Operator::AndAnd;
+        Env entry = m_env;
+        analyzeCondition(binary->left, isAnd);
+        if (m_env.reachable)
+            analyzeCondition(binary->right, truth);
+        if (truth != isAnd) {
+            Env viaRight = m_env;
+            m_env = entry;
+            analyzeCondition(binary->left, truth);
+            m_env = join(m_env, viaRight);
+        }
+        return;
+    }
+    analyzeExpression(condition);
+    refine(condition, truth);
+}
+
+// Narrows the environment to the states where the comparison or literal
+// t_condition, already analyzed, evaluates to t_truth; marks it
+// unreachable when no such state exists.
+void RangeAnalyzer::refine(Expression* condition, bool truth)
+{
+    if (auto literal = dynamic_cast<BoolExpr*>(condition)) {
+        if (literal->value != truth)
+            m_env.reachable = false;
+        return;
+    }
+
+    auto binary = dynamic_cast<BinaryExpr*>(condition);
+    if (!binary)
+        return;
+
+    Operator op = binary->op;
+    if (!truth) {
+        switch (op) {
+            case Operator::Less:         op = Operator::GreaterEqual; break;
+            case Operator::LessEqual:    op = Operator::Greater; break;
+            case Operator::Greater:      op = Operator::LessEqual; break;
+            case Operator::GreaterEqual: op = Operator::Less; break;
+            case Operator::EqualEqual:   op = Operator::NotEqual; break;
+            case Operator::NotEqual:     op = Operator::EqualEqual; break;
+            default: return;
+        }
+    }
+    refineCompare(op, binary->left, binary->right);
+
+    // Mirror the comparison to refine the right-hand side as well
+    switch (op) {
+        case Operator::Less:         op = Operator::Greater; break;
+        case Operator::LessEqual:    op = Operator::GreaterEqual; break;
+        case Operator::Greater:      op = Operator::Less; break;
+        case Operator::GreaterEqual: op = Operator::LessEqual; break;
+        default: break;
+    }
+    refineCompare(op, binary->right, binary->left);
+}
+
+// Refines `left op right` where left is an int variable and right an int
+// literal, variable or array length
+void RangeAnalyzer::refineCompare(Operator op, Expression* left, Expression* right)
+{
+    auto ident = dynamic_cast<IdentifierExpr*>(left);
+    if (!ident || !m_env.reachable)
+        return;
+    Value* var = lookup(ident->name);
+    if (!var || var->type != TypeKind::INT)
+        return;
+
+    Interval other = full();
+    // Set when right is the length of this array
+    std::string array;
+    if (auto literal = dynamic_cast<IntExpr*>(right)) {
+        other = Interval{literal->value, literal->value};
+    } else if (auto otherIdent = dynamic_cast<IdentifierExpr*>(right)) {
+        Value* otherVar = lookup(otherIdent->name);
+        if (!otherVar || otherVar->type != TypeKind::INT)
+            return;
+        other = otherVar->range;
+        array = otherVar->lengthOf;
+    } else if (auto length = dynamic_cast<LengthExpr*>(right)) {
+        Value* arrayVar = lookup(length->name);
+        if (!arrayVar || !arrayVar->type.isArray())
+            return;
+        other = arrayVar->range;
+        array = length->name;
+    } else {
+        return;
+    }
+
+    Interval& r = var->range;
+    switch (op) {
+        case Operator::Less:
+            r.hi = std::min(r.hi, other.hi - 1);
+            if (!array.empty())
+                var->below.insert(array);
+            break;
+        case Operator::LessEqual:    r.hi = std::min(r.hi, other.hi); break;
+        case Operator::Greater:      r.lo = std::max(r.lo, other.lo + 1); break;
+        case Operator::GreaterEqual: r.lo = std::max(r.lo, other.lo); break;
+        case Operator::EqualEqual:
+            r.lo = std::max(r.lo, other.lo);
+            r.hi = std::min(r.hi, other.hi);
+            break;
+        case Operator::NotEqual:
+            if (other.lo == other.hi) {
+                if (r.lo == other.lo)
+                    r.lo++;
+                if (r.hi == other.hi)
+                    r.hi--;
+            }
+            break;
+        default:
+            break;
+    }
+    if (r.lo > r.hi)
+        m_env.reachable = false;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../ast/program.h"
+#include "../ast/function.h"
+
+// Interval analysis over int locals and loop induction variables. Each
+// function body is abstractly interpreted with branch conditions refining
+// the ranges and loops iterated to a fixpoint with widening. Arrays carry
+// the range of their length, and ints remember which arrays they are known
+// to index (from `i < len(a)`). The proven facts are written back onto the
+// AST for codegen: no-wrap flags on arithmetic, safe/non-negative flags on
+// division and in-bounds flags on array accesses.
+class RangeAnalyzer {
+public:
+    void analyzeProgram(Program* t_program);
+    // Only analyzes (and annotates) the bodies of t_functions
+    void analyzeFunctions(Program* t_program, const std::set<std::string>& t_functions);
+
+private:
+    struct Interval {
+        int64_t lo;
+        int64_t hi;
+    };
+
+    // The range of an int, or of an array's length
+    struct Value {
+        Type type;
+        Interval range;
+        // Arrays whose length this int is below
+        std::set<std::string> below = {};
+        // Array whose length this int equals
+        std::string lengthOf = {};
+    };
+
+    // Scoped variables in scope; ranges are only tracked for ints and
+    // array lengths
+    struct Env {
+        bool reachable = true;
+        std::vector<std::map<std::string, Value>> scopes;
+    };
+
+    static Interval full();
+    static bool hasRange(const Value& t_value);
+    static Env join(const Env& t_a, const Env& t_b);
+    static Env widen(const Env& t_old, const Env& t_new);
+    static bool contains(const Env& t_outer, const Env& t_inner);
+
+    void analyzeFunction(FunctionDef* t_func);
+    void analyzeBlock(BlockStmt* t_block, bool t_newScope);
+    void analyzeStatement(Statement* t_stmt);
+    void analyzeLoop(Expression* t_condition, BlockStmt* t_body, bool t_newScope,
+                     Expression* t_increment);
+    Value analyzeExpression(Expression* t_expr);
+    Value analyzeBinary(BinaryExpr* t_expr);
+    void analyzeCondition(Expression* t_condition, bool t_truth);
+    void refine(Expression* t_condition, bool t_truth);
+    void refineCompare(Operator t_op, Expression* t_left, Expression* t_right);
+
+    Value* lookup(const std::string& t_name);
+    void declare(const std::string& t_name, const Type& t_type, const Value& t_init);
+    void assign(Value& t_var, const std::string& t_name, const Value& t_value);
+    // Drops the facts that refer to the array t_name
+    void forget(const std::string& t_name);
+    void popScope();
+    bool inBounds(const Value& t_index, const std::string& t_array);
+
+    // Every visit ANDs into the flag, so the result holds for the widest
+    // (final) environment a node was analyzed in
+    void prove(bool& t_flag, bool t_holds);
+
+    Env m_env;
+    std::map<std::string, Type> m_returnTypes;
+    std::map<bool*, bool> m_proven;
+};
@@ -7,9 +7,10 @@
 
 struct Symbol {
     std::string name;
-    TypeKind type;
+    Type type;
     bool isFunction = false;
-    std::vector<TypeKind> params;
+    std::vector<Type> params;
+    std::vector<PassMode> paramModes;
 };
 
 class Scope {
@@ -2,6 +2,69 @@
 #include <iostream>
 #include <cstdlib>
 #include "semantic_analyzer.h"
+#include "../parser/parser_helper.h"
+#include "../token/compile_error.h"
+
+// A borrowed T[] parameter also accepts a fixed-size array of T
+static bool acceptsArgument(const Type& param, PassMode mode, const Type& arg)
+{
+    if (param == arg)
+        return true;
+    return mode != PassMode::Value && param.isDynamicArray() && arg.isArray() &&
+           arg.elementType() == param.elementType();
+}
+
+static bool isNumeric(TypeKind kind)
+{
+    return isInteger(kind) || isFloat(kind) || kind == TypeKind::CHAR;
+}
+
+static bool isSigned(TypeKind kind)
+{
+    return (isInteger(kind) && !isUnsigned(kind)) || isFloat(kind);
+}
+
+// Explicit conversions T(x): between numbers and chars, and from bool
+static bool isConvertible(TypeKind from, TypeKind to)
+{
+    return (isNumeric(from) || from == TypeKind::BOOL) && isNumeric(to);
+}
+
+// A literal, or arithmetic on literals only, whose type comes from where it
+// is used
+static bool isUntypedLiteral(Expression* expr)
+{
+    if (dynamic_cast<IntExpr*>(expr) || dynamic_cast<FloatExpr*>(expr))
+        return true;
+    if (auto e = dynamic_cast<UnaryExpr*>(expr))
+        return e->op == Operator::Minus && isUntypedLiteral(e->operand);
+    if (auto e = dynamic_cast<BinaryExpr*>(expr))
+        return isOperator(e->op) && isUntypedLiteral(e->left) && isUntypedLiteral(e->right);
+    return false;
+}
+
+// Int literals can become any integer type and float literals any float
+// type; the others keep theirs and fail the type check
+static void typeLiterals(Expression* expr, TypeKind kind)
+{
+    if (auto e = dynamic_cast<IntExpr*>(expr)) {
+        if (isInteger(kind))
+            e->type = kind;
+    } else if (auto e = dynamic_cast<FloatExpr*>(expr)) {
+        if (isFloat(kind))
+            e->type = kind;
+    } else if (auto e = dynamic_cast<UnaryExpr*>(expr)) {
+        typeLiterals(e->operand, kind);
+    } else if (auto e = dynamic_cast<BinaryExpr*>(expr)) {
+        typeLiterals(e->left, kind);
+        typeLiterals(e->right, kind);
+    }
+}
+
+static bool isLaneCount(size_t lanes)
+{
+    return lanes >= 2 && lanes <= 64 && (lanes & (lanes - 1)) == 0;
+}
 
 SemanticAnalyzer::SemanticAnalyzer() {
     m_currentScope = new Scope();
@@ -9,6 +72,19 @@ SemanticAnalyzer::SemanticAnalyzer() {
 
 void SemanticAnalyzer::analyzeProgram(Program* program)
 {
+    std::set<std::string> functions;
+    for (auto& item : program->items)
+        if (auto func = dynamic_cast<FunctionDef*>(item))
+            functions.insert(func->name);
+    analyzeFunctions(program, functions);
+}
+
+void SemanticAnalyzer::analyzeFunctions(Program* program, const std::set<std::string>& functions)
+{
+    for (auto& item : program->items)
+        if (auto decl = dynamic_cast<StructDecl*>(item))
+            declareStruct(decl);
+
     // First pass: declare all functions to avoid forward references
     for (auto& item : program->items) 
     {
@@ -17,21 +93,37 @@ void SemanticAnalyzer::analyzeProgram(Program* program)
             sym.name = func->name;
             sym.type = func->returnType;
             sym.isFunction = true;
-            for (auto& p : func->params)
+            if (isBuiltinFunction(func->name))
+                error("Function " + func->name + " has the name of a builtin");
+            if (func->returnType.isFixedArray())
+                error("Function " + func->name + " cannot return a fixed-size array");
+            // The C startup code and the JIT call main as int() or void()
+            if (func->name == "main" && func->returnType != TypeKind::INT &&
+                func->returnType != TypeKind::VOID)
+                error("main must return int or void");
+            for (auto& p : func->params) {
+                if (p.mode != PassMode::Value && !isOwnedType(p.type))
+                    error("Only owned types can be passed by reference in " + func->name);
+                if (p.mode == PassMode::Value && p.type.isFixedArray())
+                    error("Fixed-size array " + p.name + " of " + func->name + " must be passed by reference");
                 sym.params.push_back(p.type);
+                sym.paramModes.push_back(p.mode);
+            }
             if (!m_currentScope->insert(sym.name, sym)) {
                 error("Redefinition of function " + func->name);
             }
         }
     }
     for (auto& item : program->items) {
-        analyzeItem(item);
+        auto func = dynamic_cast<FunctionDef*>(item);
+        if (!func || functions.count(func->name))
+            analyzeItem(item);
     }
 }
 
 void SemanticAnalyzer::error(const std::string& message) {
     std::cerr << "Semantic Error: " << message << std::endl;
-    exit(1);
+    throw CompileError(message);
 }
 
 void SemanticAnalyzer::enterScope() {
@@ -88,17 +180,43 @@ void SemanticAnalyzer::analyzeExtern(ExternDecl* externDecl)
     Symbol sym;
     sym.name = externDecl->name;
     sym.isFunction = true;
-    for (auto& param : externDecl->params)
+    if (isBuiltinFunction(externDecl->name))
+        error("External function " + externDecl->name + " has the name of a builtin");
+    // Strings and arrays cross over as pointers to memory the caller fills
+    // in, which a function that touches no memory could not read
+    auto passedByPointer = [](const Type& type) {
+        return type == TypeKind::STRING || type.isArray();
+    };
+    for (auto& param : externDecl->params) {
+        if (externDecl->isPure && passedByPointer(param.type))
+            error("Pure external function " + externDecl->name + " cannot take " + param.name +
+                  " by pointer");
         sym.params.push_back(param.type);
+        sym.paramModes.push_back(PassMode::Value);
+    }
+    if (externDecl->isPure && passedByPointer(externDecl->returnType))
+        error("Pure external function " + externDecl->name + " cannot return a pointer");
     sym.type = externDecl->returnType;
     if( !m_currentScope->insert(sym.name, sym) ) {
         error("Redefinition of external declaration " + externDecl->name);
     }
 }
 
+void SemanticAnalyzer::declareStruct(StructDecl* decl)
+{
+    if (!m_structs.emplace(decl->name, decl).second)
+        error("Redefinition of struct " + decl->name);
+    if (decl->fields.empty())
+        error("Struct " + decl->name + " has no fields");
+    std::set<std::string> names;
+    for (auto& field : decl->fields)
+        if (!names.insert(field.name).second)
+            error("Duplicate field " + field.name + " in struct " + decl->name);
+}
+
 void SemanticAnalyzer::analyzeIf(IfStmt* stmt)
 {
-    TypeKind condType = analyzeExpression(stmt->condition);
+    Type condType = analyzeExpression(stmt->condition);
     if (condType != TypeKind::BOOL)
         error("Condition of if statement must be a boolean");
     
@@ -119,7 +237,7 @@ void SemanticAnalyzer::analyzeIf(IfStmt* stmt)
 
 void SemanticAnalyzer::analyzeWhile(WhileStmt* stmt)
 {
-    TypeKind condType = analyzeExpression(stmt->condition);
+    Type condType = analyzeExpression(stmt->condition);
     if (condType != TypeKind::BOOL)
         error("Condition of while statement must be a boolean");
     
@@ -139,7 +257,7 @@ void SemanticAnalyzer::analyzeFor(ForStmt* stmt)
     }
     
     if (stmt->condition) {
-        TypeKind condType = analyzeExpression(stmt->condition);
+        Type condType = analyzeExpression(stmt->condition);
         if (condType != TypeKind::BOOL)
             error("Condition of for statement must be a boolean");
     }
@@ -155,6 +273,46 @@ void SemanticAnalyzer::analyzeFor(ForStmt* stmt)
     leaveScope();
 }
 
+void SemanticAnalyzer::analyzeSwitch(SwitchStmt* stmt)
+{
+    Type valueType = analyzeExpression(stmt->value);
+    if (!isInteger(valueType.kind) && valueType != TypeKind::CHAR)
+        error("Switch value must be an integer or a char");
+
+    std::set<int64_t> seen;
+    for (auto& switchCase : stmt->cases) {
+        for (auto label : switchCase.labels) {
+            // A constant the backend can put in a jump table
+            int64_t value = 0;
+            auto negated = dynamic_cast<UnaryExpr*>(label);
+            Expression* literal = negated && negated->op == Operator::Minus ? negated->operand : label;
+            if (auto e = dynamic_cast<IntExpr*>(literal))
+                value = negated ? -e->value : e->value;
+            else if (auto e = dynamic_cast<CharExpr*>(literal); e && !negated)
+                value = e->value;
+            else
+                error("Case labels must be integer or char literals");
+            if (analyzeExpression(label, valueType) != valueType)
+                error("Case label does not match the type of the switch value");
+            if (!seen.insert(value).second)
+                error("Duplicate case label " + std::to_string(value));
+        }
+        enterScope();
+        for (auto& s : switchCase.body->statements) {
+            analyzeStatement(s);
+        }
+        leaveScope();
+    }
+
+    if (stmt->defaultBlock) {
+        enterScope();
+        for (auto& s : stmt->defaultBlock->statements) {
+            analyzeStatement(s);
+        }
+        leaveScope();
+    }
+}
+
 void SemanticAnalyzer::analyzeStatement(Statement* stmt)
 {
     if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
@@ -179,7 +337,9 @@ void SemanticAnalyzer::analyzeStatement(Statement* stmt)
         }
         if(varDecl->initializer)
         {
-            TypeKind initType = analyzeExpression(varDecl->initializer);
+            if (varDecl->kind.isFixedArray())
+                error("Fixed-size array " + varDecl->name + " cannot be initialized from another value");
+            Type initType = analyzeExpression(varDecl->initializer, varDecl->kind);
             if(initType != varDecl->kind)
                 error("Type mismatch in variable declaration");
         }
@@ -187,7 +347,7 @@ void SemanticAnalyzer::analyzeStatement(Statement* stmt)
     else if (auto returnStmt = dynamic_cast<ReturnStmt*>(stmt)) {
         if(returnStmt->value)
         {
-            TypeKind returnType = analyzeExpression(returnStmt->value);
+            Type returnType = analyzeExpression(returnStmt->value, m_currentReturnType);
             if(returnType != m_currentReturnType)
                 error("Type mismatch in return statement");
         } else {
@@ -195,6 +355,12 @@ void SemanticAnalyzer::analyzeStatement(Statement* stmt)
                 error("Return statement expected");
         }
     } 
+    else if (auto regionStmt = dynamic_cast<RegionStmt*>(stmt)) {
+        analyzeStatement(regionStmt->body);
+    }
+    else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+        analyzeSwitch(switchStmt);
+    }
     else if (auto blockStmt = dynamic_cast<BlockStmt*>(stmt)) {
         enterScope();
         for (auto& s : blockStmt->statements) {
@@ -204,10 +370,279 @@ void SemanticAnalyzer::analyzeStatement(Statement* stmt)
     }
 }
 
-TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
+Type SemanticAnalyzer::lookupArray(const std::string& name, bool allowVector)
+{
+    if (auto sym = m_currentScope->lookup(name)) {
+        if (allowVector && !sym->isFunction && sym->type.isVector())
+            return sym->type;
+        if (sym->isFunction || !sym->type.isArray())
+            error(name + (allowVector ? " is not an array or a vector" : " is not an array"));
+        return sym->type;
+    }
+    error("Undefined variable " + name);
+}
+
+Type SemanticAnalyzer::lookupField(const std::string& name, bool indexed, const std::string& field)
+{
+    Type type;
+    if (indexed) {
+        type = lookupArray(name).elementType();
+    } else if (auto sym = m_currentScope->lookup(name); sym && !sym->isFunction) {
+        type = sym->type;
+    } else {
+        error("Undefined variable " + name);
+    }
+    if (!type.isStruct())
+        error(name + (indexed ? " is not an array of structs" : " is not a struct"));
+    for (auto& f : m_structs.at(type.name)->fields)
+        if (f.name == field)
+            return f.type;
+    error("Struct " + type.name + " has no field " + field);
+}
+
+// Elementwise operators on vectors; a scalar operand is used in every lane
+Type SemanticAnalyzer::analyzeVectorBinary(BinaryExpr* expr, const Type& left, const Type& right)
+{
+    const Type& vector = left.isVector() ? left : right;
+    const Type& other = left.isVector() ? right : left;
+    if (other != vector && other != vector.element)
+        error("Type mismatch in vector expression");
+    expr->isUnsigned = isUnsigned(vector.element);
+    Type mask = Type::vectorOf(TypeKind::BOOL, vector.length);
+
+    switch (expr->op) {
+        case Operator::AndAnd:
+        case Operator::OrOr:
+            if (vector.element != TypeKind::BOOL)
+                error("Logical operators require boolean operands");
+            expr->lanewise = true;
+            return vector;
+        case Operator::EqualEqual:
+        case Operator::NotEqual:
+            return mask;
+        case Operator::Less:
+        case Operator::Greater:
+        case Operator::LessEqual:
+        case Operator::GreaterEqual:
+            if (!isNumeric(vector.element))
+                error("Vector comparison requires int, float or char lanes");
+            return mask;
+        default:
+            if (!isNumeric(vector.element))
+                error(std::string("Operator ") + to_string(expr->op) + " requires int, float or char lanes");
+            return vector;
+    }
+}
+
+Type SemanticAnalyzer::analyzeVectorExpr(Expression* expr)
+{
+    if (auto e = dynamic_cast<VectorExpr*>(expr)) {
+        if (e->elements.size() != 1 && e->elements.size() != static_cast<size_t>(e->type.length))
+            error(type_to_string(e->type) + " takes 1 or " + std::to_string(e->type.length) + " elements");
+        for (auto element : e->elements) {
+            Type type = analyzeExpression(element, e->type.element);
+            if (e->elements.size() == 1 && type.isVector() && type != e->type) {
+                if (type.length != e->type.length || !isConvertible(type.element, e->type.element))
+                    error("Cannot convert " + type_to_string(type) + " to " + type_to_string(e->type));
+                e->source = type.element;
+            } else if (type != e->type.element) {
+                error("Type mismatch in element of " + type_to_string(e->type));
+            }
+        }
+        return e->type;
+    }
+
+    if (auto e = dynamic_cast<ShuffleExpr*>(expr)) {
+        Type first = analyzeExpression(e->first);
+        if (!first.isVector())
+            error("shuffle takes vectors");
+        if (e->second && analyzeExpression(e->second) != first)
+            error("Both vectors of a shuffle must have the same type");
+        if (!isLaneCount(e->lanes.size()))
+            error("shuffle must select a power of two from 2 to 64 lanes");
+        int64_t sources = first.length * (e->second ? 2 : 1);
+        for (int lane : e->lanes)
+            if (lane < 0 || lane >= sources)
+                error("Shuffle lane " + std::to_string(lane) + " out of range");
+        return Type::vectorOf(first.element, e->lanes.size());
+    }
+
+    if (auto e = dynamic_cast<BuiltinExpr*>(expr))
+        return analyzeBuiltin(e);
+
+    if (auto e = dynamic_cast<VectorLoadExpr*>(expr)) {
+        Type array = lookupArray(e->name);
+        if (!isNumeric(array.element))
+            error("Vector loads and stores need int, float or char elements");
+        if (analyzeExpression(e->index) != TypeKind::INT)
+            error("Array index must be an integer");
+        Type mask = analyzeExpression(e->mask);
+        if (!mask.isVector() || mask.element != TypeKind::BOOL)
+            error("The mask of load must be a vector of bool");
+        return Type::vectorOf(array.element, mask.length);
+    }
+
+    if (auto e = dynamic_cast<VectorStoreExpr*>(expr)) {
+        Type array = lookupArray(e->name);
+        if (!isNumeric(array.element))
+            error("Vector loads and stores need int, float or char elements");
+        if (analyzeExpression(e->index) != TypeKind::INT)
+            error("Array index must be an integer");
+        Type value = analyzeExpression(e->value);
+        if (!value.isVector() || value.element != array.element)
+            error("store needs a vector of the elements of " + e->name);
+        if (e->mask && analyzeExpression(e->mask) != Type::vectorOf(TypeKind::BOOL, value.length))
+            error("The mask of store must have one bool per lane");
+        return TypeKind::VOID;
+    }
+
+    error("Invalid expression");
+}
+
+Type SemanticAnalyzer::analyzeExpression(Expression* expr, const Type& expected)
+{
+    if (isUntypedLiteral(expr))
+        typeLiterals(expr, expected.lane());
+    return analyzeExpression(expr);
+}
+
+void SemanticAnalyzer::checkLiteral(int64_t value, TypeKind type)
+{
+    int64_t lo = INT64_MIN, hi = INT64_MAX;
+    switch (type) {
+        case TypeKind::I8: lo = INT8_MIN; hi = INT8_MAX; break;
+        case TypeKind::I16: lo = INT16_MIN; hi = INT16_MAX; break;
+        case TypeKind::INT: lo = INT32_MIN; hi = INT32_MAX; break;
+        case TypeKind::U8: lo = 0; hi = UINT8_MAX; break;
+        case TypeKind::U16: lo = 0; hi = UINT16_MAX; break;
+        case TypeKind::U32: lo = 0; hi = UINT32_MAX; break;
+        case TypeKind::U64: lo = 0; break;
+        default: break;
+    }
+    if (value < lo || value > hi)
+        error("Integer literal " + std::to_string(value) + " does not fit in " + type_to_string(type));
+}
+
+Type SemanticAnalyzer::analyzeBuiltin(BuiltinExpr* e)
 {
-    if (auto* e = dynamic_cast<IntExpr*>(expr)) return TypeKind::INT;
-    if (auto* e = dynamic_cast<FloatExpr*>(expr)) return TypeKind::FLOAT;
+    if (e->builtin == Builtin::Find) {
+        if (e->arguments.size() != 2)
+            error("Wrong number of arguments to builtin");
+        for (auto arg : e->arguments)
+            if (analyzeExpression(arg) != TypeKind::STRING)
+                error("find takes two strings");
+        return TypeKind::INT;
+    }
+    if (e->builtin == Builtin::Print || e->builtin == Builtin::Println) {
+        if (e->arguments.size() > 1 || (e->builtin == Builtin::Print && e->arguments.empty()))
+            error("print takes one value, println at most one");
+        if (e->arguments.empty())
+            return TypeKind::VOID;
+        Type type = analyzeExpression(e->arguments[0]);
+        if (type.isArray() || type.isVector() || type.isStruct() || type == TypeKind::VOID)
+            error("Only numbers, bool, char and string can be printed");
+        e->printed = type.kind;
+        return TypeKind::VOID;
+    }
+    if (e->builtin == Builtin::ReadInt || e->builtin == Builtin::ReadLine ||
+        e->builtin == Builtin::Eof) {
+        if (!e->arguments.empty())
+            error("Wrong number of arguments to builtin");
+        return e->builtin == Builtin::ReadInt    ? TypeKind::INT
+               : e->builtin == Builtin::ReadLine ? TypeKind::STRING
+                                                 : TypeKind::BOOL;
+    }
+    // Literal arguments take the type of the first value argument that has one
+    Type typed;
+    for (size_t i = e->builtin == Builtin::Select ? 1 : 0; i < e->arguments.size(); ++i) {
+        if (!isUntypedLiteral(e->arguments[i])) {
+            typed = analyzeExpression(e->arguments[i]);
+            break;
+        }
+    }
+    std::vector<Type> args;
+    for (auto arg : e->arguments)
+        args.push_back(analyzeExpression(arg, typed));
+    size_t expected = 1;
+    if (e->builtin == Builtin::Select || e->builtin == Builtin::Fma)
+        expected = 3;
+    else if (e->builtin == Builtin::Min || e->builtin == Builtin::Max || e->builtin == Builtin::Rotl)
+        expected = 2;
+    if (args.size() != expected)
+        error("Wrong number of arguments to builtin");
+    switch (e->builtin) {
+        case Builtin::Select:
+            // Also works on scalars, as a branch-free conditional
+            if (args[1] != args[2])
+                error("Both values of select must have the same type");
+            if (args[1].isVector() ? args[0] != Type::vectorOf(TypeKind::BOOL, args[1].length)
+                                   : args[0] != TypeKind::BOOL || args[1].isArray() ||
+                                         args[1] == TypeKind::STRING)
+                error("select needs a mask with one bool per value");
+            return args[1];
+        case Builtin::ReduceAdd:
+        case Builtin::ReduceMul:
+        case Builtin::ReduceMin:
+        case Builtin::ReduceMax:
+            if (!args[0].isVector() || !isNumeric(args[0].element))
+                error("Reductions take a vector of numbers or chars");
+            e->isUnsigned = isUnsigned(args[0].element);
+            return args[0].element;
+        case Builtin::Any:
+        case Builtin::All:
+            if (!args[0].isVector() || args[0].element != TypeKind::BOOL)
+                error("any and all take a vector of bool");
+            return TypeKind::BOOL;
+        case Builtin::Sqrt:
+        case Builtin::Fma:
+            for (auto& arg : args)
+                if (arg != args[0] || !isFloat(arg.lane()))
+                    error(std::string(e->builtin == Builtin::Sqrt ? "sqrt" : "fma") +
+                          " takes float arguments of the same type");
+            return args[0];
+        case Builtin::Abs:
+            if (!isSigned(args[0].lane()))
+                error("abs takes a signed integer or a float");
+            return args[0];
+        case Builtin::Min:
+        case Builtin::Max:
+            if (args[0] != args[1] || !isNumeric(args[0].lane()))
+                error("min and max take two numbers or chars of the same type");
+            e->isUnsigned = isUnsigned(args[0].lane());
+            return args[0];
+        case Builtin::Rotl:
+            // A vector can be rotated by a single amount for every lane
+            if (args[1] != args[0] && args[1] != args[0].lane())
+                error("rotl takes the number of bits in the type of the value");
+            [[fallthrough]];
+        case Builtin::Popcount:
+        case Builtin::Ctz:
+        case Builtin::Clz:
+        case Builtin::Bswap:
+            if (!isInteger(args[0].lane()))
+                error("Bit operations take an integer");
+            if (e->builtin == Builtin::Bswap &&
+                (args[0].lane() == TypeKind::I8 || args[0].lane() == TypeKind::U8))
+                error("bswap needs an integer of at least 16 bits");
+            return args[0];
+        case Builtin::Find:
+        case Builtin::Print:
+        case Builtin::Println:
+        case Builtin::ReadInt:
+        case Builtin::ReadLine:
+        case Builtin::Eof:
+            break;
+    }
+    error("Invalid builtin");
+}
+
+Type SemanticAnalyzer::analyzeExpression(Expression* expr)
+{
+    if (auto* e = dynamic_cast<IntExpr*>(expr)) {
+        checkLiteral(e->value, e->type);
+        return e->type;
+    }
+    if (auto* e = dynamic_cast<FloatExpr*>(expr)) return e->type;
     if (auto* e = dynamic_cast<BoolExpr*>(expr)) return TypeKind::BOOL;
     if (auto* e = dynamic_cast<StringExpr*>(expr)) return TypeKind::STRING;
     if (auto* e = dynamic_cast<CharExpr*>(expr)) return TypeKind::CHAR;
@@ -220,8 +655,32 @@ TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
     }
     
     if (auto e = dynamic_cast<BinaryExpr*>(expr)) {
-        TypeKind leftType = analyzeExpression(e->left);
-        TypeKind rightType = analyzeExpression(e->right);
+        Type leftType, rightType;
+        if (isUntypedLiteral(e->left) && !isUntypedLiteral(e->right)) {
+            rightType = analyzeExpression(e->right);
+            leftType = analyzeExpression(e->left, rightType);
+        } else {
+            leftType = analyzeExpression(e->left);
+            rightType = analyzeExpression(e->right, leftType);
+        }
+        if (leftType.isArray() || rightType.isArray())
+            error(std::string("Operator ") + to_string(e->op) + " cannot be applied to arrays");
+        if (leftType.isStruct() || rightType.isStruct())
+            error(std::string("Operator ") + to_string(e->op) + " cannot be applied to structs");
+        if (leftType.isVector() || rightType.isVector())
+            return analyzeVectorBinary(e, leftType, rightType);
+        if (leftType == TypeKind::STRING || rightType == TypeKind::STRING) {
+            if (leftType != rightType)
+                error("Type mismatch in binary expression");
+            e->isString = true;
+            if (e->op == Operator::Plus)
+                return TypeKind::STRING;
+            if (e->op != Operator::EqualEqual && e->op != Operator::NotEqual &&
+                e->op != Operator::Less && e->op != Operator::Greater &&
+                e->op != Operator::LessEqual && e->op != Operator::GreaterEqual)
+                error(std::string("Operator ") + to_string(e->op) + " cannot be applied to strings");
+            return TypeKind::BOOL;
+        }
         
         // Comparison and logical operators return bool
         if (e->op == Operator::EqualEqual || e->op == Operator::NotEqual ||
@@ -229,6 +688,7 @@ TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
             e->op == Operator::LessEqual || e->op == Operator::GreaterEqual) {
             if (leftType != rightType)
                 error("Type mismatch in comparison expression");
+            e->isUnsigned = isUnsigned(leftType.kind);
             return TypeKind::BOOL;
         }
         
@@ -241,25 +701,39 @@ TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
         // Arithmetic operators
         if (leftType != rightType)
             error("Type mismatch in binary expression");
+        e->isUnsigned = isUnsigned(leftType.kind);
         return leftType;
     }
     
     if (auto e = dynamic_cast<UnaryExpr*>(expr)) {
-        TypeKind operandType = analyzeExpression(e->operand);
+        // -128 fits in an i8 even though 128 doesn't
+        auto literal = dynamic_cast<IntExpr*>(e->operand);
+        Type operandType = literal && e->op == Operator::Minus ? Type(literal->type)
+                                                              : analyzeExpression(e->operand);
+        if (literal && e->op == Operator::Minus)
+            checkLiteral(-literal->value, literal->type);
+        if (operandType.isVector()) {
+            if (e->op == Operator::Not && operandType.element == TypeKind::BOOL)
+                return operandType;
+            if (e->op == Operator::Minus && isNumeric(operandType.element))
+                return operandType;
+            error(std::string("Operator ") + to_string(e->op) + " cannot be applied to " +
+                  type_to_string(operandType));
+        }
         if (e->op == Operator::Not) {
             if (operandType != TypeKind::BOOL)
                 error("Operand of '!' must be a boolean");
             return TypeKind::BOOL;
         }
         if (e->op == Operator::Minus) {
-            if (operandType != TypeKind::INT && operandType != TypeKind::FLOAT)
-                error("Operand of unary '-' must be numeric");
+            if (!isSigned(operandType.kind))
+                error("Operand of unary '-' must be a signed number");
             return operandType;
         }
         if (e->op == Operator::PlusPlus || e->op == Operator::MinusMinus) {
-            if (operandType != TypeKind::INT)
+            if (!isInteger(operandType.kind))
                 error("Operand of increment/decrement must be an integer");
-            return TypeKind::INT;
+            return operandType;
         }
         return operandType;
     }
@@ -271,10 +745,20 @@ TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
                     error("Argument count mismatch in function call");
                 }
                 for (size_t i = 0; i < e->arguments.size(); i++) {
-                    TypeKind argType = analyzeExpression(e->arguments[i]);
-                    if (argType != func->params[i]) {
+                    Type argType = analyzeExpression(e->arguments[i], func->params[i]);
+                    PassMode mode = func->paramModes[i];
+                    if (!acceptsArgument(func->params[i], mode, argType)) {
                         error("Argument type mismatch in function call");
                     }
+                    auto borrow = dynamic_cast<BorrowExpr*>(e->arguments[i]);
+                    if (mode == PassMode::Value && borrow) {
+                        error("Cannot pass a borrow to a by-value parameter of " + e->callee);
+                    }
+                    if (mode != PassMode::Value &&
+                        (!borrow || borrow->isMutable != (mode == PassMode::MutBorrow))) {
+                        error(std::string("Argument ") + std::to_string(i + 1) + " of " + e->callee +
+                              (mode == PassMode::MutBorrow ? " must be passed as &mut" : " must be passed as &"));
+                    }
                 }
             } else {
                 error("Call to non-function " + e->callee);
@@ -284,12 +768,25 @@ TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
         error("Undefined function " + e->callee);
     }
     
+    if (auto e = dynamic_cast<BorrowExpr*>(expr)) {
+        if (auto sym = m_currentScope->lookup(e->name)) {
+            if (sym->isFunction || !isOwnedType(sym->type)) {
+                error("Only owned values can be borrowed: " + e->name);
+            }
+            return sym->type;
+        }
+        error("Undefined variable " + e->name);
+    }
+
     if (auto e = dynamic_cast<AssignExpr*>(expr)) {
         if (auto sym = m_currentScope->lookup(e->name)) {
             if (sym->isFunction) {
                 error("Cannot assign to function " + e->name);
             }
-            TypeKind valueType = analyzeExpression(e->value);
+            if (sym->type.isFixedArray()) {
+                error("Cannot assign to fixed-size array " + e->name);
+            }
+            Type valueType = analyzeExpression(e->value, sym->type);
             if (valueType != sym->type) {
                 error("Type mismatch in assignment");
             }
@@ -298,5 +795,82 @@ TypeKind SemanticAnalyzer::analyzeExpression(Expression* expr)
         error("Undefined variable " + e->name);
     }
 
-    error("Invalid expression");
+    if (auto e = dynamic_cast<IndexExpr*>(expr)) {
+        Type array = lookupArray(e->name, true);
+        e->lane = array.isVector();
+        if (analyzeExpression(e->index) != TypeKind::INT)
+            error("Array index must be an integer");
+        return array.elementType();
+    }
+
+    if (auto e = dynamic_cast<IndexAssignExpr*>(expr)) {
+        Type array = lookupArray(e->name, true);
+        e->lane = array.isVector();
+        if (analyzeExpression(e->index) != TypeKind::INT)
+            error("Array index must be an integer");
+        if (analyzeExpression(e->value, array.elementType()) != array.elementType())
+            error("Type mismatch in assignment to an element of " + e->name);
+        return array.elementType();
+    }
+
+    if (auto e = dynamic_cast<ArrayAllocExpr*>(expr)) {
+        if (analyzeExpression(e->length) != TypeKind::INT)
+            error("Array length must be an integer");
+        return Type::arrayOf(e->element, 0);
+    }
+
+    if (auto e = dynamic_cast<LengthExpr*>(expr)) {
+        auto sym = m_currentScope->lookup(e->name);
+        if (!sym || sym->isFunction || sym->type != TypeKind::STRING)
+            lookupArray(e->name);
+        return TypeKind::INT;
+    }
+
+    if (auto e = dynamic_cast<SliceExpr*>(expr)) {
+        auto sym = m_currentScope->lookup(e->name);
+        if (!sym)
+            error("Undefined variable " + e->name);
+        if (sym->isFunction || sym->type != TypeKind::STRING)
+            error(e->name + " is not a string");
+        if (analyzeExpression(e->start) != TypeKind::INT || analyzeExpression(e->end) != TypeKind::INT)
+            error("Slice bounds must be integers");
+        return TypeKind::STRING;
+    }
+
+    if (auto e = dynamic_cast<StructExpr*>(expr)) {
+        StructDecl* decl = m_structs.at(e->name);
+        if (e->arguments.size() != decl->fields.size())
+            error(e->name + " takes " + std::to_string(decl->fields.size()) + " fields");
+        for (size_t i = 0; i < e->arguments.size(); i++) {
+            if (analyzeExpression(e->arguments[i], decl->fields[i].type) != decl->fields[i].type)
+                error("Type mismatch in field " + decl->fields[i].name + " of " + e->name);
+        }
+        return Type::structNamed(e->name);
+    }
+
+    if (auto e = dynamic_cast<FieldExpr*>(expr)) {
+        e->type = lookupField(e->name, e->index != nullptr, e->field);
+        if (e->index && analyzeExpression(e->index) != TypeKind::INT)
+            error("Array index must be an integer");
+        return e->type;
+    }
+
+    if (auto e = dynamic_cast<FieldAssignExpr*>(expr)) {
+        e->type = lookupField(e->name, e->index != nullptr, e->field);
+        if (e->index && analyzeExpression(e->index) != TypeKind::INT)
+            error("Array index must be an integer");
+        if (analyzeExpression(e->value, e->type) != e->type)
+            error("Type mismatch in assignment to " + e->name + "." + e->field);
+        return e->type;
+    }
+
+    if (auto e = dynamic_cast<CastExpr*>(expr)) {
+        Type source = analyzeExpression(e->operand, e->target);
+        if (!isConvertible(source.kind, e->target))
+            error("Cannot convert " + type_to_string(source) + " to " + type_to_string(e->target));
+        e->source = source.kind;
+        return e->target;
+    }
+
+    return analyzeVectorExpr(expr);
 }
\ No newline at end of file
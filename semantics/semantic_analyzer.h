@@ -1,16 +1,19 @@
 #pragma once
 
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include "scope.h"
 
-enum class TypeKind;
-
 class SemanticAnalyzer {
 public:
     SemanticAnalyzer();
 
     void analyzeProgram(Program* t_program);
+    // Declares every function but only checks the bodies of t_functions;
+    // the other bodies are known to be unchanged since they last passed
+    void analyzeFunctions(Program* t_program, const std::set<std::string>& t_functions);
 
 private:
     [[noreturn]] void error(const std::string& t_message);
@@ -21,14 +24,29 @@ private:
     void analyzeItem(Item* t_item);
     void analyzeFunction(FunctionDef* t_func);
     void analyzeExtern(ExternDecl* t_externDecl);
+    void declareStruct(StructDecl* t_struct);
 
     void analyzeStatement(Statement* t_stmt);
     void analyzeIf(IfStmt* t_stmt);
     void analyzeWhile(WhileStmt* t_stmt);
     void analyzeFor(ForStmt* t_stmt);
-    TypeKind analyzeExpression(Expression* t_expr);
+    void analyzeSwitch(SwitchStmt* t_stmt);
+    Type analyzeExpression(Expression* t_expr);
+    // Like analyzeExpression, but literals take the (lane) type of
+    // t_expected, e.g. the 1 in `i64 x = 1`
+    Type analyzeExpression(Expression* t_expr, const Type& t_expected);
+    void checkLiteral(int64_t t_value, TypeKind t_type);
+    Type analyzeVectorBinary(BinaryExpr* t_expr, const Type& t_left, const Type& t_right);
+    // Vector constructors, shuffles, builtins and vector loads and stores
+    Type analyzeVectorExpr(Expression* t_expr);
+    Type analyzeBuiltin(BuiltinExpr* t_expr);
+    // Type of the array variable t_name, or of the vector when t_allowVector
+    Type lookupArray(const std::string& t_name, bool t_allowVector = false);
+    // Type of name.field, or of name[index].field when t_indexed
+    Type lookupField(const std::string& t_name, bool t_indexed, const std::string& t_field);
 
 private:
-    TypeKind m_currentReturnType;
+    Type m_currentReturnType;
     Scope* m_currentScope;
+    std::map<std::string, StructDecl*> m_structs;
 };
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// Thrown by the lexer, parser and checkers after they have printed a
+// diagnostic, so a long-running session can report the error and keep going
+// instead of exiting.
+struct CompileError : std::runtime_error {
+    explicit CompileError(const std::string& t_message) : std::runtime_error(t_message) {}
+};
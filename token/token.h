@@ -7,6 +7,8 @@ enum Kind {
     tok_eof,
     tok_def,
     tok_extern,
+    tok_pure,
+    tok_mut,
     tok_int,
     tok_float,
     tok_int_literal,
@@ -32,7 +34,24 @@ enum Kind {
     tok_if,
     tok_else,
     tok_while,
-    tok_for
+    tok_for,
+    tok_region,
+    tok_switch,
+    tok_case,
+    tok_default,
+    tok_vec,
+    tok_struct,
+    tok_dot,
+    tok_i8,
+    tok_i16,
+    tok_i32,
+    tok_i64,
+    tok_u8,
+    tok_u16,
+    tok_u32,
+    tok_u64,
+    tok_f32,
+    tok_f64
 };
 
 enum class Operator {
@@ -72,13 +91,114 @@ struct Token {
     > value;
 };
 
+// INT is i32 and FLOAT is f32; the other sized types have their own kind
 enum class TypeKind {
     INT,
     FLOAT,
     STRING,
     BOOL,
     CHAR,
-    VOID
+    VOID,
+    ARRAY,
+    VECTOR,
+    I8,
+    I16,
+    I64,
+    U8,
+    U16,
+    U32,
+    U64,
+    F64,
+    STRUCT
 };
 
+inline bool isUnsigned(TypeKind t_kind) {
+    return t_kind == TypeKind::U8 || t_kind == TypeKind::U16 || t_kind == TypeKind::U32 ||
+           t_kind == TypeKind::U64;
+}
+
+// Integer types; char is a separate type even though it is 8 bits wide
+inline bool isInteger(TypeKind t_kind) {
+    return t_kind == TypeKind::INT || t_kind == TypeKind::I8 || t_kind == TypeKind::I16 ||
+           t_kind == TypeKind::I64 || isUnsigned(t_kind);
+}
+
+inline bool isFloat(TypeKind t_kind) {
+    return t_kind == TypeKind::FLOAT || t_kind == TypeKind::F64;
+}
+
+// A scalar type, a struct, or an array or SIMD vector of a scalar element
+// type (arrays may also hold structs). Converts from TypeKind, so scalar
+// types compare and pass around as before.
+struct Type {
+    TypeKind kind = TypeKind::VOID;
+    TypeKind element = TypeKind::VOID;
+    // Element count of a fixed-size array (T[N]); 0 for a dynamic one (T[]).
+    // Lane count of a vector.
+    int64_t length = 0;
+    // Name of the struct, or of the struct elements of an array
+    std::string name;
+
+    Type() = default;
+    Type(TypeKind t_kind) : kind(t_kind) {}
+
+    static Type structNamed(const std::string& t_name) {
+        Type type(TypeKind::STRUCT);
+        type.name = t_name;
+        return type;
+    }
+
+    static Type arrayOf(const Type& t_element, int64_t t_length) {
+        Type type(TypeKind::ARRAY);
+        type.element = t_element.kind;
+        type.name = t_element.name;
+        type.length = t_length;
+        return type;
+    }
+
+    static Type vectorOf(TypeKind t_element, int64_t t_lanes) {
+        Type type(TypeKind::VECTOR);
+        type.element = t_element;
+        type.length = t_lanes;
+        return type;
+    }
+
+    bool isArray() const { return kind == TypeKind::ARRAY; }
+    bool isFixedArray() const { return isArray() && length > 0; }
+    bool isDynamicArray() const { return isArray() && length == 0; }
+    bool isVector() const { return kind == TypeKind::VECTOR; }
+    bool isStruct() const { return kind == TypeKind::STRUCT; }
+    // The type of each element of an array
+    Type elementType() const {
+        Type type(element);
+        type.name = name;
+        return type;
+    }
+    // The type of a scalar, or of each lane of a vector
+    TypeKind lane() const { return isVector() ? element : kind; }
+};
+
+inline bool operator==(const Type& t_a, const Type& t_b) {
+    return t_a.kind == t_b.kind && t_a.element == t_b.element && t_a.length == t_b.length &&
+           t_a.name == t_b.name;
+}
+
+inline bool operator!=(const Type& t_a, const Type& t_b) {
+    return !(t_a == t_b);
+}
+
+// How a parameter receives its argument
+enum class PassMode {
+    Value,      // by value; owned types are moved into the callee
+    Borrow,     // &T, shared read-only borrow
+    MutBorrow   // &mut T, exclusive borrow
+};
+
+// Types with an owner: moved on assignment and by-value calls, borrowable,
+// and dropped after their last use. Fixed-size arrays are never moved (the
+// semantic analyzer only lets them be borrowed), but share the rest.
+inline bool isOwnedType(const Type& t_type) {
+    return t_type.kind == TypeKind::STRING || t_type.isArray();
+}
+
 const char* to_string(Operator op);
\ No newline at end of file